@@ -22,6 +22,8 @@
 #include <znc/Message.h>
 #include <sys/time.h>
 #include <deque>
+#include <utility>
+#include <vector>
 
 // Forward Declarations
 class CClient;
@@ -49,7 +51,10 @@ class CBufLine {
     }
 
     // Setters
-    void SetFormat(const CString& sFormat) { m_Message.Parse(sFormat); }
+    void SetFormat(const CString& sFormat) {
+        m_Message.Parse(sFormat);
+        Compile();
+    }
     void SetText(const CString& sText) { m_sText = sText; }
     void SetTime(const timeval& ts) { m_Message.SetTime(ts); }
     void SetTags(const MCString& mssTags) { m_Message.SetTags(mssTags); }
@@ -66,6 +71,28 @@ class CBufLine {
     // !Getters
 
   private:
+    // A field split at its {placeholders}, see CString::NamedFormat()
+    struct CFormatPart {
+        CString sLiteral;
+        bool bParam;
+        // The name of the parameter which follows the literal
+        CString sParam;
+    };
+    typedef std::vector<CFormatPart> CFormat;
+
+    // The format is parsed once when the line is added, not every time
+    // it is played back
+    void Compile();
+    static bool Compile(const CString& sField, CFormat& Format);
+    static CString Expand(const CFormat& Format, const MCString& mssParams,
+                          const CString* psText);
+
+    bool m_bSenderFormat;
+    CFormat m_SenderFormat;
+    // Only the params which contain placeholders, by index
+    std::vector<std::pair<unsigned int, CFormat>> m_vParamFormats;
+    bool m_bUsesText;
+
   protected:
     CMessage m_Message;
     CString m_sText;
@@ -97,7 +124,10 @@ class CBuffer : private std::deque<CBufLine> {
                     const MCString& msParams = MCString::EmptyMap) const;
     size_type Size() const { return size(); }
     bool IsEmpty() const { return empty(); }
-    void Clear() { clear(); }
+    void Clear() {
+        clear();
+        m_uRewrites++;
+    }
 
     // Setters
     bool SetLineCount(unsigned int u, bool bForce = false);
@@ -105,10 +135,19 @@ class CBuffer : private std::deque<CBufLine> {
 
     // Getters
     unsigned int GetLineCount() const { return m_uLineCount; }
+    /// Number of lines ever added at the end of this buffer. As long as
+    /// GetRewrites() stays the same, the lines added since an earlier
+    /// look at the buffer are the last GetLinesAdded() - (earlier value).
+    unsigned long long GetLinesAdded() const { return m_uLinesAdded; }
+    /// Number of changes other than adding lines at the end and dropping
+    /// the oldest ones, e.g. Clear().
+    unsigned long long GetRewrites() const { return m_uRewrites; }
     // !Getters
   private:
   protected:
     unsigned int m_uLineCount;
+    unsigned long long m_uLinesAdded = 0;
+    unsigned long long m_uRewrites = 0;
 };
 
 #endif  // !ZNC_BUFFER_H
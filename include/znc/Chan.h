@@ -23,6 +23,7 @@
 #include <znc/Buffer.h>
 #include <znc/Translation.h>
 #include <map>
+#include <unordered_map>
 
 // Forward Declarations
 class CUser;
@@ -93,6 +94,8 @@ class CChan : private CCoreTranslationMixin {
     bool AddNick(const CString& sNick);
     bool RemNick(const CString& sNick);
     bool ChangeNick(const CString& sOldNick, const CString& sNewNick);
+    /// Needed after the network's case mapping changed.
+    void ReindexNicks();
     // !Nicks
 
     // Buffer
@@ -118,6 +121,10 @@ class CChan : private CCoreTranslationMixin {
     void ClearBuffer() { m_Buffer.Clear(); }
     void SendBuffer(CClient* pClient);
     void SendBuffer(CClient* pClient, const CBuffer& Buffer);
+    // These are called by CClient while it plays the buffer back
+    void SendBufferLine(CClient* pClient, const CBufLine& BufLine,
+                        const CString& sBatchName);
+    void SendBufferEnd(CClient* pClient, const CString& sBatchName);
     // !Buffer
 
     // m_Nick wrappers
@@ -205,7 +212,11 @@ class CChan : private CCoreTranslationMixin {
     CNick m_Nick;
     unsigned int m_uJoinTries;
     CString m_sDefaultModes;
-    std::map<CString, CNick> m_msNicks;  // Todo: make this caseless (irc style)
+    std::map<CString, CNick> m_msNicks;
+    // Finds m_msNicks entries by the network's case mapping
+    std::unordered_map<CString, std::map<CString, CNick>::iterator,
+                       CCaseMapping::CHash, CCaseMapping::CEqual>
+        m_mNickIndex;
     CBuffer m_Buffer;
 
     bool m_bModeKnown;
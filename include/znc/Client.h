@@ -24,6 +24,7 @@
 #include <znc/main.h>
 #include <memory>
 #include <functional>
+#include <list>
 
 // Forward Declarations
 class CZNC;
@@ -33,6 +34,7 @@ class CIRCSock;
 class CClient;
 class CMessage;
 class CChan;
+class CBuffer;
 // !Forward Declarations
 
 class CAuthBase : private CCoreTranslationMixin {
@@ -150,7 +152,10 @@ class CClient : public CIRCSocket {
                {true, [this](bool bVal) { m_bAccountNotify = bVal; }}},
               {"extended-join",
                {true, [this](bool bVal) { m_bExtendedJoin = bVal; }}},
-          }) {
+          }),
+          m_lPlayback(),
+          m_uPlaybackStart(0),
+          m_uPlaybackLines(0) {
         EnableReadLine();
         // RFC says a line can have 512 chars max, but we are
         // a little more gentle ;)
@@ -198,6 +203,27 @@ class CClient : public CIRCSocket {
     bool IsPlaybackActive() const { return m_bPlaybackActive; }
     void SetPlaybackActive(bool bActive) { m_bPlaybackActive = bActive; }
 
+    /** Plays back the lines of a channel buffer after CChan::SendBuffer()
+     *  sent its start. The first slice is sent right away, the rest is left
+     *  to CZNC's playback scheduler. Messages for the channel which come in
+     *  meanwhile are held back until the playback is complete.
+     */
+    void QueuePlayback(const CChan& Chan,
+                       const std::shared_ptr<const CBuffer>& spBuffer,
+                       const CString& sBatchName);
+    bool HasPendingPlayback() const { return !m_lPlayback.empty(); }
+    bool HasPendingPlayback(const CString& sChan) const;
+    /** Plays back up to uMaxLines lines. Nothing is sent while the send
+     *  buffer is above its high-water mark.
+     *  @return The number of lines played back.
+     */
+    size_t ContinuePlayback(size_t uMaxLines);
+    /// Lines of one client per turn, so that a long playback doesn't block
+    /// the others.
+    static const size_t m_uPlaybackSlice;
+    /// Plays back all pending lines at once, ignoring the send buffer.
+    void FlushPlayback();
+
     void PutIRC(const CString& sLine);
     /** Sends a raw data line to the client.
      *  @param sLine The line to be sent.
@@ -339,6 +365,18 @@ class CClient : public CIRCSocket {
     bool OnOtherMessage(CMessage& Message);
 
   protected:
+    struct CPlayback {
+        CString sChan;
+        std::shared_ptr<const CBuffer> spBuffer;
+        size_t uNext;
+        CString sBatchName;
+        // Live messages for the channel, sent after the playback
+        std::vector<CMessage> vDeferred;
+    };
+    size_t PlayBack(size_t uMaxLines);
+    void EndPlayback(CPlayback& Playback, CChan* pChan);
+    void AbortPlayback();
+
     bool m_bGotPass;
     bool m_bGotNick;
     bool m_bGotUser;
@@ -373,6 +411,9 @@ class CClient : public CIRCSocket {
     // A subset of CIRCSock::GetAcceptedCaps(), the caps that can be listed
     // in CAP LS and may be notified to the client with CAP NEW (cap-notify).
     SCString m_ssServerDependentCaps;
+    std::list<CPlayback> m_lPlayback;
+    unsigned long long m_uPlaybackStart;
+    size_t m_uPlaybackLines;
 
     friend class ClientTest;
 };
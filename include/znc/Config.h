@@ -26,9 +26,12 @@ class CConfig;
 struct CConfigEntry {
     CConfigEntry();
     CConfigEntry(const CConfig& Config);
+    CConfigEntry(CConfig&& Config);
     CConfigEntry(const CConfigEntry& other);
+    CConfigEntry(CConfigEntry&& other);
     ~CConfigEntry();
     CConfigEntry& operator=(const CConfigEntry& other);
+    CConfigEntry& operator=(CConfigEntry&& other);
 
     CConfig* m_pSubConfig;
 };
@@ -69,7 +72,7 @@ class CConfig {
             return false;
         }
 
-        conf[sName] = Config;
+        conf[sName] = CConfigEntry(std::move(Config));
         return true;
     }
 
@@ -78,10 +81,12 @@ class CConfig {
         EntryMap::iterator it = m_ConfigEntries.find(sName);
         vsList.clear();
         if (it == m_ConfigEntries.end()) return false;
-        vsList = it->second;
 
         if (bErase) {
+            vsList = std::move(it->second);
             m_ConfigEntries.erase(it);
+        } else {
+            vsList = it->second;
         }
 
         return true;
@@ -149,10 +154,14 @@ class CConfig {
             Config.clear();
             return false;
         }
-        Config = it->second;
 
         if (bErase) {
+            // Nobody else will see these sub configs anymore, so there is no
+            // need to deep-copy them.
+            Config = std::move(it->second);
             m_SubConfigs.erase(it);
+        } else {
+            Config = it->second;
         }
 
         return true;
@@ -164,8 +173,20 @@ class CConfig {
 
     bool Parse(CFile& file, CString& sErrorMsg);
     void Write(CFile& file, unsigned int iIndentation = 0);
+    /** Serialize the config into the same format Write() produces.
+     *  This does not touch any global state, so it is safe to call on a
+     *  snapshot from another thread.
+     */
+    CString ToString(unsigned int iIndentation = 0) const;
+    /** Check whether two configs describe the same thing.
+     *  Keys and tags are compared case-insensitively, since Parse() lowercases
+     *  them. Values and the names of sub configs have to match exactly.
+     */
+    bool Equals(const CConfig& Other) const;
 
   private:
+    void AppendTo(CString& sOut, unsigned int iIndentation) const;
+
     EntryMap m_ConfigEntries;
     SubConfigMap m_SubConfigs;
 };
@@ -101,7 +101,13 @@ class CFile {
     bool Chmod(mode_t mode);
     static bool Chmod(const CString& sFile, mode_t mode);
     bool Seek(off_t uPos);
-    bool Truncate();
+    bool Truncate(off_t uSize = 0);
+    /**
+     * Reserves disk space for uLength bytes from uOffset on, without changing
+     * the size of the file. Appending to the file then doesn't fragment it.
+     * @return false if the system or the file system can't do that.
+     */
+    bool Preallocate(off_t uOffset, off_t uLength);
     bool Sync();
     bool Open(const CString& sFileName, int iFlags = O_RDONLY,
               mode_t iMode = 0644);
@@ -120,6 +126,8 @@ class CFile {
     bool UnLock();
 
     bool IsOpen() const;
+    /// The underlying file descriptor, -1 if the file is not open.
+    int GetFD() const { return m_iFD; }
     CString GetLongName() const;
     CString GetShortName() const;
     CString GetDir() const;
@@ -33,7 +33,6 @@ class CChan;
 class CQuery;
 class CServer;
 class CIRCSock;
-class CIRCNetworkPingTimer;
 class CIRCNetworkJoinTimer;
 class CMessage;
 
@@ -48,7 +47,8 @@ class CIRCNetwork : private CCoreTranslationMixin {
     CIRCNetwork(const CIRCNetwork&) = delete;
     CIRCNetwork& operator=(const CIRCNetwork&) = delete;
 
-    void Clone(const CIRCNetwork& Network, bool bCloneName = true);
+    void Clone(const CIRCNetwork& Network, bool bCloneName = true,
+               bool bCloneModules = true);
 
     CString GetNetworkPath() const;
 
@@ -107,6 +107,11 @@ class CIRCNetwork : private CCoreTranslationMixin {
     bool IsChan(CString sChan) const;
     bool IsChanStrict(const CString& sChan) const;
 
+    /// Nicks, channels and queries are compared with this.
+    const CCaseMapping& GetCaseMapping() const { return m_CaseMapping; }
+    /// From the server's CASEMAPPING.
+    void SetCaseMapping(const CString& sName);
+
     const std::vector<CServer*>& GetServers() const;
     bool HasServers() const { return !m_vServers.empty(); }
     CServer* FindServer(const CString& sName) const;
@@ -153,8 +158,24 @@ class CIRCNetwork : private CCoreTranslationMixin {
     void SetIRCSocket(CIRCSock* pIRCSock);
     void IRCConnected();
     void IRCDisconnected();
+    /** Called when a connection attempt ended before the server accepted us.
+     *  Each consecutive failure doubles the time until the connection queue
+     *  tries this network again.
+     */
+    void IRCConnectFailed();
     void CheckIRCConnect();
 
+    /// Priority classes of the connection queue, lower values connect first
+    enum EConnectPriority {
+        CONNECT_PRIO_ADMIN,
+        CONNECT_PRIO_ACTIVE,
+        CONNECT_PRIO_NORMAL,
+    };
+    EConnectPriority GetConnectPriority() const;
+    unsigned int GetConnectFailures() const { return m_uConnectFailures; }
+    /// The connection queue doesn't try this network before this time.
+    time_t GetNextConnectTime() const { return m_tNextConnect; }
+
     bool PutIRC(const CString& sLine);
     bool PutIRC(const CMessage& Message);
 
@@ -302,6 +323,7 @@ class CIRCNetwork : private CCoreTranslationMixin {
     std::vector<CQuery*> m_vQueries;
 
     CString m_sChanPrefixes;
+    CCaseMapping m_CaseMapping;
 
     bool m_bIRCConnectEnabled;
     bool m_bTrustAllCerts;
@@ -320,12 +342,14 @@ class CIRCNetwork : private CCoreTranslationMixin {
     CBuffer m_MotdBuffer;
     CBuffer m_NoticeBuffer;
 
-    CIRCNetworkPingTimer* m_pPingTimer;
     CIRCNetworkJoinTimer* m_pJoinTimer;
 
     unsigned short int m_uJoinDelay;
     unsigned long long m_uBytesRead;
     unsigned long long m_uBytesWritten;
+
+    unsigned int m_uConnectFailures;
+    time_t m_tNextConnect;
 };
 
 #endif  // !ZNC_IRCNETWORK_H
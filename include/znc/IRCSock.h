@@ -29,6 +29,8 @@ class CChan;
 class CUser;
 class CIRCNetwork;
 class CClient;
+class CIRCFloodTimer;
+class CModules;
 // !Forward Declarations
 
 // TODO: This class needs new name
@@ -49,6 +51,16 @@ class CIRCSock : public CIRCSocket {
         NoArg = 3
     } EChanModeArgs;
 
+    /** Lanes of the send queue. Lines of a lane are only sent when all lanes
+     *  before it are empty.
+     */
+    enum ESendLane {
+        SEND_LANE_QUICK,  //!< PONG and \l PutIRCQuick()
+        SEND_LANE_NORMAL,
+        SEND_LANE_BULK,  //!< WHO and queries for modes and mode lists
+        SEND_LANE_COUNT
+    };
+
     void ReadLine(const CString& sData) override;
     void Connected() override;
     void Disconnected() override;
@@ -85,6 +97,10 @@ class CIRCSock : public CIRCSocket {
      *
      *  Additional tags can be added via \l CIRCSock::SetTagSupport().
      *
+     *  Lines are put into one of the \l ESendLane lanes of the send queue,
+     *  see \l GetSendLane(). They wait there serialized and are only parsed
+     *  again if a module handles \ref CModule::OnSendToIRCMessage().
+     *
      *  @warning Bypassing the filter may cause troubles to some older IRC
      *  servers.
      *
@@ -143,6 +159,17 @@ class CIRCSock : public CIRCSocket {
     const CString& GetNick() const { return m_Nick.GetNick(); }
     const CString& GetPass() const { return m_sPass; }
     CIRCNetwork* GetNetwork() const { return m_pNetwork; }
+    /** @return The number of lines waiting in the send queue. */
+    size_t GetSendQueueSize() const;
+    size_t GetSendQueueSize(ESendLane eLane) const {
+        return m_avSendQueue[eLane].size();
+    }
+    /** @return The number of lines which left the send queue. */
+    unsigned long long GetSentLines() const { return m_uSentLines; }
+    /** @return How long the lines waited in the send queue, in total and at
+     *  most, in milliseconds. */
+    unsigned long long GetSendWaitTotal() const { return m_uSendWaitTotal; }
+    unsigned long long GetSendWaitMax() const { return m_uSendWaitMax; }
     bool HasNamesx() const { return m_bNamesx; }
     bool HasUHNames() const { return m_bUHNames; }
     bool HasAwayNotify() const { return m_bAwayNotify; }
@@ -197,6 +224,16 @@ class CIRCSock : public CIRCSocket {
     void SendAltNick(const CString& sBadNick);
     void SendNextCap();
     void TrySend();
+    // Serializes the message with only the tags the server agreed to
+    CString ToServerString(const CMessage& Message) const;
+    ESendLane GetSendLane(const CString& sLine) const;
+    void QueueLine(const CString& sLine, ESendLane eLane);
+    bool ModulesWant(bool (CModules::*fWants)() const) const;
+    void SendLine(const CString& sLine);
+    // sLine must end with "\r\n"
+    void WriteLine(const CString& sLine);
+    void RefillFloodBudget(unsigned long long uNow);
+    void ArmFloodTimer();
 
   protected:
     bool m_bAuthed;
@@ -223,11 +260,26 @@ class CIRCSock : public CIRCSocket {
     static const time_t m_uCTCPFloodTime;
     static const unsigned int m_uCTCPFloodCount;
     MCString m_mISupport;
-    std::deque<CMessage> m_vSendQueue;
-    short int m_iSendsAllowed;
+    struct CQueuedMessage {
+        CString sLine;  //!< Serialized, with filtered tags and "\r\n"
+        unsigned long long uQueued;
+    };
+    std::deque<CQueuedMessage> m_avSendQueue[SEND_LANE_COUNT];
     unsigned short int m_uFloodBurst;
     double m_fFloodRate;
     bool m_bFloodProtection;
+    // Token bucket in milliseconds: every line costs m_uFloodInterval of the
+    // budget, which refills by one per millisecond up to the burst
+    unsigned long long m_uFloodInterval;
+    unsigned long long m_uFloodBudget;
+    unsigned long long m_uFloodRefill;
+    // Armed only while the queue waits for budget
+    CIRCFloodTimer* m_pFloodTimer;
+    unsigned long long m_uSentLines;
+    unsigned long long m_uSendWaitTotal;
+    unsigned long long m_uSendWaitMax;
+    // An error or timeout ended the connection, not e.g. the user
+    bool m_bConnectFailed;
     SCString m_ssSupportedTags;
 
     friend class CIRCFloodTimer;
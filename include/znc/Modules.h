@@ -27,6 +27,7 @@
 #include <functional>
 #include <set>
 #include <queue>
+#include <type_traits>
 #include <sys/time.h>
 
 // Forward Declarations
@@ -327,11 +328,17 @@ class CModInfo {
 template <class M>
 void TModInfo(CModInfo& Info) {}
 
+template <class M>
+class TModSendHooks;
+
 template <class M>
 CModule* TModLoad(ModHandle p, CUser* pUser, CIRCNetwork* pNetwork,
                   const CString& sModName, const CString& sModPath,
                   CModInfo::EModuleType eType) {
-    return new M(p, pUser, pNetwork, sModName, sModPath, eType);
+    M* pModule = new M(p, pUser, pNetwork, sModName, sModPath, eType);
+    pModule->SetWantsSendToIRC(TModSendHooks<M>::bMessage,
+                               TModSendHooks<M>::bLine);
+    return pModule;
 }
 
 /** A helper class for handling commands in modules. */
@@ -1052,11 +1059,26 @@ class CModule {
      *  @param Message The message being sent to the IRC server.
      *  @warning Calling PutIRC() from within this hook leads to infinite recursion.
      *  @return See CModule::EModRet.
+     *  @note ZNC parses outgoing lines only for modules which override this.
      */
     virtual EModRet OnSendToIRCMessage(CMessage& Message);
     /// @deprecated Use OnSendToIRCMessage() instead.
     virtual EModRet OnSendToIRC(CString& sLine);
 
+    /** Tells ZNC whether the module handles OnSendToIRCMessage() and
+     *  OnSendToIRC(). Modules loaded from a shared object get this set from
+     *  whether their class overrides them. Modules created in other ways,
+     *  e.g. by modpython, may opt out with this.
+     */
+    void SetWantsSendToIRC(bool bMessage, bool bLine) {
+        m_bWantsSendToIRCMessage = bMessage;
+        m_bWantsSendToIRC = bLine;
+    }
+    /// @return Whether the module may handle OnSendToIRCMessage().
+    bool WantsSendToIRCMessage() const { return m_bWantsSendToIRCMessage; }
+    /// @return Whether the module may handle OnSendToIRC().
+    bool WantsSendToIRC() const { return m_bWantsSendToIRC; }
+
     ModHandle GetDLL() { return m_pDLL; }
 
     /** This function sends a given IRC line to the IRC server, if we
@@ -1391,6 +1413,34 @@ class CModule {
         m_mssRegistry;  //!< way to save name/value pairs. Note there is no encryption involved in this
     VWebSubPages m_vSubPages;
     std::map<CString, CModCommand> m_mCommands;
+    bool m_bWantsSendToIRCMessage;
+    bool m_bWantsSendToIRC;
+};
+
+/** Whether M overrides CModule::OnSendToIRCMessage() and
+ *  CModule::OnSendToIRC(). An override which isn't public counts as well.
+ */
+template <class M>
+class TModSendHooks {
+    template <class T>
+    static std::integral_constant<
+        bool, !std::is_same<decltype(&T::OnSendToIRCMessage),
+                            decltype(&CModule::OnSendToIRCMessage)>::value>
+    Message(int);
+    template <class T>
+    static std::true_type Message(...);
+
+    template <class T>
+    static std::integral_constant<
+        bool, !std::is_same<decltype(&T::OnSendToIRC),
+                            decltype(&CModule::OnSendToIRC)>::value>
+    Line(int);
+    template <class T>
+    static std::true_type Line(...);
+
+  public:
+    static const bool bMessage = decltype(Message<M>(0))::value;
+    static const bool bLine = decltype(Line<M>(0))::value;
 };
 
 class CModules : public std::vector<CModule*>, private CCoreTranslationMixin {
@@ -1549,6 +1599,8 @@ class CModules : public std::vector<CModule*>, private CCoreTranslationMixin {
     bool OnSendToClientMessage(CMessage& Message);
     bool OnSendToIRC(CString& sLine);
     bool OnSendToIRCMessage(CMessage& Message);
+    bool WantsSendToIRC() const;
+    bool WantsSendToIRCMessage() const;
 
     bool OnServerCapAvailable(const CString& sCap);
     bool OnServerCapResult(const CString& sCap, bool bSuccess);
@@ -26,6 +26,48 @@ class CIRCNetwork;
 class CChan;
 // !Forward Decl
 
+/** How a server compares nick and channel names, from its CASEMAPPING.
+ *
+ *  Names are folded one byte at a time through a table, so comparing and
+ *  hashing them neither branches on the byte values nor copies the strings.
+ */
+class CCaseMapping {
+  public:
+    /// Defaults to "rfc1459", which servers use if they don't say otherwise.
+    CCaseMapping();
+
+    /** Switch to the named mapping: "ascii", "rfc1459" or "strict-rfc1459".
+     *  Unknown names get "rfc1459".
+     *  @return false if the name is unknown.
+     */
+    bool SetName(const CString& sName);
+    const CString& GetName() const { return m_sName; }
+
+    char Fold(char c) const { return m_acFold[(unsigned char)c]; }
+    /// Only for when a folded copy is needed, e.g. for wildcards.
+    CString Fold(const CString& s) const;
+    bool Equals(const CString& s1, const CString& s2) const;
+    size_t Hash(const CString& s) const;
+
+    /// For unordered containers keyed by names.
+    struct CHash {
+        const CCaseMapping* pMapping;
+        size_t operator()(const CString& s) const {
+            return pMapping->Hash(s);
+        }
+    };
+    struct CEqual {
+        const CCaseMapping* pMapping;
+        bool operator()(const CString& s1, const CString& s2) const {
+            return pMapping->Equals(s1, s2);
+        }
+    };
+
+  private:
+    CString m_sName;
+    char m_acFold[256];
+};
+
 class CNick {
   public:
     CNick();
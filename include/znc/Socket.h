@@ -21,6 +21,8 @@
 #include <znc/Csocket.h>
 #include <znc/Threads.h>
 #include <znc/Translation.h>
+#include <list>
+#include <unordered_map>
 
 class CModule;
 
@@ -72,6 +74,91 @@ class CZNCSock : public Csock, protected CCoreTranslationMixin {
 
 enum EAddrType { ADDR_IPV4ONLY, ADDR_IPV6ONLY, ADDR_ALL };
 
+/**
+ * @class CTimerWheel
+ * @brief Hierarchical timing wheel which keeps the crons of CSockManager.
+ *
+ * Crons are hashed into slots by the time of their next run, so adding,
+ * removing and expiring one is O(1) and crons which are not due are never
+ * looked at. Each level has 64 slots; a slot of level 0 covers one tick of
+ * 10ms, a slot of level n covers 64 slots of level n-1. Crons which are far
+ * away wait in the coarse levels and are moved down as their time comes.
+ *
+ * The wheel owns its crons: crons which are no longer valid after a run are
+ * deleted, as CSockCommon::Cron() would do.
+ */
+class CTimerWheel {
+  public:
+    CTimerWheel();
+    ~CTimerWheel();
+
+    CTimerWheel(const CTimerWheel&) = delete;
+    CTimerWheel& operator=(const CTimerWheel&) = delete;
+
+    /** Takes ownership of the cron and schedules it for its next run. */
+    void Add(CCron* pCron);
+    /**
+     * Takes the cron out of the wheel without deleting it.
+     * @return false if the cron is not in this wheel.
+     */
+    bool Remove(CCron* pCron);
+    /**
+     * Moves the cron to its current next run. Needed when a cron was
+     * restarted with a shorter interval or unpaused from outside of its
+     * RunJob().
+     */
+    void Reschedule(CCron* pCron);
+    /** Runs all crons which are due at tNow. */
+    void Expire(const timeval& tNow);
+    /** Deletes all crons. */
+    void Clear();
+
+    bool Contains(CCron* pCron) const;
+    std::vector<CCron*> GetCrons() const;
+    size_t GetCronCount() const { return m_mEntries.size(); }
+    /**
+     * @param tNext Set to the time when Expire() has work to do next.
+     * @return false if the wheel is empty.
+     */
+    bool GetNextExpiry(timeval& tNext) const;
+
+    /** @return tv rounded up to the next tick of the wheel. Expire() runs a
+     *  cron which is due at tv no earlier than this. */
+    static timeval RoundUp(const timeval& tv);
+
+  private:
+    static constexpr unsigned int LEVELS = 4;
+    static constexpr unsigned int SLOT_BITS = 6;
+    static constexpr unsigned int SLOTS = 1 << SLOT_BITS;
+    static constexpr uint64_t TICK_USEC = 10000;
+
+    struct CEntry {
+        uint64_t uExpires;
+        // LEVELS means that the cron is in m_lDue
+        unsigned int uLevel;
+        unsigned int uSlot;
+        std::list<CCron*>::iterator it;
+    };
+
+    static uint64_t ToTick(const timeval& tv, bool bRoundUp);
+    static timeval FromTick(uint64_t uTick);
+    std::list<CCron*>& GetList(const CEntry& Entry);
+    std::list<CCron*>& Place(CEntry& Entry);
+    void Link(CCron* pCron, uint64_t uExpires);
+    void Cascade(unsigned int uLevel, unsigned int uSlot);
+    void Rebase(uint64_t uTick);
+    void RunDue(const timeval& tNow);
+
+    std::list<CCron*> m_aSlots[LEVELS][SLOTS];
+    size_t m_auLevelCount[LEVELS];
+    std::list<CCron*> m_lDue;
+    std::unordered_map<CCron*, CEntry> m_mEntries;
+    // The next tick which Expire() hasn't processed yet
+    uint64_t m_uCurrentTick;
+    CCron* m_pRunning;
+    bool m_bRunningRemoved;
+};
+
 class CSockManager : public TSocketManager<CZNCSock>,
                      private CCoreTranslationMixin {
   public:
@@ -158,7 +245,36 @@ class CSockManager : public TSocketManager<CZNCSock>,
     unsigned int GetAnonConnectionCount(const CString& sIP) const;
     void DelSockByAddr(Csock* pcSock) override;
 
+    /** @name Crons
+     *  Crons of the manager live in a CTimerWheel instead of being polled on
+     *  every iteration of the loop. Crons added to single sockets are not
+     *  affected.
+     */
+    //@{
+    void AddCron(CCron* pcCron) override;
+    void DelCron(const CString& sName, bool bDeleteAll = true,
+                 bool bCaseSensitive = true) override;
+    void DelCronByAddr(CCron* pcCron) override;
+    /**
+     * Call this after a cron was restarted with a shorter interval or was
+     * unpaused, otherwise it runs at the time it was due before.
+     */
+    void RescheduleCron(CCron* pcCron);
+    const CTimerWheel& GetTimerWheel() const { return m_TimerWheel; }
+    //@}
+
+    void Cleanup() override;
+
   private:
+    class CTimerWheelCron;
+    friend class CTimerWheelCron;
+
+    void ExpireTimers();
+    void WakeTimerWheel(const timeval& tWhen);
+
+    CTimerWheel m_TimerWheel;
+    CTimerWheelCron* m_pTimerWheelCron = nullptr;
+
     void FinishConnect(const CString& sHostname, u_short iPort,
                        const CString& sSockName, int iTimeout, bool bSSL,
                        const CString& sBindHost, CZNCSock* pcSock);
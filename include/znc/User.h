@@ -32,7 +32,6 @@ class CConfig;
 class CFile;
 class CIRCNetwork;
 class CIRCSock;
-class CUserTimer;
 class CServer;
 
 class CUser : private CCoreTranslationMixin {
@@ -115,7 +114,7 @@ class CUser : private CCoreTranslationMixin {
 
     void CloneNetworks(const CUser& User);
     bool Clone(const CUser& User, CString& sErrorRet,
-               bool bCloneNetworks = true);
+               bool bCloneNetworks = true, bool bCloneModules = true);
     void BounceAllClients();
 
     void AddBytesRead(unsigned long long u) { m_uBytesRead += u; }
@@ -192,7 +191,8 @@ class CUser : private CCoreTranslationMixin {
     const CString& GetDefaultChanModes() const;
     /** How long must an IRC connection be idle before ZNC sends a ping */
     unsigned int GetPingFrequency() const { return m_uNoTrafficTimeout / 2; }
-    /** Time between checks if PINGs need to be sent */
+    /** How much later than GetPingFrequency() a PING may be sent, so that
+     *  the PINGs of several connections are sent together */
     unsigned int GetPingSlack() const { return m_uNoTrafficTimeout / 6; }
     /** Timeout after which IRC connections are closed. Must
      *  obviously be greater than GetPingFrequency() + GetPingSlack().
@@ -255,8 +255,6 @@ class CUser : private CCoreTranslationMixin {
     bool m_bPrependTimestamp;
     bool m_bAuthOnlyViaModule;
 
-    CUserTimer* m_pUserTimer;
-
     std::vector<CIRCNetwork*> m_vIRCNetworks;
     std::vector<CClient*> m_vClients;
     std::set<CString> m_ssAllowedHosts;
@@ -577,6 +577,15 @@ class CString : public std::string {
      * @return The result of the conversion.
      */
     CString StripControls_n() const;
+    /** Remove all CR and LF characters from this string.
+     * @return A reference to *this.
+     */
+    CString& StripCRLF();
+    /** Remove all CR and LF characters from this string.
+     * This string object isn't modified.
+     * @return The result of the conversion.
+     */
+    CString StripCRLF_n() const;
 
   private:
   protected:
@@ -586,6 +595,67 @@ class CString : public std::string {
                            unsigned int* piCount = nullptr) const;
 };
 
+/**
+ * @brief Walks over the tokens of a string without copying it.
+ *
+ * The tokens are the same as those of CString::Split() with the same
+ * arguments, but they are found one at a time and nothing is allocated
+ * unless GetToken() is called. The string must outlive the tokenizer.
+ *
+ * @code
+ * CStringTokenizer Tokens(sLine);
+ * while (Tokens.Next()) {
+ *     if (Tokens.Equals("foo")) ...
+ * }
+ * @endcode
+ */
+class CStringTokenizer {
+  public:
+    CStringTokenizer(const CString& sStr, const CString& sSep = " ",
+                     bool bAllowEmpty = false, const CString& sLeft = "",
+                     const CString& sRight = "", bool bTrimQuotes = true);
+
+    /** Moves on to the next token.
+     *  @return false if there are no more tokens.
+     */
+    bool Next();
+    /** Skips up to uCount tokens.
+     *  @return The number of tokens skipped.
+     */
+    size_t Skip(size_t uCount);
+
+    /// The current token, including the quotes around marked sections.
+    const char* GetData() const { return m_sStr.data() + m_uStart; }
+    size_t GetLength() const { return m_uEnd - m_uStart; }
+
+    /// A copy of the current token, with the quotes trimmed if requested.
+    CString GetToken() const;
+    /// Everything from the start of the current token on, unchanged.
+    CString GetRest() const { return m_sStr.substr(m_uStart); }
+    bool Equals(const CString& s,
+                CaseSensitivity cs = CString::CaseInsensitive) const;
+
+  private:
+    bool MatchAt(size_t uPos, const CString& s) const;
+    bool IsSeparatorAt(size_t uPos) const;
+    void SkipSeparators();
+
+    const CString& m_sStr;
+    const CString m_sSep;
+    const CString m_sLeft;
+    const CString m_sRight;
+    bool m_bAllowEmpty;
+    bool m_bTrimQuotes;
+    size_t m_uPos;
+    size_t m_uStart;
+    size_t m_uEnd;
+    // Whether the current token has quotes which GetToken() has to trim
+    bool m_bQuoted;
+    // Both cases of the first character of the separator
+    char m_cSepLower;
+    char m_cSepUpper;
+};
+
 /**
  * @brief A dictionary for strings.
  * @todo Replace with "using MCString = std::map<CString, CString>;" in ZNC 2.0
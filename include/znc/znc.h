@@ -26,12 +26,18 @@
 #include <mutex>
 #include <map>
 #include <list>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
 
 class CListener;
 class CUser;
 class CIRCNetwork;
 class CConnectQueueTimer;
+class CKeepAliveTimer;
+class CPlaybackTimer;
 class CConfigWriteTimer;
+class CConfigWriteJob;
 class CConfig;
 class CFile;
 
@@ -67,8 +73,29 @@ class CZNC : private CCoreTranslationMixin {
                              bool bAllowMkDir = true);
     bool WriteNewConfig(const CString& sConfigFile);
     bool WriteConfig();
+    /** Write the config without blocking the main loop.
+     *
+     *  The config tree is built here, but serializing it and syncing it to
+     *  disk happens on the thread pool. If a write is already in flight, the
+     *  request is coalesced into a single follow-up write.
+     *
+     *  @param bVerbose Broadcast a message to admins once the write finished.
+     */
+    void WriteConfigInBackground(bool bVerbose = false);
     bool ParseConfig(const CString& sConfig, CString& sError);
+    /** Read the module registries of the given users on the thread pool.
+     *  Modules which get constructed afterwards take their registry from
+     *  this cache instead of reading it from disk.
+     */
+    void PrefetchUserData(const VCString& vsUsers);
+    /// Move a prefetched registry out of the cache, if there is one.
+    bool TakePrefetchedRegistry(const CString& sPath, MCString& msRet);
     bool RehashConfig(CString& sError);
+    /** What the last RehashConfig() did: the first line summarizes the
+     *  changes and how long each phase took, the following lines list the
+     *  users and networks which were added, removed or updated.
+     */
+    const VCString& GetRehashReport() const { return m_vsRehashReport; }
     void BackupConfigOnce(const CString& sSuffix);
     static CString GetVersion();
     static CString GetTag(bool bIncludeVersion = true, bool bHTML = false);
@@ -125,6 +152,9 @@ class CZNC : private CCoreTranslationMixin {
     void SetHideVersion(bool b) { m_bHideVersion = b; }
     void SetAuthOnlyViaModule(bool b) { m_bAuthOnlyViaModule = b; }
     void SetConnectDelay(unsigned int i);
+    void SetConnectConcurrency(unsigned int i) {
+        m_uiConnectConcurrency = (i < 1) ? 1 : i;
+    }
     void SetSSLCiphers(const CString& sCiphers) { m_sSSLCiphers = sCiphers; }
     bool SetSSLProtocols(const CString& sProtocols);
     void SetSSLCertFile(const CString& sFile) { m_sSSLCertFile = sFile; }
@@ -165,6 +195,10 @@ class CZNC : private CCoreTranslationMixin {
         return m_sConnectThrottle.GetTTL() / 1000;
     }
     unsigned int GetConnectDelay() const { return m_uiConnectDelay; }
+    /// How many IRC connections may be connecting or registering at once.
+    unsigned int GetConnectConcurrency() const {
+        return m_uiConnectConcurrency;
+    }
     bool GetProtectWebSessions() const { return m_bProtectWebSessions; }
     bool GetHideVersion() const { return m_bHideVersion; }
     bool GetAuthOnlyViaModule() const { return m_bAuthOnlyViaModule; }
@@ -176,6 +210,22 @@ class CZNC : private CCoreTranslationMixin {
     CString GetSSLCertFile() const { return m_sSSLCertFile; }
     static VCString GetAvailableSSLProtocols();
     unsigned int GetConfigWriteDelay() const { return m_uiConfigWriteDelay; }
+    /// Number of times the config file was written since startup.
+    unsigned long long GetConfigWriteCount() const {
+        return m_uConfigWriteCount;
+    }
+    /// Number of write requests which were merged into another write.
+    unsigned long long GetConfigWriteCoalesced() const {
+        return m_uConfigWriteCoalesced;
+    }
+    /// Size in bytes of the last written config file.
+    unsigned long long GetLastConfigWriteSize() const {
+        return m_uLastConfigWriteSize;
+    }
+    /// Milliseconds spent serializing and syncing the last config file.
+    unsigned long long GetLastConfigWriteTime() const {
+        return m_uLastConfigWriteTime;
+    }
     // !Getters
 
     // Static allocator
@@ -232,6 +282,18 @@ class CZNC : private CCoreTranslationMixin {
 
     void AddNetworkToQueue(CIRCNetwork* pNetwork);
     std::list<CIRCNetwork*>& GetConnectionQueue() { return m_lpConnectQueue; }
+    /** The connection queue in the order in which it is worked on: by
+     *  priority class, first come first served within a class.
+     */
+    std::vector<CIRCNetwork*> GetScheduledConnectionQueue() const;
+    /// Number of IRC connections which didn't finish registration yet.
+    unsigned int GetPendingConnections() const {
+        return m_uiPendingConnections;
+    }
+    // CIRCSock calls these when it starts connecting and when it is
+    // registered or gone, whichever comes first
+    void AddPendingConnection() { m_uiPendingConnections++; }
+    void DelPendingConnection() { m_uiPendingConnections--; }
 
     // This creates a CConnectQueueTimer if we haven't got one yet
     void EnableConnectQueue();
@@ -240,6 +302,26 @@ class CZNC : private CCoreTranslationMixin {
     void PauseConnectQueue();
     void ResumeConnectQueue();
 
+    /** Sends a PING to the connection whenever it was idle for
+     *  CUser::GetPingFrequency(). All connections share one timer, which
+     *  only wakes up when some connection is due.
+     */
+    void AddKeepAlive(CClient* pClient);
+    void AddKeepAlive(CIRCSock* pIRCSock);
+    void DelKeepAlive(Csock* pSock);
+    size_t GetKeepAliveCount() const { return m_mKeepAlives.size(); }
+    // This is called by CKeepAliveTimer
+    void RunKeepAlive();
+
+    /** Clients which have channel buffers left to play back. They get a
+     *  slice of lines in turns, see CClient::QueuePlayback().
+     */
+    void AddPlayback(CClient* pClient);
+    void DelPlayback(CClient* pClient);
+    size_t GetPlaybackCount() const { return m_lpPlayback.size(); }
+    // This is called by CPlaybackTimer
+    void RunPlayback();
+
     void ForceEncoding();
     void UnforceEncoding();
     bool IsForcingEncoding() const;
@@ -247,6 +329,10 @@ class CZNC : private CCoreTranslationMixin {
 
     // Never call this unless you are CConnectQueueTimer::~CConnectQueueTimer()
     void LeakConnectQueueTimer(CConnectQueueTimer* pTimer);
+    // Never call this unless you are CKeepAliveTimer::~CKeepAliveTimer()
+    void LeakKeepAliveTimer(CKeepAliveTimer* pTimer);
+    // Never call this unless you are CPlaybackTimer::~CPlaybackTimer()
+    void LeakPlaybackTimer(CPlaybackTimer* pTimer);
 
     void DisableConfigTimer();
 
@@ -257,14 +343,38 @@ class CZNC : private CCoreTranslationMixin {
 
     CFile* InitPidFile();
 
+    struct CKeepAlive {
+        CClient* pClient;
+        CIRCSock* pIRCSock;
+        unsigned long long uGeneration;
+    };
+    void AddKeepAlive(Csock* pSock, const CKeepAlive& KeepAlive);
+    void ScheduleKeepAlive();
+    CUser* GetKeepAliveUser(const CKeepAlive& KeepAlive) const;
+
     bool ReadConfig(CConfig& config, CString& sError);
     bool LoadGlobal(CConfig& config, CString& sError);
     bool LoadUsers(CConfig& config, CString& sError);
+    CUser* ParseUser(const CString& sUserName, CConfig* pConfig,
+                     CString& sError);
+    struct CRehashUser;
+    bool DiffUsers(CConfig& config, std::vector<CRehashUser>& vUsers,
+                   CString& sError);
+    bool ApplyUsers(std::vector<CRehashUser>& vUsers, CString& sError);
+    bool SyncModules(const VCString& vsModules, CUser* pUser,
+                     CIRCNetwork* pNetwork, CString& sError);
     bool LoadListeners(CConfig& config, CString& sError);
     void UnloadRemovedModules(const MCString& msModules);
 
     bool HandleUserDeletion();
     CString MakeConfigHeader();
+    CConfig MakeConfig();
+    static bool WriteConfigFile(const CString& sConfigFile,
+                                const CString& sContents, CFile*& pFileRet);
+    void ConfigWriteFinished(bool bSuccess, CFile* pFile,
+                             unsigned long long uSize,
+                             unsigned long long uTime, bool bVerbose);
+    void CancelConfigWrite();
     bool AddListener(const CString& sLine, CString& sError);
     bool AddListener(CConfig* pConfig, CString& sError);
 
@@ -294,6 +404,8 @@ class CZNC : private CCoreTranslationMixin {
     VCString m_vsBindHosts;  // TODO: remove (deprecated in 1.7.0)
     VCString m_vsTrustedProxies;
     VCString m_vsMotd;
+    VCString m_vsRehashReport;
+    std::map<CString, MCString> m_mPrefetchedRegistries;
     CFile* m_pLockFile;
     unsigned int m_uiConnectDelay;
     unsigned int m_uiAnonIPLimit;
@@ -305,6 +417,19 @@ class CZNC : private CCoreTranslationMixin {
     std::list<CIRCNetwork*> m_lpConnectQueue;
     CConnectQueueTimer* m_pConnectQueueTimer;
     unsigned int m_uiConnectPaused;
+    unsigned int m_uiConnectConcurrency;
+    unsigned int m_uiPendingConnections;
+    // Min-heap of idle deadline, generation and socket. Entries of sockets
+    // which were removed or added again are skipped when they come up.
+    typedef std::tuple<time_t, unsigned long long, Csock*> KeepAliveDeadline;
+    std::priority_queue<KeepAliveDeadline, std::vector<KeepAliveDeadline>,
+                        std::greater<KeepAliveDeadline>>
+        m_KeepAliveQueue;
+    std::unordered_map<Csock*, CKeepAlive> m_mKeepAlives;
+    unsigned long long m_uKeepAliveGeneration;
+    CKeepAliveTimer* m_pKeepAliveTimer;
+    std::list<CClient*> m_lpPlayback;
+    CPlaybackTimer* m_pPlaybackTimer;
     unsigned int m_uiForceEncoding;
     TCacheMap<CString> m_sConnectThrottle;
     bool m_bProtectWebSessions;
@@ -313,6 +438,15 @@ class CZNC : private CCoreTranslationMixin {
     CTranslationDomainRefHolder m_Translation;
     unsigned int m_uiConfigWriteDelay;
     CConfigWriteTimer* m_pConfigTimer;
+    CConfigWriteJob* m_pConfigWriteJob;
+    bool m_bConfigWritePending;
+    bool m_bConfigWritePendingVerbose;
+    unsigned long long m_uConfigWriteCount;
+    unsigned long long m_uConfigWriteCoalesced;
+    unsigned long long m_uLastConfigWriteSize;
+    unsigned long long m_uLastConfigWriteTime;
+
+    friend class CConfigWriteJob;
 };
 
 #endif  // !ZNC_H
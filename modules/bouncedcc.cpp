@@ -17,6 +17,11 @@
 #include <znc/User.h>
 #include <znc/IRCNetwork.h>
 
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 using std::set;
 
 class CBounceDCCMod;
@@ -40,6 +45,7 @@ class CDCCBounce : public CSocket {
                                      const CString& sRemoteIP);
 
     void ReadLine(const CString& sData) override;
+    cs_ssize_t Read(char* data, size_t len) override;
     void ReadData(const char* data, size_t len) override;
     void ReadPaused() override;
     void Timeout() override;
@@ -73,6 +79,8 @@ class CDCCBounce : public CSocket {
     bool IsChat() { return m_bIsChat; }
     // !Getters
   private:
+    bool CanSplice();
+
   protected:
     CString m_sRemoteNick;
     CString m_sRemoteIP;
@@ -84,15 +92,24 @@ class CDCCBounce : public CSocket {
     unsigned short m_uRemotePort;
     bool m_bIsChat;
     bool m_bIsRemote;
+    // Bytes which went to the peer without passing through ZNC's buffers
+    unsigned long long m_uSpliced;
+#ifdef HAVE_SPLICE
+    int m_aiPipe[2];
+    bool m_bNoSplice;
+#endif
 
     static const unsigned int m_uiMaxDCCBuffer;
     static const unsigned int m_uiMinDCCBuffer;
+    static const unsigned int m_uiSpliceChunk;
 };
 
 // If we buffer more than this in memory, we will throttle the receiving side
 const unsigned int CDCCBounce::m_uiMaxDCCBuffer = 10 * 1024;
 // If less than this is in the buffer, the receiving side continues
 const unsigned int CDCCBounce::m_uiMinDCCBuffer = 2 * 1024;
+// How much is moved from one socket to the other at once, at most a pipe full
+const unsigned int CDCCBounce::m_uiSpliceChunk = 64 * 1024;
 
 class CBounceDCCMod : public CModule {
   public:
@@ -148,6 +165,20 @@ class CBounceDCCMod : public CModule {
         PutModule(t_f("Use client IP: {1}")(GetNV("UseClientIP").ToBool()));
     }
 
+    void SpliceCommand(const CString& sLine) {
+        CString sValue = sLine.Token(1, true);
+
+        if (!sValue.empty()) {
+            SetNV("Splice", sValue);
+        }
+
+#ifdef HAVE_SPLICE
+        PutModule(t_f("Relay transfers in the kernel: {1}")(UseSplice()));
+#else
+        PutModule(t_s("Relaying in the kernel isn't supported here"));
+#endif
+    }
+
     MODCONSTRUCTOR(CBounceDCCMod) {
         AddHelpCommand();
         AddCommand("ListDCCs", "", t_d("List all active DCCs"),
@@ -155,6 +186,9 @@ class CBounceDCCMod : public CModule {
         AddCommand("UseClientIP", "<true|false>",
                    t_d("Change the option to use IP of client"),
                    [this](const CString& sLine) { UseClientIPCommand(sLine); });
+        AddCommand("Splice", "<true|false>",
+                   t_d("Change the option to relay transfers in the kernel"),
+                   [this](const CString& sLine) { SpliceCommand(sLine); });
     }
 
     ~CBounceDCCMod() override {}
@@ -163,6 +197,10 @@ class CBounceDCCMod : public CModule {
 
     bool UseClientIP() { return GetNV("UseClientIP").ToBool(); }
 
+    bool UseSplice() {
+        return GetNV("Splice").empty() || GetNV("Splice").ToBool();
+    }
+
     EModRet OnUserCTCP(CString& sTarget, CString& sMessage) override {
         if (sMessage.StartsWith("DCC ")) {
             CString sType =
@@ -332,6 +370,11 @@ CDCCBounce::CDCCBounce(CBounceDCCMod* pMod, unsigned long uLongIP,
     m_sLocalIP = pMod->GetLocalDCCIP();
     m_pPeer = nullptr;
     m_bIsRemote = false;
+    m_uSpliced = 0;
+#ifdef HAVE_SPLICE
+    m_aiPipe[0] = m_aiPipe[1] = -1;
+    m_bNoSplice = false;
+#endif
 
     if (bIsChat) {
         EnableReadLine();
@@ -353,6 +396,11 @@ CDCCBounce::CDCCBounce(CBounceDCCMod* pMod, const CString& sHostname,
     m_sFileName = sFileName;
     m_sRemoteIP = sRemoteIP;
     m_bIsRemote = false;
+    m_uSpliced = 0;
+#ifdef HAVE_SPLICE
+    m_aiPipe[0] = m_aiPipe[1] = -1;
+    m_bNoSplice = false;
+#endif
 
     SetMaxBufferThreshold(10240);
     if (bIsChat) {
@@ -367,6 +415,12 @@ CDCCBounce::~CDCCBounce() {
         m_pPeer->Shutdown();
         m_pPeer = nullptr;
     }
+#ifdef HAVE_SPLICE
+    if (m_aiPipe[0] != -1) {
+        close(m_aiPipe[0]);
+        close(m_aiPipe[1]);
+    }
+#endif
 }
 
 void CDCCBounce::ReadLine(const CString& sData) {
@@ -387,6 +441,70 @@ void CDCCBounce::ReachedMaxBuffer() {
     Close();
 }
 
+bool CDCCBounce::CanSplice() {
+#ifdef HAVE_SPLICE
+    // TLS needs the data in user space, and whatever is buffered for the peer
+    // already has to go out first
+    if (m_bIsChat || m_bNoSplice || !m_pPeer || !m_pPeer->IsConnected() ||
+        GetSSL() || m_pPeer->GetSSL() ||
+        !m_pPeer->GetInternalWriteBuffer().empty() ||
+        !m_pModule->UseSplice()) {
+        return false;
+    }
+    if (m_aiPipe[0] == -1 && pipe2(m_aiPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        m_aiPipe[0] = m_aiPipe[1] = -1;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+cs_ssize_t CDCCBounce::Read(char* data, size_t len) {
+#ifdef HAVE_SPLICE
+    if (CanSplice()) {
+        ssize_t iIn =
+            splice(GetRSock(), nullptr, m_aiPipe[1], nullptr, m_uiSpliceChunk,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (iIn == 0) return READ_EOF;
+        if (iIn < 0) {
+            if (errno == EAGAIN || errno == EINTR) return READ_EAGAIN;
+            if (errno == EINVAL) {
+                // This kind of socket can't be spliced after all
+                m_bNoSplice = true;
+                return CSocket::Read(data, len);
+            }
+            return READ_ERR;
+        }
+
+        ssize_t iOut = 0;
+        while (iOut < iIn) {
+            ssize_t iMoved =
+                splice(m_aiPipe[0], nullptr, m_pPeer->GetWSock(), nullptr,
+                       iIn - iOut, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (iMoved <= 0) break;
+            iOut += iMoved;
+        }
+        m_uSpliced += iOut;
+
+        if (iOut < iIn) {
+            // The peer is congested or gone, let the usual write buffer deal
+            // with the rest. Nothing may stay in the pipe, the sender could
+            // be waiting for this to arrive before it sends more.
+            CString sRest;
+            sRest.resize(iIn - iOut);
+            ssize_t iRest = read(m_aiPipe[0], &sRest[0], sRest.length());
+            if (iRest > 0) ReadData(sRest.data(), iRest);
+        }
+        // The socket manager only does this for data it has seen
+        if (GetTimeoutType() & TMO_READ) ResetTimer();
+        return READ_EAGAIN;
+    }
+#endif
+    return CSocket::Read(data, len);
+}
+
 void CDCCBounce::ReadData(const char* data, size_t len) {
     if (m_pPeer) {
         m_pPeer->Write(data, len);
@@ -474,7 +592,8 @@ void CDCCBounce::Connected() {
 }
 
 void CDCCBounce::Disconnected() {
-    DEBUG(GetSockName() << " == Disconnected()");
+    DEBUG(GetSockName() << " == Disconnected(), " << m_uSpliced
+                        << " bytes spliced");
 }
 
 void CDCCBounce::Shutdown() {
@@ -18,6 +18,10 @@
 #include <znc/User.h>
 #include <znc/FileUtils.h>
 
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 using std::set;
 
 class CDCCMod;
@@ -32,6 +36,7 @@ class CDCCSock : public CSocket {
              const CString& sLocalFile, unsigned long uFileSize);
     ~CDCCSock() override;
 
+    cs_ssize_t Read(char* data, size_t len) override;
     void ReadData(const char* data, size_t len) override;
     void ConnectionRefused() override;
     void SockError(int iErrno, const CString& sDescription) override;
@@ -62,25 +67,64 @@ class CDCCSock : public CSocket {
                               100.0)
                    : 0;
     }
+    // In bytes per second. The socket's own counters miss what went through
+    // sendfile() or was read by Read().
+    double GetSpeed() const {
+        unsigned long long uNow = CUtils::GetMillTime();
+        return (m_uStartTime && uNow > m_uStartTime)
+                   ? (m_uBytesSoFar - m_uStartBytes) * 1000.0 /
+                         (uNow - m_uStartTime)
+                   : 0;
+    }
     bool IsSend() const { return m_bSend; }
     // const CString& GetRemoteIP() const { return m_sRemoteIP; }
     // !Getters
   private:
+    void Received(bool bDrained);
+    bool FlushFile();
+
   protected:
     CString m_sRemoteNick;
     CString m_sRemoteIP;
     CString m_sFileName;
     CString m_sLocalFile;
     CString m_sSendBuf;
+    // Received data which isn't in the file yet
+    CString m_sWriteBuf;
+    // Reused by Read(), so that recv() needs no freshly zeroed memory
+    CString m_sReadBuf;
     unsigned short m_uRemotePort;
     unsigned long long m_uFileSize;
     unsigned long long m_uBytesSoFar;
+    // What the receiver acknowledged
+    unsigned long long m_uAcked;
+    unsigned long long m_uStartBytes;
+    unsigned long long m_uStartTime;
     bool m_bSend;
     bool m_bNoDelFile;
+    bool m_bNoSendfile;
+    // sendfile() doesn't move the file position along
+    bool m_bSeekFile;
     CFile* m_pFile;
     CDCCMod* m_pModule;
+
+    static const unsigned int m_uiSendWindow;
+    static const unsigned int m_uiReadChunk;
+    static const unsigned int m_uiWriteBehind;
+    static const unsigned int m_uiAckInterval;
 };
 
+// How much may be sent before the receiver acknowledges it
+const unsigned int CDCCSock::m_uiSendWindow = 2 * 1024 * 1024;
+// How much is received at once
+const unsigned int CDCCSock::m_uiReadChunk = 256 * 1024;
+// How much received data is collected before it's written to the file
+const unsigned int CDCCSock::m_uiWriteBehind = 256 * 1024;
+// How often received data is acknowledged while more is coming in. When
+// nothing more is there, the sender may be waiting for it, so it's
+// acknowledged right away.
+const unsigned int CDCCSock::m_uiAckInterval = 64 * 1024;
+
 class CDCCMod : public CModule {
   public:
     MODCONSTRUCTOR(CDCCMod) {
@@ -242,7 +286,7 @@ class CDCCMod : public CModule {
                               CString::ToPercent(pSock->GetProgress()));
                 Table.SetCell(t_s("Speed", "list"),
                               t_f("{1} KiB/s")(static_cast<int>(
-                                  pSock->GetAvgRead() / 1024.0)));
+                                  pSock->GetSpeed() / 1024.0)));
             }
         }
 
@@ -302,11 +346,16 @@ CDCCSock::CDCCSock(CDCCMod* pMod, const CString& sRemoteNick,
     m_uFileSize = uFileSize;
     m_uRemotePort = 0;
     m_uBytesSoFar = 0;
+    m_uAcked = 0;
+    m_uStartBytes = 0;
+    m_uStartTime = 0;
     m_pModule = pMod;
     m_pFile = pFile;
     m_sLocalFile = sLocalFile;
     m_bSend = true;
     m_bNoDelFile = false;
+    m_bNoSendfile = false;
+    m_bSeekFile = false;
     SetMaxBufferThreshold(0);
 }
 
@@ -319,16 +368,22 @@ CDCCSock::CDCCSock(CDCCMod* pMod, const CString& sRemoteNick,
     m_uRemotePort = uRemotePort;
     m_uFileSize = uFileSize;
     m_uBytesSoFar = 0;
+    m_uAcked = 0;
+    m_uStartBytes = 0;
+    m_uStartTime = 0;
     m_pModule = pMod;
     m_pFile = nullptr;
     m_sLocalFile = sLocalFile;
     m_bSend = false;
     m_bNoDelFile = false;
+    m_bNoSendfile = false;
+    m_bSeekFile = false;
     SetMaxBufferThreshold(0);
 }
 
 CDCCSock::~CDCCSock() {
     if ((m_pFile) && (!m_bNoDelFile)) {
+        FlushFile();
         m_pFile->Close();
         delete m_pFile;
     }
@@ -355,30 +410,79 @@ void CDCCSock::ReadData(const char* data, size_t len) {
     // file that we can transfer is 4 GiB big (see OpenFile()).
     if (m_bSend) {
         m_sSendBuf.append(data, len);
+        if (m_sSendBuf.size() < 4) return;
 
-        while (m_sSendBuf.size() >= 4) {
-            uint32_t iRemoteSoFar;
-            memcpy(&iRemoteSoFar, m_sSendBuf.data(), sizeof(iRemoteSoFar));
-            iRemoteSoFar = ntohl(iRemoteSoFar);
-
-            if ((iRemoteSoFar + 65536) >= m_uBytesSoFar) {
-                SendPacket();
-            }
+        // Only the newest acknowledgement matters
+        size_t uLast = (m_sSendBuf.size() / 4 - 1) * 4;
+        uint32_t iRemoteSoFar;
+        memcpy(&iRemoteSoFar, m_sSendBuf.data() + uLast, sizeof(iRemoteSoFar));
+        m_uAcked = ntohl(iRemoteSoFar);
+        m_sSendBuf.erase(0, uLast + 4);
 
-            m_sSendBuf.erase(0, 4);
-        }
+        SendPacket();
     } else {
-        m_pFile->Write(data, len);
-        m_uBytesSoFar += len;
+        m_sWriteBuf.append(data, len);
+        Received(true);
+    }
+}
+
+cs_ssize_t CDCCSock::Read(char* data, size_t len) {
+    if (m_bSend || !m_pFile || GetSSL()) return CSocket::Read(data, len);
+
+    // Bigger reads than the socket manager does
+    if (m_sReadBuf.size() < m_uiReadChunk) m_sReadBuf.resize(m_uiReadChunk);
+    ssize_t iRead = recv(GetRSock(), &m_sReadBuf[0], m_uiReadChunk, 0);
+    if (iRead == 0) return READ_EOF;
+    if (iRead < 0) {
+        if (errno == EAGAIN || errno == EINTR) return READ_EAGAIN;
+        return READ_ERR;
+    }
+
+    // The socket manager only does this for data it has seen
+    if (GetTimeoutType() & TMO_READ) ResetTimer();
+    m_sWriteBuf.append(m_sReadBuf.data(), iRead);
+    Received((size_t)iRead < m_uiReadChunk);
+    return READ_EAGAIN;
+}
+
+void CDCCSock::Received(bool bDrained) {
+    bool bDone = m_uBytesSoFar + m_sWriteBuf.size() >= m_uFileSize;
+
+    // Only what is in the file gets acknowledged, so everything is written
+    // before the sender is told to wait for more
+    if ((bDone || bDrained || m_sWriteBuf.size() >= m_uiWriteBehind) &&
+        !FlushFile()) {
+        return;
+    }
+
+    if (bDone || bDrained || m_uBytesSoFar - m_uAcked >= m_uiAckInterval) {
+        m_uAcked = m_uBytesSoFar;
         uint32_t uSoFar = htonl((uint32_t)m_uBytesSoFar);
         Write((char*)&uSoFar, sizeof(uSoFar));
+    }
 
-        if (m_uBytesSoFar >= m_uFileSize) {
-            Close();
-        }
+    if (bDone) {
+        Close();
     }
 }
 
+bool CDCCSock::FlushFile() {
+    if (m_sWriteBuf.empty() || !m_pFile) return true;
+
+    ssize_t iWritten = m_pFile->Write(m_sWriteBuf);
+    if (iWritten != (ssize_t)m_sWriteBuf.size()) {
+        m_pModule->PutModule(
+            t_f("Receiving [{1}] from [{2}]: Error writing to file.")(
+                m_sFileName, m_sRemoteNick));
+        m_sWriteBuf.clear();
+        Close();
+        return false;
+    }
+    m_uBytesSoFar += m_sWriteBuf.size();
+    m_sWriteBuf.clear();
+    return true;
+}
+
 void CDCCSock::ConnectionRefused() {
     DEBUG(GetSockName() << " == ConnectionRefused()");
     if (m_bSend) {
@@ -428,6 +532,9 @@ void CDCCSock::Connected() {
                 m_sFileName, m_sRemoteNick));
     }
 
+    m_uStartBytes = m_uBytesSoFar;
+    m_uStartTime = CUtils::GetMillTime();
+
     if (m_bSend) {
         SendPacket();
     }
@@ -441,6 +548,10 @@ void CDCCSock::Disconnected() {
 
     DEBUG(GetSockName() << " == Disconnected()");
 
+    if (!m_bSend) {
+        FlushFile();
+    }
+
     if (m_uBytesSoFar > m_uFileSize) {
         if (m_bSend) {
             m_pModule->PutModule(t_f("Sending [{1}] to [{2}]: Too much data!")(
@@ -455,12 +566,12 @@ void CDCCSock::Disconnected() {
             m_pModule->PutModule(
                 t_f("Sending [{1}] to [{2}] completed at {3} KiB/s")(
                     m_sFileName, m_sRemoteNick,
-                    static_cast<int>(GetAvgWrite() / 1024.0)));
+                    static_cast<int>(GetSpeed() / 1024.0)));
         } else {
             m_pModule->PutModule(
                 t_f("Receiving [{1}] from [{2}] completed at {3} KiB/s")(
                     m_sFileName, m_sRemoteNick,
-                    static_cast<int>(GetAvgRead() / 1024.0)));
+                    static_cast<int>(GetSpeed() / 1024.0)));
         }
     } else {
         m_pModule->PutModule(sStart + "Incomplete!");
@@ -483,34 +594,79 @@ void CDCCSock::SendPacket() {
         return;
     }
 
-    if (GetInternalWriteBuffer().size() > 1024 * 1024) {
-        // There is still enough data to be written, don't add more
-        // stuff to that buffer.
-        DEBUG("SendPacket(): Skipping send, buffer still full enough ["
-              << GetInternalWriteBuffer().size() << "][" << m_sRemoteNick
-              << "][" << m_sFileName << "]");
-        return;
-    }
+    // Keep up to m_uiSendWindow bytes on their way, the acknowledgements
+    // bring us back here for more
+    while (m_uBytesSoFar < m_uFileSize) {
+        unsigned long long uInFlight =
+            m_uBytesSoFar - std::min(m_uAcked, m_uBytesSoFar);
+        if (uInFlight >= m_uiSendWindow) return;
+        size_t uRoom = std::min<unsigned long long>(
+            m_uiSendWindow - uInFlight, m_uFileSize - m_uBytesSoFar);
+
+#ifdef HAVE_SENDFILE
+        // Straight from the file to the socket. TLS needs the data in user
+        // space, and whatever is buffered already has to go out first.
+        if (!m_bNoSendfile && !GetSSL() && GetInternalWriteBuffer().empty()) {
+            off_t uOffset = m_uBytesSoFar;
+            ssize_t iSent =
+                sendfile(GetWSock(), m_pFile->GetFD(), &uOffset, uRoom);
+            if (iSent > 0) {
+                m_uBytesSoFar += iSent;
+                m_bSeekFile = true;
+                if (GetTimeoutType() & TMO_WRITE) ResetTimer();
+                continue;
+            }
+            // The socket is full, or the file ended early
+            if (iSent == 0 || errno == EAGAIN || errno == EINTR) return;
 
-    char szBuf[4096];
-    ssize_t iLen = m_pFile->Read(szBuf, 4096);
+            // Not for this file or socket, read it ourselves from now on
+            DEBUG("SendPacket(): sendfile() failed: " << strerror(errno));
+            m_bNoSendfile = true;
+        }
+#endif
 
-    if (iLen < 0) {
-        if (m_bSend) {
-            m_pModule->PutModule(
-                t_f("Sending [{1}] to [{2}]: Error reading from file.")(
-                    m_sFileName, m_sRemoteNick));
-        } else {
-            m_pModule->PutModule(
-                t_f("Receiving [{1}] from [{2}]: Error reading from file.")(
-                    m_sFileName, m_sRemoteNick));
+        if (GetInternalWriteBuffer().size() > 1024 * 1024) {
+            // There is still enough data to be written, don't add more
+            // stuff to that buffer.
+            DEBUG("SendPacket(): Skipping send, buffer still full enough ["
+                  << GetInternalWriteBuffer().size() << "][" << m_sRemoteNick
+                  << "][" << m_sFileName << "]");
+            return;
         }
 
-        Close();
-        return;
-    }
+        // Continue reading where sendfile() stopped
+        if (m_bSeekFile) {
+            if (!m_pFile->Seek(m_uBytesSoFar)) {
+                m_pModule->PutModule(
+                    t_f("Sending [{1}] to [{2}]: Error reading from file.")(
+                        m_sFileName, m_sRemoteNick));
+                Close();
+                return;
+            }
+            m_bSeekFile = false;
+        }
+
+        char szBuf[16 * 1024];
+        ssize_t iLen =
+            m_pFile->Read(szBuf, std::min<size_t>(sizeof(szBuf), uRoom));
+
+        if (iLen < 0) {
+            if (m_bSend) {
+                m_pModule->PutModule(
+                    t_f("Sending [{1}] to [{2}]: Error reading from file.")(
+                        m_sFileName, m_sRemoteNick));
+            } else {
+                m_pModule->PutModule(
+                    t_f("Receiving [{1}] from [{2}]: Error reading from file.")(
+                        m_sFileName, m_sRemoteNick));
+            }
+
+            Close();
+            return;
+        }
+
+        if (iLen == 0) return;
 
-    if (iLen > 0) {
         Write(szBuf, iLen);
         m_uBytesSoFar += iLen;
     }
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2004-2018 ZNC, see the NOTICE file for details.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <znc/Client.h>
+#include <znc/IRCNetwork.h>
+#include <znc/Message.h>
+#include <znc/Modules.h>
+#include <functional>
+#include <vector>
+
+/** The IRC traffic of a script module, collected for its OnEventBatch().
+ *  modperl and modpython share it and only convert the events for their
+ *  language when a batch is delivered.
+ */
+class CEventBatch {
+  public:
+    struct SEvent {
+        CString sType;
+        CString sNetwork;
+        CString sTarget;
+        CString sNick;
+        CString sText;
+        double dTime;
+    };
+
+    typedef std::function<void(const std::vector<SEvent>&)> DeliverFunc;
+
+    CEventBatch(CModule* pModule, DeliverFunc fDeliver)
+        : m_pModule(pModule), m_fDeliver(std::move(fDeliver)) {}
+
+    CEventBatch(const CEventBatch&) = delete;
+    CEventBatch& operator=(const CEventBatch&) = delete;
+
+    bool IsEnabled() const { return m_bEnabled; }
+
+    /// A batch is delivered uIntervalMs after its first event, or right away
+    /// once it has uMaxEvents events. An interval of 0 delivers on the next
+    /// turn of the event loop.
+    void Enable(unsigned int uIntervalMs, unsigned int uMaxEvents) {
+        m_bEnabled = true;
+        m_uInterval = uIntervalMs;
+        m_uMax = uMaxEvents ? uMaxEvents : 1;
+    }
+
+    void Disable() {
+        Flush();
+        m_bEnabled = false;
+    }
+
+    /// Queues the message if it's traffic, i.e. not a numeric, ping or the
+    /// like.
+    void Add(const CMessage& Message) {
+        SEvent Event;
+        switch (Message.GetType()) {
+            case CMessage::Type::Text:
+                Event.sType = "text";
+                Event.sText = Message.As<CTextMessage>().GetText();
+                break;
+            case CMessage::Type::Notice:
+                Event.sType = "notice";
+                Event.sText = Message.As<CNoticeMessage>().GetText();
+                break;
+            case CMessage::Type::Action:
+                Event.sType = "action";
+                Event.sText = Message.As<CActionMessage>().GetText();
+                break;
+            case CMessage::Type::CTCP:
+                Event.sType = "ctcp";
+                Event.sText = Message.As<CCTCPMessage>().GetText();
+                break;
+            case CMessage::Type::Join:
+                Event.sType = "join";
+                break;
+            case CMessage::Type::Part:
+                Event.sType = "part";
+                Event.sText = Message.GetParam(1);
+                break;
+            case CMessage::Type::Kick:
+                Event.sType = "kick";
+                Event.sText = Message.GetParam(1) + " " + Message.GetParam(2);
+                break;
+            case CMessage::Type::Topic:
+                Event.sType = "topic";
+                Event.sText = Message.GetParam(1);
+                break;
+            case CMessage::Type::Mode:
+                Event.sType = "mode";
+                Event.sText = Message.GetParamsColon(1);
+                break;
+            case CMessage::Type::Quit:
+                Event.sType = "quit";
+                Event.sText = Message.GetParam(0);
+                break;
+            case CMessage::Type::Nick:
+                Event.sType = "nick";
+                Event.sText = Message.GetParam(0);
+                break;
+            default:
+                return;
+        }
+        if (Event.sType != "quit" && Event.sType != "nick") {
+            Event.sTarget = Message.GetParam(0);
+        }
+
+        CIRCNetwork* pNetwork = Message.GetNetwork();
+        if (!pNetwork && Message.GetClient()) {
+            pNetwork = Message.GetClient()->GetNetwork();
+        }
+        if (pNetwork) Event.sNetwork = pNetwork->GetName();
+        // Lines from clients don't have a prefix
+        Event.sNick = Message.GetNick().GetNick();
+        if (Event.sNick.empty() && pNetwork) {
+            Event.sNick = pNetwork->GetCurNick();
+        }
+        const timeval& tv = Message.GetTime();
+        Event.dTime = tv.tv_sec + tv.tv_usec / 1000000.0;
+
+        m_vEvents.push_back(std::move(Event));
+        if (m_vEvents.size() >= m_uMax) {
+            Flush();
+        } else if (!m_pTimer) {
+            m_pTimer = new CDeliverTimer(this, m_uInterval);
+            // Fails while the last timer is still delivering. Nothing would
+            // deliver these events until the next one, so do it now.
+            if (!m_pModule->AddTimer(m_pTimer)) {
+                m_pTimer = nullptr;
+                Flush();
+            }
+        }
+    }
+
+    /// Delivers the pending events now.
+    void Flush() {
+        if (m_pTimer) {
+            CDeliverTimer* pTimer = m_pTimer;
+            m_pTimer = nullptr;
+            m_pModule->RemTimer(pTimer);
+        }
+        if (m_vEvents.empty()) return;
+
+        std::vector<SEvent> vEvents;
+        vEvents.swap(m_vEvents);
+        m_fDeliver(vEvents);
+    }
+
+  private:
+    class CDeliverTimer : public CTimer {
+      public:
+        CDeliverTimer(CEventBatch* pBatch, unsigned int uIntervalMs)
+            : CTimer(pBatch->m_pModule, 1, 1, "EventBatch",
+                     "Delivers events to OnEventBatch"),
+              m_pBatch(pBatch) {
+            StartMaxCycles(uIntervalMs / 1000.0, 1);
+        }
+
+      protected:
+        void RunJob() override {
+            // This timer is done, it mustn't be removed by the flush
+            m_pBatch->m_pTimer = nullptr;
+            m_pBatch->Flush();
+        }
+
+      private:
+        CEventBatch* m_pBatch;
+    };
+
+    CModule* m_pModule;
+    DeliverFunc m_fDeliver;
+    std::vector<SEvent> m_vEvents;
+    bool m_bEnabled = false;
+    unsigned int m_uInterval = 0;
+    unsigned int m_uMax = 0;
+    CDeliverTimer* m_pTimer = nullptr;
+};
@@ -23,6 +23,15 @@
 #include <znc/Server.h>
 #include <time.h>
 #include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sys/mman.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 using std::vector;
 using std::map;
@@ -53,8 +62,1002 @@ class CLogRule {
     bool m_bEnabled;
 };
 
+// A log file, which stays open across lines while it is in use
+class CLogFile {
+  public:
+    CLogFile(const CString& sPath) : m_File(sPath) {}
+
+    CFile m_File;
+    // Lines not written yet
+    CString m_sBuffer;
+    // For closing the least recently used file
+    unsigned long long m_uLastUse = 0;
+    // Bytes in the file, and up to where disk space is reserved for it
+    off_t m_uSize = 0;
+    off_t m_uReserved = 0;
+    bool m_bPreallocate = true;
+};
+
+// Disk space is reserved ahead of the writes in chunks which grow with the
+// file, so that a day's log ends up in a few extents without copying it
+#define LOG_PREALLOCATE_MIN (64 * 1024)
+#define LOG_PREALLOCATE_MAX (4 * 1024 * 1024)
+
+// The searchable log of a window is a directory of segments with up to
+// LOG_INDEX_SEGMENT_LINES lines each. NNNNNNNN.dat has the lines, as
+// "time\tnick\tline\n". Once a segment is full, NNNNNNNN.idx gets its index.
+// Until then the index is kept in memory, and rebuilt from the .dat file when
+// the window is opened again.
+//
+// An .idx file is LOG_INDEX_MAGIC, the number of lines, the times of the
+// first and the last line, the number of tokens and of nicks, where the nicks
+// and the postings start (8 bytes little endian each), where each line starts
+// in the .dat file (4 bytes each), the time of every LOG_INDEX_TIME_STRIDE-th
+// line (8 bytes each), the tokens and then the nicks with the number and the
+// position of their postings, and the postings: line numbers as delta encoded
+// varints.
+#define LOG_INDEX_MAGIC "ZNCLI001"
+#define LOG_INDEX_HEADER_LEN (8 + 7 * 8)
+#define LOG_INDEX_SEGMENT_LINES 16384
+#define LOG_INDEX_TIME_STRIDE 64
+#define LOG_INDEX_MAX_OPEN 16
+#define LOG_SEARCH_MAX_RESULTS 50
+#define LOG_PLAY_MAX_LINES 1000
+
+static void PutFixed(CString& sOut, uint64_t u, unsigned int uBytes) {
+    for (unsigned int i = 0; i < uBytes; ++i) sOut += (char)(u >> (8 * i));
+}
+
+static uint64_t GetFixed(const char* pIn, size_t uPos, unsigned int uBytes) {
+    uint64_t u = 0;
+    for (unsigned int i = 0; i < uBytes; ++i) {
+        u |= (uint64_t)(unsigned char)pIn[uPos + i] << (8 * i);
+    }
+    return u;
+}
+
+static uint64_t GetFixed(const CString& sIn, size_t uPos,
+                         unsigned int uBytes) {
+    return GetFixed(sIn.data(), uPos, uBytes);
+}
+
+static void PutVarint(CString& sOut, uint64_t u) {
+    while (u >= 0x80) {
+        sOut += (char)(u | 0x80);
+        u >>= 7;
+    }
+    sOut += (char)u;
+}
+
+static bool GetVarint(const char* pIn, size_t uLen, size_t& uPos,
+                      uint64_t& u) {
+    u = 0;
+    for (unsigned int uShift = 0; uPos < uLen && uShift < 64; uShift += 7) {
+        unsigned char c = pIn[uPos++];
+        u |= (uint64_t)(c & 0x7f) << uShift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+static bool GetVarint(const CString& sIn, size_t& uPos, uint64_t& u) {
+    return GetVarint(sIn.data(), sIn.length(), uPos, u);
+}
+
+// Lowercased words of at least two characters, which are what can be searched
+static void LogTokens(const CString& sText, SCString& ssTokens) {
+    CString sToken;
+    for (size_t i = 0; i <= sText.length(); ++i) {
+        unsigned char c = i < sText.length() ? sText[i] : ' ';
+        if (isalnum(c) || c >= 0x80) {
+            if (sToken.length() < 64) sToken += (char)tolower(c);
+        } else if (!sToken.empty()) {
+            if (sToken.length() >= 2) ssTokens.insert(sToken);
+            sToken.clear();
+        }
+    }
+}
+
+// Who a line which CLogMod wrote is from
+static CString LogLineNick(const CString& sLine) {
+    if (sLine.StartsWith("<")) {
+        return sLine.Token(0).TrimPrefix_n("<").TrimSuffix_n(">");
+    } else if (sLine.StartsWith("-")) {
+        return sLine.Token(0).TrimPrefix_n("-").TrimSuffix_n("-");
+    } else if (sLine.StartsWith("*** ")) {
+        CString sWord = sLine.Token(1);
+        if (sWord == "Joins:" || sWord == "Parts:" || sWord == "Quits:") {
+            return sLine.Token(2);
+        }
+        return sWord;
+    } else if (sLine.StartsWith("* ")) {
+        return sLine.Token(1);
+    }
+    return "";
+}
+
+// Parses YYYY-MM-DD or YYYY-MM-DDTHH:MM:SS in the time zone sTZ. A date alone
+// means the start of the day, or with bEnd its end.
+static bool ParseLogTime(const CString& sTime, const CString& sTZ, bool bEnd,
+                         time_t& tTime) {
+    struct tm stm;
+    memset(&stm, 0, sizeof(stm));
+    bool bDate = false;
+    const char* pEnd = strptime(sTime.c_str(), "%Y-%m-%dT%H:%M:%S", &stm);
+    if (!pEnd || *pEnd) {
+        memset(&stm, 0, sizeof(stm));
+        pEnd = strptime(sTime.c_str(), "%Y-%m-%d", &stm);
+        if (!pEnd || *pEnd) return false;
+        bDate = true;
+    }
+    stm.tm_isdst = -1;
+
+    const char* pOldTZ = getenv("TZ");
+    bool bHadTZ = pOldTZ != nullptr;
+    CString sOldTZ = bHadTZ ? pOldTZ : "";
+    if (!sTZ.empty()) {
+        setenv("TZ", sTZ.c_str(), 1);
+        tzset();
+    }
+    tTime = mktime(&stm);
+    if (!sTZ.empty()) {
+        if (bHadTZ) {
+            setenv("TZ", sOldTZ.c_str(), 1);
+        } else {
+            unsetenv("TZ");
+        }
+        tzset();
+    }
+
+    if (tTime == -1) return false;
+    if (bDate && bEnd) tTime += 24 * 60 * 60 - 1;
+    return true;
+}
+
+// The index of a segment of the searchable log
+class CLogSegmentIndex {
+  public:
+    virtual ~CLogSegmentIndex() {}
+
+    virtual uint32_t GetLines() const = 0;
+    virtual uint64_t GetOffset(uint32_t uLine) const = 0;
+    // Time of line uStride * LOG_INDEX_TIME_STRIDE
+    virtual time_t GetStrideTime(size_t uStride) const = 0;
+    virtual void GetPostings(bool bNick, const CString& sKey,
+                             vector<uint32_t>& vLines) const = 0;
+
+    /** Lines with all of the tokens and nicks which may be between the
+     *  times. The exact times are only known from the lines themselves. */
+    vector<uint32_t> Find(const SCString& ssTokens, const SCString& ssNicks,
+                          time_t tSince, time_t tUntil) const {
+        vector<uint32_t> vResult;
+        bool bFirst = true;
+        auto Intersect = [&](bool bNick, const CString& sKey) {
+            vector<uint32_t> vLines;
+            GetPostings(bNick, sKey, vLines);
+            if (bFirst) {
+                vResult = std::move(vLines);
+                bFirst = false;
+                return;
+            }
+            vector<uint32_t> vBoth;
+            std::set_intersection(vResult.begin(), vResult.end(),
+                                  vLines.begin(), vLines.end(),
+                                  std::back_inserter(vBoth));
+            vResult = std::move(vBoth);
+        };
+        for (const CString& sToken : ssTokens) Intersect(false, sToken);
+        for (const CString& sNick : ssNicks) Intersect(true, sNick);
+
+        size_t uStrides =
+            (GetLines() + LOG_INDEX_TIME_STRIDE - 1) / LOG_INDEX_TIME_STRIDE;
+        size_t uLow = 0, uHigh = uStrides;
+        while (uLow + 1 < uStrides && GetStrideTime(uLow + 1) < tSince) uLow++;
+        while (uHigh > uLow && GetStrideTime(uHigh - 1) > tUntil) uHigh--;
+        uint32_t uFirst = uLow * LOG_INDEX_TIME_STRIDE;
+        uint32_t uEnd = uHigh * LOG_INDEX_TIME_STRIDE;
+        vResult.erase(std::remove_if(vResult.begin(), vResult.end(),
+                                     [&](uint32_t uLine) {
+                                         return uLine < uFirst ||
+                                                uLine >= uEnd;
+                                     }),
+                      vResult.end());
+        return vResult;
+    }
+};
+
+// The index of the segment which is being written
+class CLogActiveSegment : public CLogSegmentIndex {
+  public:
+    uint32_t GetLines() const override { return m_vOffsets.size(); }
+    uint64_t GetOffset(uint32_t uLine) const override {
+        return m_vOffsets[uLine];
+    }
+    time_t GetStrideTime(size_t uStride) const override {
+        return m_vTimes[uStride];
+    }
+    void GetPostings(bool bNick, const CString& sKey,
+                     vector<uint32_t>& vLines) const override {
+        const auto& mPostings = bNick ? m_mNicks : m_mTokens;
+        auto it = mPostings.find(sKey);
+        if (it != mPostings.end()) vLines = it->second;
+    }
+
+    time_t GetFirstTime() const { return m_tFirst; }
+    time_t GetLastTime() const { return m_tLast; }
+
+    void Add(time_t tTime, const CString& sNick, const CString& sLine,
+             uint64_t uOffset) {
+        uint32_t uLine = m_vOffsets.size();
+        if (uLine == 0) m_tFirst = tTime;
+        m_tLast = tTime;
+        if (uLine % LOG_INDEX_TIME_STRIDE == 0) m_vTimes.push_back(tTime);
+        m_vOffsets.push_back(uOffset);
+
+        SCString ssTokens;
+        LogTokens(sLine, ssTokens);
+        for (const CString& sToken : ssTokens) {
+            m_mTokens[sToken].push_back(uLine);
+        }
+        if (!sNick.empty()) m_mNicks[sNick].push_back(uLine);
+    }
+
+    /** The contents of the .idx file of the segment. */
+    CString Serialize() const {
+        CString sDict, sPostings;
+        auto AddKeys =
+            [&](const std::unordered_map<CString, vector<uint32_t>>& mKeys) {
+                // Sorted, so that the file doesn't depend on the hash
+                std::map<CString, const vector<uint32_t>*> mSorted;
+                for (const auto& it : mKeys) mSorted[it.first] = &it.second;
+                for (const auto& it : mSorted) {
+                    PutVarint(sDict, it.first.length());
+                    sDict += it.first;
+                    PutVarint(sDict, it.second->size());
+                    PutVarint(sDict, sPostings.length());
+                    uint32_t uPrev = 0;
+                    for (uint32_t uLine : *it.second) {
+                        PutVarint(sPostings, uLine - uPrev);
+                        uPrev = uLine;
+                    }
+                }
+            };
+        AddKeys(m_mTokens);
+        size_t uNickDict = sDict.length();
+        AddKeys(m_mNicks);
+
+        size_t uDictStart = LOG_INDEX_HEADER_LEN + 4 * m_vOffsets.size() +
+                            8 * m_vTimes.size();
+        CString sOut = LOG_INDEX_MAGIC;
+        PutFixed(sOut, m_vOffsets.size(), 8);
+        PutFixed(sOut, m_tFirst, 8);
+        PutFixed(sOut, m_tLast, 8);
+        PutFixed(sOut, m_mTokens.size(), 8);
+        PutFixed(sOut, m_mNicks.size(), 8);
+        PutFixed(sOut, uDictStart + uNickDict, 8);
+        PutFixed(sOut, uDictStart + sDict.length(), 8);
+        for (uint64_t uOffset : m_vOffsets) PutFixed(sOut, uOffset, 4);
+        for (time_t tTime : m_vTimes) PutFixed(sOut, tTime, 8);
+        sOut += sDict;
+        sOut += sPostings;
+        return sOut;
+    }
+
+  private:
+    time_t m_tFirst = 0;
+    time_t m_tLast = 0;
+    vector<uint64_t> m_vOffsets;
+    vector<time_t> m_vTimes;
+    std::unordered_map<CString, vector<uint32_t>> m_mTokens;
+    std::unordered_map<CString, vector<uint32_t>> m_mNicks;
+};
+
+// The index of a full segment, used straight from the .idx file. The file is
+// mmap()ed when possible, and the index keeps it for later searches.
+class CLogSealedSegment : public CLogSegmentIndex {
+  public:
+    CLogSealedSegment() {}
+    ~CLogSealedSegment() override {
+        if (m_pMap) munmap(m_pMap, m_uSize);
+    }
+
+    CLogSealedSegment(const CLogSealedSegment&) = delete;
+    CLogSealedSegment& operator=(const CLogSealedSegment&) = delete;
+
+    bool Load(const CString& sPath) {
+        CFile File(sPath);
+        struct stat st;
+        if (!File.Open() || fstat(File.GetFD(), &st) != 0) return false;
+        if (st.st_size > 0) {
+            void* pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                              File.GetFD(), 0);
+            if (pMap != MAP_FAILED) {
+                m_pMap = pMap;
+                m_pData = static_cast<const char*>(pMap);
+                m_uSize = st.st_size;
+            }
+        }
+        if (!m_pMap) {
+            if (!File.ReadFile(m_sData, 256 * 1024 * 1024)) return false;
+            m_pData = m_sData.data();
+            m_uSize = m_sData.length();
+        }
+
+        if (m_uSize < LOG_INDEX_HEADER_LEN ||
+            memcmp(m_pData, LOG_INDEX_MAGIC, 8) != 0) {
+            return false;
+        }
+        m_uLines = GetFixed(m_pData, 8, 8);
+        m_uNickDict = GetFixed(m_pData, 48, 8);
+        m_uPostings = GetFixed(m_pData, 56, 8);
+        m_uTimes = LOG_INDEX_HEADER_LEN + 4 * (size_t)m_uLines;
+        size_t uDict = m_uTimes + 8 * ((m_uLines + LOG_INDEX_TIME_STRIDE - 1) /
+                                       LOG_INDEX_TIME_STRIDE);
+        if (m_uLines > LOG_INDEX_SEGMENT_LINES || uDict > m_uNickDict ||
+            m_uNickDict > m_uPostings || m_uPostings > m_uSize) {
+            return false;
+        }
+        return LoadKeys(uDict, m_uNickDict, GetFixed(m_pData, 32, 8),
+                        m_vTokens) &&
+               LoadKeys(m_uNickDict, m_uPostings, GetFixed(m_pData, 40, 8),
+                        m_vNicks);
+    }
+
+    uint32_t GetLines() const override { return m_uLines; }
+    uint64_t GetOffset(uint32_t uLine) const override {
+        return GetFixed(m_pData, LOG_INDEX_HEADER_LEN + 4 * uLine, 4);
+    }
+    time_t GetStrideTime(size_t uStride) const override {
+        return GetFixed(m_pData, m_uTimes + 8 * uStride, 8);
+    }
+    void GetPostings(bool bNick, const CString& sKey,
+                     vector<uint32_t>& vLines) const override {
+        // The keys are sorted by Serialize()
+        const vector<size_t>& vKeys = bNick ? m_vNicks : m_vTokens;
+        auto it = std::lower_bound(
+            vKeys.begin(), vKeys.end(), sKey,
+            [&](size_t uEntry, const CString& sFind) {
+                uint64_t uLen;
+                GetVarint(m_pData, m_uPostings, uEntry, uLen);
+                return sFind.compare(0, sFind.length(), m_pData + uEntry,
+                                     uLen) > 0;
+            });
+        if (it == vKeys.end()) return;
+
+        size_t uPos = *it;
+        uint64_t uLen, uCount, uStart;
+        GetVarint(m_pData, m_uPostings, uPos, uLen);
+        if (sKey.compare(0, sKey.length(), m_pData + uPos, uLen) != 0) return;
+        uPos += uLen;
+        GetVarint(m_pData, m_uPostings, uPos, uCount);
+        GetVarint(m_pData, m_uPostings, uPos, uStart);
+
+        size_t uPosting = m_uPostings + uStart;
+        uint64_t uLine = 0, uDelta;
+        for (uint64_t j = 0; j < uCount && j < m_uLines; ++j) {
+            if (!GetVarint(m_pData, m_uSize, uPosting, uDelta)) return;
+            uLine += uDelta;
+            vLines.push_back(uLine);
+        }
+    }
+
+  private:
+    // Where each of the uKeys entries of the dictionary from uPos to uEnd
+    // starts
+    bool LoadKeys(size_t uPos, size_t uEnd, uint64_t uKeys,
+                  vector<size_t>& vKeys) {
+        if (uKeys > uEnd - uPos) return false;
+        vKeys.reserve(uKeys);
+        for (uint64_t i = 0; i < uKeys; ++i) {
+            vKeys.push_back(uPos);
+            uint64_t uLen, uCount, uStart;
+            if (!GetVarint(m_pData, uEnd, uPos, uLen) || uLen > uEnd - uPos) {
+                return false;
+            }
+            uPos += uLen;
+            if (!GetVarint(m_pData, uEnd, uPos, uCount) ||
+                !GetVarint(m_pData, uEnd, uPos, uStart) ||
+                uStart > m_uSize - m_uPostings) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    CString m_sData;
+    void* m_pMap = nullptr;
+    const char* m_pData = nullptr;
+    size_t m_uSize = 0;
+    uint64_t m_uLines = 0;
+    size_t m_uTimes = 0;
+    size_t m_uNickDict = 0;
+    size_t m_uPostings = 0;
+    vector<size_t> m_vTokens;
+    vector<size_t> m_vNicks;
+};
+
+// Log files of past days can be compressed. They become gzip with a member
+// for every block, so gzip and zcat read them as usual, and an empty member
+// at the end whose extra field tells where every block starts. This way a
+// line can be read without inflating everything before it. A file is renamed
+// to .sealed before it's compressed, so that nothing writes to it anymore.
+// What's logged to that day afterwards goes to a new file, which is appended
+// to the .gz the same way when it's compressed.
+#define LOG_GZ_EXT ".gz"
+#define LOG_SEALED_EXT ".sealed"
+#define LOG_GZ_MAGIC "ZNCLGZ01"
+#define LOG_GZ_BLOCK (64 * 1024)
+// The extra field of a gzip header has at most 65535 bytes
+#define LOG_GZ_MAX_BLOCKS 8000
+// Size of the end of the index member: block size, number of blocks,
+// uncompressed size, magic, and the empty deflate stream with its trailer
+#define LOG_GZ_TAIL (24 + 10)
+
+#ifdef HAVE_ZLIB
+// Compresses sPath.sealed into sPath.gz and removes sPath.sealed
+static bool CompressLog(const CString& sPath, uint64_t& uIn, uint64_t& uOut) {
+    CFile Source(sPath + LOG_SEALED_EXT);
+    struct stat st;
+    if (!Source.Open() || fstat(Source.GetFD(), &st) != 0) return false;
+    uint32_t uBlock = LOG_GZ_BLOCK;
+    while ((uint64_t)st.st_size / uBlock >= LOG_GZ_MAX_BLOCKS) {
+        uBlock *= 2;
+    }
+
+    // Appending happens on a copy, so that a failure doesn't break the .gz
+    CString sPacked = sPath + LOG_GZ_EXT;
+    CFile Packed(sPacked + ".new");
+    if (CFile::Exists(sPacked)) {
+        if (!CFile::Copy(sPacked, Packed.GetLongName(), true) ||
+            !Packed.Open(O_WRONLY | O_APPEND)) {
+            Packed.Delete();
+            return false;
+        }
+    } else if (!Packed.Open(O_WRONLY | O_CREAT | O_TRUNC,
+                            st.st_mode & 0777)) {
+        return false;
+    }
+    struct stat stPacked;
+    if (fstat(Packed.GetFD(), &stPacked) != 0) {
+        Packed.Close();
+        Packed.Delete();
+        return false;
+    }
+
+    // Offsets are from the start of the .gz
+    vector<uint64_t> vBlocks;
+    uint64_t uTotal = 0;
+    uint64_t uPacked = stPacked.st_size;
+    vector<char> vIn(uBlock);
+    vector<char> vOut;
+    bool bOk = true;
+    while (bOk) {
+        size_t uRead = 0;
+        ssize_t iRead = 0;
+        while (uRead < uBlock &&
+               (iRead = Source.Read(&vIn[uRead], uBlock - uRead)) > 0) {
+            uRead += iRead;
+        }
+        if (iRead < 0) bOk = false;
+        if (uRead == 0) break;
+
+        z_stream zStrm;
+        memset(&zStrm, 0, sizeof(zStrm));
+        if (deflateInit2(&zStrm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            bOk = false;
+            break;
+        }
+        vOut.resize(deflateBound(&zStrm, uRead));
+        zStrm.next_in = (Bytef*)&vIn[0];
+        zStrm.avail_in = uRead;
+        zStrm.next_out = (Bytef*)&vOut[0];
+        zStrm.avail_out = vOut.size();
+        int iRet = deflate(&zStrm, Z_FINISH);
+        size_t uLen = vOut.size() - zStrm.avail_out;
+        deflateEnd(&zStrm);
+        if (iRet != Z_STREAM_END ||
+            Packed.Write(&vOut[0], uLen) != (ssize_t)uLen) {
+            bOk = false;
+            break;
+        }
+        vBlocks.push_back(uPacked);
+        uPacked += uLen;
+        uTotal += uRead;
+    }
+    vBlocks.push_back(uPacked);
+
+    if (bOk) {
+        CString sIndex;
+        for (uint64_t uOffset : vBlocks) PutFixed(sIndex, uOffset, 8);
+        PutFixed(sIndex, uBlock, 4);
+        PutFixed(sIndex, vBlocks.size() - 1, 4);
+        PutFixed(sIndex, uTotal, 8);
+        sIndex += LOG_GZ_MAGIC;
+
+        // Header with FEXTRA, no mtime, unknown OS
+        CString sMember("\x1f\x8b\x08\x04\0\0\0\0\0\xff", 10);
+        PutFixed(sMember, sIndex.length() + 4, 2);
+        sMember += "ZN";
+        PutFixed(sMember, sIndex.length(), 2);
+        sMember += sIndex;
+        // Empty deflate stream, CRC32 and size of nothing
+        sMember += CString("\x03\0\0\0\0\0\0\0\0\0", 10);
+        bOk = Packed.Write(sMember) == (ssize_t)sMember.length() &&
+              Packed.Sync();
+        uPacked += sMember.length();
+    }
+    Packed.Close();
+
+    if (!bOk || !Packed.Move(sPacked, true)) {
+        Packed.Delete();
+        return false;
+    }
+    Source.Close();
+    Source.Delete();
+    uIn = uTotal;
+    uOut = uPacked - stPacked.st_size;
+    return true;
+}
+#endif
+
+// Reads a log file, which may have been compressed. Its lines are in
+// sPath.gz, then in sPath.sealed while that waits to be compressed, then in
+// sPath. Files compressed by something else than CompressLog() work too, but
+// they are inflated from the start, and the offsets of ReadLine() can't go
+// past them.
+class CLogReader {
+  public:
+    bool Open(const CString& sPath) {
+        m_uCached = std::numeric_limits<size_t>::max();
+        m_sCached.clear();
+        m_vBlocks.clear();
+        m_vParts.clear();
+        m_uSize = 0;
+#ifdef HAVE_ZLIB
+        AddPart(sPath + LOG_GZ_EXT, true);
+#endif
+        AddPart(sPath + LOG_SEALED_EXT, false);
+        AddPart(sPath, false);
+        return !m_vParts.empty();
+    }
+
+    /** Reads the line which starts at uOffset of the uncompressed file,
+     *  with its newline. */
+    bool ReadLine(uint64_t uOffset, CString& sLine) {
+        sLine.clear();
+        auto it = std::upper_bound(
+            m_vBlocks.begin(), m_vBlocks.end(), uOffset,
+            [](uint64_t u, const SBlock& Block) { return u < Block.uStart; });
+        if (it == m_vBlocks.begin()) return false;
+        size_t uBlock = it - m_vBlocks.begin() - 1;
+        uint64_t uPos = uOffset - m_vBlocks[uBlock].uStart;
+
+        const SPart& Part = m_vParts[m_vBlocks[uBlock].uPart];
+        if (!Part.bPacked) {
+            return Part.pFile->Seek(uPos) && Part.pFile->ReadLine(sLine);
+        }
+        while (uBlock < m_vBlocks.size() &&
+               m_vParts[m_vBlocks[uBlock].uPart].bPacked &&
+               LoadBlock(uBlock)) {
+            if (uPos > m_sCached.length()) return false;
+            size_t uEnd = m_sCached.find('\n', uPos);
+            if (uEnd != CString::npos) {
+                sLine.append(m_sCached, uPos, uEnd + 1 - uPos);
+                return true;
+            }
+            // It continues in the next block
+            sLine.append(m_sCached, uPos, CString::npos);
+            uBlock++;
+            uPos = 0;
+        }
+        return !sLine.empty();
+    }
+
+    /** Reads the whole uncompressed file. */
+    bool ReadAll(CString& sData) {
+        sData.clear();
+        for (size_t uBlock = 0; uBlock < m_vBlocks.size(); ++uBlock) {
+            const SPart& Part = m_vParts[m_vBlocks[uBlock].uPart];
+            if (Part.bPacked) {
+                if (!LoadBlock(uBlock)) return false;
+                sData += m_sCached;
+                continue;
+            }
+            CString sPart;
+            if (!Part.pFile->Seek(0) ||
+                !Part.pFile->ReadFile(sPart,
+                                      std::numeric_limits<size_t>::max())) {
+                return false;
+            }
+            sData += sPart;
+        }
+        return true;
+    }
+
+  private:
+    struct SPart {
+        std::unique_ptr<CFile> pFile;
+        bool bPacked;
+    };
+
+    struct SBlock {
+        size_t uPart;
+        // Where it starts in the uncompressed file
+        uint64_t uStart;
+        // Where its gzip members are in the .gz
+        uint64_t uBegin;
+        uint64_t uEnd;
+    };
+
+    void AddPart(const CString& sPath, bool bPacked) {
+        std::unique_ptr<CFile> pFile(new CFile(sPath));
+        if (!pFile->Open()) return;
+        off_t uSize = pFile->GetSize();
+        m_vParts.push_back({std::move(pFile), bPacked});
+#ifdef HAVE_ZLIB
+        if (bPacked) {
+            LoadBlocks(uSize);
+            return;
+        }
+#endif
+        m_vBlocks.push_back({m_vParts.size() - 1, m_uSize, 0, (uint64_t)uSize});
+        if (m_uSize != std::numeric_limits<uint64_t>::max()) m_uSize += uSize;
+    }
+
+#ifdef HAVE_ZLIB
+    // Every CompressLog() of the file appended blocks and an index member
+    // for them. The first block of each tells where the one before ends.
+    void LoadBlocks(uint64_t uSize) {
+        CFile& File = *m_vParts.back().pFile;
+        size_t uPart = m_vParts.size() - 1;
+        vector<vector<SBlock>> vRuns;
+        vector<uint64_t> vTotals;
+        uint64_t uEnd = uSize;
+        while (uEnd > 0) {
+            CString sTail;
+            if (uEnd < LOG_GZ_TAIL || !File.Seek(uEnd - LOG_GZ_TAIL) ||
+                !ReadExactly(File, LOG_GZ_TAIL, sTail) ||
+                sTail.substr(16, 8) != LOG_GZ_MAGIC) {
+                break;
+            }
+            uint64_t uBlockSize = GetFixed(sTail, 0, 4);
+            uint64_t uBlocks = GetFixed(sTail, 4, 4);
+            uint64_t uIndex = (uBlocks + 1) * 8;
+            // The index member starts with 16 bytes of header
+            uint64_t uMember = uIndex + LOG_GZ_TAIL + 16;
+            CString sIndex;
+            if (!uBlockSize || uBlocks >= LOG_GZ_MAX_BLOCKS ||
+                uEnd < uMember ||
+                !File.Seek(uEnd - LOG_GZ_TAIL - uIndex) ||
+                !ReadExactly(File, uIndex, sIndex) ||
+                GetFixed(sIndex, uBlocks * 8, 8) != uEnd - uMember) {
+                break;
+            }
+            vector<SBlock> vRun;
+            for (uint64_t i = 0; i < uBlocks; ++i) {
+                vRun.push_back({uPart, i * uBlockSize,
+                                GetFixed(sIndex, i * 8, 8),
+                                GetFixed(sIndex, i * 8 + 8, 8)});
+            }
+            uint64_t uFirst = GetFixed(sIndex, 0, 8);
+            if (uFirst > uEnd - uMember) break;
+            vRuns.push_back(std::move(vRun));
+            vTotals.push_back(GetFixed(sTail, 8, 8));
+            uEnd = uFirst;
+        }
+
+        if (uEnd > 0) {
+            // Without our index it's a single block of unknown size
+            m_vBlocks.push_back({uPart, m_uSize, 0, uSize});
+            m_uSize = std::numeric_limits<uint64_t>::max();
+            return;
+        }
+        for (size_t i = vRuns.size(); i-- > 0;) {
+            for (SBlock& Block : vRuns[i]) {
+                Block.uStart += m_uSize;
+                m_vBlocks.push_back(Block);
+            }
+            m_uSize += vTotals[i];
+        }
+    }
+
+    static bool ReadExactly(CFile& File, size_t uLen, CString& sData) {
+        sData.resize(uLen);
+        size_t uRead = 0;
+        ssize_t iRead = 0;
+        while (uRead < uLen &&
+               (iRead = File.Read(&sData[uRead], uLen - uRead)) > 0) {
+            uRead += iRead;
+        }
+        return uRead == uLen;
+    }
+#endif
+
+    // Inflates a block of the .gz into m_sCached, unless it's there already
+    bool LoadBlock(size_t uBlock) {
+        if (uBlock == m_uCached) return true;
+#ifdef HAVE_ZLIB
+        m_uCached = std::numeric_limits<size_t>::max();
+        m_sCached.clear();
+        const SBlock& Block = m_vBlocks[uBlock];
+        CFile& File = *m_vParts[Block.uPart].pFile;
+        CString sIn;
+        if (Block.uEnd < Block.uBegin || !File.Seek(Block.uBegin) ||
+            !ReadExactly(File, Block.uEnd - Block.uBegin, sIn)) {
+            return false;
+        }
+
+        z_stream zStrm;
+        memset(&zStrm, 0, sizeof(zStrm));
+        if (inflateInit2(&zStrm, 15 + 16) != Z_OK) return false;
+        zStrm.next_in = (Bytef*)sIn.data();
+        zStrm.avail_in = sIn.length();
+        char szBuf[16 * 1024];
+        int iRet = Z_OK;
+        while (iRet == Z_OK || iRet == Z_STREAM_END) {
+            if (iRet == Z_STREAM_END) {
+                // gzip files can have several members
+                if (!zStrm.avail_in) break;
+                inflateReset(&zStrm);
+            }
+            zStrm.next_out = (Bytef*)szBuf;
+            zStrm.avail_out = sizeof(szBuf);
+            iRet = inflate(&zStrm, Z_NO_FLUSH);
+            m_sCached.append(szBuf, sizeof(szBuf) - zStrm.avail_out);
+        }
+        inflateEnd(&zStrm);
+        if (iRet != Z_STREAM_END) return false;
+        m_uCached = uBlock;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    vector<SPart> m_vParts;
+    vector<SBlock> m_vBlocks;
+    // Size of the parts added so far
+    uint64_t m_uSize = 0;
+    size_t m_uCached = std::numeric_limits<size_t>::max();
+    CString m_sCached;
+};
+
+// The searchable log of one window
+class CLogIndex {
+  public:
+    struct SMatch {
+        time_t tTime;
+        CString sLine;
+    };
+
+    /** fOnSealed gets the data files of full segments, for compressing. */
+    CLogIndex(const CString& sDir,
+              std::function<void(const CString&)> fOnSealed = nullptr)
+        : m_sDir(sDir), m_fOnSealed(fOnSealed) {}
+    ~CLogIndex() { Flush(); }
+
+    CLogIndex(const CLogIndex&) = delete;
+    CLogIndex& operator=(const CLogIndex&) = delete;
+
+    bool Open() {
+        if (!CFile::Exists(m_sDir) && !CDir::MakeDir(m_sDir, 0700)) {
+            return false;
+        }
+
+        unsigned int uActive = 0;
+        vector<unsigned int> vData;
+        CDir Dir(m_sDir);
+        for (CFile* pFile : Dir) {
+            CString sName = pFile->GetShortName();
+            unsigned int uNumber = sName.Token(0, false, ".").ToUInt();
+            if (sName.EndsWith(".dat")) {
+                uActive = std::max(uActive, uNumber);
+                vData.push_back(uNumber);
+            } else if (sName.EndsWith(".dat" LOG_SEALED_EXT)) {
+                vData.push_back(uNumber);
+            } else if (sName.EndsWith(".idx")) {
+                uActive = std::max(uActive, uNumber + 1);
+                CFile File(pFile->GetLongName());
+                char aHeader[LOG_INDEX_HEADER_LEN];
+                if (File.Open() &&
+                    File.Read(aHeader, sizeof(aHeader)) == sizeof(aHeader)) {
+                    CString sHeader(aHeader, sizeof(aHeader));
+                    m_mSealed[uNumber] = std::make_pair(
+                        (time_t)GetFixed(sHeader, 16, 8),
+                        (time_t)GetFixed(sHeader, 24, 8));
+                }
+            }
+        }
+        m_uActive = uActive;
+        if (m_fOnSealed) {
+            // Left over from an unload before they were compressed
+            for (unsigned int uNumber : vData) {
+                if (uNumber < m_uActive) m_fOnSealed(GetPath(uNumber, ".dat"));
+            }
+        }
+        return Load();
+    }
+
+    void Add(time_t tTime, const CString& sNick, const CString& sLine) {
+        m_Active.Add(tTime, sNick, sLine, m_uSize);
+        CString sRecord = CString(tTime) + "\t" + sNick + "\t" + sLine + "\n";
+        m_uSize += sRecord.length();
+        m_sBuffer += sRecord;
+        if (m_Active.GetLines() >= LOG_INDEX_SEGMENT_LINES) {
+            Seal();
+        } else if (m_sBuffer.length() >= 64 * 1024) {
+            Flush();
+        }
+    }
+
+    void Flush() {
+        if (m_sBuffer.empty()) return;
+        m_Data.Write(m_sBuffer);
+        m_sBuffer.clear();
+    }
+
+    /** Finds the newest lines with all of the tokens and nicks.
+     *  @return Whether there are more than uMax. */
+    bool Search(const SCString& ssTokens, const SCString& ssNicks,
+                time_t tSince, time_t tUntil, size_t uMax,
+                vector<SMatch>& vMatches) {
+        Flush();
+        if (SearchSegment(m_Active, m_uActive, ssTokens, ssNicks, tSince,
+                          tUntil, uMax, vMatches)) {
+            return true;
+        }
+        for (auto it = m_mSealed.rbegin(); it != m_mSealed.rend(); ++it) {
+            if (it->second.second < tSince || it->second.first > tUntil) {
+                continue;
+            }
+            const CLogSealedSegment* pSegment = GetSealed(it->first);
+            if (!pSegment) continue;
+            if (SearchSegment(*pSegment, it->first, ssTokens, ssNicks, tSince,
+                              tUntil, uMax, vMatches)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // For closing the least recently used index
+    unsigned long long m_uLastUse = 0;
+
+  private:
+    CString GetPath(unsigned int uNumber, const CString& sExt) const {
+        char szName[16];
+        snprintf(szName, sizeof(szName), "%08u", uNumber);
+        return m_sDir + "/" + szName + sExt;
+    }
+
+    // Loaded on the first search which needs it
+    const CLogSealedSegment* GetSealed(unsigned int uNumber) {
+        auto it = m_mLoaded.find(uNumber);
+        if (it == m_mLoaded.end()) {
+            std::unique_ptr<CLogSealedSegment> pSegment(new CLogSealedSegment);
+            if (!pSegment->Load(GetPath(uNumber, ".idx"))) pSegment.reset();
+            it = m_mLoaded.emplace(uNumber, std::move(pSegment)).first;
+        }
+        return it->second.get();
+    }
+
+    // Indexes the lines which are already in the active segment
+    bool Load() {
+        m_Data.Close();
+        m_Data.SetFileName(GetPath(m_uActive, ".dat"));
+        m_Active = CLogActiveSegment();
+        m_uSize = 0;
+
+        CFile File(m_Data.GetLongName());
+        if (File.Open()) {
+            CString sLine;
+            while (File.ReadLine(sLine)) {
+                uint64_t uOffset = m_uSize;
+                m_uSize += sLine.length();
+                if (!sLine.TrimSuffix("\n")) {
+                    // Torn by a crash, finish it
+                    m_sBuffer = "\n";
+                    m_uSize++;
+                }
+                m_Active.Add(sLine.Token(0, false, "\t").ToLongLong(),
+                             sLine.Token(1, false, "\t"),
+                             sLine.Token(2, true, "\t"), uOffset);
+            }
+        }
+
+        if (!m_Data.Open(O_WRONLY | O_APPEND | O_CREAT, 0600)) return false;
+        if (m_Active.GetLines() >= LOG_INDEX_SEGMENT_LINES) Seal();
+        return true;
+    }
+
+    void Seal() {
+        Flush();
+        CFile Index(GetPath(m_uActive, ".idx.new"));
+        if (Index.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
+            Index.Write(m_Active.Serialize());
+            Index.Close();
+            if (Index.Move(GetPath(m_uActive, ".idx"), true)) {
+                m_mSealed[m_uActive] = std::make_pair(
+                    m_Active.GetFirstTime(), m_Active.GetLastTime());
+            }
+        }
+        m_Data.Close();
+        if (m_fOnSealed) m_fOnSealed(GetPath(m_uActive, ".dat"));
+        m_uActive++;
+        Load();
+    }
+
+    bool SearchSegment(const CLogSegmentIndex& Segment, unsigned int uNumber,
+                       const SCString& ssTokens, const SCString& ssNicks,
+                       time_t tSince, time_t tUntil, size_t uMax,
+                       vector<SMatch>& vMatches) {
+        vector<uint32_t> vLines = Segment.Find(ssTokens, ssNicks, tSince,
+                                               tUntil);
+        if (vLines.empty()) return false;
+
+        // Sealed segments may have been compressed
+        CLogReader Reader;
+        if (!Reader.Open(GetPath(uNumber, ".dat"))) return false;
+        for (auto it = vLines.rbegin(); it != vLines.rend(); ++it) {
+            CString sLine;
+            if (!Reader.ReadLine(Segment.GetOffset(*it), sLine)) continue;
+            time_t tTime = sLine.Token(0, false, "\t").ToLongLong();
+            if (tTime < tSince || tTime > tUntil) continue;
+            if (vMatches.size() == uMax) return true;
+            vMatches.push_back({tTime, sLine.Token(2, true, "\t").TrimRight_n(
+                                           "\n")});
+        }
+        return false;
+    }
+
+    CString m_sDir;
+    std::function<void(const CString&)> m_fOnSealed;
+    // The segment which new lines go to
+    unsigned int m_uActive = 0;
+    CLogActiveSegment m_Active;
+    CFile m_Data;
+    uint64_t m_uSize = 0;
+    // Lines not written yet
+    CString m_sBuffer;
+    // Full segments, and the times of their first and last lines
+    map<unsigned int, std::pair<time_t, time_t>> m_mSealed;
+    // Indexes of full segments which were searched, null if broken
+    map<unsigned int, std::unique_ptr<CLogSealedSegment>> m_mLoaded;
+};
+
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+class CLogCompressJob : public CModuleJob {
+  public:
+    CLogCompressJob(CModule* pModule, const VCString& vsPaths)
+        : CModuleJob(pModule, "compress", "Compresses finished log files"),
+          m_vsPaths(vsPaths) {}
+
+    void runThread() override {
+        for (const CString& sPath : m_vsPaths) {
+            if (wasCancelled()) return;
+            uint64_t uIn, uOut;
+            if (CompressLog(sPath, uIn, uOut)) {
+                m_uFiles++;
+                m_uIn += uIn;
+                m_uOut += uOut;
+            }
+        }
+    }
+    void runMain() override;
+
+  private:
+    VCString m_vsPaths;
+    unsigned long long m_uFiles = 0;
+    unsigned long long m_uIn = 0;
+    unsigned long long m_uOut = 0;
+};
+#endif
+
 class CLogMod : public CModule {
   public:
+    enum EFsync { FsyncNever, FsyncClose, FsyncFlush };
+
     MODCONSTRUCTOR(CLogMod) {
         m_bSanitize = false;
         AddHelpCommand();
@@ -89,6 +1092,17 @@ class CLogMod : public CModule {
         AddCommand("ShowSettings", "",
                    t_d("Show current settings set by Set command"),
                    [=](const CString& sLine) { ShowSettingsCmd(sLine); });
+        AddCommand("Stats", "", t_d("Show how many syscalls logging takes"),
+                   [=](const CString& sLine) { StatsCmd(sLine); });
+        AddCommand("Search", t_d("<window> <terms> [since [until]]"),
+                   t_d("Search the indexed log of a window. Terms are words "
+                       "or nick:<nick>, times are YYYY-MM-DD or "
+                       "YYYY-MM-DDTHH:MM:SS"),
+                   [=](const CString& sLine) { SearchCmd(sLine); });
+        AddCommand("Play", t_d("<window> [YYYY-MM-DD [lines]]"),
+                   t_d("Show the end of the log of a window for a day, "
+                       "compressed or not"),
+                   [=](const CString& sLine) { PlayCmd(sLine); });
     }
 
     ~CLogMod() override;
@@ -102,6 +1116,9 @@ class CLogMod : public CModule {
     void ListRulesCmd(const CString& sLine = "");
     void SetCmd(const CString& sLine);
     void ShowSettingsCmd(const CString& sLine);
+    void StatsCmd(const CString& sLine);
+    void SearchCmd(const CString& sLine);
+    void PlayCmd(const CString& sLine);
 
     void SetRules(const VCString& vsRules);
     void SetMessageRules(const CString& sMsgRules);
@@ -159,7 +1176,7 @@ class CLogMod : public CModule {
     EModRet OnRaw(CString &sLine) override;
 
     /* logfile cache */
-    CFile& CacheLookup(const CString& filename);
+    CLogFile& CacheLookup(const CString& filename);
     void CacheNudge(const CString& filename);
     void CacheProcess(const CString& filename);
     void CacheKill(const CString& filename);
@@ -169,8 +1186,25 @@ class CLogMod : public CModule {
     void CacheProcessOne();
     void CacheProcessAll();
 
+    void FlushLog(CLogFile& LogFile);
+    void CloseLog(CLogFile& LogFile);
+    void FlushAll();
+
+    /* searchable log */
+    CString GetIndexDir(const CString& sWindow);
+    CLogIndex* GetIndex(const CString& sWindow, bool bCreate);
+
+    /* compressed logs */
+    CString GetWindowPath(const CString& sDayPath, const CString& sWindow);
+    bool SealLog(const CString& sPath);
+    void Compress(const CString& sPath);
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+    void StartCompressJob();
+#endif
+    void CompressFinished(unsigned long long uFiles, unsigned long long uIn,
+                          unsigned long long uOut);
+
     bool MatchesExtraLogging(const CString &sLine);
-    void LogDefrag(const CString &filename);
 
   private:
     bool NeedJoins() const;
@@ -185,11 +1219,75 @@ class CLogMod : public CModule {
     SCString m_ssMsgRules;
     VCString m_vsExtraRules;
 
-    CString              m_sLastDay;
-    map<CString, CFile*> m_LogCache;
-    map<CString, CFile*> m_ExpCache;
+    map<CString, CLogFile*> m_LogCache;
+    map<CString, CLogFile*> m_ExpCache;
+
+    // The current day of a timezone. Users of a global module can be in
+    // different ones. Formatting the time switches the timezone, so it's done
+    // once a second, unless the timestamp has fractions of a second.
+    struct SDay {
+        CString sPath;
+        time_t tFormatted = 0;
+        CString sStamp;
+        // User, network and window -> log file of sPath
+        MCString msWindowPaths;
+    };
+    map<CString, SDay> m_mDays;
+    bool m_bSubSecond = false;
+
+    unsigned int m_uFlushInterval = 1;
+    unsigned int m_uMaxOpenFiles = 8;
+    EFsync m_eFsync = FsyncNever;
+    unsigned int m_uOpenFiles = 0;
+    unsigned long long m_uUseCount = 0;
+
+    // Stats
+    unsigned long long m_uLines = 0;
+    unsigned long long m_uDirChecks = 0;
+    unsigned long long m_uOpens = 0;
+    unsigned long long m_uWrites = 0;
+    unsigned long long m_uSyncs = 0;
+    unsigned long long m_uCloses = 0;
+    unsigned long long m_uBytesWritten = 0;
+    unsigned long long m_uPreallocated = 0;
+    unsigned long long m_uReleased = 0;
+
+    // Window directory -> searchable log, if -index is given
+    bool m_bIndex = false;
+    map<CString, CLogIndex*> m_mIndexes;
+
+    // Log files of past days waiting to be compressed, if -compress is given
+    bool m_bCompress = false;
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+    VCString m_vsToCompress;
+    CLogCompressJob* m_pCompressJob = nullptr;
+#endif
+    unsigned long long m_uCompressedFiles = 0;
+    unsigned long long m_uCompressedIn = 0;
+    unsigned long long m_uCompressedOut = 0;
+};
+
+class CLogFlushTimer : public CTimer {
+  public:
+    CLogFlushTimer(CLogMod* pModule, unsigned int uInterval)
+        : CTimer(pModule, uInterval, 0, "Flush", "Writes buffered log lines") {
+    }
+
+  protected:
+    void RunJob() override { static_cast<CLogMod*>(m_pModule)->FlushAll(); }
 };
 
+// Whether the time format has fractions of a second, like %f or %6f
+static bool HasSubSecond(const CString& sFormat) {
+    for (CString::size_type i = 0; i < sFormat.length(); i++) {
+        if (sFormat[i] != '%') continue;
+        CString::size_type j = i + 1;
+        while (j < sFormat.length() && isdigit((unsigned char)sFormat[j])) j++;
+        if (j < sFormat.length() && sFormat[j] == 'f') return true;
+    }
+    return false;
+}
+
 void CLogMod::SetRulesCmd(const CString& sLine) {
     VCString vsRules = SplitRules(sLine.Token(1, true));
 
@@ -374,6 +1472,39 @@ bool CLogMod::NeedServerNotices() const {
     return !HasNV("snotices") || GetNV("snotices").ToBool();
 }
 
+void CLogMod::StatsCmd(const CString& sLine) {
+    unsigned long long uSyscalls = 2 * m_uDirChecks + m_uOpens + m_uWrites +
+                                   m_uSyncs + m_uCloses;
+    double dPerLine = m_uLines ? double(uSyscalls) / m_uLines : 0;
+
+    CTable Table;
+    Table.AddColumn(t_s("Stat", "stats"));
+    Table.AddColumn(t_s("Value", "stats"));
+    auto AddRow = [&](const CString& sStat, const CString& sValue) {
+        Table.AddRow();
+        Table.SetCell(t_s("Stat", "stats"), sStat);
+        Table.SetCell(t_s("Value", "stats"), sValue);
+    };
+    AddRow(t_s("Lines", "stats"), CString(m_uLines));
+    AddRow(t_s("Directory checks", "stats"), CString(m_uDirChecks));
+    AddRow(t_s("Opens", "stats"), CString(m_uOpens));
+    AddRow(t_s("Writes", "stats"), CString(m_uWrites));
+    AddRow(t_s("Fsyncs", "stats"), CString(m_uSyncs));
+    AddRow(t_s("Closes", "stats"), CString(m_uCloses));
+    AddRow(t_s("Bytes written", "stats"), CString(m_uBytesWritten));
+    AddRow(t_s("Bytes preallocated", "stats"), CString(m_uPreallocated));
+    AddRow(t_s("Unused preallocation released", "stats"),
+           CString(m_uReleased));
+    AddRow(t_s("Files compressed", "stats"), CString(m_uCompressedFiles));
+    AddRow(t_s("Bytes before compression", "stats"),
+           CString(m_uCompressedIn));
+    AddRow(t_s("Bytes after compression", "stats"), CString(m_uCompressedOut));
+    AddRow(t_s("Open files", "stats"),
+           CString(m_uOpenFiles) + "/" + CString(m_uMaxOpenFiles));
+    AddRow(t_s("Syscalls per line", "stats"), CString(dPerLine));
+    PutModule(Table);
+}
+
 void CLogMod::SetRules(const VCString& vsRules) {
     m_vRules.clear();
 
@@ -430,48 +1561,83 @@ void CLogMod::PutLog(const CString& sLine,
         return;
     }
 
-    CString sPath;
     timeval curtime;
 
     gettimeofday(&curtime, nullptr);
-    // Generate file name
-    sPath = CUtils::FormatTime(curtime, m_sLogPath, GetUser()->GetTimezone());
-    if (sPath.empty()) {
-        DEBUG("Could not format log path [" << sPath << "]");
-        return;
-    }
+    const CString& sTZ = GetUser()->GetTimezone();
+    SDay& Day = m_mDays[sTZ];
+    if (curtime.tv_sec != Day.tFormatted) {
+        // Generate file name
+        CString sPath = CUtils::FormatTime(curtime, m_sLogPath, sTZ);
+        if (sPath.empty()) {
+            DEBUG("Could not format log path [" << sPath << "]");
+            return;
+        }
+
+        if (sPath != Day.sPath) {
+            Day.sPath = sPath;
+            // That day is over, nobody writes to these anymore. Windows
+            // which only differ in case share a file.
+            SCString ssDone;
+            for (const auto& it : Day.msWindowPaths) ssDone.insert(it.second);
+            Day.msWindowPaths.clear();
+            for (const CString& sDone : ssDone) {
+                CacheKill(sDone);
+                if (m_bCompress) Compress(sDone);
+            }
+        }
 
-    if (sPath != m_sLastDay) {
-        m_sLastDay = sPath;
-        CacheKillAll();
+        Day.sStamp = CUtils::FormatTime(curtime, m_sTimestamp, sTZ);
+        Day.tFormatted = curtime.tv_sec;
     }
 
-    // TODO: Properly handle IRC case mapping
-    // $WINDOW has to be handled last, since it can contain %
-    sPath.Replace("$USER", GetUser() ? GetUser()->GetUserName() : "UNKNOWN");
-    sPath.Replace("$NETWORK", GetNetwork() ? GetNetwork()->GetName() : "znc");
-    sPath.Replace("$WINDOW", sWindow.Replace_n("/", "-")
-                                    .Replace_n("\\", "-").AsLower());
+    // A user module logs several networks, a global one several users
+    CString sKey = (GetUser() ? GetUser()->GetUserName() : "") + "/" +
+                   (GetNetwork() ? GetNetwork()->GetName() : "") + "/" +
+                   sWindow;
+    MCString::const_iterator itPath = Day.msWindowPaths.find(sKey);
+    if (itPath == Day.msWindowPaths.end()) {
+        CString sPath = GetWindowPath(Day.sPath, sWindow);
+
+        // Check if it's allowed to write in this specific path
+        if (sPath.empty()) {
+            DEBUG("Invalid log path [" << m_sLogPath << "].");
+            return;
+        }
 
-    // Check if it's allowed to write in this specific path
-    if (sPath.empty()) {
-        DEBUG("Invalid log path [" << m_sLogPath << "].");
-        return;
+        CFile File(sPath);
+        CString sLogDir = File.GetDir();
+        struct stat ModDirInfo;
+        CFile::GetInfo(GetSavePath(), ModDirInfo);
+        if (!CFile::Exists(sLogDir)) {
+            CDir::MakeDir(sLogDir, ModDirInfo.st_mode);
+        }
+        m_uDirChecks++;
+
+        itPath = Day.msWindowPaths.emplace(sKey, File.GetLongName()).first;
     }
 
     CacheProcessOne();
-    try {
-        CFile &LogFile = CacheLookup(sPath);
-        if (!LogFile.Open(O_WRONLY | O_APPEND | O_CREAT)) {
-            throw runtime_error("Could not open log file: " + sPath);
+    CLogFile& LogFile = CacheLookup(itPath->second);
+    const CString& sLogged = m_bSanitize ? sLine.StripControls_n() : sLine;
+    LogFile.m_sBuffer +=
+        (m_bSubSecond ? CUtils::FormatTime(curtime, m_sTimestamp, sTZ)
+                      : Day.sStamp) +
+        " " + sLogged + "\n";
+    LogFile.m_uLastUse = ++m_uUseCount;
+    m_uLines++;
+
+    if (!m_uFlushInterval || LogFile.m_sBuffer.size() >= 64 * 1024) {
+        FlushLog(LogFile);
+    }
+
+    if (m_bIndex) {
+        CLogIndex* pIndex = GetIndex(sWindow, true);
+        if (pIndex) {
+            pIndex->Add(curtime.tv_sec, LogLineNick(sLogged).AsLower(),
+                        sLogged);
+            if (!m_uFlushInterval) pIndex->Flush();
         }
-        LogFile.Write(CUtils::FormatTime(curtime, m_sTimestamp,
-                                         GetUser()->GetTimezone()) +
-                      " " + (m_bSanitize ? sLine.StripControls_n() : sLine) +
-                      "\n");
-        LogFile.Close();
-    } catch (exception &e) {
-        DEBUG("Could not open log file [" << sPath << "]: " << e.what());
     }
 }
 
@@ -498,16 +1664,51 @@ bool CLogMod::OnLoad(const CString& sArgs, CString& sMessage) {
     sArgs.QuoteSplit(vsArgs);
 
     bool bReadingTimestamp = false;
+    bool bReadingFlush = false;
+    bool bReadingMaxFiles = false;
+    bool bReadingFsync = false;
     bool bHaveLogPath = false;
 
     for (CString& sArg : vsArgs) {
         if (bReadingTimestamp) {
             m_sTimestamp = sArg;
             bReadingTimestamp = false;
+        } else if (bReadingFlush) {
+            m_uFlushInterval = sArg.ToUInt();
+            bReadingFlush = false;
+        } else if (bReadingMaxFiles) {
+            m_uMaxOpenFiles = std::max(sArg.ToUInt(), 1u);
+            bReadingMaxFiles = false;
+        } else if (bReadingFsync) {
+            if (sArg.Equals("never")) {
+                m_eFsync = FsyncNever;
+            } else if (sArg.Equals("close")) {
+                m_eFsync = FsyncClose;
+            } else if (sArg.Equals("flush")) {
+                m_eFsync = FsyncFlush;
+            } else {
+                sMessage = t_f("Invalid fsync policy [{1}]")(sArg);
+                return false;
+            }
+            bReadingFsync = false;
         } else if (sArg.Equals("-sanitize")) {
             m_bSanitize = true;
+        } else if (sArg.Equals("-index")) {
+            m_bIndex = true;
+        } else if (sArg.Equals("-compress")) {
+#ifndef HAVE_ZLIB
+            sMessage = t_s("Compressing logs needs ZNC built with zlib");
+            return false;
+#endif
+            m_bCompress = true;
         } else if (sArg.Equals("-timestamp")) {
             bReadingTimestamp = true;
+        } else if (sArg.Equals("-flush")) {
+            bReadingFlush = true;
+        } else if (sArg.Equals("-maxfiles")) {
+            bReadingMaxFiles = true;
+        } else if (sArg.Equals("-fsync")) {
+            bReadingFsync = true;
         } else {
             // Only one arg may be LogPath
             if (bHaveLogPath) {
@@ -524,6 +1725,11 @@ bool CLogMod::OnLoad(const CString& sArgs, CString& sMessage) {
     if (m_sTimestamp.empty()) {
         m_sTimestamp = "[%H:%M:%S]";
     }
+    m_bSubSecond = HasSubSecond(m_sTimestamp);
+
+    if (m_uFlushInterval) {
+        AddTimer(new CLogFlushTimer(this, m_uFlushInterval));
+    }
 
     // Add default filename to path if it's a folder
     if (GetType() == CModInfo::UserModule) {
@@ -752,61 +1958,41 @@ CModule::EModRet CLogMod::OnChanMsg(CNick& Nick, CChan& Channel,
     return CONTINUE;
 }
 
-CFile &CLogMod::CacheLookup(const CString &filename) {
-    CFile new_file(filename);
-    CString full_name = new_file.GetLongName();
-
-    CString sLogDir = new_file.GetDir();
-    struct stat ModDirInfo;
-    CFile::GetInfo(GetSavePath(), ModDirInfo);
-    if (!CFile::Exists(sLogDir)) CDir::MakeDir(sLogDir, ModDirInfo.st_mode);
-
-    if (m_LogCache.find(full_name) != m_LogCache.end()) {}
-    else if (m_ExpCache.find(full_name) != m_ExpCache.end()) {
-        m_LogCache[full_name] = m_ExpCache[full_name];
+CLogFile &CLogMod::CacheLookup(const CString &filename) {
+    if (m_LogCache.find(filename) != m_LogCache.end()) {}
+    else if (m_ExpCache.find(filename) != m_ExpCache.end()) {
+        m_LogCache[filename] = m_ExpCache[filename];
     } else {
-        CFile *cf = NULL;
-        try {
-            cf = new CFile(new_file);
-            m_LogCache[full_name] = cf;
-        } catch (exception &e) {
-            m_LogCache.erase(full_name);
-            if (cf) delete cf;
-            throw;
-        }
+        m_LogCache[filename] = new CLogFile(filename);
     }
-    return *m_LogCache[full_name];
+    return *m_LogCache[filename];
 }
 
 void CLogMod::CacheNudge(const CString &filename) {
-    CFile new_file(filename);
-    CString full_name = new_file.GetLongName();
-    if (m_LogCache.find(full_name) != m_LogCache.end()) {
-        m_ExpCache[full_name] = m_LogCache[full_name];
+    if (m_LogCache.find(filename) != m_LogCache.end()) {
+        m_ExpCache[filename] = m_LogCache[filename];
     }
     return;
 }
 
 void CLogMod::CacheKill(const CString &filename) {
-    CFile new_file(filename);
-    CString full_name = new_file.GetLongName();
-    if (m_LogCache.find(full_name) != m_LogCache.end()) {
-        m_ExpCache[full_name] = m_LogCache[full_name];
-        m_LogCache.erase(full_name);
+    if (m_LogCache.find(filename) != m_LogCache.end()) {
+        CloseLog(*m_LogCache[filename]);
+        m_ExpCache[filename] = m_LogCache[filename];
+        m_LogCache.erase(filename);
     }
     return;
 }
 
 void CLogMod::CacheProcess(const CString &filename)
 {
-    CFile new_file(filename);
-    CString full_name = new_file.GetLongName();
-    if (m_ExpCache.find(full_name) != m_ExpCache.end()) {
-        LogDefrag(full_name);
-        if (m_LogCache.find(full_name) == m_LogCache.end()) {
-            delete m_ExpCache[full_name];
+    if (m_ExpCache.find(filename) != m_ExpCache.end()) {
+        CLogFile* pLogFile = m_ExpCache[filename];
+        m_ExpCache.erase(filename);
+        CloseLog(*pLogFile);
+        if (m_LogCache.find(filename) == m_LogCache.end()) {
+            delete pLogFile;
         }
-        m_ExpCache.erase(full_name);
     }
     return;
 }
@@ -818,6 +2004,9 @@ void CLogMod::CacheNudgeAll()
 
 void CLogMod::CacheKillAll()
 {
+    for (const auto& it : m_LogCache) {
+        CloseLog(*it.second);
+    }
     CacheNudgeAll();
     m_LogCache.clear();
 }
@@ -832,16 +2021,327 @@ void CLogMod::CacheProcessAll()
     while (!m_ExpCache.empty()) CacheProcess(m_ExpCache.begin()->first);
 }
 
-void CLogMod::LogDefrag(const CString &filename)
-{
-    CString newfilename(filename + ".new");
-    if (!CFile::Copy(filename, newfilename, true)) {
-        PutModule("Log defragment failed: copy! (" + filename + ")");
-    } else if (!CFile::Move(newfilename, filename, true)) {
-        PutModule("Log defragment failed: move! (" + filename + ")");
+void CLogMod::FlushLog(CLogFile& LogFile) {
+    if (LogFile.m_sBuffer.empty()) return;
+
+    CFile& File = LogFile.m_File;
+    if (!File.IsOpen()) {
+        if (m_uOpenFiles >= m_uMaxOpenFiles) {
+            // Make room by closing the least recently used file
+            CLogFile* pOldest = nullptr;
+            for (const auto& it : m_LogCache) {
+                CLogFile* pEach = it.second;
+                if (pEach->m_File.IsOpen() &&
+                    (!pOldest || pEach->m_uLastUse < pOldest->m_uLastUse)) {
+                    pOldest = pEach;
+                }
+            }
+            if (pOldest) CloseLog(*pOldest);
+        }
+
+        m_uOpens++;
+        if (!File.Open(O_WRONLY | O_APPEND | O_CREAT)) {
+            DEBUG("Could not open log file [" << File.GetLongName()
+                                              << "]: " << strerror(errno));
+            LogFile.m_sBuffer.clear();
+            return;
+        }
+        m_uOpenFiles++;
+        LogFile.m_uSize = File.GetSize();
+        LogFile.m_uReserved = LogFile.m_uSize;
+    }
+
+    off_t uEnd = LogFile.m_uSize + LogFile.m_sBuffer.size();
+    if (LogFile.m_bPreallocate && uEnd > LogFile.m_uReserved) {
+        off_t uChunk = std::min<off_t>(
+            std::max<off_t>(uEnd, LOG_PREALLOCATE_MIN), LOG_PREALLOCATE_MAX);
+        if (File.Preallocate(LogFile.m_uSize,
+                             uEnd + uChunk - LogFile.m_uSize)) {
+            m_uPreallocated += uEnd + uChunk - LogFile.m_uReserved;
+            LogFile.m_uReserved = uEnd + uChunk;
+        } else {
+            // Not supported here, don't try again for this file
+            LogFile.m_bPreallocate = false;
+        }
+    }
+
+    m_uWrites++;
+    ssize_t iWritten = File.Write(LogFile.m_sBuffer);
+    if (iWritten > 0) {
+        LogFile.m_uSize += iWritten;
+        m_uBytesWritten += iWritten;
+    }
+    LogFile.m_sBuffer.clear();
+
+    if (m_eFsync == FsyncFlush) {
+        m_uSyncs++;
+        File.Sync();
     }
 }
 
+void CLogMod::CloseLog(CLogFile& LogFile) {
+    FlushLog(LogFile);
+
+    CFile& File = LogFile.m_File;
+    if (!File.IsOpen()) return;
+
+    if (LogFile.m_uReserved > LogFile.m_uSize) {
+        // Give back the space which wasn't used. Somebody else may have
+        // appended to the file, so the real size is what counts.
+        struct stat st;
+        if (fstat(File.GetFD(), &st) == 0 && File.Truncate(st.st_size)) {
+            m_uReleased += LogFile.m_uReserved - LogFile.m_uSize;
+        }
+        LogFile.m_uReserved = 0;
+    }
+
+    if (m_eFsync == FsyncClose) {
+        m_uSyncs++;
+        File.Sync();
+    }
+    m_uCloses++;
+    File.Close();
+    m_uOpenFiles--;
+}
+
+void CLogMod::FlushAll() {
+    for (const auto& it : m_LogCache) {
+        FlushLog(*it.second);
+    }
+    for (const auto& it : m_mIndexes) {
+        it.second->Flush();
+    }
+}
+
+CString CLogMod::GetIndexDir(const CString& sWindow) {
+    CString sName = sWindow.Replace_n("/", "-").Replace_n("\\", "-").AsLower();
+    if (sName.empty() || sName == "." || sName == "..") return "";
+
+    CString sDir = GetSavePath() + "/index/";
+    if (GetType() == CModInfo::GlobalModule) {
+        sDir += (GetUser() ? GetUser()->GetUserName() : "UNKNOWN") + "/";
+    }
+    if (GetType() != CModInfo::NetworkModule) {
+        sDir += (GetNetwork() ? GetNetwork()->GetName() : "znc") + "/";
+    }
+    return sDir + sName;
+}
+
+CLogIndex* CLogMod::GetIndex(const CString& sWindow, bool bCreate) {
+    CString sDir = GetIndexDir(sWindow);
+    if (sDir.empty()) return nullptr;
+
+    auto it = m_mIndexes.find(sDir);
+    if (it == m_mIndexes.end()) {
+        if (!bCreate && !CFile::Exists(sDir)) return nullptr;
+        if (!CFile::Exists(CFile(sDir).GetDir())) {
+            struct stat ModDirInfo;
+            CFile::GetInfo(GetSavePath(), ModDirInfo);
+            CDir::MakeDir(CFile(sDir).GetDir(), ModDirInfo.st_mode);
+        }
+
+        if (m_mIndexes.size() >= LOG_INDEX_MAX_OPEN) {
+            // Make room by closing the least recently used one
+            auto itOldest = m_mIndexes.begin();
+            for (auto itEach = m_mIndexes.begin(); itEach != m_mIndexes.end();
+                 ++itEach) {
+                if (itEach->second->m_uLastUse < itOldest->second->m_uLastUse) {
+                    itOldest = itEach;
+                }
+            }
+            delete itOldest->second;
+            m_mIndexes.erase(itOldest);
+        }
+
+        CLogIndex* pIndex = new CLogIndex(
+            sDir, [=](const CString& sPath) {
+                if (m_bCompress) Compress(sPath);
+            });
+        if (!pIndex->Open()) {
+            DEBUG("Could not open log index [" << sDir
+                                               << "]: " << strerror(errno));
+            delete pIndex;
+            return nullptr;
+        }
+        it = m_mIndexes.emplace(sDir, pIndex).first;
+    }
+    it->second->m_uLastUse = ++m_uUseCount;
+    return it->second;
+}
+
+void CLogMod::SearchCmd(const CString& sLine) {
+    if (!m_bIndex) {
+        PutModule(t_s("Searching needs the module to be loaded with -index"));
+        return;
+    }
+
+    CString sWindow = sLine.Token(1);
+    VCString vsArgs;
+    sLine.Token(2, true).Split(" ", vsArgs, false);
+
+    // The times come last
+    const CString& sTZ = GetUser()->GetTimezone();
+    time_t tSince = 0;
+    time_t tUntil = std::numeric_limits<time_t>::max();
+    time_t tFirst, tSecond;
+    size_t uArgs = vsArgs.size();
+    if (uArgs >= 2 && ParseLogTime(vsArgs[uArgs - 2], sTZ, false, tFirst) &&
+        ParseLogTime(vsArgs[uArgs - 1], sTZ, true, tSecond)) {
+        tSince = tFirst;
+        tUntil = tSecond;
+        vsArgs.resize(uArgs - 2);
+    } else if (uArgs >= 1 &&
+               ParseLogTime(vsArgs[uArgs - 1], sTZ, false, tFirst)) {
+        tSince = tFirst;
+        vsArgs.resize(uArgs - 1);
+    }
+
+    SCString ssTokens, ssNicks;
+    for (const CString& sArg : vsArgs) {
+        CString sNick = sArg;
+        if (sNick.TrimPrefix("nick:")) {
+            if (!sNick.empty()) ssNicks.insert(sNick.AsLower());
+        } else {
+            LogTokens(sArg, ssTokens);
+        }
+    }
+    if (sWindow.empty() || (ssTokens.empty() && ssNicks.empty())) {
+        PutModule(t_s("Usage: Search <window> <terms> [since [until]]"));
+        return;
+    }
+
+    CLogIndex* pIndex = GetIndex(sWindow, false);
+    if (!pIndex) {
+        PutModule(t_f("Nothing is logged for {1}")(sWindow));
+        return;
+    }
+
+    unsigned long long uStart = CUtils::GetMillTime();
+    vector<CLogIndex::SMatch> vMatches;
+    bool bMore = pIndex->Search(ssTokens, ssNicks, tSince, tUntil,
+                                LOG_SEARCH_MAX_RESULTS, vMatches);
+    unsigned long long uMillis = CUtils::GetMillTime() - uStart;
+
+    for (auto it = vMatches.rbegin(); it != vMatches.rend(); ++it) {
+        PutModule(CUtils::FormatTime(it->tTime, "%Y-%m-%d %H:%M:%S", sTZ) +
+                  " " + it->sLine);
+    }
+    if (bMore) {
+        PutModule(t_f("Showing the newest {1} matches, found in {2} ms")(
+            vMatches.size(), uMillis));
+    } else {
+        PutModule(t_p("1 match found in {2} ms", "{1} matches found in {2} ms",
+                      vMatches.size())(vMatches.size(), uMillis));
+    }
+}
+
+void CLogMod::PlayCmd(const CString& sLine) {
+    CString sWindow = sLine.Token(1);
+    CString sDay = sLine.Token(2);
+    unsigned int uLines =
+        sLine.Token(3).empty() ? 50 : sLine.Token(3).ToUInt();
+    const CString& sTZ = GetUser()->GetTimezone();
+    time_t tDay = time(nullptr);
+    if (sWindow.empty() || !uLines ||
+        (!sDay.empty() && !ParseLogTime(sDay, sTZ, false, tDay))) {
+        PutModule(t_s("Usage: Play <window> [YYYY-MM-DD [lines]]"));
+        return;
+    }
+    uLines = std::min(uLines, (unsigned int)LOG_PLAY_MAX_LINES);
+    sDay = CUtils::FormatTime(tDay, "%Y-%m-%d", sTZ);
+
+    CString sPath = CDir::CheckPathPrefix(
+        GetSavePath(),
+        GetWindowPath(CUtils::FormatTime(tDay, m_sLogPath, sTZ), sWindow));
+    // Lines of today may be buffered still
+    FlushAll();
+
+    CLogReader Reader;
+    CString sData;
+    if (sPath.empty() || !Reader.Open(sPath) || !Reader.ReadAll(sData)) {
+        PutModule(t_f("Nothing is logged for {1} on {2}")(sWindow, sDay));
+        return;
+    }
+
+    VCString vsLines;
+    sData.Split("\n", vsLines, false);
+    size_t uStart = vsLines.size() > uLines ? vsLines.size() - uLines : 0;
+    for (size_t i = uStart; i < vsLines.size(); ++i) {
+        PutModule(vsLines[i]);
+    }
+    PutModule(t_f("End of {1} on {2}")(sWindow, sDay));
+}
+
+CString CLogMod::GetWindowPath(const CString& sDayPath,
+                               const CString& sWindow) {
+    CString sPath = sDayPath;
+    // TODO: Properly handle IRC case mapping
+    // $WINDOW has to be handled last, since it can contain %
+    sPath.Replace("$USER", GetUser() ? GetUser()->GetUserName() : "UNKNOWN");
+    sPath.Replace("$NETWORK", GetNetwork() ? GetNetwork()->GetName() : "znc");
+    sPath.Replace("$WINDOW", sWindow.Replace_n("/", "-")
+                                 .Replace_n("\\", "-").AsLower());
+    return sPath;
+}
+
+bool CLogMod::SealLog(const CString& sPath) {
+    // Left over from an unload before it was compressed
+    if (CFile::Exists(sPath + LOG_SEALED_EXT)) return true;
+    // If that day is logged to again, it goes to a new file
+    CacheKill(sPath);
+    return CFile::Exists(sPath) && CFile::Move(sPath, sPath + LOG_SEALED_EXT);
+}
+
+void CLogMod::Compress(const CString& sPath) {
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+    // One job at a time, the next one takes what piled up meanwhile
+    m_vsToCompress.push_back(sPath);
+    if (!m_pCompressJob) StartCompressJob();
+#elif defined(HAVE_ZLIB)
+    uint64_t uIn, uOut;
+    while (SealLog(sPath) && CompressLog(sPath, uIn, uOut)) {
+        CompressFinished(1, uIn, uOut);
+    }
+#endif
+}
+
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+void CLogMod::StartCompressJob() {
+    // The files are sealed here rather than when they're queued, since only
+    // one .sealed file of a day can wait at a time
+    VCString vsPaths, vsLater;
+    for (const CString& sPath : m_vsToCompress) {
+        bool bLeftover = CFile::Exists(sPath + LOG_SEALED_EXT);
+        if (!SealLog(sPath)) continue;
+        vsPaths.push_back(sPath);
+        if (bLeftover && CFile::Exists(sPath)) vsLater.push_back(sPath);
+    }
+    m_vsToCompress = vsLater;
+    if (vsPaths.empty()) return;
+    m_pCompressJob = new CLogCompressJob(this, vsPaths);
+    AddJob(m_pCompressJob);
+}
+#endif
+
+void CLogMod::CompressFinished(unsigned long long uFiles,
+                               unsigned long long uIn,
+                               unsigned long long uOut) {
+    m_uCompressedFiles += uFiles;
+    m_uCompressedIn += uIn;
+    m_uCompressedOut += uOut;
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+    m_pCompressJob = nullptr;
+    if (!m_vsToCompress.empty()) StartCompressJob();
+#endif
+}
+
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+void CLogCompressJob::runMain() {
+    static_cast<CLogMod*>(GetModule())
+        ->CompressFinished(m_uFiles, m_uIn, m_uOut);
+}
+#endif
+
 bool CLogMod::MatchesExtraLogging(const CString &sLine)
 {
     CString messageType(
@@ -868,8 +2368,15 @@ CModule::EModRet CLogMod::OnRaw(CString &sLine)
 }
 
 CLogMod::~CLogMod() {
+#if defined(HAVE_ZLIB) && defined(HAVE_PTHREAD)
+    // What's left stays uncompressed
+    CancelJob(m_pCompressJob);
+#endif
     CacheKillAll();
     CacheProcessAll();
+    for (const auto& it : m_mIndexes) {
+        delete it.second;
+    }
 }
 
 template <>
@@ -878,7 +2385,10 @@ void TModInfo<CLogMod>(CModInfo& Info) {
     Info.AddType(CModInfo::GlobalModule);
     Info.SetHasArgs(true);
     Info.SetArgsHelpText(
-        Info.t_s("[-sanitize] Optional path where to store logs."));
+        Info.t_s("[-sanitize] [-index] [-compress] [-timestamp <format>] "
+                 "[-flush <seconds, 0 writes every line>] [-maxfiles <open "
+                 "files>] [-fsync never|close|flush] Optional path where to "
+                 "store logs."));
     Info.SetWikiPage("log");
 }
 
@@ -278,6 +278,82 @@ class CModPerl : public CModule {
 
 #include "modperl/perlfunctions.cpp"
 
+void CPerlModule::DetectPerlHooks() {
+    const size_t uHooks = sizeof(apszPerlHooks) / sizeof(apszPerlHooks[0]);
+    std::vector<bool> vbHooks(uHooks, true);
+    auto Overrides = [&](const char* szHook, bool& bResult) {
+        PSTART;
+        XPUSHs(GetPerlObj());
+        PUSH_STR(szHook);
+        PCALL("ZNC::Core::HasHook");
+        bool bFailed = SvTRUE(ERRSV);
+        if (bFailed) {
+            DEBUG("modperl: can't detect hooks of " << GetModName() << ": "
+                                                     << PString(ERRSV));
+        } else {
+            bResult = SvTRUE(ST(0));
+        }
+        PEND;
+        return !bFailed;
+    };
+    for (size_t i = 0; i < uHooks; ++i) {
+        bool bHook = false;
+        if (!Overrides(apszPerlHooks[i], bHook)) return;
+        // The default calls the other hook, which the module may have
+        if (!bHook && apszPerlHookFallbacks[i] &&
+            !Overrides(apszPerlHookFallbacks[i], bHook)) {
+            return;
+        }
+        vbHooks[i] = bHook;
+    }
+    m_vbPerlHooks = vbHooks;
+
+    // Outgoing lines aren't parsed for scripts which don't handle them
+    auto HasHook = [&](const char* szHook) -> bool {
+        for (size_t i = 0; i < uHooks; ++i) {
+            if (strcmp(apszPerlHooks[i], szHook) == 0) return vbHooks[i];
+        }
+        return true;
+    };
+    SetWantsSendToIRC(HasHook("OnSendToIRCMessage"), HasHook("OnSendToIRC"));
+}
+
+void CPerlModule::SetEventBatching(unsigned int uIntervalMs,
+                                   unsigned int uMaxEvents) {
+    m_EventBatch.Enable(uIntervalMs, uMaxEvents);
+}
+
+void CPerlModule::DisableEventBatching() { m_EventBatch.Disable(); }
+
+void CPerlModule::FlushEventBatch() { m_EventBatch.Flush(); }
+
+void CPerlModule::DeliverEventBatch(
+    const std::vector<CEventBatch::SEvent>& vEvents) {
+    AV* pEvents = newAV();
+    av_extend(pEvents, vEvents.size());
+    for (const CEventBatch::SEvent& Event : vEvents) {
+        AV* pEvent = newAV();
+        av_push(pEvent, PString(Event.sType).GetSV(false));
+        av_push(pEvent, PString(Event.sNetwork).GetSV(false));
+        av_push(pEvent, PString(Event.sTarget).GetSV(false));
+        av_push(pEvent, PString(Event.sNick).GetSV(false));
+        av_push(pEvent, PString(Event.sText).GetSV(false));
+        av_push(pEvent, newSVnv(Event.dTime));
+        av_push(pEvents, newRV_noinc((SV*)pEvent));
+    }
+
+    PSTART;
+    XPUSHs(GetPerlObj());
+    PUSH_STR("OnEventBatch");
+    XPUSHs(sv_2mortal(newRV_noinc((SV*)pEvents)));
+    PCALL("ZNC::Core::CallModFunc");
+    if (SvTRUE(ERRSV)) {
+        DEBUG("modperl: " << GetModName()
+                          << "/OnEventBatch died with: " << PString(ERRSV));
+    }
+    PEND;
+}
+
 VWebSubPages& CPerlModule::GetSubPages() {
     VWebSubPages* result = _GetSubPages();
     if (!result) {
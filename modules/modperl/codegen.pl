@@ -71,8 +71,13 @@ namespace {
 
 EOF
 
+my @hooks;
+# What CModule's default of a hook calls instead, given as "->OnHook"
+my @fallbacks;
+# Hooks which see the traffic collected by SetEventBatching()
+my %batched = map { $_ => 1 } qw(OnRawMessage OnUserRawMessage);
 while (<$in>) {
-	my ($type, $name, $args, $default) = /(\S+)\s+(\w+)\((.*)\)(?:=(\w+))?/ or next;
+	my ($type, $name, $args, $default, $fallback) = /(\S+)\s+(\w+)\((.*)\)(?:=(\w+))?(?:\s*->(\w+))?/ or next;
 	$type =~ s/(EModRet)/CModule::$1/;
 	$type =~ s/^\s*(.*?)\s*$/$1/;
 	my @arg = map {
@@ -81,10 +86,17 @@ while (<$in>) {
 		my ($tt, $tm) = $t =~ /^(.*?)\s*?(\*|&)?$/;
 		{type=>$t, var=>$v, base=>$tt, mod=>$tm//''}
 	} split /,/, $args;
-	unless (defined $default) {
-		$default = "CModule::$name(" . (join ', ', map { $_->{var} } @arg) . ")";
-	}
+	# What CModule does when nobody overrides the hook. _GetSubPages() is
+	# ours, not CModule's.
+	my $base = "CModule::$name(" . (join ', ', map { $_->{var} } @arg) . ")";
+	$base = $default if $name =~ /^_/;
+	$default //= $base;
 	say $out "$type CPerlModule::$name($args) {";
+	say $out "\tif (m_EventBatch.IsEnabled()) m_EventBatch.Add($arg[0]{var});" if $batched{$name};
+	# Nothing to call if the perl module doesn't have its own $name
+	say $out "\tif (!HasPerlHook(".scalar(@hooks).")) return $base;";
+	push @hooks, $name;
+	push @fallbacks, $fallback;
 	say $out "\t$type result{};" if $type ne 'void';
 	say $out "\tPSTART_IDF($name);";
 	for my $a (@arg) {
@@ -120,6 +132,17 @@ while (<$in>) {
 	say $out "}\n";
 }
 
+say $out "namespace {";
+say $out "\t// Hook names by their index in HasPerlHook()";
+say $out "\tconst char* const apszPerlHooks[] = {";
+say $out "\t\t\"$_\"," for @hooks;
+say $out "\t};";
+say $out "\t// What the default of each hook calls, if anything";
+say $out "\tconst char* const apszPerlHookFallbacks[] = {";
+say $out "\t\t", (defined $_ ? "\"$_\"" : "nullptr"), "," for @fallbacks;
+say $out "\t};";
+say $out "}";
+
 sub sv {
 	my $type = shift;
 	given ($type) {
@@ -21,19 +21,49 @@
 #include <XSUB.h>
 
 #include <znc/Modules.h>
+#include "../eventbatch.h"
 
 class ZNC_EXPORT_LIB_EXPORT CPerlModule : public CModule {
     SV* m_perlObj;
+    // Which hooks the perl module has, empty if not known yet
+    std::vector<bool> m_vbPerlHooks;
     VWebSubPages* _GetSubPages();
 
+    bool HasPerlHook(size_t uHook) const {
+        return uHook >= m_vbPerlHooks.size() || m_vbPerlHooks[uHook];
+    }
+
+    // Events waiting for OnEventBatch(), see SetEventBatching()
+    CEventBatch m_EventBatch;
+    void DeliverEventBatch(const std::vector<CEventBatch::SEvent>& vEvents);
+
   public:
     CPerlModule(CUser* pUser, CIRCNetwork* pNetwork, const CString& sModName,
                 const CString& sDataPath, CModInfo::EModuleType eType,
                 SV* perlObj)
-        : CModule(nullptr, pUser, pNetwork, sModName, sDataPath, eType) {
+        : CModule(nullptr, pUser, pNetwork, sModName, sDataPath, eType),
+          m_EventBatch(this,
+                       [this](const std::vector<CEventBatch::SEvent>& vEvents) {
+                           DeliverEventBatch(vEvents);
+                       }) {
         m_perlObj = newSVsv(perlObj);
     }
     SV* GetPerlObj() { return sv_2mortal(newSVsv(m_perlObj)); }
+    /// Find out which hooks the perl module doesn't override, so calling
+    /// them can be skipped.
+    void DetectPerlHooks();
+
+    /// Also deliver the IRC traffic of this module's user or network to
+    /// OnEventBatch(), as an array of plain arrays
+    /// [type, network, target, nick, text, time], instead of only to the
+    /// individual hooks. A batch is delivered uIntervalMs after its first
+    /// event, or right away once it has uMaxEvents events. An interval of 0
+    /// delivers on the next turn of the event loop.
+    void SetEventBatching(unsigned int uIntervalMs,
+                          unsigned int uMaxEvents = 1000);
+    void DisableEventBatching();
+    /// Delivers the pending events now.
+    void FlushEventBatch();
 
     bool OnBoot() override;
     bool WebRequiresLogin() override;
@@ -150,6 +150,7 @@ sub LoadModule {
 	tie %nv, 'ZNC::ModuleNV', $cmod;
 	$pmod->{_cmod} = $cmod;
 	$pmod->{_nv} = \%nv;
+	$cmod->DetectPerlHooks;
 	$cmod->SetDescription($pmod->description);
 	$cmod->SetArgs($args);
 	$cmod->SetModPath($modpath);
@@ -226,6 +227,15 @@ sub CallModFunc {
 	(defined $res, $res//0, @arg)
 }
 
+# Whether the module overrides the hook of ZNC::Module. What the default calls
+# instead comes from functions.in, see CPerlModule::DetectPerlHooks().
+sub HasHook {
+	my ($pmod, $hook) = @_;
+	my $own = $pmod->can($hook) // 0;
+	my $default = ZNC::Module->can($hook) // 0;
+	return $own != $default ? 1 : 0;
+}
+
 sub CallTimer {
 	my $timer = shift;
 	$timer->RunJob;
@@ -591,6 +601,10 @@ sub OnTopicMessage {
 sub OnSendToClientMessage {}
 sub OnSendToIRCMessage {}
 
+# Gets an array ref of [type, network, target, nick, text, time] array refs,
+# after $self->SetEventBatching($interval_ms, $max_events)
+sub OnEventBatch {}
+
 # In Perl "undefined" is allowed value, so perl modules may continue using OnMode and not OnMode2
 sub OnChanPermission2 { my $self = shift; $self->OnChanPermission(@_) }
 sub OnOp2 { my $self = shift; $self->OnOp(@_) }
@@ -28,9 +28,54 @@
 #include "modpython/module.h"
 #include "modpython/ret.h"
 
+#include <chrono>
+
 using std::vector;
 using std::set;
 
+/// Holds the GIL while C++ code calls into python.
+///
+/// Without python jobs in the thread pool, the main thread just keeps the
+/// GIL all the time, and this is cheap. While there are some, the main
+/// thread gives the GIL away whenever it goes back to the event loop, so
+/// that the jobs can run.
+class CPyGIL {
+  public:
+    CPyGIL() : m_eState(PyGILState_Ensure()) { ++s_uDepth; }
+    ~CPyGIL() {
+        PyGILState_Release(m_eState);
+        if (--s_uDepth == 0) Handoff();
+    }
+
+    CPyGIL(const CPyGIL&) = delete;
+    CPyGIL& operator=(const CPyGIL&) = delete;
+
+    static void JobStarted() { ++s_uJobs; }
+    static void JobFinished() { --s_uJobs; }
+
+  private:
+    static void Handoff() {
+        if (s_uJobs && !s_pMainThread) {
+            s_pMainThread = PyEval_SaveThread();
+        } else if (!s_uJobs && s_pMainThread) {
+            PyEval_RestoreThread(s_pMainThread);
+            s_pMainThread = nullptr;
+        }
+    }
+
+    PyGILState_STATE m_eState;
+    // Nesting of CPyGIL in the main thread; threads don't use this class
+    static unsigned int s_uDepth;
+    // Python jobs in the thread pool
+    static unsigned int s_uJobs;
+    // Set while the main thread has given the GIL away
+    static PyThreadState* s_pMainThread;
+};
+
+unsigned int CPyGIL::s_uDepth = 0;
+unsigned int CPyGIL::s_uJobs = 0;
+PyThreadState* CPyGIL::s_pMainThread = nullptr;
+
 class CModPython : public CModule {
     PyObject* m_PyZNCModule;
     PyObject* m_PyFormatException;
@@ -84,11 +129,15 @@ class CModPython : public CModule {
     MODCONSTRUCTOR(CModPython) {
         CZNC::Get().ForceEncoding();
         Py_Initialize();
+#if PY_VERSION_HEX < 0x03070000
+        PyEval_InitThreads();
+#endif
         m_PyFormatException = nullptr;
         m_PyZNCModule = nullptr;
     }
 
     bool OnLoad(const CString& sArgsi, CString& sMessage) override {
+        CPyGIL GIL;
         CString sModPath, sTmp;
 #ifdef __CYGWIN__
         CString sDllPath = "modpython/_znc_core.dll";
@@ -150,6 +199,7 @@ class CModPython : public CModule {
     EModRet OnModuleLoading(const CString& sModName, const CString& sArgs,
                             CModInfo::EModuleType eType, bool& bSuccess,
                             CString& sRetMsg) override {
+        CPyGIL GIL;
         PyObject* pyFunc = PyObject_GetAttrString(m_PyZNCModule, "load_module");
         if (!pyFunc) {
             sRetMsg = GetPyExceptionStr();
@@ -208,6 +258,7 @@ class CModPython : public CModule {
                               CString& sRetMsg) override {
         CPyModule* pMod = AsPyModule(pModule);
         if (pMod) {
+            CPyGIL GIL;
             CString sModName = pMod->GetModName();
             PyObject* pyFunc =
                 PyObject_GetAttrString(m_PyZNCModule, "unload_module");
@@ -242,6 +293,7 @@ class CModPython : public CModule {
 
     EModRet OnGetModInfo(CModInfo& ModInfo, const CString& sModule,
                          bool& bSuccess, CString& sRetMsg) override {
+        CPyGIL GIL;
         PyObject* pyFunc =
             PyObject_GetAttrString(m_PyZNCModule, "get_mod_info");
         if (!pyFunc) {
@@ -294,6 +346,7 @@ class CModPython : public CModule {
         if (ssAlready.count(sName)) {
             return;
         }
+        CPyGIL GIL;
         PyObject* pyFunc =
             PyObject_GetAttrString(m_PyZNCModule, "get_mod_info_path");
         if (!pyFunc) {
@@ -368,21 +421,28 @@ class CModPython : public CModule {
                 "initialize python");
             return;
         }
-        PyObject* pyFunc = PyObject_GetAttrString(m_PyZNCModule, "unload_all");
-        if (!pyFunc) {
-            CString sRetMsg = GetPyExceptionStr();
-            DEBUG("~CModPython(): couldn't find unload_all: " << sRetMsg);
-            return;
-        }
-        PyObject* pyRes = PyObject_CallFunctionObjArgs(pyFunc, nullptr);
-        if (!pyRes) {
-            CString sRetMsg = GetPyExceptionStr();
-            DEBUG(
-                "modpython tried to unload all modules in its destructor, but: "
-                << sRetMsg);
+        {
+            // Unloading the modules cancels their jobs, so afterwards the
+            // main thread has the GIL for good
+            CPyGIL GIL;
+            PyObject* pyFunc =
+                PyObject_GetAttrString(m_PyZNCModule, "unload_all");
+            if (!pyFunc) {
+                CString sRetMsg = GetPyExceptionStr();
+                DEBUG("~CModPython(): couldn't find unload_all: " << sRetMsg);
+                return;
+            }
+            PyObject* pyRes = PyObject_CallFunctionObjArgs(pyFunc, nullptr);
+            if (!pyRes) {
+                CString sRetMsg = GetPyExceptionStr();
+                DEBUG(
+                    "modpython tried to unload all modules in its destructor, "
+                    "but: "
+                    << sRetMsg);
+            }
+            Py_CLEAR(pyRes);
+            Py_CLEAR(pyFunc);
         }
-        Py_CLEAR(pyRes);
-        Py_CLEAR(pyFunc);
 
         Py_CLEAR(m_PyFormatException);
         Py_CLEAR(m_PyZNCModule);
@@ -395,8 +455,215 @@ CString CPyModule::GetPyExceptionStr() {
     return m_pModPython->GetPyExceptionStr();
 }
 
+#ifdef HAVE_PTHREAD
+class CPyJob : public CModuleJob {
+  public:
+    CPyJob(CPyModule* pModule, PyObject* pyFunc, PyObject* pyDone)
+        : CModuleJob(pModule, "python", "Runs a python function"),
+          m_pyFunc(pyFunc),
+          m_pyDone(pyDone) {
+        Py_INCREF(pyFunc);
+        Py_INCREF(pyDone);
+    }
+    ~CPyJob() override {
+        CPyGIL GIL;
+        Py_CLEAR(m_pyFunc);
+        Py_CLEAR(m_pyDone);
+        Py_CLEAR(m_pyResult);
+        if (m_bStarted) CPyGIL::JobFinished();
+    }
+
+    void Start() {
+        m_bStarted = true;
+        CPyGIL::JobStarted();
+        GetModule()->AddJob(this);
+    }
+
+    void runThread() override {
+        if (wasCancelled()) return;
+        PyGILState_STATE eState = PyGILState_Ensure();
+        auto Start = std::chrono::steady_clock::now();
+        m_pyResult = PyObject_CallObject(m_pyFunc, nullptr);
+        m_dSeconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - Start)
+                         .count();
+        if (!m_pyResult) {
+            CPyModule* pMod = static_cast<CPyModule*>(GetModule());
+            m_sError = pMod->GetPyExceptionStr();
+        }
+        PyGILState_Release(eState);
+    }
+
+    void runMain() override {
+        CPyGIL GIL;
+        CPyModule* pMod = static_cast<CPyModule*>(GetModule());
+        // Before calling back, which may as well unload the module
+        pMod->PyJobDone(!m_pyResult, m_dSeconds);
+        if (!m_pyResult) {
+            DEBUG("modpython: " << pMod->GetModName()
+                                << ": job failed: " << m_sError);
+            return;
+        }
+        PyObject* pyRes =
+            PyObject_CallFunctionObjArgs(m_pyDone, m_pyResult, nullptr);
+        if (!pyRes) {
+            CString sRetMsg = pMod->GetPyExceptionStr();
+            DEBUG("modpython: " << pMod->GetModName()
+                                << ": job callback failed: " << sRetMsg);
+        }
+        Py_CLEAR(pyRes);
+    }
+
+  private:
+    PyObject* m_pyFunc;
+    PyObject* m_pyDone;
+    PyObject* m_pyResult = nullptr;
+    // Written by the thread, read by runMain() after it
+    CString m_sError;
+    double m_dSeconds = 0;
+    bool m_bStarted = false;
+};
+#endif
+
+bool CPyModule::AddPyJob(PyObject* pyFunc, PyObject* pyDone) {
+#ifdef HAVE_PTHREAD
+    m_dqPendingPyJobs.push_back(new CPyJob(this, pyFunc, pyDone));
+    StartPyJobs();
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CPyModule::StartPyJobs() {
+#ifdef HAVE_PTHREAD
+    while (!m_dqPendingPyJobs.empty() && m_uRunningPyJobs < m_uMaxPyJobs) {
+        CPyJob* pJob = m_dqPendingPyJobs.front();
+        m_dqPendingPyJobs.pop_front();
+        m_uRunningPyJobs++;
+        pJob->Start();
+    }
+#endif
+}
+
+void CPyModule::PyJobDone(bool bFailed, double dSeconds) {
+    m_uRunningPyJobs--;
+    if (bFailed) {
+        m_uFailedPyJobs++;
+    } else {
+        m_uFinishedPyJobs++;
+    }
+    m_dPyJobsTime += dSeconds;
+    StartPyJobs();
+}
+
+void CPyModule::SetMaxPyJobs(unsigned int uMax) {
+    m_uMaxPyJobs = uMax ? uMax : 1;
+    StartPyJobs();
+}
+
+void CPyModule::CancelPyJobs() {
+#ifdef HAVE_PTHREAD
+    CPyGIL GIL;
+    for (CPyJob* pJob : m_dqPendingPyJobs) delete pJob;
+    m_dqPendingPyJobs.clear();
+    if (!m_sJobs.empty()) {
+        // The running jobs need the GIL to finish
+        Py_BEGIN_ALLOW_THREADS
+        CancelJobs(m_sJobs);
+        Py_END_ALLOW_THREADS
+    }
+    m_uRunningPyJobs = 0;
+#endif
+}
+
 #include "modpython/pyfunctions.cpp"
 
+void CPyModule::DetectPyHooks() {
+    const size_t uHooks = sizeof(apszPyHooks) / sizeof(apszPyHooks[0]);
+    std::vector<bool> vbHooks(uHooks, true);
+    auto Overrides = [&](const char* szHook, bool& bResult) {
+        PyObject* pyRes =
+            PyObject_CallMethod(m_pyObj, const_cast<char*>("_HasHook"),
+                                const_cast<char*>("s"), szHook);
+        if (!pyRes) {
+            CString sRetMsg = m_pModPython->GetPyExceptionStr();
+            DEBUG("modpython: can't detect hooks of " << GetModName() << ": "
+                                                       << sRetMsg);
+            return false;
+        }
+        bResult = PyObject_IsTrue(pyRes) != 0;
+        Py_CLEAR(pyRes);
+        return true;
+    };
+    for (size_t i = 0; i < uHooks; ++i) {
+        bool bHook = false;
+        if (!Overrides(apszPyHooks[i], bHook)) return;
+        // The default calls the other hook, which the module may have
+        if (!bHook && apszPyHookFallbacks[i] &&
+            !Overrides(apszPyHookFallbacks[i], bHook)) {
+            return;
+        }
+        vbHooks[i] = bHook;
+    }
+    m_vbPyHooks = vbHooks;
+
+    // Outgoing lines aren't parsed for scripts which don't handle them
+    auto HasHook = [&](const char* szHook) -> bool {
+        for (size_t i = 0; i < uHooks; ++i) {
+            if (strcmp(apszPyHooks[i], szHook) == 0) return vbHooks[i];
+        }
+        return true;
+    };
+    SetWantsSendToIRC(HasHook("OnSendToIRCMessage"), HasHook("OnSendToIRC"));
+}
+
+void CPyModule::SetEventBatching(unsigned int uIntervalMs,
+                                 unsigned int uMaxEvents) {
+    m_EventBatch.Enable(uIntervalMs, uMaxEvents);
+}
+
+void CPyModule::DisableEventBatching() { m_EventBatch.Disable(); }
+
+void CPyModule::FlushEventBatch() { m_EventBatch.Flush(); }
+
+void CPyModule::DeliverEventBatch(
+    const std::vector<CEventBatch::SEvent>& vEvents) {
+    CPyGIL GIL;
+    PyObject* pyEvents = PyList_New(0);
+    if (!pyEvents) {
+        CString sRetMsg = m_pModPython->GetPyExceptionStr();
+        DEBUG("modpython: " << GetModName()
+                            << ": can't create event batch: " << sRetMsg);
+        return;
+    }
+    for (const CEventBatch::SEvent& Event : vEvents) {
+        PyObject* pyEvent = Py_BuildValue(
+            "(sssssd)", Event.sType.c_str(), Event.sNetwork.c_str(),
+            Event.sTarget.c_str(), Event.sNick.c_str(), Event.sText.c_str(),
+            Event.dTime);
+        if (!pyEvent) {
+            // Most likely not valid UTF-8; skip just this event
+            CString sRetMsg = m_pModPython->GetPyExceptionStr();
+            DEBUG("modpython: " << GetModName()
+                                << ": can't convert event: " << sRetMsg);
+            continue;
+        }
+        PyList_Append(pyEvents, pyEvent);
+        Py_CLEAR(pyEvent);
+    }
+    PyObject* pyRes =
+        PyObject_CallMethod(m_pyObj, const_cast<char*>("OnEventBatch"),
+                            const_cast<char*>("O"), pyEvents);
+    if (!pyRes) {
+        CString sRetMsg = m_pModPython->GetPyExceptionStr();
+        DEBUG("modpython: " << GetModName()
+                            << "/OnEventBatch failed: " << sRetMsg);
+    }
+    Py_CLEAR(pyRes);
+    Py_CLEAR(pyEvents);
+}
+
 VWebSubPages& CPyModule::GetSubPages() {
     VWebSubPages* result = _GetSubPages();
     if (!result) {
@@ -408,6 +675,7 @@ VWebSubPages& CPyModule::GetSubPages() {
 void CPyTimer::RunJob() {
     CPyModule* pMod = AsPyModule(GetModule());
     if (pMod) {
+        CPyGIL GIL;
         PyObject* pyRes = PyObject_CallMethod(
             m_pyObj, const_cast<char*>("RunJob"), const_cast<char*>(""));
         if (!pyRes) {
@@ -422,6 +690,7 @@ void CPyTimer::RunJob() {
 CPyTimer::~CPyTimer() {
     CPyModule* pMod = AsPyModule(GetModule());
     if (pMod) {
+        CPyGIL GIL;
         PyObject* pyRes = PyObject_CallMethod(
             m_pyObj, const_cast<char*>("OnShutdown"), const_cast<char*>(""));
         if (!pyRes) {
@@ -443,6 +712,7 @@ CPyTimer::~CPyTimer() {
 
 #define CBSOCK(Func)                                                        \
     void CPySocket::Func() {                                                \
+        CPyGIL GIL;                                                         \
         PyObject* pyRes = PyObject_CallMethod(                              \
             m_pyObj, const_cast<char*>("On" #Func), const_cast<char*>("")); \
         CHECKCLEARSOCK(#Func);                                              \
@@ -453,6 +723,7 @@ CBSOCK(Timeout);
 CBSOCK(ConnectionRefused);
 
 void CPySocket::ReadData(const char* data, size_t len) {
+    CPyGIL GIL;
     PyObject* pyRes =
         PyObject_CallMethod(m_pyObj, const_cast<char*>("OnReadData"),
                             const_cast<char*>("y#"), data, (int)len);
@@ -460,6 +731,7 @@ void CPySocket::ReadData(const char* data, size_t len) {
 }
 
 void CPySocket::ReadLine(const CString& sLine) {
+    CPyGIL GIL;
     PyObject* pyRes =
         PyObject_CallMethod(m_pyObj, const_cast<char*>("OnReadLine"),
                             const_cast<char*>("s"), sLine.c_str());
@@ -467,6 +739,7 @@ void CPySocket::ReadLine(const CString& sLine) {
 }
 
 Csock* CPySocket::GetSockObj(const CString& sHost, unsigned short uPort) {
+    CPyGIL GIL;
     CPySocket* result = nullptr;
     PyObject* pyRes =
         PyObject_CallMethod(m_pyObj, const_cast<char*>("_Accepted"),
@@ -494,6 +767,7 @@ Csock* CPySocket::GetSockObj(const CString& sHost, unsigned short uPort) {
 }
 
 CPySocket::~CPySocket() {
+    CPyGIL GIL;
     PyObject* pyRes = PyObject_CallMethod(
         m_pyObj, const_cast<char*>("OnShutdown"), const_cast<char*>(""));
     if (!pyRes) {
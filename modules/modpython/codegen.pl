@@ -244,8 +244,13 @@ bool OnFoo(const CString& x) {
 }
 =cut
 
+my @hooks;
+# What CModule's default of a hook calls instead, given as "->OnHook"
+my @fallbacks;
+# Hooks which see the traffic collected by SetEventBatching()
+my %batched = map { $_ => 1 } qw(OnRawMessage OnUserRawMessage);
 while (<$in>) {
-	my ($type, $name, $args, $default) = /(\S+)\s+(\w+)\((.*)\)(?:=(\w+))?/ or next;
+	my ($type, $name, $args, $default, $fallback) = /(\S+)\s+(\w+)\((.*)\)(?:=(\w+))?(?:\s*->(\w+))?/ or next;
 	$type =~ s/(EModRet)/CModule::$1/;
 	$type =~ s/^\s*(.*?)\s*$/$1/;
 	my @arg = map {
@@ -255,15 +260,23 @@ while (<$in>) {
 		{type=>$t, var=>$v, base=>$tb, mod=>$tm//'', pyvar=>"pyArg_$v", error=>"can't convert parameter '$v' to PyObject"}
 	} split /,/, $args;
 
-	unless (defined $default) {
-		$default = "CModule::$name(" . (join ', ', map { $_->{var} } @arg) . ")";
-	}
+	# What CModule does when nobody overrides the hook. _GetSubPages() is
+	# ours, not CModule's.
+	my $base = "CModule::$name(" . (join ', ', map { $_->{var} } @arg) . ")";
+	$base = $default if $name =~ /^_/;
+	$default //= $base;
 
 	unshift @arg, {type=>'$func$', var=>"", base=>"", mod=>"", pyvar=>"pyName", error=>"can't convert string '$name' to PyObject"};
 
 	my $cleanup = '';
 
 	say $out "$type CPyModule::$name($args) {";
+	say $out "\tif (m_EventBatch.IsEnabled()) m_EventBatch.Add($arg[1]{var});" if $batched{$name};
+	# Nothing to call if the python module doesn't have its own $name
+	say $out "\tif (!HasPyHook(".scalar(@hooks).")) return $base;";
+	push @hooks, $name;
+	push @fallbacks, $fallback;
+	say $out "\tCPyGIL GIL;";
 	for my $a (@arg) {
 		print $out "\tPyObject* $a->{pyvar} = ";
 		given ($a->{type}) {
@@ -428,6 +441,17 @@ while (<$in>) {
 	say $out "}\n";
 }
 
+say $out "namespace {";
+say $out "\t// Hook names by their index in HasPyHook()";
+say $out "\tconst char* const apszPyHooks[] = {";
+say $out "\t\t\"$_\"," for @hooks;
+say $out "\t};";
+say $out "\t// What the default of each hook calls, if anything";
+say $out "\tconst char* const apszPyHookFallbacks[] = {";
+say $out "\t\t", (defined $_ ? "\"$_\"" : "nullptr"), "," for @fallbacks;
+say $out "\t};";
+say $out "}";
+
 sub getres {
 	my $type = shift;
 	given ($type) {
@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <deque>
+#include "../eventbatch.h"
+
 // This class is used from python to call functions which accept CString&
 // __str__ is added to it in modpython.i
 class String {
@@ -26,17 +29,44 @@ class String {
 };
 
 class CModPython;
+class CPyJob;
 
 class ZNC_EXPORT_LIB_EXPORT CPyModule : public CModule {
     PyObject* m_pyObj;
     CModPython* m_pModPython;
+    // Which hooks the python module has, empty if not known yet
+    std::vector<bool> m_vbPyHooks;
     VWebSubPages* _GetSubPages();
 
+    bool HasPyHook(size_t uHook) const {
+        return uHook >= m_vbPyHooks.size() || m_vbPyHooks[uHook];
+    }
+
+    // Events waiting for OnEventBatch(), see SetEventBatching()
+    CEventBatch m_EventBatch;
+    void DeliverEventBatch(const std::vector<CEventBatch::SEvent>& vEvents);
+
+    // Jobs of AddPyJob() which wait for a free slot
+    std::deque<CPyJob*> m_dqPendingPyJobs;
+    unsigned int m_uMaxPyJobs = 4;
+    unsigned int m_uRunningPyJobs = 0;
+    unsigned long long m_uFinishedPyJobs = 0;
+    unsigned long long m_uFailedPyJobs = 0;
+    double m_dPyJobsTime = 0;
+    friend class CPyJob;
+
+    void StartPyJobs();
+    void PyJobDone(bool bFailed, double dSeconds);
+
   public:
     CPyModule(CUser* pUser, CIRCNetwork* pNetwork, const CString& sModName,
               const CString& sDataPath, CModInfo::EModuleType eType,
               PyObject* pyObj, CModPython* pModPython)
-        : CModule(nullptr, pUser, pNetwork, sModName, sDataPath, eType) {
+        : CModule(nullptr, pUser, pNetwork, sModName, sDataPath, eType),
+          m_EventBatch(this,
+                       [this](const std::vector<CEventBatch::SEvent>& vEvents) {
+                           DeliverEventBatch(vEvents);
+                       }) {
         m_pyObj = pyObj;
         Py_INCREF(pyObj);
         m_pModPython = pModPython;
@@ -49,11 +79,43 @@ class ZNC_EXPORT_LIB_EXPORT CPyModule : public CModule {
         return m_pyObj;
     }
     void DeletePyModule() {
+        CancelPyJobs();
         Py_CLEAR(m_pyObj);
         delete this;
     }
     CString GetPyExceptionStr();
     CModPython* GetModPython() { return m_pModPython; }
+    /// Find out which hooks the python module doesn't override, so calling
+    /// them can be skipped.
+    void DetectPyHooks();
+
+    /// Also deliver the IRC traffic of this module's user or network to
+    /// OnEventBatch(), as lists of plain tuples
+    /// (type, network, target, nick, text, time), instead of only to the
+    /// individual hooks. A batch is delivered uIntervalMs after its first
+    /// event, or right away once it has uMaxEvents events. An interval of 0
+    /// delivers on the next turn of the event loop.
+    void SetEventBatching(unsigned int uIntervalMs,
+                          unsigned int uMaxEvents = 1000);
+    void DisableEventBatching();
+    /// Delivers the pending events now.
+    void FlushEventBatch();
+
+    /// Calls pyFunc() in the thread pool, and then pyDone(result) in the
+    /// main thread. At most GetMaxPyJobs() jobs of this module run at the
+    /// same time, the others wait for their turn.
+    /// @return false if ZNC was built without threads; nothing is run then.
+    bool AddPyJob(PyObject* pyFunc, PyObject* pyDone);
+    /// Cancels all jobs, waiting for the running ones to finish.
+    void CancelPyJobs();
+    void SetMaxPyJobs(unsigned int uMax);
+    unsigned int GetMaxPyJobs() const { return m_uMaxPyJobs; }
+    unsigned int GetRunningPyJobs() const { return m_uRunningPyJobs; }
+    size_t GetPendingPyJobs() const { return m_dqPendingPyJobs.size(); }
+    unsigned long long GetFinishedPyJobs() const { return m_uFinishedPyJobs; }
+    unsigned long long GetFailedPyJobs() const { return m_uFailedPyJobs; }
+    /// Seconds spent by the jobs in their threads, in total
+    double GetPyJobsTime() const { return m_dPyJobsTime; }
 
     bool OnBoot() override;
     bool WebRequiresLogin() override;
@@ -215,8 +277,10 @@ inline CPyModule* CreatePyModule(CUser* pUser, CIRCNetwork* pNetwork,
                                  const CString& sDataPath,
                                  CModInfo::EModuleType eType, PyObject* pyObj,
                                  CModPython* pModPython) {
-    return new CPyModule(pUser, pNetwork, sModName, sDataPath, eType, pyObj,
-                         pModPython);
+    CPyModule* pModule = new CPyModule(pUser, pNetwork, sModName, sDataPath,
+                                       eType, pyObj, pModPython);
+    pModule->DetectPyHooks();
+    return pModule;
 }
 
 class ZNC_EXPORT_LIB_EXPORT CPyTimer : public CTimer {
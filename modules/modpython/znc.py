@@ -199,6 +199,17 @@ class Module:
     def OnLoad(self, sArgs, sMessage):
         return True
 
+    def _HasHook(self, hook):
+        '''Whether the module overrides the hook of Module. What the default
+        calls instead comes from functions.in, see DetectPyHooks().'''
+        own = getattr(type(self), hook, None)
+        return own is not getattr(Module, hook, None)
+
+    def OnEventBatch(self, events):
+        '''events is a list of tuples
+        (type, network, target, nick, text, time), see SetEventBatching().'''
+        pass
+
     def _GetSubPages(self):
         return self.GetSubPages()
 
@@ -215,6 +226,32 @@ class Module:
                                   description, t)
         return t
 
+    def RunInThread(self, func, callback=None, errback=None):
+        '''Calls func() in ZNC's thread pool, and afterwards callback(result),
+        or errback(exception) if func raised, in the main thread.
+
+        func must not use ZNC's API. See SetMaxPyJobs() and the other
+        *PyJobs() methods for the limit of jobs running at the same time.'''
+        def job():
+            try:
+                return True, func()
+            except Exception as e:
+                return False, e
+
+        def done(result):
+            ok, value = result
+            if ok:
+                if callback is not None:
+                    callback(value)
+            elif errback is not None:
+                errback(value)
+            else:
+                raise value
+
+        if not self._cmod.AddPyJob(job, done):
+            # ZNC without threads
+            done(job())
+
     def GetSubPages(self):
         pass
 
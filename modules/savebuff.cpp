@@ -29,7 +29,11 @@
 #include <znc/IRCNetwork.h>
 #include <znc/FileUtils.h>
 #include <znc/Query.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 
+using std::map;
 using std::set;
 using std::vector;
 
@@ -42,6 +46,17 @@ using std::vector;
 #define CRYPT_LAME_PASS "::__:NOPASS:__::"
 #define CRYPT_ASK_PASS "--ask-pass"
 
+// Buffers are saved as journals which new lines are appended to:
+// JOURNAL_MAGIC, a random salt of JOURNAL_SALT_LEN bytes, and records. A
+// record is the 4 byte big endian length of its plain text, the AES-256-GCM
+// encrypted text and the tag. The key is HMAC-SHA256(password, salt), the
+// nonce of the n-th record is n, and the length is authenticated too.
+// The first record has the verification token and the name of the buffer,
+// the others have lines, both like the old Blowfish files have them.
+#define JOURNAL_MAGIC "ZNCSBJ01"
+#define JOURNAL_SALT_LEN 16
+#define JOURNAL_TAG_LEN 16
+
 class CSaveBuff;
 
 class CSaveBuffJob : public CTimer {
@@ -56,10 +71,213 @@ class CSaveBuffJob : public CTimer {
     void RunJob() override;
 };
 
+// Pairs of file path and decrypted content
+typedef vector<std::pair<CString, CString>> VBufferFiles;
+
+class CSaveBuffJournal {
+  public:
+    static CString DeriveKey(const CString& sPassword, const CString& sSalt) {
+        unsigned char aKey[EVP_MAX_MD_SIZE];
+        unsigned int uLen = 0;
+        HMAC(EVP_sha256(), sPassword.data(), sPassword.length(),
+             (const unsigned char*)sSalt.data(), sSalt.length(), aKey, &uLen);
+        return CString((const char*)aKey, uLen);
+    }
+
+    /** A new journal, with its first record. */
+    static CString Create(const CString& sPassword, const CString& sHeader,
+                          CString& sKey) {
+        unsigned char aSalt[JOURNAL_SALT_LEN];
+        RAND_bytes(aSalt, sizeof(aSalt));
+        CString sSalt((const char*)aSalt, sizeof(aSalt));
+        sKey = DeriveKey(sPassword, sSalt);
+        CString sJournal = JOURNAL_MAGIC + sSalt;
+        Seal(sKey, 0, sHeader, sJournal);
+        return sJournal;
+    }
+
+    /** Appends record number uRecord with sPlain to sOut. */
+    static bool Seal(const CString& sKey, uint64_t uRecord,
+                     const CString& sPlain, CString& sOut) {
+        unsigned char aNonce[12], aLen[4];
+        MakeNonce(uRecord, aNonce);
+        PutLength(sPlain.length(), aLen);
+
+        size_t uStart = sOut.length();
+        sOut.append((const char*)aLen, sizeof(aLen));
+        sOut.resize(uStart + sizeof(aLen) + sPlain.length() + JOURNAL_TAG_LEN);
+        unsigned char* pOut = (unsigned char*)&sOut[uStart + sizeof(aLen)];
+
+        EVP_CIPHER_CTX* pCtx = EVP_CIPHER_CTX_new();
+        int iLen = 0, iFinal = 0;
+        bool bOk =
+            pCtx &&
+            EVP_EncryptInit_ex(pCtx, EVP_aes_256_gcm(), nullptr,
+                               (const unsigned char*)sKey.data(), aNonce) &&
+            EVP_EncryptUpdate(pCtx, nullptr, &iLen, aLen, sizeof(aLen)) &&
+            EVP_EncryptUpdate(pCtx, pOut, &iLen,
+                              (const unsigned char*)sPlain.data(),
+                              sPlain.length()) &&
+            EVP_EncryptFinal_ex(pCtx, pOut + iLen, &iFinal) &&
+            EVP_CIPHER_CTX_ctrl(pCtx, EVP_CTRL_GCM_GET_TAG, JOURNAL_TAG_LEN,
+                                pOut + sPlain.length());
+        EVP_CIPHER_CTX_free(pCtx);
+        if (!bOk) sOut.resize(uStart);
+        return bOk;
+    }
+
+    /**
+     * Decrypts a whole journal into the same content an old Blowfish file
+     * has. A torn record at the end (e.g. ZNC crashed while appending) ends
+     * the journal.
+     * @return false if not even the first record can be decrypted, i.e. the
+     *         password is wrong.
+     */
+    static bool Read(const CString& sJournal, const CString& sPassword,
+                     CString& sContent) {
+        sContent.clear();
+        size_t uPos = strlen(JOURNAL_MAGIC) + JOURNAL_SALT_LEN;
+        if (sJournal.length() < uPos) return false;
+        CString sSalt =
+            sJournal.substr(strlen(JOURNAL_MAGIC), JOURNAL_SALT_LEN);
+        CString sKey = DeriveKey(sPassword, sSalt);
+
+        const unsigned char* pData = (const unsigned char*)sJournal.data();
+        uint64_t uRecord = 0;
+        while (uPos + 4 <= sJournal.length()) {
+            size_t uLen = (size_t)pData[uPos] << 24 |
+                          (size_t)pData[uPos + 1] << 16 |
+                          (size_t)pData[uPos + 2] << 8 | pData[uPos + 3];
+            if (uLen + JOURNAL_TAG_LEN > sJournal.length() - uPos - 4) break;
+            if (!Open(sKey, uRecord, pData + uPos, uLen, sContent)) break;
+            uPos += 4 + uLen + JOURNAL_TAG_LEN;
+            uRecord++;
+        }
+        return uRecord > 0;
+    }
+
+  private:
+    static void MakeNonce(uint64_t uRecord, unsigned char* pNonce) {
+        memset(pNonce, 0, 4);
+        for (int i = 0; i < 8; ++i) {
+            pNonce[4 + i] = (unsigned char)(uRecord >> (56 - 8 * i));
+        }
+    }
+
+    static void PutLength(size_t uLen, unsigned char* pOut) {
+        pOut[0] = (unsigned char)(uLen >> 24);
+        pOut[1] = (unsigned char)(uLen >> 16);
+        pOut[2] = (unsigned char)(uLen >> 8);
+        pOut[3] = (unsigned char)uLen;
+    }
+
+    // pRecord points to the length of the record, appends its text to sOut
+    static bool Open(const CString& sKey, uint64_t uRecord,
+                     const unsigned char* pRecord, size_t uLen,
+                     CString& sOut) {
+        unsigned char aNonce[12];
+        MakeNonce(uRecord, aNonce);
+
+        size_t uStart = sOut.length();
+        sOut.resize(uStart + uLen);
+        unsigned char* pOut = (unsigned char*)&sOut[uStart];
+        unsigned char aTag[JOURNAL_TAG_LEN];
+        memcpy(aTag, pRecord + 4 + uLen, sizeof(aTag));
+
+        EVP_CIPHER_CTX* pCtx = EVP_CIPHER_CTX_new();
+        int iLen = 0, iFinal = 0;
+        bool bOk =
+            pCtx &&
+            EVP_DecryptInit_ex(pCtx, EVP_aes_256_gcm(), nullptr,
+                               (const unsigned char*)sKey.data(), aNonce) &&
+            EVP_DecryptUpdate(pCtx, nullptr, &iLen, pRecord, 4) &&
+            EVP_DecryptUpdate(pCtx, pOut, &iLen, pRecord + 4, uLen) &&
+            EVP_CIPHER_CTX_ctrl(pCtx, EVP_CTRL_GCM_SET_TAG, sizeof(aTag),
+                                aTag) &&
+            EVP_DecryptFinal_ex(pCtx, pOut + iLen, &iFinal) > 0;
+        EVP_CIPHER_CTX_free(pCtx);
+        if (!bOk) sOut.resize(uStart);
+        return bOk;
+    }
+};
+
+// What we know about a journal which we wrote
+struct SJournal {
+    CString sKey;
+    uint64_t uRecords;
+    // Lines in the journal, including the ones the buffer dropped
+    unsigned long long uLines;
+    // The buffer's counters when it was saved
+    unsigned long long uLinesAdded;
+    unsigned long long uRewrites;
+};
+
+// A copy of everything one save writes, so that it can be done in another
+// thread while the buffers change
+struct SBufferWrite {
+    CString sPath;
+    // Replace the journal with a new one, instead of appending a record
+    bool bCompact;
+    CString sHeader;
+    CString sLines;
+    // The journal after the write. The writer fills in the key and the
+    // records of new ones.
+    SJournal Journal;
+    bool bWritten;
+};
+
+struct SSave {
+    CString sPassword;
+    vector<SBufferWrite> vWrites;
+    VCString vsDeletes;
+    // If set, every other file in this directory is deleted
+    CString sCleanupDir;
+    set<CString> ssKeep;
+    // Results of saves from before a password change are stale
+    unsigned int uGeneration;
+    bool bReport;
+};
+
+#ifdef HAVE_PTHREAD
+class CSaveBuffSaveJob : public CModuleJob {
+  public:
+    CSaveBuffSaveJob(CModule* pModule, SSave&& Save)
+        : CModuleJob(pModule, "save", "Encrypts and writes the buffers"),
+          m_Save(std::move(Save)) {}
+
+    void runThread() override;
+    void runMain() override;
+
+  private:
+    SSave m_Save;
+};
+
+class CSaveBuffBootJob : public CModuleJob {
+  public:
+    CSaveBuffBootJob(CModule* pModule, const CString& sPath,
+                     const CString& sPassword)
+        : CModuleJob(pModule, "boot", "Decrypts the saved buffers"),
+          m_sPath(sPath),
+          m_sPassword(sPassword) {}
+
+    void runThread() override;
+    void runMain() override;
+
+  private:
+    CString m_sPath;
+    CString m_sPassword;
+};
+#endif
+
 class CSaveBuff : public CModule {
   public:
     MODCONSTRUCTOR(CSaveBuff) {
         m_bBootError = false;
+#ifdef HAVE_PTHREAD
+        m_pBootJob = nullptr;
+        m_bBootDecrypted = false;
+        m_pSaveJob = nullptr;
+#endif
 
         AddHelpCommand();
         AddCommand("SetPass", t_d("<password>"), t_d("Sets the password"),
@@ -70,8 +288,19 @@ class CSaveBuff : public CModule {
                    [=](const CString& sLine) { OnSaveCommand(sLine); });
     }
     ~CSaveBuff() override {
-        if (!m_bBootError) {
-            SaveBuffersToDisk();
+#ifdef HAVE_PTHREAD
+        // The job writes to our members, so it has to be gone before they are
+        CancelJob(m_pBootJob);
+        if (m_pSaveJob) {
+            // This waits for the writes, but we don't learn what they did
+            CancelJob(m_pSaveJob);
+            m_mJournals.clear();
+        }
+#endif
+        // There is no event loop which could finish a job anymore
+        SSave Save;
+        if (!m_bBootError && PrepareSave(Save)) {
+            WriteBuffers(Save);
         }
     }
 
@@ -93,23 +322,46 @@ class CSaveBuff : public CModule {
             this, 60, 0, "SaveBuff",
             "Saves the current buffer to disk every 1 minute"));
 
+#ifdef HAVE_PTHREAD
+        // Decrypting the buffers is the slow part of booting. Start right
+        // away, so that it overlaps with loading all the other users and
+        // networks. OnBoot() waits for the result.
+        if (!m_bBootError) {
+            m_pBootJob = new CSaveBuffBootJob(this, GetSavePath(), m_sPassword);
+            AddJob(m_pBootJob);
+        }
+#endif
+
         return (!m_bBootError);
     }
 
     bool OnBoot() override {
-        CDir saveDir(GetSavePath());
-        for (CFile* pFile : saveDir) {
+        VBufferFiles vFiles;
+#ifdef HAVE_PTHREAD
+        if (m_pBootJob) {
+            CMutexLocker guard(m_BootMutex);
+            m_BootCond.wait(guard, [this]() { return m_bBootDecrypted; });
+            vFiles = std::move(m_vBootFiles);
+        } else
+#endif
+        {
+            ReadBuffers(GetSavePath(), m_sPassword, vFiles);
+        }
+
+        for (auto& File : vFiles) {
+            const CString& sPath = File.first;
+            CString& sBuffer = File.second;
             CString sName;
-            CString sBuffer;
 
-            EBufferType eType =
-                DecryptBuffer(pFile->GetLongName(), sBuffer, sName);
+            EBufferType eType = sBuffer.empty()
+                                    ? EmptyBuffer
+                                    : ParseBuffer(sPath, sBuffer, sName);
             switch (eType) {
                 case InvalidBuffer:
                     m_sPassword = "";
                     CUtils::PrintError("[" + GetModName() +
-                                       ".so] Failed to Decrypt [" +
-                                       pFile->GetLongName() + "]");
+                                       ".so] Failed to Decrypt [" + sPath +
+                                       "]");
                     if (!sName.empty()) {
                         PutUser(":***!znc@znc.in PRIVMSG " + sName +
                                 " :Failed to decrypt this buffer, did you "
@@ -166,64 +418,150 @@ class CSaveBuff : public CModule {
         }
     }
 
-    void SaveBufferToDisk(const CBuffer& Buffer, const CString& sPath,
-                          const CString& sHeader) {
-        CFile File(sPath);
-        CString sContent = sHeader + "\n";
-
-        size_t uSize = Buffer.Size();
-        for (unsigned int uIdx = 0; uIdx < uSize; uIdx++) {
+    static CString FormatLines(const CBuffer& Buffer, size_t uFirst) {
+        CString sContent;
+        for (size_t uIdx = uFirst; uIdx < Buffer.Size(); uIdx++) {
             const CBufLine& Line = Buffer.GetBufLine(uIdx);
             timeval ts = Line.GetTime();
             sContent += "@" + CString(ts.tv_sec) + "," + CString(ts.tv_usec) +
                         " " + Line.GetFormat() + "\n" + Line.GetText() + "\n";
         }
+        return sContent;
+    }
 
-        CBlowfish c(m_sPassword, BF_ENCRYPT);
-        sContent = c.Crypt(sContent);
-
-        if (File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
-            File.Chmod(0600);
-            File.Write(sContent);
+    // Decides what to write for a buffer. Nothing is written for buffers
+    // without new lines.
+    void PrepareWrite(const CBuffer& Buffer, const CString& sPath,
+                      const CString& sHeader, SSave& Save) {
+        SBufferWrite Write;
+        Write.sPath = sPath;
+        Write.bWritten = false;
+
+        auto it = m_mJournals.find(sPath);
+        if (it != m_mJournals.end()) {
+            const SJournal& Journal = it->second;
+            unsigned long long uNew =
+                Buffer.GetLinesAdded() - Journal.uLinesAdded;
+            // Lines which were never saved may have been dropped already, and
+            // the journal shouldn't grow much beyond the buffer
+            if (Buffer.GetRewrites() == Journal.uRewrites &&
+                uNew <= Buffer.Size() &&
+                Journal.uLines + uNew <= 2 * Buffer.GetLineCount() + 10) {
+                if (uNew == 0) return;
+                Write.bCompact = false;
+                Write.sLines = FormatLines(Buffer, Buffer.Size() - uNew);
+                Write.Journal = Journal;
+                Write.Journal.uLines += uNew;
+                Write.Journal.uLinesAdded = Buffer.GetLinesAdded();
+                Save.vWrites.push_back(std::move(Write));
+                return;
+            }
         }
-        File.Close();
+
+        Write.bCompact = true;
+        Write.sHeader = sHeader + "\n";
+        Write.sLines = FormatLines(Buffer, 0);
+        Write.Journal.uLines = Buffer.Size();
+        Write.Journal.uLinesAdded = Buffer.GetLinesAdded();
+        Write.Journal.uRewrites = Buffer.GetRewrites();
+        Save.vWrites.push_back(std::move(Write));
     }
 
-    void SaveBuffersToDisk() {
-        if (!m_sPassword.empty()) {
-            set<CString> ssPaths;
+    // Takes the snapshot of the buffers for a save
+    bool PrepareSave(SSave& Save) {
+        if (m_sPassword.empty()) {
+            PutModule(t_s(
+                "Password is unset usually meaning the decryption failed. You "
+                "can setpass to the appropriate pass and things should start "
+                "working, or setpass to a new pass and save to reinstantiate"));
+            return false;
+        }
 
-            const vector<CChan*>& vChans = GetNetwork()->GetChans();
-            for (CChan* pChan : vChans) {
-                CString sPath = GetPath(pChan->GetName());
-                SaveBufferToDisk(pChan->GetBuffer(), sPath,
-                                 CHAN_VERIFICATION_TOKEN + pChan->GetName());
-                ssPaths.insert(sPath);
-            }
+        Save.sPassword = m_sPassword;
+        Save.uGeneration = m_uSaveGeneration;
+        Save.bReport = false;
 
-            const vector<CQuery*>& vQueries = GetNetwork()->GetQueries();
-            for (CQuery* pQuery : vQueries) {
-                CString sPath = GetPath(pQuery->GetName());
-                SaveBufferToDisk(pQuery->GetBuffer(), sPath,
-                                 QUERY_VERIFICATION_TOKEN + pQuery->GetName());
-                ssPaths.insert(sPath);
+        const vector<CChan*>& vChans = GetNetwork()->GetChans();
+        for (CChan* pChan : vChans) {
+            CString sPath = GetPath(pChan->GetName());
+            PrepareWrite(pChan->GetBuffer(), sPath,
+                         CHAN_VERIFICATION_TOKEN + pChan->GetName(), Save);
+            Save.ssKeep.insert(sPath);
+        }
+
+        const vector<CQuery*>& vQueries = GetNetwork()->GetQueries();
+        for (CQuery* pQuery : vQueries) {
+            CString sPath = GetPath(pQuery->GetName());
+            PrepareWrite(pQuery->GetBuffer(), sPath,
+                         QUERY_VERIFICATION_TOKEN + pQuery->GetName(), Save);
+            Save.ssKeep.insert(sPath);
+        }
+
+        // cleanup leftovers ie. cleared buffers. Only the first time
+        // we need to look at the directory, afterwards we know our files.
+        if (!m_bCleanedUp) {
+            Save.sCleanupDir = GetSavePath();
+            m_bCleanedUp = true;
+        }
+        for (auto it = m_mJournals.begin(); it != m_mJournals.end();) {
+            if (Save.ssKeep.count(it->first) == 0) {
+                Save.vsDeletes.push_back(it->first);
+                m_mJournals.erase(it++);
+            } else {
+                ++it;
             }
+        }
+        return true;
+    }
 
-            // cleanup leftovers ie. cleared buffers
-            CDir saveDir(GetSavePath());
-            for (CFile* pFile : saveDir) {
-                if (ssPaths.count(pFile->GetLongName()) == 0) {
-                    pFile->Delete();
+    void SaveBuffersToDisk(bool bReport = false) {
+#ifdef HAVE_PTHREAD
+        if (m_pSaveJob) {
+            // The next save starts from what this one wrote
+            m_bSaveAgain = true;
+            m_bReportAgain = m_bReportAgain || bReport;
+            return;
+        }
+#endif
+        SSave Save;
+        if (!PrepareSave(Save)) return;
+        Save.bReport = bReport;
+#ifdef HAVE_PTHREAD
+        m_pSaveJob = new CSaveBuffSaveJob(this, std::move(Save));
+        AddJob(m_pSaveJob);
+#else
+        WriteBuffers(Save);
+        SaveFinished(Save);
+#endif
+    }
+
+    void SaveFinished(const SSave& Save) {
+        if (Save.uGeneration == m_uSaveGeneration) {
+            for (const SBufferWrite& Write : Save.vWrites) {
+                if (Write.bWritten) {
+                    m_mJournals[Write.sPath] = Write.Journal;
+                } else {
+                    // Start over with the next save
+                    m_mJournals.erase(Write.sPath);
                 }
             }
-        } else {
-            PutModule(t_s(
-                "Password is unset usually meaning the decryption failed. You "
-                "can setpass to the appropriate pass and things should start "
-                "working, or setpass to a new pass and save to reinstantiate"));
         }
+        if (Save.bReport) PutModule("Done.");
     }
 
+#ifdef HAVE_PTHREAD
+    void SaveJobFinished(const SSave& Save) {
+        m_pSaveJob = nullptr;
+        SaveFinished(Save);
+        if (m_bSaveAgain) {
+            bool bReport = m_bReportAgain;
+            m_bSaveAgain = false;
+            m_bReportAgain = false;
+            SaveBuffersToDisk(bReport);
+        }
+    }
+#endif
+
     void OnSetPassCommand(const CString& sCmdLine) {
         CString sArgs = sCmdLine.Token(1, true);
 
@@ -231,6 +569,9 @@ class CSaveBuff : public CModule {
 
         PutModule(t_f("Password set to [{1}]")(sArgs));
         m_sPassword = CBlowfish::MD5(sArgs);
+        // The journals need new keys
+        m_mJournals.clear();
+        m_uSaveGeneration++;
     }
 
     void OnModCommand(const CString& sCmdLine) override {
@@ -263,8 +604,7 @@ class CSaveBuff : public CModule {
     }
 
     void OnSaveCommand(const CString& sCmdLine) {
-        SaveBuffersToDisk();
-        PutModule("Done.");
+        SaveBuffersToDisk(true);
     }
 
     void Replay(const CString& sBuffer) {
@@ -303,6 +643,9 @@ class CSaveBuff : public CModule {
   private:
     bool m_bBootError;
     CString m_sPassword;
+    map<CString, SJournal> m_mJournals;
+    bool m_bCleanedUp = false;
+    unsigned int m_uSaveGeneration = 0;
 
     enum EBufferType {
         InvalidBuffer = 0,
@@ -313,36 +656,161 @@ class CSaveBuff : public CModule {
 
     EBufferType DecryptBuffer(const CString& sPath, CString& sBuffer,
                               CString& sName) {
+        if (!ReadBuffer(sPath, m_sPassword, sBuffer)) return EmptyBuffer;
+        return ParseBuffer(sPath, sBuffer, sName);
+    }
+
+    EBufferType ParseBuffer(const CString& sPath, CString& sBuffer,
+                            CString& sName) {
+        if (sBuffer.TrimPrefix(LEGACY_VERIFICATION_TOKEN)) {
+            sName = FindLegacyBufferName(sPath);
+            return ChanBuffer;
+        } else if (sBuffer.TrimPrefix(CHAN_VERIFICATION_TOKEN)) {
+            sName = sBuffer.FirstLine();
+            if (sBuffer.TrimLeft(sName + "\n")) return ChanBuffer;
+        } else if (sBuffer.TrimPrefix(QUERY_VERIFICATION_TOKEN)) {
+            sName = sBuffer.FirstLine();
+            if (sBuffer.TrimLeft(sName + "\n")) return QueryBuffer;
+        }
+
+        PutModule(t_f("Unable to decode Encrypted file {1}")(sPath));
+        return InvalidBuffer;
+    }
+
+  public:
+    // These don't touch the module, so they are safe to use from any
+    // thread
+    static bool ReadBuffer(const CString& sPath, const CString& sPassword,
+                           CString& sBuffer) {
         CString sContent;
         sBuffer = "";
 
         CFile File(sPath);
 
         if (sPath.empty() || !File.Open() || !File.ReadFile(sContent))
-            return EmptyBuffer;
+            return false;
+
+        File.Close();
+
+        if (sContent.empty()) return false;
+
+        if (sContent.StartsWith(JOURNAL_MAGIC)) {
+            if (!CSaveBuffJournal::Read(sContent, sPassword, sBuffer)) {
+                // No verification token, so this fails like a Blowfish file
+                // decrypted with the wrong password
+                sBuffer = JOURNAL_MAGIC;
+            }
+            return true;
+        }
+
+        CBlowfish c(sPassword, BF_DECRYPT);
+        sBuffer = c.Crypt(sContent);
+        return true;
+    }
+
+    static void ReadBuffers(const CString& sPath, const CString& sPassword,
+                            VBufferFiles& vFiles) {
+        CDir saveDir(sPath);
+        for (CFile* pFile : saveDir) {
+            CString sBuffer;
+            ReadBuffer(pFile->GetLongName(), sPassword, sBuffer);
+            vFiles.emplace_back(pFile->GetLongName(), std::move(sBuffer));
+        }
+    }
+
+    static void WriteBuffers(SSave& Save) {
+        for (SBufferWrite& Write : Save.vWrites) {
+            if (Write.bCompact) {
+                Write.bWritten = CompactJournal(Save.sPassword, Write);
+            } else {
+                Write.bWritten = AppendToJournal(Write);
+            }
+        }
+        for (const CString& sPath : Save.vsDeletes) {
+            CFile::Delete(sPath);
+        }
+        if (!Save.sCleanupDir.empty()) {
+            CDir saveDir(Save.sCleanupDir);
+            for (CFile* pFile : saveDir) {
+                if (Save.ssKeep.count(pFile->GetLongName()) == 0) {
+                    pFile->Delete();
+                }
+            }
+        }
+    }
 
+  private:
+    static bool AppendToJournal(SBufferWrite& Write) {
+        SJournal& Journal = Write.Journal;
+        CString sRecord;
+        if (!CSaveBuffJournal::Seal(Journal.sKey, Journal.uRecords,
+                                    Write.sLines, sRecord)) {
+            return false;
+        }
+        CFile File(Write.sPath);
+        if (!File.Open(O_WRONLY | O_APPEND) ||
+            File.Write(sRecord) != (ssize_t)sRecord.length()) {
+            return false;
+        }
         File.Close();
+        Journal.uRecords++;
+        return true;
+    }
 
-        if (!sContent.empty()) {
-            CBlowfish c(m_sPassword, BF_DECRYPT);
-            sBuffer = c.Crypt(sContent);
-
-            if (sBuffer.TrimPrefix(LEGACY_VERIFICATION_TOKEN)) {
-                sName = FindLegacyBufferName(sPath);
-                return ChanBuffer;
-            } else if (sBuffer.TrimPrefix(CHAN_VERIFICATION_TOKEN)) {
-                sName = sBuffer.FirstLine();
-                if (sBuffer.TrimLeft(sName + "\n")) return ChanBuffer;
-            } else if (sBuffer.TrimPrefix(QUERY_VERIFICATION_TOKEN)) {
-                sName = sBuffer.FirstLine();
-                if (sBuffer.TrimLeft(sName + "\n")) return QueryBuffer;
+    // Replaces the journal with one of just the current lines
+    static bool CompactJournal(const CString& sPassword,
+                               SBufferWrite& Write) {
+        SJournal& Journal = Write.Journal;
+        CString sContent =
+            CSaveBuffJournal::Create(sPassword, Write.sHeader, Journal.sKey);
+        Journal.uRecords = 1;
+        if (!Write.sLines.empty()) {
+            if (!CSaveBuffJournal::Seal(Journal.sKey, Journal.uRecords,
+                                        Write.sLines, sContent)) {
+                return false;
             }
+            Journal.uRecords++;
+        }
 
-            PutModule(t_f("Unable to decode Encrypted file {1}")(sPath));
-            return InvalidBuffer;
+        CFile File(Write.sPath + ".new");
+        if (!File.Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) return false;
+        File.Chmod(0600);
+        bool bWritten = File.Write(sContent) == (ssize_t)sContent.length();
+        File.Close();
+        if (!bWritten || !File.Move(Write.sPath, true)) {
+            File.Delete();
+            return false;
         }
-        return EmptyBuffer;
+        return true;
     }
+
+  public:
+#ifdef HAVE_PTHREAD
+    void BootBuffersDecrypted(VBufferFiles&& vFiles) {
+        CMutexLocker guard(m_BootMutex);
+        m_vBootFiles = std::move(vFiles);
+        m_bBootDecrypted = true;
+        m_BootCond.notify_all();
+    }
+
+    void BootJobFinished() {
+        // Without OnBoot() (e.g. the module was loaded at runtime), nobody is
+        // interested in the buffers
+        m_pBootJob = nullptr;
+        m_vBootFiles.clear();
+    }
+
+  private:
+    CSaveBuffBootJob* m_pBootJob;
+    CMutex m_BootMutex;
+    CConditionVariable m_BootCond;
+    bool m_bBootDecrypted;
+    VBufferFiles m_vBootFiles;
+
+    CSaveBuffSaveJob* m_pSaveJob;
+    bool m_bSaveAgain = false;
+    bool m_bReportAgain = false;
+#endif
 };
 
 void CSaveBuffJob::RunJob() {
@@ -350,6 +818,24 @@ void CSaveBuffJob::RunJob() {
     p->SaveBuffersToDisk();
 }
 
+#ifdef HAVE_PTHREAD
+void CSaveBuffSaveJob::runThread() { CSaveBuff::WriteBuffers(m_Save); }
+
+void CSaveBuffSaveJob::runMain() {
+    ((CSaveBuff*)GetModule())->SaveJobFinished(m_Save);
+}
+
+void CSaveBuffBootJob::runThread() {
+    VBufferFiles vFiles;
+    CSaveBuff::ReadBuffers(m_sPath, m_sPassword, vFiles);
+    ((CSaveBuff*)GetModule())->BootBuffersDecrypted(std::move(vFiles));
+}
+
+void CSaveBuffBootJob::runMain() {
+    ((CSaveBuff*)GetModule())->BootJobFinished();
+}
+#endif
+
 template <>
 void TModInfo<CSaveBuff>(CModInfo& Info) {
     Info.SetWikiPage("savebuff");
@@ -1880,6 +1880,8 @@ class CWebAdminMod : public CModule {
             Tmpl["StatusPrefix"] = CZNC::Get().GetStatusPrefix();
             Tmpl["MaxBufferSize"] = CString(CZNC::Get().GetMaxBufferSize());
             Tmpl["ConnectDelay"] = CString(CZNC::Get().GetConnectDelay());
+            Tmpl["ConnectConcurrency"] =
+                CString(CZNC::Get().GetConnectConcurrency());
             Tmpl["ServerThrottle"] = CString(CZNC::Get().GetServerThrottle());
             Tmpl["AnonIPLimit"] = CString(CZNC::Get().GetAnonIPLimit());
             Tmpl["ProtectWebSessions"] =
@@ -2024,6 +2026,8 @@ class CWebAdminMod : public CModule {
         CZNC::Get().SetMaxBufferSize(sArg.ToUInt());
         sArg = WebSock.GetParam("connectdelay");
         CZNC::Get().SetConnectDelay(sArg.ToUInt());
+        sArg = WebSock.GetParam("connectconcurrency");
+        CZNC::Get().SetConnectConcurrency(sArg.ToUInt());
         sArg = WebSock.GetParam("serverthrottle");
         CZNC::Get().SetServerThrottle(sArg.ToUInt());
         sArg = WebSock.GetParam("anoniplimit");
@@ -20,13 +20,16 @@
 #include <time.h>
 
 CBufLine::CBufLine(const CMessage& Format, const CString& sText)
-    : m_Message(Format), m_sText(sText) {}
+    : m_Message(Format), m_sText(sText) {
+    Compile();
+}
 
 CBufLine::CBufLine(const CString& sFormat, const CString& sText,
                    const timeval* ts, const MCString& mssTags)
     : m_sText(sText) {
     m_Message.Parse(sFormat);
     m_Message.SetTags(mssTags);
+    Compile();
 
     if (ts == nullptr)
         UpdateTime();
@@ -40,26 +43,105 @@ void CBufLine::UpdateTime() {
     m_Message.SetTime(CUtils::GetTime());
 }
 
+void CBufLine::Compile() {
+    m_bSenderFormat =
+        Compile(m_Message.GetNick().GetNickMask(), m_SenderFormat);
+
+    m_vParamFormats.clear();
+    m_bUsesText = false;
+    const VCString& vsParams = m_Message.GetParams();
+    for (unsigned int uIdx = 0; uIdx < vsParams.size(); ++uIdx) {
+        CFormat Format;
+        if (!Compile(vsParams[uIdx], Format)) continue;
+        for (const CFormatPart& Part : Format) {
+            if (Part.bParam && Part.sParam == "text") m_bUsesText = true;
+        }
+        m_vParamFormats.emplace_back(uIdx, std::move(Format));
+    }
+}
+
+bool CBufLine::Compile(const CString& sField, CFormat& Format) {
+    Format.clear();
+    // Most fields are plain text, which NamedFormat() would leave as is
+    if (sField.find_first_of("{\\") == CString::npos) {
+        return false;
+    }
+
+    // The same parser as in CString::NamedFormat()
+    CFormatPart Part = {"", false, ""};
+    bool bEscape = false;
+    bool bParam = false;
+    for (char c : sField) {
+        if (!bParam) {
+            if (bEscape) {
+                Part.sLiteral += c;
+                bEscape = false;
+            } else if (c == '\\') {
+                bEscape = true;
+            } else if (c == '{') {
+                bParam = true;
+            } else {
+                Part.sLiteral += c;
+            }
+        } else {
+            if (bEscape) {
+                Part.sParam += c;
+                bEscape = false;
+            } else if (c == '\\') {
+                bEscape = true;
+            } else if (c == '}') {
+                bParam = false;
+                Part.bParam = true;
+                Format.push_back(std::move(Part));
+                Part = {"", false, ""};
+            } else {
+                Part.sParam += c;
+            }
+        }
+    }
+    // An unterminated placeholder is dropped
+    if (!Part.sLiteral.empty()) {
+        Part.sParam.clear();
+        Format.push_back(std::move(Part));
+    }
+    return true;
+}
+
+CString CBufLine::Expand(const CFormat& Format, const MCString& mssParams,
+                         const CString* psText) {
+    CString sRet;
+    for (const CFormatPart& Part : Format) {
+        sRet += Part.sLiteral;
+        if (!Part.bParam) continue;
+        if (psText && Part.sParam == "text") {
+            sRet += *psText;
+            continue;
+        }
+        MCString::const_iterator it = mssParams.find(Part.sParam);
+        if (it != mssParams.end()) {
+            sRet += it->second;
+        }
+    }
+    return sRet;
+}
+
 CMessage CBufLine::ToMessage(const CClient& Client,
                              const MCString& mssParams) const {
     CMessage Line = m_Message;
 
-    CString sSender = Line.GetNick().GetNickMask();
-    Line.SetNick(CNick(CString::NamedFormat(sSender, mssParams)));
+    if (m_bSenderFormat) {
+        Line.SetNick(CNick(Expand(m_SenderFormat, mssParams, nullptr)));
+    }
 
-    MCString mssThisParams = mssParams;
-    if (Client.HasServerTime()) {
-        mssThisParams["text"] = m_sText;
-    } else {
-        mssThisParams["text"] =
-            Client.GetUser()->AddTimestamp(Line.GetTime(), m_sText);
+    const CString* psText = &m_sText;
+    CString sTimestamped;
+    if (m_bUsesText && !Client.HasServerTime()) {
+        sTimestamped = Client.GetUser()->AddTimestamp(Line.GetTime(), m_sText);
+        psText = &sTimestamped;
     }
 
-    // make a copy of params, because the following loop modifies the original
-    VCString vsParams = Line.GetParams();
-    for (unsigned int uIdx = 0; uIdx < vsParams.size(); ++uIdx) {
-        Line.SetParam(uIdx,
-                      CString::NamedFormat(vsParams[uIdx], mssThisParams));
+    for (const auto& Param : m_vParamFormats) {
+        Line.SetParam(Param.first, Expand(Param.second, mssParams, psText));
     }
 
     return Line;
@@ -100,6 +182,7 @@ CBuffer::size_type CBuffer::AddLine(const CMessage& Format,
     }
 
     push_back(CBufLine(Format, sText));
+    m_uLinesAdded++;
     return size();
 }
 
@@ -109,6 +192,7 @@ CBuffer::size_type CBuffer::UpdateLine(const CString& sCommand,
     for (CBufLine& Line : *this) {
         if (Line.GetCommand().Equals(sCommand)) {
             Line = CBufLine(Format, sText);
+            m_uRewrites++;
             return size();
         }
     }
@@ -46,6 +46,8 @@ CChan::CChan(const CString& sName, CIRCNetwork* pNetwork, bool bInConfig,
       m_uJoinTries(0),
       m_sDefaultModes(""),
       m_msNicks(),
+      m_mNickIndex(0, CCaseMapping::CHash{&pNetwork->GetCaseMapping()},
+                   CCaseMapping::CEqual{&pNetwork->GetCaseMapping()}),
       m_Buffer(),
       m_bModeKnown(false),
       m_mcsModes() {
@@ -477,16 +479,17 @@ CString CChan::GetModeArg(CString& sArgs) const {
     return sRet;
 }
 
-void CChan::ClearNicks() { m_msNicks.clear(); }
+void CChan::ClearNicks() {
+    m_msNicks.clear();
+    m_mNickIndex.clear();
+}
 
 int CChan::AddNicks(const CString& sNicks) {
     int iRet = 0;
-    VCString vsNicks;
-
-    sNicks.Split(" ", vsNicks, false);
+    CStringTokenizer Nicks(sNicks);
 
-    for (const CString& sNick : vsNicks) {
-        if (AddNick(sNick)) {
+    while (Nicks.Next()) {
+        if (AddNick(Nicks.GetToken())) {
             iRet++;
         }
     }
@@ -520,6 +523,12 @@ bool CChan::AddNick(const CString& sNick) {
     if (!pNick) {
         pNick = &tmpNick;
         pNick->SetNetwork(m_pNetwork);
+    } else if (pNick->GetNick() != sTmp) {
+        // Same nick in another case, which the server knows better
+        tmpNick = *pNick;
+        tmpNick.SetNick(sTmp);
+        RemNick(sTmp);
+        pNick = &tmpNick;
     }
 
     if (!sIdent.empty()) pNick->SetIdent(sIdent);
@@ -535,7 +544,13 @@ bool CChan::AddNick(const CString& sNick) {
         }
     }
 
-    m_msNicks[pNick->GetNick()] = *pNick;
+    auto it = m_msNicks.find(pNick->GetNick());
+    if (it == m_msNicks.end()) {
+        it = m_msNicks.emplace(pNick->GetNick(), *pNick).first;
+        m_mNickIndex.emplace(it->first, it);
+    } else {
+        it->second = *pNick;
+    }
 
     return true;
 }
@@ -555,44 +570,54 @@ map<char, unsigned int> CChan::GetPermCounts() const {
 }
 
 bool CChan::RemNick(const CString& sNick) {
-    map<CString, CNick>::iterator it;
-
-    it = m_msNicks.find(sNick);
-    if (it == m_msNicks.end()) {
+    auto it = m_mNickIndex.find(sNick);
+    if (it == m_mNickIndex.end()) {
         return false;
     }
 
-    m_msNicks.erase(it);
+    m_msNicks.erase(it->second);
+    m_mNickIndex.erase(it);
 
     return true;
 }
 
 bool CChan::ChangeNick(const CString& sOldNick, const CString& sNewNick) {
-    map<CString, CNick>::iterator it = m_msNicks.find(sOldNick);
+    auto it = m_mNickIndex.find(sOldNick);
 
-    if (it == m_msNicks.end()) {
+    if (it == m_mNickIndex.end()) {
         return false;
     }
 
     // Rename this nick
-    it->second.SetNick(sNewNick);
+    CNick Nick = it->second->second;
+    Nick.SetNick(sNewNick);
 
-    // Insert a new element into the map then erase the old one, do this to
-    // change the key to the new nick
-    m_msNicks[sNewNick] = it->second;
-    m_msNicks.erase(it);
+    // Erase the old element then insert a new one, to change the key to the
+    // new nick. The new nick may differ only in case from the old one.
+    m_msNicks.erase(it->second);
+    m_mNickIndex.erase(it);
+    RemNick(sNewNick);
+    auto itNew = m_msNicks.emplace(sNewNick, Nick).first;
+    m_mNickIndex.emplace(itNew->first, itNew);
 
     return true;
 }
 
+void CChan::ReindexNicks() {
+    m_mNickIndex.clear();
+    for (auto it = m_msNicks.begin(); it != m_msNicks.end(); ++it) {
+        m_mNickIndex.emplace(it->first, it);
+    }
+}
+
 const CNick* CChan::FindNick(const CString& sNick) const {
-    map<CString, CNick>::const_iterator it = m_msNicks.find(sNick);
-    return (it != m_msNicks.end()) ? &it->second : nullptr;
+    auto it = m_mNickIndex.find(sNick);
+    return (it != m_mNickIndex.end()) ? &it->second->second : nullptr;
 }
 
 CNick* CChan::FindNick(const CString& sNick) {
-    map<CString, CNick>::iterator it = m_msNicks.find(sNick);
-    return (it != m_msNicks.end()) ? &it->second : nullptr;
+    auto it = m_mNickIndex.find(sNick);
+    return (it != m_mNickIndex.end()) ? &it->second->second : nullptr;
 }
 
 void CChan::SendBuffer(CClient* pClient) {
@@ -608,23 +633,27 @@ void CChan::SendBuffer(CClient* pClient, const CBuffer& Buffer) {
         // clients for the user I'm presuming here that pClient is listed
         // inside vClients thus vClients at this point can't be empty.
         //
-        // This loop has to be cycled twice to maintain the existing behavior
-        // which is
+        // For each client:
         // 1. OnChanBufferStarting
-        // 2. OnChanBufferPlayLine
-        // 3. ClearBuffer() if not keeping the buffer
-        // 4. OnChanBufferEnding
-        //
-        // With the exception of ClearBuffer(), this needs to happen per
-        // client, and if pClient is not nullptr, the loops break after the
-        // first iteration.
+        // 2. OnChanBufferPlayMessage for every line
+        // 3. OnChanBufferEnding
         //
-        // Rework this if you like ...
+        // Only the start is sent from here. The lines are played back in
+        // slices by the client, interleaved with other clients and paced by
+        // their send buffers, see CClient::QueuePlayback(). The buffer may be
+        // cleared right after this, so the clients share a copy of it.
         if (!Buffer.IsEmpty()) {
+            std::shared_ptr<const CBuffer> spBuffer =
+                std::make_shared<CBuffer>(Buffer);
             const vector<CClient*>& vClients = m_pNetwork->GetClients();
             for (CClient* pEachClient : vClients) {
                 CClient* pUseClient = (pClient ? pClient : pEachClient);
 
+                // Don't interleave with an earlier playback of this channel
+                if (pUseClient->HasPendingPlayback(GetName())) {
+                    pUseClient->FlushPlayback();
+                }
+
                 bool bWasPlaybackActive = pUseClient->IsPlaybackActive();
                 pUseClient->SetPlaybackActive(true);
 
@@ -639,50 +668,16 @@ void CChan::SendBuffer(CClient* pClient, const CBuffer& Buffer) {
                                         pUseClient);
                 }
 
-                bool bBatch = pUseClient->HasBatch();
-                CString sBatchName = GetName().MD5();
-
-                if (bBatch) {
+                CString sBatchName;
+                if (pUseClient->HasBatch()) {
+                    sBatchName = GetName().MD5();
                     m_pNetwork->PutUser(":znc.in BATCH +" + sBatchName +
                                             " znc.in/playback " + GetName(),
                                         pUseClient);
                 }
 
-                size_t uSize = Buffer.Size();
-                for (size_t uIdx = 0; uIdx < uSize; uIdx++) {
-                    const CBufLine& BufLine = Buffer.GetBufLine(uIdx);
-                    CMessage Message =
-                        BufLine.ToMessage(*pUseClient, MCString::EmptyMap);
-                    Message.SetChan(this);
-                    Message.SetNetwork(m_pNetwork);
-                    Message.SetClient(pUseClient);
-                    if (bBatch) {
-                        Message.SetTag("batch", sBatchName);
-                    }
-                    bool bNotShowThisLine = false;
-                    NETWORKMODULECALL(OnChanBufferPlayMessage(Message),
-                                      m_pNetwork->GetUser(), m_pNetwork,
-                                      nullptr, &bNotShowThisLine);
-                    if (bNotShowThisLine) continue;
-                    m_pNetwork->PutUser(Message, pUseClient);
-                }
-
-                bSkipStatusMsg = pUseClient->HasServerTime();
-                NETWORKMODULECALL(OnChanBufferEnding(*this, *pUseClient),
-                                  m_pNetwork->GetUser(), m_pNetwork, nullptr,
-                                  &bSkipStatusMsg);
-                if (!bSkipStatusMsg) {
-                    m_pNetwork->PutUser(":***!znc@znc.in PRIVMSG " + GetName() +
-                                            " :" + t_s("Playback Complete."),
-                                        pUseClient);
-                }
-
-                if (bBatch) {
-                    m_pNetwork->PutUser(":znc.in BATCH -" + sBatchName,
-                                        pUseClient);
-                }
-
                 pUseClient->SetPlaybackActive(bWasPlaybackActive);
+                pUseClient->QueuePlayback(*this, spBuffer, sBatchName);
 
                 if (pClient) break;
             }
@@ -690,6 +685,38 @@ void CChan::SendBuffer(CClient* pClient, const CBuffer& Buffer) {
     }
 }
 
+void CChan::SendBufferLine(CClient* pClient, const CBufLine& BufLine,
+                           const CString& sBatchName) {
+    CMessage Message = BufLine.ToMessage(*pClient, MCString::EmptyMap);
+    Message.SetChan(this);
+    Message.SetNetwork(m_pNetwork);
+    Message.SetClient(pClient);
+    if (!sBatchName.empty()) {
+        Message.SetTag("batch", sBatchName);
+    }
+    bool bNotShowThisLine = false;
+    NETWORKMODULECALL(OnChanBufferPlayMessage(Message), m_pNetwork->GetUser(),
+                      m_pNetwork, nullptr, &bNotShowThisLine);
+    if (bNotShowThisLine) return;
+    m_pNetwork->PutUser(Message, pClient);
+}
+
+void CChan::SendBufferEnd(CClient* pClient, const CString& sBatchName) {
+    bool bSkipStatusMsg = pClient->HasServerTime();
+    NETWORKMODULECALL(OnChanBufferEnding(*this, *pClient),
+                      m_pNetwork->GetUser(), m_pNetwork, nullptr,
+                      &bSkipStatusMsg);
+    if (!bSkipStatusMsg) {
+        m_pNetwork->PutUser(":***!znc@znc.in PRIVMSG " + GetName() + " :" +
+                                t_s("Playback Complete."),
+                            pClient);
+    }
+
+    if (!sBatchName.empty()) {
+        m_pNetwork->PutUser(":znc.in BATCH -" + sBatchName, pClient);
+    }
+}
+
 void CChan::Enable() {
     ResetJoinTries();
     m_bDisabled = false;
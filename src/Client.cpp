@@ -76,6 +76,8 @@ using std::vector;
     }
 
 CClient::~CClient() {
+    CZNC::Get().DelKeepAlive(this);
+    CZNC::Get().DelPlayback(this);
     if (m_spAuth) {
         CClientAuth* pAuth = (CClientAuth*)&(*m_spAuth);
         pAuth->Invalidate();
@@ -103,8 +105,7 @@ void CClient::ReadLine(const CString& sData) {
     CLanguageScope user_lang(GetUser() ? GetUser()->GetLanguage() : "");
     CString sLine = sData;
 
-    sLine.Replace("\n", "");
-    sLine.Replace("\r", "");
+    sLine.StripCRLF();
 
     DEBUG("(" << GetFullName() << ") CLI -> ZNC ["
         << CDebug::Filter(sLine) << "]");
@@ -232,6 +233,8 @@ void CClient::SetNick(const CString& s) { m_sNick = s; }
 
 void CClient::SetNetwork(CIRCNetwork* pNetwork, bool bDisconnect,
                          bool bReconnect) {
+    AbortPlayback();
+
     if (m_pNetwork) {
         m_pNetwork->ClientDisconnected(this);
 
@@ -384,6 +387,7 @@ void CClient::AcceptLogin(CUser& User) {
     // Set our proper timeout and set back our proper timeout mode
     // (constructor set a different timeout and mode)
     SetTimeout(User.GetNoTrafficTimeout(), TMO_READ);
+    CZNC::Get().AddKeepAlive(this);
 
     SetSockName("USR::" + m_pUser->GetUserName());
     SetEncoding(m_pUser->GetClientEncoding());
@@ -481,6 +485,18 @@ void CClient::PutClient(const CString& sLine) {
 }
 
 bool CClient::PutClient(const CMessage& Message) {
+    if (!m_bPlaybackActive && Message.GetChan()) {
+        // Keep the order of the channel's messages
+        for (CPlayback& Playback : m_lPlayback) {
+            if (Playback.sChan.Equals(Message.GetChan()->GetName())) {
+                Playback.vDeferred.push_back(Message);
+                // The channel may be gone by the time this is sent
+                Playback.vDeferred.back().SetChan(nullptr);
+                return true;
+            }
+        }
+    }
+
     if (!m_bAwayNotify && Message.GetType() == CMessage::Type::Away) {
         return false;
     } else if (!m_bAccountNotify &&
@@ -589,6 +605,109 @@ bool CClient::PutClientRaw(const CString& sLine) {
     return true;
 }
 
+const size_t CClient::m_uPlaybackSlice = 100;
+// Bytes in the send buffer above which playback waits for it to drain
+static const size_t PLAYBACK_HIGH_WATER = 64 * 1024;
+
+void CClient::QueuePlayback(const CChan& Chan,
+                            const std::shared_ptr<const CBuffer>& spBuffer,
+                            const CString& sBatchName) {
+    if (m_lPlayback.empty()) {
+        m_uPlaybackStart = CUtils::GetMillTime();
+        m_uPlaybackLines = 0;
+    }
+    m_lPlayback.push_back({Chan.GetName(), spBuffer, 0, sBatchName, {}});
+
+    // Short buffers are played back right away
+    if (m_lPlayback.size() == 1) ContinuePlayback(m_uPlaybackSlice);
+    if (HasPendingPlayback()) CZNC::Get().AddPlayback(this);
+}
+
+bool CClient::HasPendingPlayback(const CString& sChan) const {
+    for (const CPlayback& Playback : m_lPlayback) {
+        if (Playback.sChan.Equals(sChan)) return true;
+    }
+    return false;
+}
+
+size_t CClient::ContinuePlayback(size_t uMaxLines) {
+    if (GetInternalWriteBuffer().size() > PLAYBACK_HIGH_WATER) return 0;
+    return PlayBack(uMaxLines);
+}
+
+void CClient::FlushPlayback() {
+    PlayBack(std::numeric_limits<size_t>::max());
+}
+
+size_t CClient::PlayBack(size_t uMaxLines) {
+    size_t uLines = 0;
+    while (uLines < uMaxLines && !m_lPlayback.empty()) {
+        // Modules may start or flush another playback from the hooks, so
+        // take the current one off the list while it's being sent
+        std::list<CPlayback> lCurrent;
+        lCurrent.splice(lCurrent.begin(), m_lPlayback, m_lPlayback.begin());
+        CPlayback& Playback = lCurrent.front();
+
+        CChan* pChan =
+            m_pNetwork ? m_pNetwork->FindChan(Playback.sChan) : nullptr;
+        bool bWasPlaybackActive = m_bPlaybackActive;
+        m_bPlaybackActive = true;
+        if (pChan) {
+            const CBuffer& Buffer = *Playback.spBuffer;
+            while (uLines < uMaxLines && Playback.uNext < Buffer.Size()) {
+                pChan->SendBufferLine(
+                    this, Buffer.GetBufLine(Playback.uNext++),
+                    Playback.sBatchName);
+                uLines++;
+            }
+        }
+        m_bPlaybackActive = bWasPlaybackActive;
+
+        if (pChan && Playback.uNext < Playback.spBuffer->Size()) {
+            m_lPlayback.splice(m_lPlayback.begin(), lCurrent);
+        } else {
+            EndPlayback(Playback, pChan);
+        }
+    }
+
+    m_uPlaybackLines += uLines;
+    if (m_lPlayback.empty() && m_uPlaybackLines > 0) {
+        unsigned long long uMsecs = CUtils::GetMillTime() - m_uPlaybackStart;
+        DEBUG("(" << GetFullName() << ") played back " << m_uPlaybackLines
+                  << " lines in " << uMsecs << " ms ("
+                  << m_uPlaybackLines * 1000 / std::max(uMsecs, 1ULL)
+                  << " lines/s)");
+        m_uPlaybackLines = 0;
+    }
+    return uLines;
+}
+
+void CClient::EndPlayback(CPlayback& Playback, CChan* pChan) {
+    bool bWasPlaybackActive = m_bPlaybackActive;
+    m_bPlaybackActive = true;
+    if (pChan) {
+        pChan->SendBufferEnd(this, Playback.sBatchName);
+    } else if (!Playback.sBatchName.empty()) {
+        PutClient(":znc.in BATCH -" + Playback.sBatchName);
+    }
+    m_bPlaybackActive = bWasPlaybackActive;
+
+    for (CMessage& Message : Playback.vDeferred) {
+        Message.SetChan(pChan);
+        PutClient(Message);
+    }
+}
+
+void CClient::AbortPlayback() {
+    // The channels are of the network the client leaves
+    while (HasPendingPlayback()) {
+        CPlayback Playback = std::move(m_lPlayback.front());
+        m_lPlayback.pop_front();
+        EndPlayback(Playback, nullptr);
+    }
+    CZNC::Get().DelPlayback(this);
+}
+
 void CClient::PutStatusNotice(const CString& sLine) {
     PutModNotice("status", sLine);
 }
@@ -27,6 +27,34 @@ using std::vector;
 using std::set;
 using std::map;
 
+namespace {
+// The words of a command, split once. Arg(n) and Rest(n) are what
+// Token(n) and Token(n, true) of the line would be.
+class CCommandArgs {
+  public:
+    explicit CCommandArgs(const CString& sLine) : m_sLine(sLine) {
+        CStringTokenizer Tokens(m_sLine);
+        while (Tokens.Next()) {
+            m_vsArgs.push_back(Tokens.GetToken());
+            m_vuStarts.push_back(Tokens.GetData() - m_sLine.data());
+        }
+    }
+
+    CString Arg(size_t uPos) const {
+        return uPos < m_vsArgs.size() ? m_vsArgs[uPos] : "";
+    }
+    CString Rest(size_t uPos) const {
+        return uPos < m_vuStarts.size() ? m_sLine.substr(m_vuStarts[uPos])
+                                        : "";
+    }
+
+  private:
+    const CString m_sLine;
+    VCString m_vsArgs;
+    vector<size_t> m_vuStarts;
+};
+}  // namespace
+
 void CClient::UserCommand(CString& sLine) {
     if (!m_pUser) {
         return;
@@ -41,10 +69,11 @@ void CClient::UserCommand(CString& sLine) {
                       &bReturn);
     if (bReturn) return;
 
-    const CString sCommand = sLine.Token(0);
+    const CCommandArgs Args(sLine);
+    const CString sCommand = Args.Arg(0);
 
     if (sCommand.Equals("HELP")) {
-        HelpUser(sLine.Token(1));
+        HelpUser(Args.Arg(1));
     } else if (sCommand.Equals("LISTNICKS")) {
         if (!m_pNetwork) {
             PutStatus(t_s(
@@ -52,7 +81,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sChan = sLine.Token(1);
+        CString sChan = Args.Arg(1);
 
         if (sChan.empty()) {
             PutStatus(t_s("Usage: ListNicks <#chan>"));
@@ -116,7 +145,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sPatterns = sLine.Token(1, true);
+        CString sPatterns = Args.Rest(1);
 
         if (sPatterns.empty()) {
             PutStatus(t_s("Usage: Attach <#chans>"));
@@ -138,7 +167,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sPatterns = sLine.Token(1, true);
+        CString sPatterns = Args.Rest(1);
 
         if (sPatterns.empty()) {
             PutStatus(t_s("Usage: Detach <#chans>"));
@@ -168,15 +197,25 @@ void CClient::UserCommand(CString& sLine) {
         } else {
             PutStatus(t_f("Rehashing failed: {1}")(sRet));
         }
+
+        for (const CString& sLine : CZNC::Get().GetRehashReport()) {
+            PutStatus(sLine);
+        }
     } else if (m_pUser->IsAdmin() && sCommand.Equals("SaveConfig")) {
         if (CZNC::Get().WriteConfig()) {
             PutStatus(t_f("Wrote config to {1}")(CZNC::Get().GetConfigFile()));
+            PutStatus(t_f("{1} config writes so far, {2} requests coalesced. "
+                          "Last write: {3} in {4} ms")(
+                CZNC::Get().GetConfigWriteCount(),
+                CZNC::Get().GetConfigWriteCoalesced(),
+                CString::ToByteStr(CZNC::Get().GetLastConfigWriteSize()),
+                CZNC::Get().GetLastConfigWriteTime()));
         } else {
             PutStatus(t_s("Error while trying to write config."));
         }
     } else if (sCommand.Equals("LISTCLIENTS")) {
         CUser* pUser = m_pUser;
-        CString sNick = sLine.Token(1);
+        CString sNick = Args.Arg(1);
 
         if (!sNick.empty()) {
             if (!m_pUser->IsAdmin()) {
@@ -273,9 +312,60 @@ void CClient::UserCommand(CString& sLine) {
             }
         }
 
+        PutStatus(Table);
+    } else if (m_pUser->IsAdmin() && sCommand.Equals("ConnectQueue")) {
+        const vector<CIRCNetwork*> vNetworks =
+            CZNC::Get().GetScheduledConnectionQueue();
+
+        PutStatus(t_f("{1} networks queued, {2} of {3} connections in "
+                      "progress")(vNetworks.size(),
+                                  CZNC::Get().GetPendingConnections(),
+                                  CZNC::Get().GetConnectConcurrency()));
+        if (vNetworks.empty()) return;
+
+        CTable Table;
+        Table.AddColumn(t_s("Username", "connectqueuecmd"));
+        Table.AddColumn(t_s("Network", "connectqueuecmd"));
+        Table.AddColumn(t_s("Priority", "connectqueuecmd"));
+        Table.AddColumn(t_s("Failures", "connectqueuecmd"));
+        Table.AddColumn(t_s("Next attempt", "connectqueuecmd"));
+
+        time_t tNow = time(nullptr);
+        for (const CIRCNetwork* pNetwork : vNetworks) {
+            Table.AddRow();
+            Table.SetCell(t_s("Username", "connectqueuecmd"),
+                          pNetwork->GetUser()->GetUserName());
+            Table.SetCell(t_s("Network", "connectqueuecmd"),
+                          pNetwork->GetName());
+            switch (pNetwork->GetConnectPriority()) {
+                case CIRCNetwork::CONNECT_PRIO_ADMIN:
+                    Table.SetCell(t_s("Priority", "connectqueuecmd"),
+                                  t_s("Admin", "connectqueuecmd"));
+                    break;
+                case CIRCNetwork::CONNECT_PRIO_ACTIVE:
+                    Table.SetCell(t_s("Priority", "connectqueuecmd"),
+                                  t_s("Active", "connectqueuecmd"));
+                    break;
+                case CIRCNetwork::CONNECT_PRIO_NORMAL:
+                    Table.SetCell(t_s("Priority", "connectqueuecmd"),
+                                  t_s("Normal", "connectqueuecmd"));
+                    break;
+            }
+            Table.SetCell(t_s("Failures", "connectqueuecmd"),
+                          CString(pNetwork->GetConnectFailures()));
+            if (pNetwork->GetNextConnectTime() > tNow) {
+                Table.SetCell(t_s("Next attempt", "connectqueuecmd"),
+                              t_f("in {1}s", "connectqueuecmd")(
+                                  pNetwork->GetNextConnectTime() - tNow));
+            } else {
+                Table.SetCell(t_s("Next attempt", "connectqueuecmd"),
+                              t_s("Now", "connectqueuecmd"));
+            }
+        }
+
         PutStatus(Table);
     } else if (m_pUser->IsAdmin() && sCommand.Equals("SetMOTD")) {
-        CString sMessage = sLine.Token(1, true);
+        CString sMessage = Args.Rest(1);
 
         if (sMessage.empty()) {
             PutStatus("Usage: SetMOTD <message>");
@@ -284,7 +374,7 @@ void CClient::UserCommand(CString& sLine) {
             PutStatus("MOTD set to [" + sMessage + "]");
         }
     } else if (m_pUser->IsAdmin() && sCommand.Equals("AddMOTD")) {
-        CString sMessage = sLine.Token(1, true);
+        CString sMessage = Args.Rest(1);
 
         if (sMessage.empty()) {
             PutStatus("Usage: AddMOTD <message>");
@@ -296,11 +386,11 @@ void CClient::UserCommand(CString& sLine) {
         CZNC::Get().ClearMotd();
         PutStatus("Cleared MOTD");
     } else if (m_pUser->IsAdmin() && sCommand.Equals("BROADCAST")) {
-        CZNC::Get().Broadcast(sLine.Token(1, true));
+        CZNC::Get().Broadcast(Args.Rest(1));
     } else if (m_pUser->IsAdmin() &&
                (sCommand.Equals("SHUTDOWN") || sCommand.Equals("RESTART"))) {
         bool bRestart = sCommand.Equals("RESTART");
-        CString sMessage = sLine.Token(1, true);
+        CString sMessage = Args.Rest(1);
         bool bForce = false;
 
         if (sMessage.Token(0).Equals("FORCE")) {
@@ -334,7 +424,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sArgs = sLine.Token(1, true);
+        CString sArgs = Args.Rest(1);
         sArgs.Trim();
         CServer* pServer = nullptr;
 
@@ -381,7 +471,7 @@ void CClient::UserCommand(CString& sLine) {
         }
 
         if (GetIRCSock()) {
-            CString sQuitMsg = sLine.Token(1, true);
+            CString sQuitMsg = Args.Rest(1);
             GetIRCSock()->Quit(sQuitMsg);
         }
 
@@ -395,7 +485,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sPatterns = sLine.Token(1, true);
+        CString sPatterns = Args.Rest(1);
 
         if (sPatterns.empty()) {
             PutStatus("Usage: EnableChan <#chans>");
@@ -420,7 +510,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sPatterns = sLine.Token(1, true);
+        CString sPatterns = Args.Rest(1);
 
         if (sPatterns.empty()) {
             PutStatus("Usage: DisableChan <#chans>");
@@ -447,8 +537,8 @@ void CClient::UserCommand(CString& sLine) {
 
         CIRCNetwork* pNetwork = m_pNetwork;
 
-        const CString sUser = sLine.Token(1);
-        const CString sNetwork = sLine.Token(2);
+        const CString sUser = Args.Arg(1);
+        const CString sNetwork = Args.Arg(2);
 
         if (!sUser.empty()) {
             if (!m_pUser->IsAdmin()) {
@@ -544,7 +634,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sNetwork = sLine.Token(1);
+        CString sNetwork = Args.Arg(1);
 
         if (sNetwork.empty()) {
             PutStatus(t_s("Usage: AddNetwork <name>"));
@@ -567,7 +657,7 @@ void CClient::UserCommand(CString& sLine) {
             PutStatus(sNetworkAddError);
         }
     } else if (sCommand.Equals("DELNETWORK")) {
-        CString sNetwork = sLine.Token(1);
+        CString sNetwork = Args.Arg(1);
 
         if (sNetwork.empty()) {
             PutStatus(t_s("Usage: DelNetwork <name>"));
@@ -588,11 +678,11 @@ void CClient::UserCommand(CString& sLine) {
     } else if (sCommand.Equals("LISTNETWORKS")) {
         CUser* pUser = m_pUser;
 
-        if (m_pUser->IsAdmin() && !sLine.Token(1).empty()) {
-            pUser = CZNC::Get().FindUser(sLine.Token(1));
+        if (m_pUser->IsAdmin() && !Args.Arg(1).empty()) {
+            pUser = CZNC::Get().FindUser(Args.Arg(1));
 
             if (!pUser) {
-                PutStatus(t_f("User {1} not found")(sLine.Token(1)));
+                PutStatus(t_f("User {1} not found")(Args.Arg(1)));
                 return;
             }
         }
@@ -627,16 +717,47 @@ void CClient::UserCommand(CString& sLine) {
         if (PutStatus(Table) == 0) {
             PutStatus(t_s("No networks", "listnetworks"));
         }
+    } else if (sCommand.Equals("SENDQUEUE")) {
+        CTable Table;
+        Table.AddColumn(t_s("Network", "sendqueuecmd"));
+        Table.AddColumn(t_s("Queued", "sendqueuecmd"));
+        Table.AddColumn(t_s("Sent", "sendqueuecmd"));
+        Table.AddColumn(t_s("Average wait", "sendqueuecmd"));
+        Table.AddColumn(t_s("Max wait", "sendqueuecmd"));
+
+        for (const CIRCNetwork* pNetwork : m_pUser->GetNetworks()) {
+            const CIRCSock* pIRCSock = pNetwork->GetIRCSock();
+            if (!pIRCSock) continue;
+
+            unsigned long long uSent = pIRCSock->GetSentLines();
+            Table.AddRow();
+            Table.SetCell(t_s("Network", "sendqueuecmd"), pNetwork->GetName());
+            Table.SetCell(t_s("Queued", "sendqueuecmd"),
+                          CString(pIRCSock->GetSendQueueSize()));
+            Table.SetCell(t_s("Sent", "sendqueuecmd"), CString(uSent));
+            Table.SetCell(
+                t_s("Average wait", "sendqueuecmd"),
+                t_f("{1} ms", "sendqueuecmd")(
+                    uSent ? pIRCSock->GetSendWaitTotal() / uSent : 0));
+            Table.SetCell(t_s("Max wait", "sendqueuecmd"),
+                          t_f("{1} ms", "sendqueuecmd")(
+                              pIRCSock->GetSendWaitMax()));
+        }
+
+        if (PutStatus(Table) == 0) {
+            PutStatus(t_s("You are not connected to any network",
+                          "sendqueuecmd"));
+        }
     } else if (sCommand.Equals("MOVENETWORK")) {
         if (!m_pUser->IsAdmin()) {
             PutStatus(t_s("Access denied."));
             return;
         }
 
-        CString sOldUser = sLine.Token(1);
-        CString sOldNetwork = sLine.Token(2);
-        CString sNewUser = sLine.Token(3);
-        CString sNewNetwork = sLine.Token(4);
+        CString sOldUser = Args.Arg(1);
+        CString sOldNetwork = Args.Arg(2);
+        CString sNewUser = Args.Arg(3);
+        CString sNewNetwork = Args.Arg(4);
 
         if (sOldUser.empty() || sOldNetwork.empty() || sNewUser.empty()) {
             PutStatus(t_s(
@@ -722,7 +843,7 @@ void CClient::UserCommand(CString& sLine) {
                     "network"));
         }
     } else if (sCommand.Equals("JUMPNETWORK")) {
-        CString sNetwork = sLine.Token(1);
+        CString sNetwork = Args.Arg(1);
 
         if (sNetwork.empty()) {
             PutStatus(t_s("No network supplied."));
@@ -742,7 +863,7 @@ void CClient::UserCommand(CString& sLine) {
             PutStatus(t_f("You don't have a network named {1}")(sNetwork));
         }
     } else if (sCommand.Equals("ADDSERVER")) {
-        CString sServer = sLine.Token(1);
+        CString sServer = Args.Arg(1);
 
         if (!m_pNetwork) {
             PutStatus(t_s(
@@ -755,7 +876,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        if (m_pNetwork->AddServer(sLine.Token(1, true))) {
+        if (m_pNetwork->AddServer(Args.Rest(1))) {
             PutStatus(t_s("Server added"));
         } else {
             PutStatus(
@@ -769,9 +890,9 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sServer = sLine.Token(1);
-        unsigned short uPort = sLine.Token(2).ToUShort();
-        CString sPass = sLine.Token(3);
+        CString sServer = Args.Arg(1);
+        unsigned short uPort = Args.Arg(2).ToUShort();
+        CString sPass = Args.Arg(3);
 
         if (sServer.empty()) {
             PutStatus(t_s("Usage: DelServer <host> [port] [pass]"));
@@ -827,7 +948,7 @@ void CClient::UserCommand(CString& sLine) {
                 "You must be connected with a network to use this command"));
             return;
         }
-        CString sFP = sLine.Token(1);
+        CString sFP = Args.Arg(1);
         if (sFP.empty()) {
             PutStatus(t_s("Usage: AddTrustedServerFingerprint <fi:ng:er>"));
             return;
@@ -840,7 +961,7 @@ void CClient::UserCommand(CString& sLine) {
                 "You must be connected with a network to use this command"));
             return;
         }
-        CString sFP = sLine.Token(1);
+        CString sFP = Args.Arg(1);
         if (sFP.empty()) {
             PutStatus(t_s("Usage: DelTrustedServerFingerprint <fi:ng:er>"));
             return;
@@ -989,9 +1110,9 @@ void CClient::UserCommand(CString& sLine) {
         return;
     } else if (sCommand.Equals("LOADMOD") || sCommand.Equals("LOADMODULE")) {
         CModInfo::EModuleType eType;
-        CString sType = sLine.Token(1);
-        CString sMod = sLine.Token(2);
-        CString sArgs = sLine.Token(3, true);
+        CString sType = Args.Arg(1);
+        CString sMod = Args.Arg(2);
+        CString sArgs = Args.Rest(3);
 
         // TODO use proper library for parsing arguments
         if (sType.Equals("--type=global")) {
@@ -1002,7 +1123,7 @@ void CClient::UserCommand(CString& sLine) {
             eType = CModInfo::NetworkModule;
         } else {
             sMod = sType;
-            sArgs = sLine.Token(2, true);
+            sArgs = Args.Rest(2);
             sType = "default";
             // Will be set correctly later
             eType = CModInfo::UserModule;
@@ -1077,8 +1198,8 @@ void CClient::UserCommand(CString& sLine) {
     } else if (sCommand.Equals("UNLOADMOD") ||
                sCommand.Equals("UNLOADMODULE")) {
         CModInfo::EModuleType eType = CModInfo::UserModule;
-        CString sType = sLine.Token(1);
-        CString sMod = sLine.Token(2);
+        CString sType = Args.Arg(1);
+        CString sMod = Args.Arg(2);
 
         // TODO use proper library for parsing arguments
         if (sType.Equals("--type=global")) {
@@ -1150,9 +1271,9 @@ void CClient::UserCommand(CString& sLine) {
     } else if (sCommand.Equals("RELOADMOD") ||
                sCommand.Equals("RELOADMODULE")) {
         CModInfo::EModuleType eType;
-        CString sType = sLine.Token(1);
-        CString sMod = sLine.Token(2);
-        CString sArgs = sLine.Token(3, true);
+        CString sType = Args.Arg(1);
+        CString sMod = Args.Arg(2);
+        CString sArgs = Args.Rest(3);
 
         if (m_pUser->DenyLoadMod()) {
             PutStatus(t_s("Unable to reload modules. Access denied."));
@@ -1168,7 +1289,7 @@ void CClient::UserCommand(CString& sLine) {
             eType = CModInfo::NetworkModule;
         } else {
             sMod = sType;
-            sArgs = sLine.Token(2, true);
+            sArgs = Args.Rest(2);
             sType = "default";
             // Will be set correctly later
             eType = CModInfo::UserModule;
@@ -1230,7 +1351,7 @@ void CClient::UserCommand(CString& sLine) {
     } else if ((sCommand.Equals("UPDATEMOD") ||
                 sCommand.Equals("UPDATEMODULE")) &&
                m_pUser->IsAdmin()) {
-        CString sMod = sLine.Token(1);
+        CString sMod = Args.Arg(1);
 
         if (sMod.empty()) {
             PutStatus(t_s("Usage: UpdateMod <module>"));
@@ -1254,7 +1375,7 @@ void CClient::UserCommand(CString& sLine) {
                 "SetUserBindHost instead"));
             return;
         }
-        CString sArg = sLine.Token(1);
+        CString sArg = Args.Arg(1);
 
         if (sArg.empty()) {
             PutStatus(t_s("Usage: SetBindHost <host>"));
@@ -1271,7 +1392,7 @@ void CClient::UserCommand(CString& sLine) {
             m_pNetwork->GetName(), m_pNetwork->GetBindHost()));
     } else if (sCommand.Equals("SETUSERBINDHOST") &&
                (m_pUser->IsAdmin() || !m_pUser->DenySetBindHost())) {
-        CString sArg = sLine.Token(1);
+        CString sArg = Args.Arg(1);
 
         if (sArg.empty()) {
             PutStatus(t_s("Usage: SetUserBindHost <host>"));
@@ -1322,7 +1443,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sBuffer = sLine.Token(1);
+        CString sBuffer = Args.Arg(1);
 
         if (sBuffer.empty()) {
             PutStatus(t_s("Usage: PlayBuffer <#chan|query>"));
@@ -1370,7 +1491,7 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sBuffer = sLine.Token(1);
+        CString sBuffer = Args.Arg(1);
 
         if (sBuffer.empty()) {
             PutStatus(t_s("Usage: ClearBuffer <#chan|query>"));
@@ -1434,14 +1555,14 @@ void CClient::UserCommand(CString& sLine) {
             return;
         }
 
-        CString sBuffer = sLine.Token(1);
+        CString sBuffer = Args.Arg(1);
 
         if (sBuffer.empty()) {
             PutStatus(t_s("Usage: SetBuffer <#chan|query> [linecount]"));
             return;
         }
 
-        unsigned int uLineCount = sLine.Token(2).ToUInt();
+        unsigned int uLineCount = Args.Arg(2).ToUInt();
         unsigned int uMatches = 0, uFail = 0;
         vector<CChan*> vChans = m_pNetwork->FindChans(sBuffer);
         for (CChan* pChan : vChans) {
@@ -1532,7 +1653,8 @@ void CClient::UserCommand(CString& sLine) {
 }
 
 void CClient::UserPortCommand(CString& sLine) {
-    const CString sCommand = sLine.Token(0);
+    const CCommandArgs Args(sLine);
+    const CString sCommand = Args.Arg(0);
 
     if (sCommand.Equals("LISTPORTS")) {
         CTable Table;
@@ -1581,8 +1703,8 @@ void CClient::UserPortCommand(CString& sLine) {
         return;
     }
 
-    CString sPort = sLine.Token(1);
-    CString sAddr = sLine.Token(2);
+    CString sPort = Args.Arg(1);
+    CString sAddr = Args.Arg(2);
     EAddrType eAddr = ADDR_ALL;
 
     if (sAddr.Equals("IPV4")) {
@@ -1599,7 +1721,7 @@ void CClient::UserPortCommand(CString& sLine) {
 
     if (sCommand.Equals("ADDPORT")) {
         CListener::EAcceptType eAccept = CListener::ACCEPT_ALL;
-        CString sAccept = sLine.Token(3);
+        CString sAccept = Args.Arg(3);
 
         if (sAccept.Equals("WEB")) {
             eAccept = CListener::ACCEPT_HTTP;
@@ -1617,8 +1739,8 @@ void CClient::UserPortCommand(CString& sLine) {
                     "[bindhost [uriprefix]]"));
         } else {
             bool bSSL = (sPort.StartsWith("+"));
-            const CString sBindHost = sLine.Token(4);
-            const CString sURIPrefix = sLine.Token(5);
+            const CString sBindHost = Args.Arg(4);
+            const CString sURIPrefix = Args.Arg(5);
 
             CListener* pListener = new CListener(uPort, sBindHost, sURIPrefix,
                                                  bSSL, eAddr, eAccept);
@@ -1639,7 +1761,7 @@ void CClient::UserPortCommand(CString& sLine) {
         if (sPort.empty() || sAddr.empty()) {
             PutStatus(t_s("Usage: DelPort <port> <ipv4|ipv6|all> [bindhost]"));
         } else {
-            const CString sBindHost = sLine.Token(3);
+            const CString sBindHost = Args.Arg(3);
 
             CListener* pListener =
                 CZNC::Get().FindListener(uPort, sBindHost, eAddr);
@@ -1709,6 +1831,10 @@ void CClient::HelpUser(const CString& sFilter) {
         t_s("Delete a network from your user", "helpcmd|DelNetwork|desc"));
     AddCommandHelp("ListNetworks", "",
                    t_s("List all networks", "helpcmd|ListNetworks|desc"));
+    AddCommandHelp("SendQueue", "",
+                   t_s("Show the lines waiting to be sent to IRC because of "
+                       "flood protection",
+                       "helpcmd|SendQueue|desc"));
     if (m_pUser->IsAdmin()) {
         AddCommandHelp("MoveNetwork",
                        t_s("<old user> <old network> <new user> [new network]",
@@ -1877,6 +2003,9 @@ void CClient::HelpUser(const CString& sFilter) {
         AddCommandHelp(
             "ListClients", t_s("[user]", "helpcmd|ListClients|args"),
             t_s("List all connected clients", "helpcmd|ListClients|desc"));
+        AddCommandHelp("ConnectQueue", "",
+                       t_s("Show the networks waiting to connect to IRC",
+                           "helpcmd|ConnectQueue|desc"));
         AddCommandHelp("Traffic", "",
                        t_s("Show basic traffic stats for all ZNC users",
                            "helpcmd|Traffic|desc"));
@@ -16,16 +16,67 @@
 
 #include <znc/Config.h>
 #include <znc/FileUtils.h>
+#include <memory>
 #include <stack>
 #include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 struct ConfigStackEntry {
     CString sTag;
     CString sName;
-    CConfig Config;
+    std::unique_ptr<CConfig> pConfig;
 
     ConfigStackEntry(const CString& Tag, const CString Name)
-        : sTag(Tag), sName(Name), Config() {}
+        : sTag(Tag), sName(Name), pConfig(new CConfig) {}
+};
+
+/** Read-only view of the whole config file.
+ *
+ *  The file is mmap()ed when possible, so that a config of several megabytes
+ *  doesn't have to be pushed through CFile::ReadLine()'s buffer line by line.
+ */
+class CConfigFileView {
+  public:
+    CConfigFileView() : m_sData(), m_pMap(nullptr), m_uSize(0) {}
+    ~CConfigFileView() {
+        if (m_pMap) munmap(m_pMap, m_uSize);
+    }
+
+    CConfigFileView(const CConfigFileView&) = delete;
+    CConfigFileView& operator=(const CConfigFileView&) = delete;
+
+    bool Load(CFile& file) {
+        struct stat st;
+        if (fstat(file.GetFD(), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0) {
+            void* pMap = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                              file.GetFD(), 0);
+            if (pMap != MAP_FAILED) {
+                m_pMap = pMap;
+                m_uSize = st.st_size;
+                return true;
+            }
+        }
+
+        // Not a regular file, or mmap() is not possible; read it instead
+        char szBuf[4096];
+        ssize_t iLen;
+        while ((iLen = file.Read(szBuf, sizeof(szBuf))) > 0) {
+            m_sData.append(szBuf, iLen);
+        }
+        return iLen == 0;
+    }
+
+    const char* Data() const {
+        return m_pMap ? static_cast<const char*>(m_pMap) : m_sData.data();
+    }
+    size_t Size() const { return m_pMap ? m_uSize : m_sData.size(); }
+
+  private:
+    CString m_sData;
+    void* m_pMap;
+    size_t m_uSize;
 };
 
 CConfigEntry::CConfigEntry() : m_pSubConfig(nullptr) {}
@@ -33,10 +84,18 @@ CConfigEntry::CConfigEntry() : m_pSubConfig(nullptr) {}
 CConfigEntry::CConfigEntry(const CConfig& Config)
     : m_pSubConfig(new CConfig(Config)) {}
 
+CConfigEntry::CConfigEntry(CConfig&& Config)
+    : m_pSubConfig(new CConfig(std::move(Config))) {}
+
 CConfigEntry::CConfigEntry(const CConfigEntry& other) : m_pSubConfig(nullptr) {
     if (other.m_pSubConfig) m_pSubConfig = new CConfig(*other.m_pSubConfig);
 }
 
+CConfigEntry::CConfigEntry(CConfigEntry&& other)
+    : m_pSubConfig(other.m_pSubConfig) {
+    other.m_pSubConfig = nullptr;
+}
+
 CConfigEntry::~CConfigEntry() { delete m_pSubConfig; }
 
 CConfigEntry& CConfigEntry::operator=(const CConfigEntry& other) {
@@ -48,8 +107,20 @@ CConfigEntry& CConfigEntry::operator=(const CConfigEntry& other) {
     return *this;
 }
 
+CConfigEntry& CConfigEntry::operator=(CConfigEntry&& other) {
+    if (this != &other) {
+        delete m_pSubConfig;
+        m_pSubConfig = other.m_pSubConfig;
+        other.m_pSubConfig = nullptr;
+    }
+    return *this;
+}
+
+static bool IsConfigSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
 bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
-    CString sLine;
     unsigned int uLineNum = 0;
     CConfig* pActiveConfig = this;
     std::stack<ConfigStackEntry> ConfigStack;
@@ -60,7 +131,24 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
         return false;
     }
 
-    while (file.ReadLine(sLine)) {
+    CConfigFileView View;
+    if (!View.Load(file)) {
+        sErrorMsg = "Could not read the config.";
+        return false;
+    }
+
+    const char* pCur = View.Data();
+    const char* const pFileEnd = pCur + View.Size();
+
+    // Lines are handled as [pLine, pLineEnd) ranges inside of the file,
+    // CStrings are only created for the parts which end up in the config.
+    while (pCur < pFileEnd) {
+        const char* pNewLine = static_cast<const char*>(
+            memchr(pCur, '\n', pFileEnd - pCur));
+        const char* pLine = pCur;
+        const char* pLineEnd = pNewLine ? pNewLine : pFileEnd;
+        pCur = pNewLine ? pNewLine + 1 : pFileEnd;
+
         uLineNum++;
 
 #define ERROR(arg)                                             \
@@ -74,24 +162,35 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
     } while (0)
 
         // Remove all leading spaces and trailing line endings
-        sLine.TrimLeft();
-        sLine.TrimRight("\r\n");
-
-        if (bCommented || sLine.StartsWith("/*")) {
+        while (pLine < pLineEnd && IsConfigSpace(*pLine)) pLine++;
+        while (pLineEnd > pLine &&
+               (pLineEnd[-1] == '\r' || pLineEnd[-1] == '\n'))
+            pLineEnd--;
+
+        const size_t uLen = pLineEnd - pLine;
+        auto StartsWith = [&](const char* sPrefix, size_t uPrefixLen) {
+            return uLen >= uPrefixLen &&
+                   memcmp(pLine, sPrefix, uPrefixLen) == 0;
+        };
+        auto EndsWith = [&](const char* sSuffix, size_t uSuffixLen) {
+            return uLen >= uSuffixLen &&
+                   memcmp(pLineEnd - uSuffixLen, sSuffix, uSuffixLen) == 0;
+        };
+
+        if (bCommented || StartsWith("/*", 2)) {
             /* Does this comment end on the same line again? */
-            bCommented = (!sLine.EndsWith("*/"));
+            bCommented = (!EndsWith("*/", 2));
 
             continue;
         }
 
-        if ((sLine.empty()) || (sLine.StartsWith("#")) ||
-            (sLine.StartsWith("//"))) {
+        if ((uLen == 0) || (StartsWith("#", 1)) || (StartsWith("//", 2))) {
             continue;
         }
 
-        if ((sLine.StartsWith("<")) && (sLine.EndsWith(">"))) {
-            sLine.LeftChomp();
-            sLine.RightChomp();
+        if ((StartsWith("<", 1)) && (EndsWith(">", 1))) {
+            // Tags are rare, so just use CString for them
+            CString sLine(pLine + 1, uLen >= 2 ? uLen - 2 : 0);
             sLine.Trim();
 
             CString sTag = sLine.Token(0);
@@ -107,20 +206,19 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
                 if (ConfigStack.empty())
                     ERROR("Closing tag \"" << sTag << "\" which is not open.");
 
-                const struct ConfigStackEntry& entry = ConfigStack.top();
-                CConfig myConfig(entry.Config);
-                CString sName(entry.sName);
+                ConfigStackEntry& entry = ConfigStack.top();
 
                 if (!sTag.Equals(entry.sTag))
                     ERROR("Closing tag \"" << sTag << "\" which is not open.");
 
-                // This breaks entry
+                std::unique_ptr<CConfig> pConfig = std::move(entry.pConfig);
+                CString sName = std::move(entry.sName);
                 ConfigStack.pop();
 
                 if (ConfigStack.empty())
                     pActiveConfig = this;
                 else
-                    pActiveConfig = &ConfigStack.top().Config;
+                    pActiveConfig = ConfigStack.top().pConfig.get();
 
                 SubConfig& conf = pActiveConfig->m_SubConfigs[sTag.AsLower()];
                 SubConfig::const_iterator it = conf.find(sName);
@@ -129,20 +227,27 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
                     ERROR("Duplicate entry for tag \"" << sTag << "\" name \""
                                                        << sName << "\".");
 
-                conf[sName] = CConfigEntry(myConfig);
+                // Hand the finished block over without copying it
+                conf[sName].m_pSubConfig = pConfig.release();
             } else {
                 if (sValue.empty())
                     ERROR("Empty block name at begin of block.");
                 ConfigStack.push(ConfigStackEntry(sTag.AsLower(), sValue));
-                pActiveConfig = &ConfigStack.top().Config;
+                pActiveConfig = ConfigStack.top().pConfig.get();
             }
 
             continue;
         }
 
-        // If we have a regular line, figure out where it goes
-        CString sName = sLine.Token(0, false, "=");
-        CString sValue = sLine.Token(1, true, "=");
+        // If we have a regular line, figure out where it goes. This is
+        // Token(0, false, "=") and Token(1, true, "=") without the copies.
+        const char* p = pLine;
+        while (p < pLineEnd && *p == '=') p++;
+        const char* pName = p;
+        while (p < pLineEnd && *p != '=') p++;
+        CString sName(pName, p - pName);
+        while (p < pLineEnd && *p == '=') p++;
+        CString sValue(p, pLineEnd - p);
 
         // Only remove the first space, people might want
         // leading spaces (e.g. in the MOTD).
@@ -154,8 +259,8 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
 
         if (sName.empty() || sValue.empty()) ERROR("Malformed line");
 
-        CString sNameLower = sName.AsLower();
-        pActiveConfig->m_ConfigEntries[sNameLower].push_back(sValue);
+        pActiveConfig->m_ConfigEntries[sName.MakeLower()].push_back(
+            std::move(sValue));
     }
 
     if (bCommented) ERROR("Comment not closed at end of file.");
@@ -172,6 +277,70 @@ bool CConfig::Parse(CFile& file, CString& sErrorMsg) {
 }
 
 void CConfig::Write(CFile& File, unsigned int iIndentation) {
+    File.Write(ToString(iIndentation));
+}
+
+CString CConfig::ToString(unsigned int iIndentation) const {
+    CString sOut;
+    AppendTo(sOut, iIndentation);
+    return sOut;
+}
+
+namespace {
+template <typename Map>
+std::map<CString, const typename Map::mapped_type*> LowerKeys(const Map& m) {
+    std::map<CString, const typename Map::mapped_type*> mLower;
+    for (const auto& it : m) {
+        mLower[it.first.AsLower()] = &it.second;
+    }
+    return mLower;
+}
+}  // namespace
+
+bool CConfig::Equals(const CConfig& Other) const {
+    if (m_ConfigEntries.size() != Other.m_ConfigEntries.size() ||
+        m_SubConfigs.size() != Other.m_SubConfigs.size()) {
+        return false;
+    }
+
+    auto mEntries = LowerKeys(m_ConfigEntries);
+    auto mOtherEntries = LowerKeys(Other.m_ConfigEntries);
+    if (mEntries.size() != mOtherEntries.size()) return false;
+
+    for (const auto& it : mEntries) {
+        auto it2 = mOtherEntries.find(it.first);
+        if (it2 == mOtherEntries.end() || *it.second != *it2->second) {
+            return false;
+        }
+    }
+
+    auto mSubConfigs = LowerKeys(m_SubConfigs);
+    auto mOtherSubConfigs = LowerKeys(Other.m_SubConfigs);
+    if (mSubConfigs.size() != mOtherSubConfigs.size()) return false;
+
+    for (const auto& it : mSubConfigs) {
+        auto it2 = mOtherSubConfigs.find(it.first);
+        if (it2 == mOtherSubConfigs.end()) return false;
+
+        const SubConfig& subConf = *it.second;
+        const SubConfig& otherSubConf = *it2->second;
+        if (subConf.size() != otherSubConf.size()) return false;
+
+        auto subIt = subConf.begin();
+        auto otherIt = otherSubConf.begin();
+        for (; subIt != subConf.end(); ++subIt, ++otherIt) {
+            if (subIt->first != otherIt->first ||
+                !subIt->second.m_pSubConfig->Equals(
+                    *otherIt->second.m_pSubConfig)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void CConfig::AppendTo(CString& sOut, unsigned int iIndentation) const {
     CString sIndentation = CString(iIndentation, '\t');
 
     auto SingleLine = [](const CString& s) {
@@ -180,20 +349,19 @@ void CConfig::Write(CFile& File, unsigned int iIndentation) {
 
     for (const auto& it : m_ConfigEntries) {
         for (const CString& sValue : it.second) {
-            File.Write(SingleLine(sIndentation + it.first + " = " + sValue) +
-                       "\n");
+            sOut += SingleLine(sIndentation + it.first + " = " + sValue) + "\n";
         }
     }
 
     for (const auto& it : m_SubConfigs) {
         for (const auto& it2 : it.second) {
-            File.Write("\n");
+            sOut += "\n";
 
-            File.Write(SingleLine(sIndentation + "<" + it.first + " " +
-                                  it2.first + ">") +
-                       "\n");
-            it2.second.m_pSubConfig->Write(File, iIndentation + 1);
-            File.Write(SingleLine(sIndentation + "</" + it.first + ">") + "\n");
+            sOut += SingleLine(sIndentation + "<" + it.first + " " +
+                               it2.first + ">") +
+                    "\n";
+            it2.second.m_pSubConfig->AppendTo(sOut, iIndentation + 1);
+            sOut += SingleLine(sIndentation + "</" + it.first + ">") + "\n";
         }
     }
 }
@@ -316,11 +316,11 @@ bool CFile::Seek(off_t uPos) {
     return false;
 }
 
-bool CFile::Truncate() {
+bool CFile::Truncate(off_t uSize) {
     /* This sets errno in case m_iFD == -1 */
     errno = EBADF;
 
-    if (m_iFD != -1 && ftruncate(m_iFD, 0) == 0) {
+    if (m_iFD != -1 && ftruncate(m_iFD, uSize) == 0) {
         ClearBuffer();
         return true;
     }
@@ -330,6 +330,20 @@ bool CFile::Truncate() {
     return false;
 }
 
+bool CFile::Preallocate(off_t uOffset, off_t uLength) {
+    /* This sets errno in case m_iFD == -1 */
+    errno = EBADF;
+    if (m_iFD == -1) return false;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    // Not being able to doesn't make the file unusable, so no m_bHadError
+    return fallocate(m_iFD, FALLOC_FL_KEEP_SIZE, uOffset, uLength) == 0;
+#else
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
 bool CFile::Sync() {
     /* This sets errno in case m_iFD == -1 */
     errno = EBADF;
@@ -29,47 +29,6 @@
 using std::vector;
 using std::set;
 
-class CIRCNetworkPingTimer : public CCron {
-  public:
-    CIRCNetworkPingTimer(CIRCNetwork* pNetwork)
-        : CCron(), m_pNetwork(pNetwork) {
-        SetName("CIRCNetworkPingTimer::" +
-                m_pNetwork->GetUser()->GetUserName() + "::" +
-                m_pNetwork->GetName());
-        Start(m_pNetwork->GetUser()->GetPingSlack());
-    }
-
-    ~CIRCNetworkPingTimer() override {}
-
-    CIRCNetworkPingTimer(const CIRCNetworkPingTimer&) = delete;
-    CIRCNetworkPingTimer& operator=(const CIRCNetworkPingTimer&) = delete;
-
-  protected:
-    void RunJob() override {
-        CIRCSock* pIRCSock = m_pNetwork->GetIRCSock();
-        auto uFrequency = m_pNetwork->GetUser()->GetPingFrequency();
-
-        if (pIRCSock &&
-            pIRCSock->GetTimeSinceLastDataTransaction() >= uFrequency) {
-            pIRCSock->PutIRC("PING :ZNC");
-        }
-
-        const vector<CClient*>& vClients = m_pNetwork->GetClients();
-        for (CClient* pClient : vClients) {
-            if (pClient->GetTimeSinceLastDataTransaction() >= uFrequency) {
-                pClient->PutClient("PING :ZNC");
-            }
-        }
-
-        // Restart timer for the case if the period had changed. Usually this is
-        // noop
-        Start(m_pNetwork->GetUser()->GetPingSlack());
-    }
-
-  private:
-    CIRCNetwork* m_pNetwork;
-};
-
 class CIRCNetworkJoinTimer : public CCron {
     constexpr static int JOIN_FREQUENCY = 30 /* seconds */;
 
@@ -90,6 +49,7 @@ class CIRCNetworkJoinTimer : public CCron {
     void Delay(unsigned short int uDelay) {
         m_bDelayed = true;
         Start(uDelay);
+        CZNC::Get().GetManager().RescheduleCron(this);
     }
 
   protected:
@@ -144,6 +104,7 @@ CIRCNetwork::CIRCNetwork(CUser* pUser, const CString& sName)
       m_vChans(),
       m_vQueries(),
       m_sChanPrefixes(""),
+      m_CaseMapping(),
       m_bIRCConnectEnabled(true),
       m_bTrustAllCerts(false),
       m_bTrustPKI(true),
@@ -157,11 +118,12 @@ CIRCNetwork::CIRCNetwork(CUser* pUser, const CString& sName)
       m_RawBuffer(),
       m_MotdBuffer(),
       m_NoticeBuffer(),
-      m_pPingTimer(nullptr),
       m_pJoinTimer(nullptr),
       m_uJoinDelay(0),
       m_uBytesRead(0),
-      m_uBytesWritten(0) {
+      m_uBytesWritten(0),
+      m_uConnectFailures(0),
+      m_tNextConnect(0) {
     SetUser(pUser);
 
     // This should be more than enough raws, especially since we are buffering
@@ -171,9 +133,6 @@ CIRCNetwork::CIRCNetwork(CUser* pUser, const CString& sName)
     m_MotdBuffer.SetLineCount(200, true);
     m_NoticeBuffer.SetLineCount(250, true);
 
-    m_pPingTimer = new CIRCNetworkPingTimer(this);
-    CZNC::Get().GetManager().AddCron(m_pPingTimer);
-
     m_pJoinTimer = new CIRCNetworkJoinTimer(this);
     CZNC::Get().GetManager().AddCron(m_pJoinTimer);
 
@@ -185,7 +144,8 @@ CIRCNetwork::CIRCNetwork(CUser* pUser, const CIRCNetwork& Network)
     Clone(Network);
 }
 
-void CIRCNetwork::Clone(const CIRCNetwork& Network, bool bCloneName) {
+void CIRCNetwork::Clone(const CIRCNetwork& Network, bool bCloneName,
+                        bool bCloneModules) {
     if (bCloneName) {
         m_sName = Network.GetName();
     }
@@ -263,34 +223,37 @@ void CIRCNetwork::Clone(const CIRCNetwork& Network, bool bCloneName) {
     // !Chans
 
     // Modules
-    set<CString> ssUnloadMods;
-    CModules& vCurMods = GetModules();
-    const CModules& vNewMods = Network.GetModules();
-
-    for (CModule* pNewMod : vNewMods) {
-        CString sModRet;
-        CModule* pCurMod = vCurMods.FindModule(pNewMod->GetModName());
-
-        if (!pCurMod) {
-            vCurMods.LoadModule(pNewMod->GetModName(), pNewMod->GetArgs(),
-                                CModInfo::NetworkModule, m_pUser, this,
-                                sModRet);
-        } else if (pNewMod->GetArgs() != pCurMod->GetArgs()) {
-            vCurMods.ReloadModule(pNewMod->GetModName(), pNewMod->GetArgs(),
-                                  m_pUser, this, sModRet);
+    if (bCloneModules) {
+        set<CString> ssUnloadMods;
+        CModules& vCurMods = GetModules();
+        const CModules& vNewMods = Network.GetModules();
+
+        for (CModule* pNewMod : vNewMods) {
+            CString sModRet;
+            CModule* pCurMod = vCurMods.FindModule(pNewMod->GetModName());
+
+            if (!pCurMod) {
+                vCurMods.LoadModule(pNewMod->GetModName(), pNewMod->GetArgs(),
+                                    CModInfo::NetworkModule, m_pUser, this,
+                                    sModRet);
+            } else if (pNewMod->GetArgs() != pCurMod->GetArgs()) {
+                vCurMods.ReloadModule(pNewMod->GetModName(),
+                                      pNewMod->GetArgs(), m_pUser, this,
+                                      sModRet);
+            }
         }
-    }
 
-    for (CModule* pCurMod : vCurMods) {
-        CModule* pNewMod = vNewMods.FindModule(pCurMod->GetModName());
+        for (CModule* pCurMod : vCurMods) {
+            CModule* pNewMod = vNewMods.FindModule(pCurMod->GetModName());
 
-        if (!pNewMod) {
-            ssUnloadMods.insert(pCurMod->GetModName());
+            if (!pNewMod) {
+                ssUnloadMods.insert(pCurMod->GetModName());
+            }
         }
-    }
 
-    for (const CString& sMod : ssUnloadMods) {
-        vCurMods.UnloadModule(sMod);
+        for (const CString& sMod : ssUnloadMods) {
+            vCurMods.UnloadModule(sMod);
+        }
     }
     // !Modules
 
@@ -334,7 +297,6 @@ CIRCNetwork::~CIRCNetwork() {
     // Make sure we are not in the connection queue
     CZNC::Get().GetConnectionQueue().remove(this);
 
-    CZNC::Get().GetManager().DelCronByAddr(m_pPingTimer);
     CZNC::Get().GetManager().DelCronByAddr(m_pJoinTimer);
 
     if (pUser) {
@@ -856,7 +818,7 @@ CChan* CIRCNetwork::FindChan(CString sName) const {
     }
 
     for (CChan* pChan : m_vChans) {
-        if (sName.Equals(pChan->GetName())) {
+        if (m_CaseMapping.Equals(sName, pChan->GetName())) {
             return pChan;
         }
     }
@@ -867,9 +829,10 @@ CChan* CIRCNetwork::FindChan(CString sName) const {
 std::vector<CChan*> CIRCNetwork::FindChans(const CString& sWild) const {
     std::vector<CChan*> vChans;
     vChans.reserve(m_vChans.size());
-    const CString sLower = sWild.AsLower();
+    const CString sFolded = m_CaseMapping.Fold(sWild);
     for (CChan* pChan : m_vChans) {
-        if (pChan->GetName().AsLower().WildCmp(sLower)) vChans.push_back(pChan);
+        if (m_CaseMapping.Fold(pChan->GetName()).WildCmp(sFolded))
+            vChans.push_back(pChan);
     }
     return vChans;
 }
@@ -880,7 +843,7 @@ bool CIRCNetwork::AddChan(CChan* pChan) {
     }
 
     for (CChan* pEachChan : m_vChans) {
-        if (pEachChan->GetName().Equals(pChan->GetName())) {
+        if (m_CaseMapping.Equals(pEachChan->GetName(), pChan->GetName())) {
             delete pChan;
             return false;
         }
@@ -903,7 +866,7 @@ bool CIRCNetwork::AddChan(const CString& sName, bool bInConfig) {
 bool CIRCNetwork::DelChan(const CString& sName) {
     for (vector<CChan*>::iterator a = m_vChans.begin(); a != m_vChans.end();
          ++a) {
-        if (sName.Equals((*a)->GetName())) {
+        if (m_CaseMapping.Equals(sName, (*a)->GetName())) {
             delete *a;
             m_vChans.erase(a);
             return true;
@@ -1014,13 +977,23 @@ bool CIRCNetwork::IsChanStrict(const CString& sChan) const {
     return GetChanPrefixes().find(sChan[0]) != CString::npos;
 }
 
+void CIRCNetwork::SetCaseMapping(const CString& sName) {
+    CString sOld = m_CaseMapping.GetName();
+    m_CaseMapping.SetName(sName);
+    if (m_CaseMapping.GetName() == sOld) return;
+
+    for (CChan* pChan : m_vChans) {
+        pChan->ReindexNicks();
+    }
+}
+
 // Queries
 
 const vector<CQuery*>& CIRCNetwork::GetQueries() const { return m_vQueries; }
 
 CQuery* CIRCNetwork::FindQuery(const CString& sName) const {
     for (CQuery* pQuery : m_vQueries) {
-        if (sName.Equals(pQuery->GetName())) {
+        if (m_CaseMapping.Equals(sName, pQuery->GetName())) {
             return pQuery;
         }
     }
@@ -1031,9 +1004,9 @@ CQuery* CIRCNetwork::FindQuery(const CString& sName) const {
 std::vector<CQuery*> CIRCNetwork::FindQueries(const CString& sWild) const {
     std::vector<CQuery*> vQueries;
     vQueries.reserve(m_vQueries.size());
-    const CString sLower = sWild.AsLower();
+    const CString sFolded = m_CaseMapping.Fold(sWild);
     for (CQuery* pQuery : m_vQueries) {
-        if (pQuery->GetName().AsLower().WildCmp(sLower))
+        if (m_CaseMapping.Fold(pQuery->GetName()).WildCmp(sFolded))
             vQueries.push_back(pQuery);
     }
     return vQueries;
@@ -1063,7 +1036,7 @@ CQuery* CIRCNetwork::AddQuery(const CString& sName) {
 bool CIRCNetwork::DelQuery(const CString& sName) {
     for (vector<CQuery*>::iterator a = m_vQueries.begin();
          a != m_vQueries.end(); ++a) {
-        if (sName.Equals((*a)->GetName())) {
+        if (m_CaseMapping.Equals(sName, (*a)->GetName())) {
             delete *a;
             m_vQueries.erase(a);
             return true;
@@ -1327,6 +1300,9 @@ bool CIRCNetwork::IsIRCConnected() const {
 void CIRCNetwork::SetIRCSocket(CIRCSock* pIRCSock) { m_pIRCSock = pIRCSock; }
 
 void CIRCNetwork::IRCConnected() {
+    m_uConnectFailures = 0;
+    m_tNextConnect = 0;
+
     const SCString& ssCaps = m_pIRCSock->GetAcceptedCaps();
     for (CClient* pClient : m_vClients) {
         pClient->NotifyServerDependentCaps(ssCaps);
@@ -1351,6 +1327,26 @@ void CIRCNetwork::IRCDisconnected() {
     CheckIRCConnect();
 }
 
+void CIRCNetwork::IRCConnectFailed() {
+    // ConnectDelay, doubled for every further failure, but at most 5 minutes
+    const unsigned int uMaxDelay = 300;
+    unsigned int uDelay = CZNC::Get().GetConnectDelay();
+    for (unsigned int i = 0; i < m_uConnectFailures && uDelay < uMaxDelay;
+         ++i) {
+        uDelay *= 2;
+    }
+
+    m_uConnectFailures++;
+    m_tNextConnect = time(nullptr) + std::min(uDelay, uMaxDelay);
+}
+
+CIRCNetwork::EConnectPriority CIRCNetwork::GetConnectPriority() const {
+    if (m_pUser->IsAdmin()) return CONNECT_PRIO_ADMIN;
+    // Someone is already waiting for this network
+    if (!m_vClients.empty()) return CONNECT_PRIO_ACTIVE;
+    return CONNECT_PRIO_NORMAL;
+}
+
 void CIRCNetwork::SetIRCConnectEnabled(bool b) {
     m_bIRCConnectEnabled = b;
 
@@ -22,6 +22,7 @@
 #include <znc/Query.h>
 #include <znc/ZNCDebug.h>
 #include <time.h>
+#include <algorithm>
 
 using std::set;
 using std::vector;
@@ -39,19 +40,23 @@ const unsigned int CIRCSock::m_uCTCPFloodCount = 5;
 // TODO move this constant to CIRCNetwork?
 static const double FLOOD_MINIMAL_RATE = 0.3;
 
+// Fires once, when the budget suffices for the next queued line
 class CIRCFloodTimer : public CCron {
     CIRCSock* m_pSock;
 
   public:
-    CIRCFloodTimer(CIRCSock* pSock) : m_pSock(pSock) {
-        StartMaxCycles(m_pSock->m_fFloodRate, 0);
+    CIRCFloodTimer(CIRCSock* pSock, unsigned long long uDelay)
+        : m_pSock(pSock) {
+        timeval tDelay;
+        tDelay.tv_sec = uDelay / 1000;
+        tDelay.tv_usec = uDelay % 1000 * 1000;
+        StartMaxCycles(tDelay, 1);
     }
     CIRCFloodTimer(const CIRCFloodTimer&) = delete;
     CIRCFloodTimer& operator=(const CIRCFloodTimer&) = delete;
     void RunJob() override {
-        if (m_pSock->m_iSendsAllowed < m_pSock->m_uFloodBurst) {
-            m_pSock->m_iSendsAllowed++;
-        }
+        // The manager deletes the timer after this run
+        m_pSock->m_pFloodTimer = nullptr;
         m_pSock->TrySend();
     }
 };
@@ -84,14 +89,24 @@ CIRCSock::CIRCSock(CIRCNetwork* pNetwork)
       m_lastCTCP(0),
       m_uNumCTCP(0),
       m_mISupport(),
-      m_vSendQueue(),
-      m_iSendsAllowed(pNetwork->GetFloodBurst()),
+      m_avSendQueue(),
       m_uFloodBurst(pNetwork->GetFloodBurst()),
       m_fFloodRate(pNetwork->GetFloodRate()),
-      m_bFloodProtection(IsFloodProtected(pNetwork->GetFloodRate())) {
+      m_bFloodProtection(IsFloodProtected(pNetwork->GetFloodRate())),
+      m_uFloodInterval(
+          m_bFloodProtection ? (unsigned long long)(m_fFloodRate * 1000) : 0),
+      m_uFloodBudget(m_uFloodBurst * m_uFloodInterval),
+      m_uFloodRefill(CUtils::GetMillTime()),
+      m_pFloodTimer(nullptr),
+      m_uSentLines(0),
+      m_uSendWaitTotal(0),
+      m_uSendWaitMax(0),
+      m_bConnectFailed(false) {
     EnableReadLine();
     m_Nick.SetIdent(m_pNetwork->GetIdent());
     m_Nick.SetHost(m_pNetwork->GetBindHost());
+    // Until the server says otherwise
+    m_pNetwork->SetCaseMapping("rfc1459");
     SetEncoding(m_pNetwork->GetEncoding());
 
     m_mceChanModes['b'] = ListArg;
@@ -110,14 +125,22 @@ CIRCSock::CIRCSock(CIRCNetwork* pNetwork)
     // RFC says a line can have 512 chars max + 512 chars for message tags, but
     // we don't care ;)
     SetMaxBufferThreshold(2048);
-    if (m_bFloodProtection) {
-        AddCron(new CIRCFloodTimer(this));
-    }
+
+    CZNC::Get().AddKeepAlive(this);
+    CZNC::Get().AddPendingConnection();
 }
 
 CIRCSock::~CIRCSock() {
+    CZNC::Get().DelKeepAlive(this);
+    if (m_pFloodTimer) {
+        CZNC::Get().GetManager().DelCronByAddr(m_pFloodTimer);
+    }
+
     if (!m_bAuthed) {
         IRCSOCKMODULECALL(OnIRCConnectionError(this), NOTHING);
+        CZNC::Get().DelPendingConnection();
+        // Disconnects which the user asked for don't delay the next attempt
+        if (m_bConnectFailed) m_pNetwork->IRCConnectFailed();
     }
 
     const vector<CChan*>& vChans = m_pNetwork->GetChans();
@@ -156,8 +179,7 @@ void CIRCSock::Quit(const CString& sQuitMsg) {
 void CIRCSock::ReadLine(const CString& sData) {
     CString sLine = sData;
 
-    sLine.Replace("\n", "");
-    sLine.Replace("\r", "");
+    sLine.StripCRLF();
 
     DEBUG("(" << m_pNetwork->GetUser()->GetUserName() << "/"
               << m_pNetwork->GetName() << ") IRC -> ZNC [" << sLine << "]");
@@ -712,6 +734,7 @@ bool CIRCSock::OnNumericMessage(CNumericMessage& Message) {
             PutIRC("WHO " + sNick);
 
             m_bAuthed = true;
+            CZNC::Get().DelPendingConnection();
             m_pNetwork->PutStatus("Connected!");
 
             const vector<CClient*>& vClients = m_pNetwork->GetClients();
@@ -1149,47 +1172,176 @@ bool CIRCSock::OnWallopsMessage(CMessage& Message) {
 }
 
 void CIRCSock::PutIRC(const CString& sLine) {
-    PutIRC(CMessage(sLine));
+    if (sLine.StartsWith("@")) {
+        // The tags need to be filtered
+        PutIRC(CMessage(sLine));
+    } else {
+        QueueLine(sLine, GetSendLane(sLine));
+    }
 }
 
 void CIRCSock::PutIRC(const CMessage& Message) {
-    // Only print if the line won't get sent immediately (same condition as in
-    // TrySend()!)
-    if (m_bFloodProtection && m_iSendsAllowed <= 0) {
-        DEBUG("(" << m_pNetwork->GetUser()->GetUserName() << "/"
-                  << m_pNetwork->GetName() << ") ZNC -> IRC ["
-                  << CDebug::Filter(Message.ToString()) << "] (queued)");
-    }
-    m_vSendQueue.push_back(Message);
-    TrySend();
+    CString sLine = ToServerString(Message);
+    QueueLine(sLine, GetSendLane(sLine));
 }
 
 void CIRCSock::PutIRCQuick(const CString& sLine) {
+    if (sLine.StartsWith("@")) {
+        QueueLine(ToServerString(CMessage(sLine)), SEND_LANE_QUICK);
+    } else {
+        QueueLine(sLine, SEND_LANE_QUICK);
+    }
+}
+
+CString CIRCSock::ToServerString(const CMessage& Message) const {
+    bool bFilter = false;
+    for (const auto& it : Message.GetTags()) {
+        if (!IsTagEnabled(it.first)) {
+            bFilter = true;
+            break;
+        }
+    }
+    if (!bFilter) {
+        return Message.ToString();
+    }
+
+    CMessage Copy(Message);
+    MCString mssTags;
+    for (const auto& it : Message.GetTags()) {
+        if (IsTagEnabled(it.first)) {
+            mssTags[it.first] = it.second;
+        }
+    }
+    Copy.SetTags(mssTags);
+    return Copy.ToString();
+}
+
+CIRCSock::ESendLane CIRCSock::GetSendLane(const CString& sLine) const {
+    // Only the first few words are needed, so don't parse the whole line
+    unsigned int uCommand = 0;
+    CString sCommand = sLine.Token(uCommand);
+    if (sCommand.StartsWith("@")) {
+        sCommand = sLine.Token(++uCommand);
+    }
+    if (sCommand.StartsWith(":")) {
+        sCommand = sLine.Token(++uCommand);
+    }
+
+    if (sCommand.Equals("PONG")) {
+        return SEND_LANE_QUICK;
+    }
+    if (sCommand.Equals("WHO")) {
+        return SEND_LANE_BULK;
+    }
+    if (sCommand.Equals("MODE")) {
+        // Queries like "MODE #chan" and "MODE #chan +b", but not changes
+        CString sTarget = sLine.Token(uCommand + 1).TrimPrefix_n(":");
+        CString sModes = sLine.Token(uCommand + 2).TrimPrefix_n(":");
+        if (sModes.empty()) {
+            return SEND_LANE_BULK;
+        }
+        if (sLine.Token(uCommand + 3).empty() && m_pNetwork->IsChan(sTarget)) {
+            sModes.TrimPrefix("+");
+            bool bLists = !sModes.empty();
+            for (char cMode : sModes) {
+                if (GetModeType(cMode) != ListArg) {
+                    bLists = false;
+                    break;
+                }
+            }
+            if (bLists) {
+                return SEND_LANE_BULK;
+            }
+        }
+    }
+    return SEND_LANE_NORMAL;
+}
+
+void CIRCSock::QueueLine(const CString& sLine, ESendLane eLane) {
+    unsigned long long uNow = CUtils::GetMillTime();
+    RefillFloodBudget(uNow);
+
     // Only print if the line won't get sent immediately (same condition as in
     // TrySend()!)
-    if (m_bFloodProtection && m_iSendsAllowed <= 0) {
+    if (m_bFloodProtection && m_uFloodBudget < m_uFloodInterval) {
         DEBUG("(" << m_pNetwork->GetUser()->GetUserName() << "/"
                   << m_pNetwork->GetName() << ") ZNC -> IRC ["
-                  << CDebug::Filter(sLine) << "] (queued to front)");
+                  << CDebug::Filter(sLine) << "] (queued)");
     }
-    m_vSendQueue.emplace_front(sLine);
+    // Kept the way it goes to the server, see SendLine()
+    m_avSendQueue[eLane].push_back({sLine + "\r\n", uNow});
     TrySend();
 }
 
+void CIRCSock::RefillFloodBudget(unsigned long long uNow) {
+    if (uNow > m_uFloodRefill) {
+        m_uFloodBudget = std::min(m_uFloodBudget + (uNow - m_uFloodRefill),
+                                  m_uFloodBurst * m_uFloodInterval);
+    }
+    m_uFloodRefill = uNow;
+}
+
+void CIRCSock::ArmFloodTimer() {
+    if (m_pFloodTimer) {
+        return;
+    }
+    m_pFloodTimer =
+        new CIRCFloodTimer(this, m_uFloodInterval - m_uFloodBudget);
+    CZNC::Get().GetManager().AddCron(m_pFloodTimer);
+}
+
+size_t CIRCSock::GetSendQueueSize() const {
+    size_t uSize = 0;
+    for (const auto& vQueue : m_avSendQueue) {
+        uSize += vQueue.size();
+    }
+    return uSize;
+}
+
 void CIRCSock::TrySend() {
-    // This condition must be the same as in PutIRC() and PutIRCQuick()!
-    while (!m_vSendQueue.empty() &&
-           (!m_bFloodProtection || m_iSendsAllowed > 0)) {
-        m_iSendsAllowed--;
-        CMessage& Message = m_vSendQueue.front();
-
-        MCString mssTags;
-        for (const auto& it : Message.GetTags()) {
-            if (IsTagEnabled(it.first)) {
-                mssTags[it.first] = it.second;
+    unsigned long long uNow = CUtils::GetMillTime();
+    RefillFloodBudget(uNow);
+
+    for (auto& vQueue : m_avSendQueue) {
+        while (!vQueue.empty()) {
+            // This condition must be the same as in QueueMessage()!
+            if (m_bFloodProtection && m_uFloodBudget < m_uFloodInterval) {
+                ArmFloodTimer();
+                return;
             }
+            m_uFloodBudget -= m_uFloodInterval;
+
+            // Take it out first, modules may send more lines from the hook
+            CQueuedMessage Queued = std::move(vQueue.front());
+            vQueue.pop_front();
+
+            unsigned long long uWait =
+                uNow > Queued.uQueued ? uNow - Queued.uQueued : 0;
+            m_uSentLines++;
+            m_uSendWaitTotal += uWait;
+            m_uSendWaitMax = std::max(m_uSendWaitMax, uWait);
+
+            SendLine(Queued.sLine);
         }
-        Message.SetTags(mssTags);
+    }
+
+    // Nothing is waiting anymore
+    if (m_pFloodTimer) {
+        CZNC::Get().GetManager().DelCronByAddr(m_pFloodTimer);
+        m_pFloodTimer = nullptr;
+    }
+}
+
+bool CIRCSock::ModulesWant(bool (CModules::*fWants)() const) const {
+    return (CZNC::Get().GetModules().*fWants)() ||
+           (m_pNetwork->GetUser()->GetModules().*fWants)() ||
+           (m_pNetwork->GetModules().*fWants)();
+}
+
+void CIRCSock::SendLine(const CString& sLine) {
+    // Lines are parsed again only if some module wants to see them
+    if (ModulesWant(&CModules::WantsSendToIRCMessage)) {
+        CMessage Message(sLine.TrimSuffix_n("\r\n"));
         Message.SetNetwork(m_pNetwork);
 
         bool bSkip = false;
@@ -1198,22 +1350,34 @@ void CIRCSock::TrySend() {
         if (!bSkip) {
             PutIRCRaw(Message.ToString());
         }
-        m_vSendQueue.pop_front();
+    } else if (ModulesWant(&CModules::WantsSendToIRC)) {
+        PutIRCRaw(sLine.TrimSuffix_n("\r\n"));
+    } else {
+        WriteLine(sLine);
     }
 }
 
 void CIRCSock::PutIRCRaw(const CString& sLine) {
+    if (!ModulesWant(&CModules::WantsSendToIRC)) {
+        WriteLine(sLine + "\r\n");
+        return;
+    }
+
     CString sCopy = sLine;
     bool bSkip = false;
     IRCSOCKMODULECALL(OnSendToIRC(sCopy), &bSkip);
     if (!bSkip) {
-        DEBUG("(" << m_pNetwork->GetUser()->GetUserName() << "/"
-                  << m_pNetwork->GetName() << ") ZNC -> IRC ["
-                  << CDebug::Filter(sCopy) << "]");
-        Write(sCopy + "\r\n");
+        WriteLine(sCopy + "\r\n");
     }
 }
 
+void CIRCSock::WriteLine(const CString& sLine) {
+    DEBUG("(" << m_pNetwork->GetUser()->GetUserName() << "/"
+              << m_pNetwork->GetName() << ") ZNC -> IRC ["
+              << CDebug::Filter(sLine.TrimSuffix_n("\r\n")) << "]");
+    Write(sLine);
+}
+
 void CIRCSock::SetNick(const CString& sNick) {
     m_Nick.SetNick(sNick);
     m_pNetwork->SetIRCNick(m_Nick);
@@ -1281,6 +1445,7 @@ void CIRCSock::SockError(int iErrno, const CString& sDescription) {
     CString sError = sDescription;
 
     DEBUG(GetSockName() << " == SockError(" << iErrno << " " << sError << ")");
+    m_bConnectFailed = true;
     if (!m_pNetwork->GetUser()->IsBeingDeleted()) {
         if (GetConState() != CST_OK) {
             m_pNetwork->PutStatus(
@@ -1332,6 +1497,7 @@ void CIRCSock::SockError(int iErrno, const CString& sDescription) {
 
 void CIRCSock::Timeout() {
     DEBUG(GetSockName() << " == Timeout()");
+    m_bConnectFailed = true;
     if (!m_pNetwork->GetUser()->IsBeingDeleted()) {
         m_pNetwork->PutStatus(
             t_s("IRC connection timed out.  Reconnecting..."));
@@ -1345,6 +1511,7 @@ void CIRCSock::Timeout() {
 
 void CIRCSock::ConnectionRefused() {
     DEBUG(GetSockName() << " == ConnectionRefused()");
+    m_bConnectFailed = true;
     if (!m_pNetwork->GetUser()->IsBeingDeleted()) {
         m_pNetwork->PutStatus(t_s("Connection Refused.  Reconnecting..."));
     }
@@ -1359,12 +1526,13 @@ void CIRCSock::ReachedMaxBuffer() {
 }
 
 void CIRCSock::ParseISupport(const CMessage& Message) {
-    const VCString vsParams = Message.GetParams();
+    const VCString& vsParams = Message.GetParams();
 
     for (size_t i = 1; i + 1 < vsParams.size(); ++i) {
         const CString& sParam = vsParams[i];
-        CString sName = sParam.Token(0, false, "=");
-        CString sValue = sParam.Token(1, true, "=");
+        CStringTokenizer Tokens(sParam, "=");
+        CString sName = Tokens.Next() ? Tokens.GetToken() : "";
+        CString sValue = Tokens.Next() ? Tokens.GetRest() : "";
 
         if (0 < sName.length() && ':' == sName[0]) {
             break;
@@ -1383,6 +1551,8 @@ void CIRCSock::ParseISupport(const CMessage& Message) {
             }
         } else if (sName.Equals("CHANTYPES")) {
             m_pNetwork->SetChanPrefixes(sValue);
+        } else if (sName.Equals("CASEMAPPING")) {
+            m_pNetwork->SetCaseMapping(sValue);
         } else if (sName.Equals("NICKLEN")) {
             unsigned int uMax = sValue.ToUInt();
 
@@ -1393,11 +1563,10 @@ void CIRCSock::ParseISupport(const CMessage& Message) {
             if (!sValue.empty()) {
                 m_mceChanModes.clear();
 
-                for (unsigned int a = 0; a < 4; a++) {
-                    CString sModes = sValue.Token(a, false, ",");
-
-                    for (unsigned int b = 0; b < sModes.size(); b++) {
-                        m_mceChanModes[sModes[b]] = (EChanModeArgs)a;
+                CStringTokenizer Modes(sValue, ",");
+                for (unsigned int a = 0; a < 4 && Modes.Next(); a++) {
+                    for (size_t b = 0; b < Modes.GetLength(); b++) {
+                        m_mceChanModes[Modes.GetData()[b]] = (EChanModeArgs)a;
                     }
                 }
             }
@@ -148,7 +148,9 @@ CModule::CModule(ModHandle pDLL, CUser* pUser, CIRCNetwork* pNetwork,
       m_Translation("znc-" + sModName),
       m_mssRegistry(),
       m_vSubPages(),
-      m_mCommands() {
+      m_mCommands(),
+      m_bWantsSendToIRCMessage(true),
+      m_bWantsSendToIRC(true) {
     if (m_pNetwork) {
         m_sSavePath = m_pNetwork->GetNetworkPath() + "/moddata/" + m_sModName;
     } else if (m_pUser) {
@@ -235,8 +237,14 @@ CString CModule::GetWebFilesPath() {
 
 bool CModule::LoadRegistry() {
     // CString sPrefix = (m_pUser) ? m_pUser->GetUserName() : ".global";
-    return (m_mssRegistry.ReadFromDisk(GetSavePath() + "/.registry") ==
-            MCString::MCS_SUCCESS);
+    CString sPath = GetSavePath() + "/.registry";
+
+    // During startup, the registry was most likely read on the thread pool
+    if (CZNC::Get().TakePrefetchedRegistry(sPath, m_mssRegistry)) {
+        return true;
+    }
+
+    return (m_mssRegistry.ReadFromDisk(sPath) == MCString::MCS_SUCCESS);
 }
 
 bool CModule::SaveRegistry() const {
@@ -1480,6 +1488,18 @@ bool CModules::OnSendToIRC(CString& sLine) { MODHALTCHK(OnSendToIRC(sLine)); }
 bool CModules::OnSendToIRCMessage(CMessage& Message) {
     MODHALTCHK(OnSendToIRCMessage(Message));
 }
+bool CModules::WantsSendToIRC() const {
+    for (CModule* pMod : *this) {
+        if (pMod->WantsSendToIRC()) return true;
+    }
+    return false;
+}
+bool CModules::WantsSendToIRCMessage() const {
+    for (CModule* pMod : *this) {
+        if (pMod->WantsSendToIRCMessage()) return true;
+    }
+    return false;
+}
 bool CModules::OnStatusCommand(CString& sCommand) {
     MODHALTCHK(OnStatusCommand(sCommand));
 }
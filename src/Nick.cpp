@@ -22,6 +22,58 @@
 using std::vector;
 using std::map;
 
+CCaseMapping::CCaseMapping() { SetName("rfc1459"); }
+
+bool CCaseMapping::SetName(const CString& sName) {
+    // rfc1459 also folds "[]\~" to "{}|^", strict-rfc1459 leaves out "~"
+    CString sUpper = "[]\\~", sLower = "{}|^";
+    bool bKnown = true;
+    if (sName.Equals("ascii")) {
+        sUpper.clear();
+        sLower.clear();
+    } else if (sName.Equals("strict-rfc1459")) {
+        sUpper.erase(3);
+        sLower.erase(3);
+    } else if (!sName.Equals("rfc1459")) {
+        bKnown = false;
+    }
+    m_sName = bKnown ? sName.AsLower() : "rfc1459";
+
+    for (unsigned int c = 0; c < 256; ++c) {
+        m_acFold[c] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    for (CString::size_type i = 0; i < sUpper.size(); ++i) {
+        m_acFold[(unsigned char)sUpper[i]] = sLower[i];
+    }
+    return bKnown;
+}
+
+CString CCaseMapping::Fold(const CString& s) const {
+    CString sRet = s;
+    for (char& c : sRet) c = Fold(c);
+    return sRet;
+}
+
+bool CCaseMapping::Equals(const CString& s1, const CString& s2) const {
+    if (s1.size() != s2.size()) return false;
+    const unsigned char* p1 = (const unsigned char*)s1.data();
+    const unsigned char* p2 = (const unsigned char*)s2.data();
+    unsigned char cDiff = 0;
+    for (CString::size_type i = 0; i < s1.size(); ++i) {
+        cDiff |= m_acFold[p1[i]] ^ m_acFold[p2[i]];
+    }
+    return cDiff == 0;
+}
+
+size_t CCaseMapping::Hash(const CString& s) const {
+    // FNV-1a
+    uint32_t uHash = 2166136261u;
+    for (unsigned char c : s) {
+        uHash = (uHash ^ (unsigned char)m_acFold[c]) * 16777619u;
+    }
+    return uHash;
+}
+
 CNick::CNick()
     : m_sChanPerms(""),
       m_pNetwork(nullptr),
@@ -67,13 +119,8 @@ size_t CNick::GetCommonChans(vector<CChan*>& vRetChans,
     const vector<CChan*>& vChans = pNetwork->GetChans();
 
     for (CChan* pChan : vChans) {
-        const map<CString, CNick>& msNicks = pChan->GetNicks();
-
-        for (const auto& it : msNicks) {
-            if (it.first.Equals(m_sNick)) {
-                vRetChans.push_back(pChan);
-                continue;
-            }
+        if (pChan->FindNick(m_sNick)) {
+            vRetChans.push_back(pChan);
         }
     }
 
@@ -81,9 +128,8 @@ size_t CNick::GetCommonChans(vector<CChan*>& vRetChans,
 }
 
 bool CNick::NickEquals(const CString& nickname) const {
-    // TODO add proper IRC case mapping here
-    // https://tools.ietf.org/html/draft-brocklesby-irc-isupport-03#section-3.1
-    return m_sNick.Equals(nickname);
+    if (!m_pNetwork) return m_sNick.Equals(nickname);
+    return m_pNetwork->GetCaseMapping().Equals(m_sNick, nickname);
 }
 
 void CNick::SetNetwork(CIRCNetwork* pNetwork) { m_pNetwork = pNetwork; }
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <limits>
 #include <random>
 
 #include <znc/Socket.h>
@@ -385,13 +387,395 @@ void CSockManager::SetTDNSThreadFinished(TDNSTask* task, bool bBind,
 }
 #endif /* HAVE_THREADED_DNS */
 
+CTimerWheel::CTimerWheel()
+    : m_lDue(),
+      m_mEntries(),
+      m_uCurrentTick(0),
+      m_pRunning(nullptr),
+      m_bRunningRemoved(false) {
+    std::fill(std::begin(m_auLevelCount), std::end(m_auLevelCount), 0);
+    timeval tNow;
+    gettimeofday(&tNow, nullptr);
+    m_uCurrentTick = ToTick(tNow, false);
+}
+
+CTimerWheel::~CTimerWheel() { Clear(); }
+
+uint64_t CTimerWheel::ToTick(const timeval& tv, bool bRoundUp) {
+    uint64_t uUsec = uint64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+    if (bRoundUp) {
+        uUsec += TICK_USEC - 1;
+    }
+    return uUsec / TICK_USEC;
+}
+
+timeval CTimerWheel::FromTick(uint64_t uTick) {
+    timeval tv;
+    tv.tv_sec = uTick * TICK_USEC / 1000000;
+    tv.tv_usec = uTick * TICK_USEC % 1000000;
+    return tv;
+}
+
+timeval CTimerWheel::RoundUp(const timeval& tv) {
+    return FromTick(ToTick(tv, true));
+}
+
+std::list<CCron*>& CTimerWheel::GetList(const CEntry& Entry) {
+    if (Entry.uLevel == LEVELS) {
+        return m_lDue;
+    }
+    return m_aSlots[Entry.uLevel][Entry.uSlot];
+}
+
+std::list<CCron*>& CTimerWheel::Place(CEntry& Entry) {
+    if (Entry.uExpires < m_uCurrentTick) {
+        Entry.uExpires = m_uCurrentTick;
+    }
+
+    uint64_t uDelta = Entry.uExpires - m_uCurrentTick;
+    uint64_t uSlotTick = Entry.uExpires;
+    unsigned int uLevel = 0;
+    while (uLevel + 1 < LEVELS && (uDelta >> (SLOT_BITS * (uLevel + 1))) != 0) {
+        uLevel++;
+    }
+    if ((uDelta >> (SLOT_BITS * LEVELS)) != 0) {
+        // Further away than the whole wheel: park it in the last slot, it will
+        // be placed again when that slot is cascaded
+        uSlotTick = m_uCurrentTick + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    Entry.uLevel = uLevel;
+    Entry.uSlot = (uSlotTick >> (SLOT_BITS * uLevel)) & (SLOTS - 1);
+    return m_aSlots[Entry.uLevel][Entry.uSlot];
+}
+
+void CTimerWheel::Link(CCron* pCron, uint64_t uExpires) {
+    CEntry& Entry = m_mEntries[pCron];
+    Entry.uExpires = uExpires;
+    std::list<CCron*>& lSlot = Place(Entry);
+    Entry.it = lSlot.insert(lSlot.end(), pCron);
+    m_auLevelCount[Entry.uLevel]++;
+}
+
+void CTimerWheel::Add(CCron* pCron) {
+    if (Contains(pCron)) {
+        Reschedule(pCron);
+        return;
+    }
+    Link(pCron, ToTick(pCron->GetNextRun(), true));
+}
+
+bool CTimerWheel::Remove(CCron* pCron) {
+    auto it = m_mEntries.find(pCron);
+    if (it == m_mEntries.end()) {
+        if (pCron != nullptr && pCron == m_pRunning) {
+            // RunDue() must not touch it anymore
+            m_bRunningRemoved = true;
+            return true;
+        }
+        return false;
+    }
+
+    if (it->second.uLevel < LEVELS) {
+        m_auLevelCount[it->second.uLevel]--;
+    }
+    GetList(it->second).erase(it->second.it);
+    m_mEntries.erase(it);
+    return true;
+}
+
+void CTimerWheel::Reschedule(CCron* pCron) {
+    auto it = m_mEntries.find(pCron);
+    // Due and running crons are placed again after their run anyway
+    if (it == m_mEntries.end() || it->second.uLevel == LEVELS) {
+        return;
+    }
+
+    CEntry& Entry = it->second;
+    std::list<CCron*>& lOld = GetList(Entry);
+    m_auLevelCount[Entry.uLevel]--;
+    Entry.uExpires = ToTick(pCron->GetNextRun(), true);
+    std::list<CCron*>& lNew = Place(Entry);
+    m_auLevelCount[Entry.uLevel]++;
+    lNew.splice(lNew.end(), lOld, Entry.it);
+}
+
+void CTimerWheel::Cascade(unsigned int uLevel, unsigned int uSlot) {
+    std::list<CCron*> lCascade;
+    lCascade.swap(m_aSlots[uLevel][uSlot]);
+    m_auLevelCount[uLevel] -= lCascade.size();
+    while (!lCascade.empty()) {
+        CEntry& Entry = m_mEntries[lCascade.front()];
+        std::list<CCron*>& lSlot = Place(Entry);
+        m_auLevelCount[Entry.uLevel]++;
+        lSlot.splice(lSlot.end(), lCascade, lCascade.begin());
+    }
+}
+
+void CTimerWheel::Rebase(uint64_t uTick) {
+    m_uCurrentTick = uTick;
+    for (unsigned int uLevel = 0; uLevel < LEVELS; ++uLevel) {
+        for (unsigned int uSlot = 0; uSlot < SLOTS; ++uSlot) {
+            Cascade(uLevel, uSlot);
+        }
+    }
+}
+
+void CTimerWheel::Expire(const timeval& tNow) {
+    uint64_t uNow = ToTick(tNow, false);
+
+    if (m_uCurrentTick > uNow + SLOTS) {
+        // The clock went backwards. Crons keep their old times, as they do
+        // with CSockCommon::Cron(), but new ones shouldn't wait for the old
+        // current tick.
+        Rebase(uNow + 1);
+    }
+
+    while (m_uCurrentTick <= uNow) {
+        if (m_mEntries.empty()) {
+            m_uCurrentTick = uNow + 1;
+            break;
+        }
+
+        // Nothing happens before the first level which has crons is cascaded
+        unsigned int uEmpty = 0;
+        while (uEmpty + 1 < LEVELS && m_auLevelCount[uEmpty] == 0) {
+            uEmpty++;
+        }
+        uint64_t uMask = (uint64_t(1) << (SLOT_BITS * uEmpty)) - 1;
+        if ((m_uCurrentTick & uMask) != 0) {
+            m_uCurrentTick = std::min((m_uCurrentTick | uMask) + 1, uNow + 1);
+            continue;
+        }
+
+        uint64_t uTick = m_uCurrentTick;
+        for (unsigned int uLevel = LEVELS - 1; uLevel > 0; --uLevel) {
+            unsigned int uShift = SLOT_BITS * uLevel;
+            if ((uTick & ((uint64_t(1) << uShift) - 1)) == 0) {
+                Cascade(uLevel, (uTick >> uShift) & (SLOTS - 1));
+            }
+        }
+
+        std::list<CCron*>& lSlot = m_aSlots[0][uTick & (SLOTS - 1)];
+        for (CCron* pCron : lSlot) {
+            m_mEntries[pCron].uLevel = LEVELS;
+        }
+        m_auLevelCount[0] -= lSlot.size();
+        m_lDue.splice(m_lDue.end(), lSlot);
+        m_uCurrentTick = uTick + 1;
+
+        RunDue(tNow);
+    }
+}
+
+void CTimerWheel::RunDue(const timeval& tNow) {
+    while (!m_lDue.empty()) {
+        CCron* pCron = m_lDue.front();
+        m_lDue.pop_front();
+        m_mEntries.erase(pCron);
+
+        if (!pCron->isValid()) {
+            delete pCron;
+            continue;
+        }
+
+        timeval tRun = tNow;
+        m_pRunning = pCron;
+        m_bRunningRemoved = false;
+        pCron->run(tRun);
+        m_pRunning = nullptr;
+
+        if (m_bRunningRemoved) {
+            continue;
+        }
+        if (!pCron->isValid()) {
+            delete pCron;
+            continue;
+        }
+
+        timeval tNext = pCron->GetNextRun();
+        if (!timercmp(&tNext, &tNow, >)) {
+            // Paused crons don't move their next run, don't spin on them
+            timeval tInterval = pCron->GetInterval();
+            timeradd(&tNow, &tInterval, &tNext);
+        }
+        Link(pCron, ToTick(tNext, true));
+    }
+}
+
+void CTimerWheel::Clear() {
+    std::vector<CCron*> vCrons = GetCrons();
+
+    for (auto& aLevel : m_aSlots) {
+        for (std::list<CCron*>& lSlot : aLevel) {
+            lSlot.clear();
+        }
+    }
+    m_lDue.clear();
+    m_mEntries.clear();
+    std::fill(std::begin(m_auLevelCount), std::end(m_auLevelCount), 0);
+
+    for (CCron* pCron : vCrons) {
+        delete pCron;
+    }
+}
+
+bool CTimerWheel::Contains(CCron* pCron) const {
+    return m_mEntries.find(pCron) != m_mEntries.end();
+}
+
+std::vector<CCron*> CTimerWheel::GetCrons() const {
+    std::vector<CCron*> vCrons;
+    vCrons.reserve(m_mEntries.size());
+    for (const auto& it : m_mEntries) {
+        vCrons.push_back(it.first);
+    }
+    return vCrons;
+}
+
+bool CTimerWheel::GetNextExpiry(timeval& tNext) const {
+    if (m_mEntries.empty()) {
+        return false;
+    }
+
+    uint64_t uNext = std::numeric_limits<uint64_t>::max();
+    if (!m_lDue.empty()) {
+        uNext = m_uCurrentTick;
+    }
+
+    for (unsigned int uLevel = 0; uLevel < LEVELS; ++uLevel) {
+        unsigned int uShift = SLOT_BITS * uLevel;
+        uint64_t uBlock = m_uCurrentTick >> uShift;
+        // The slot of the current block was cascaded already, unless the
+        // current tick is the one which starts it
+        if ((m_uCurrentTick & ((uint64_t(1) << uShift) - 1)) != 0) {
+            uBlock++;
+        }
+        for (unsigned int i = 0; i < SLOTS; ++i) {
+            if (!m_aSlots[uLevel][(uBlock + i) & (SLOTS - 1)].empty()) {
+                uNext = std::min(uNext, (uBlock + i) << uShift);
+                break;
+            }
+        }
+    }
+
+    tNext = FromTick(uNext);
+    return true;
+}
+
+class CSockManager::CTimerWheelCron : public CCron {
+  public:
+    CTimerWheelCron(CSockManager* pManager) : CCron(), m_pManager(pManager) {
+        SetName("CSockManager::TimerWheel");
+        Start(IDLE_INTERVAL);
+    }
+
+    ~CTimerWheelCron() override { m_pManager->m_pTimerWheelCron = nullptr; }
+
+    CTimerWheelCron(const CTimerWheelCron&) = delete;
+    CTimerWheelCron& operator=(const CTimerWheelCron&) = delete;
+
+    constexpr static int IDLE_INTERVAL = 60 /* seconds */;
+
+  protected:
+    void RunJob() override { m_pManager->ExpireTimers(); }
+
+  private:
+    CSockManager* m_pManager;
+};
+
 CSockManager::CSockManager() {
 #ifdef HAVE_PTHREAD
     MonitorFD(new CThreadMonitorFD());
 #endif
 }
 
-CSockManager::~CSockManager() {}
+CSockManager::~CSockManager() {
+    // Delete the sockets while the timer wheel is still there for their crons
+    Cleanup();
+}
+
+void CSockManager::Cleanup() {
+    TSocketManager::Cleanup();
+    m_TimerWheel.Clear();
+    if (m_pTimerWheelCron) {
+        TSocketManager::DelCronByAddr(m_pTimerWheelCron);
+    }
+}
+
+void CSockManager::AddCron(CCron* pcCron) {
+    m_TimerWheel.Add(pcCron);
+    WakeTimerWheel(pcCron->GetNextRun());
+}
+
+void CSockManager::DelCron(const CString& sName, bool bDeleteAll,
+                           bool bCaseSensitive) {
+    for (CCron* pcCron : m_TimerWheel.GetCrons()) {
+        bool bMatch = bCaseSensitive ? pcCron->GetName() == sName
+                                     : sName.Equals(pcCron->GetName());
+        if (bMatch) {
+            DelCronByAddr(pcCron);
+            if (!bDeleteAll) {
+                return;
+            }
+        }
+    }
+    TSocketManager::DelCron(sName, bDeleteAll, bCaseSensitive);
+}
+
+void CSockManager::DelCronByAddr(CCron* pcCron) {
+    if (m_TimerWheel.Remove(pcCron)) {
+        delete pcCron;
+    } else {
+        TSocketManager::DelCronByAddr(pcCron);
+    }
+}
+
+void CSockManager::RescheduleCron(CCron* pcCron) {
+    if (m_TimerWheel.Contains(pcCron)) {
+        m_TimerWheel.Reschedule(pcCron);
+        WakeTimerWheel(pcCron->GetNextRun());
+    }
+}
+
+void CSockManager::ExpireTimers() {
+    timeval tNow;
+    gettimeofday(&tNow, nullptr);
+    m_TimerWheel.Expire(tNow);
+
+    // Sleep until the wheel has something to do again
+    timeval tNext;
+    timeval tDelay = {CTimerWheelCron::IDLE_INTERVAL, 0};
+    if (m_TimerWheel.GetNextExpiry(tNext)) {
+        if (timercmp(&tNext, &tNow, >)) {
+            timersub(&tNext, &tNow, &tDelay);
+        } else {
+            tDelay = {0, 0};
+        }
+    }
+    m_pTimerWheelCron->Start(tDelay);
+}
+
+void CSockManager::WakeTimerWheel(const timeval& tWhen) {
+    if (!m_pTimerWheelCron) {
+        m_pTimerWheelCron = new CTimerWheelCron(this);
+        TSocketManager::AddCron(m_pTimerWheelCron);
+    }
+
+    timeval tWake = CTimerWheel::RoundUp(tWhen);
+    timeval tScheduled = m_pTimerWheelCron->GetNextRun();
+    if (!timercmp(&tWake, &tScheduled, <)) {
+        return;
+    }
+
+    timeval tNow;
+    timeval tDelay = {0, 0};
+    gettimeofday(&tNow, nullptr);
+    if (timercmp(&tWake, &tNow, >)) {
+        timersub(&tWake, &tNow, &tDelay);
+    }
+    m_pTimerWheelCron->Start(tDelay);
+}
 
 void CSockManager::Connect(const CString& sHostname, u_short iPort,
                            const CString& sSockName, int iTimeout, bool bSSL,
@@ -28,37 +28,6 @@
 using std::vector;
 using std::set;
 
-class CUserTimer : public CCron {
-  public:
-    CUserTimer(CUser* pUser) : CCron(), m_pUser(pUser) {
-        SetName("CUserTimer::" + m_pUser->GetUserName());
-        Start(m_pUser->GetPingSlack());
-    }
-    ~CUserTimer() override {}
-
-    CUserTimer(const CUserTimer&) = delete;
-    CUserTimer& operator=(const CUserTimer&) = delete;
-
-  private:
-  protected:
-    void RunJob() override {
-        const vector<CClient*>& vUserClients = m_pUser->GetUserClients();
-
-        for (CClient* pUserClient : vUserClients) {
-            if (pUserClient->GetTimeSinceLastDataTransaction() >=
-                m_pUser->GetPingFrequency()) {
-                pUserClient->PutClient("PING :ZNC");
-            }
-        }
-
-        // Restart timer for the case if the period had changed. Usually this is
-        // noop
-        Start(m_pUser->GetPingSlack());
-    }
-
-    CUser* m_pUser;
-};
-
 CUser::CUser(const CString& sUserName)
     : m_sUserName(sUserName),
       m_sCleanUserName(MakeCleanUserName(sUserName)),
@@ -89,7 +58,6 @@ CUser::CUser(const CString& sUserName)
       m_bAppendTimestamp(false),
       m_bPrependTimestamp(true),
       m_bAuthOnlyViaModule(false),
-      m_pUserTimer(nullptr),
       m_vIRCNetworks(),
       m_vClients(),
       m_ssAllowedHosts(),
@@ -103,10 +71,7 @@ CUser::CUser(const CString& sUserName)
       m_uMaxJoins(0),
       m_uNoTrafficTimeout(180),
       m_sSkinName(""),
-      m_pModules(new CModules) {
-    m_pUserTimer = new CUserTimer(this);
-    CZNC::Get().GetManager().AddCron(m_pUserTimer);
-}
+      m_pModules(new CModules) {}
 
 CUser::~CUser() {
     // Delete networks
@@ -124,8 +89,6 @@ CUser::~CUser() {
     delete m_pModules;
     m_pModules = nullptr;
 
-    CZNC::Get().GetManager().DelCronByAddr(m_pUserTimer);
-
     CZNC::Get().AddBytesRead(m_uBytesRead);
     CZNC::Get().AddBytesWritten(m_uBytesWritten);
 }
@@ -725,7 +688,8 @@ void CUser::CloneNetworks(const CUser& User) {
     }
 }
 
-bool CUser::Clone(const CUser& User, CString& sErrorRet, bool bCloneNetworks) {
+bool CUser::Clone(const CUser& User, CString& sErrorRet, bool bCloneNetworks,
+                  bool bCloneModules) {
     sErrorRet.clear();
 
     if (!User.IsValid(sErrorRet, true)) {
@@ -811,6 +775,8 @@ bool CUser::Clone(const CUser& User, CString& sErrorRet, bool bCloneNetworks) {
     // !Flags
 
     // Modules
+    if (!bCloneModules) return true;
+
     set<CString> ssUnloadMods;
     CModules& vCurMods = GetModules();
     const CModules& vNewMods = User.GetModules();
@@ -21,6 +21,10 @@
 #include <znc/SHA256.h>
 #include <sstream>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::stringstream;
 
 CString::CString(char c) : string() {
@@ -199,21 +203,86 @@ bool CString::WildCmp(const CString& sWild, CaseSensitivity cs) const {
     return CString::WildCmp(sWild, *this, cs);
 }
 
-CString& CString::MakeUpper() {
-    for (char& c : *this) {
+// The scans below look at 16 bytes at once where SSE2 is available, which
+// is always the case on x86-64, and fall back to one byte at a time.
+
+// Adds cDelta to the ASCII letters between cFirst and cLast. Blocks with
+// non-ASCII bytes are left to the locale's toupper() / tolower().
+static void ChangeCase(CString& s, char cFirst, char cLast, char cDelta,
+                       int (*fChange)(int)) {
+    char* p = &s[0];
+    size_t uLen = s.length();
+    size_t i = 0;
+#ifdef __SSE2__
+    // Signed comparisons, which is fine for ASCII
+    const __m128i vBelow = _mm_set1_epi8(cFirst - 1);
+    const __m128i vAbove = _mm_set1_epi8(cLast + 1);
+    const __m128i vDelta = _mm_set1_epi8(cDelta);
+    for (; i + 16 <= uLen; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        if (_mm_movemask_epi8(v)) {
+            for (size_t j = i; j < i + 16; ++j) p[j] = (char)fChange(p[j]);
+            continue;
+        }
+        __m128i vIn = _mm_and_si128(_mm_cmpgt_epi8(v, vBelow),
+                                    _mm_cmplt_epi8(v, vAbove));
+        v = _mm_add_epi8(v, _mm_and_si128(vIn, vDelta));
+        _mm_storeu_si128((__m128i*)(p + i), v);
+    }
+#endif
+    for (; i < uLen; ++i) {
         // TODO use unicode
-        c = (char)toupper(c);
+        p[i] = (char)fChange(p[i]);
+    }
+}
+
+// Returns the offset of the first C0 control character or DEL, or uLen
+static size_t FindControl(const unsigned char* p, size_t uLen) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i vMaxControl = _mm_set1_epi8(0x1F);
+    const __m128i vDel = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= uLen; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i vControl =
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, vMaxControl), v),
+                         _mm_cmpeq_epi8(v, vDel));
+        int iMask = _mm_movemask_epi8(vControl);
+        if (iMask) return i + __builtin_ctz(iMask);
+    }
+#endif
+    for (; i < uLen; ++i) {
+        if (p[i] < 0x20 || p[i] == 0x7F) return i;
+    }
+    return uLen;
+}
+
+// Returns the offset of the first CR or LF, or uLen
+static size_t FindCRLF(const char* p, size_t uLen) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i vCR = _mm_set1_epi8('\r');
+    const __m128i vLF = _mm_set1_epi8('\n');
+    for (; i + 16 <= uLen; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        int iMask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, vCR), _mm_cmpeq_epi8(v, vLF)));
+        if (iMask) return i + __builtin_ctz(iMask);
+    }
+#endif
+    for (; i < uLen; ++i) {
+        if (p[i] == '\r' || p[i] == '\n') return i;
     }
+    return uLen;
+}
 
+CString& CString::MakeUpper() {
+    ChangeCase(*this, 'a', 'z', 'A' - 'a', toupper);
     return *this;
 }
 
 CString& CString::MakeLower() {
-    for (char& c : *this) {
-        // TODO use unicode
-        c = (char)tolower(c);
-    }
-
+    ChangeCase(*this, 'A', 'Z', 'a' - 'A', tolower);
     return *this;
 }
 
@@ -653,20 +722,14 @@ unsigned int CString::Replace(CString& sStr, const CString& sReplace,
 CString CString::Token(size_t uPos, bool bRest, const CString& sSep,
                        bool bAllowEmpty, const CString& sLeft,
                        const CString& sRight, bool bTrimQuotes) const {
-    VCString vsTokens;
-    if (Split(sSep, vsTokens, bAllowEmpty, sLeft, sRight, bTrimQuotes) > uPos) {
-        CString sRet;
-
-        for (size_t a = uPos; a < vsTokens.size(); a++) {
-            if (a > uPos) {
-                sRet += sSep;
-            }
-
-            sRet += vsTokens[a];
-
-            if (!bRest) {
-                break;
-            }
+    CStringTokenizer Tokens(*this, sSep, bAllowEmpty, sLeft, sRight,
+                            bTrimQuotes);
+    if (Tokens.Skip(uPos) == uPos && Tokens.Next()) {
+        CString sRet = Tokens.GetToken();
+
+        while (bRest && Tokens.Next()) {
+            sRet += sSep;
+            sRet += Tokens.GetToken();
         }
 
         return sRet;
@@ -822,98 +885,165 @@ CString::size_type CString::Split(const CString& sDelim, VCString& vsRet,
                                   bool bTrimWhiteSpace) const {
     vsRet.clear();
 
-    if (empty()) {
-        return 0;
+    CStringTokenizer Tokens(*this, sDelim, bAllowEmpty, sLeft, sRight,
+                            bTrimQuotes);
+    while (Tokens.Next()) {
+        vsRet.push_back(Tokens.GetToken());
+
+        if (bTrimWhiteSpace) {
+            vsRet.back().Trim();
+        }
     }
 
-    CString sTmp;
-    bool bInside = false;
-    size_type uDelimLen = sDelim.length();
-    size_type uLeftLen = sLeft.length();
-    size_type uRightLen = sRight.length();
-    const char* p = c_str();
+    return vsRet.size();
+}
 
-    if (!bAllowEmpty) {
-        while (strncasecmp(p, sDelim.c_str(), uDelimLen) == 0) {
-            p += uDelimLen;
+CString::size_type CString::Split(const CString& sDelim, SCString& ssRet,
+                                  bool bAllowEmpty, const CString& sLeft,
+                                  const CString& sRight, bool bTrimQuotes,
+                                  bool bTrimWhiteSpace) const {
+    ssRet.clear();
+
+    CStringTokenizer Tokens(*this, sDelim, bAllowEmpty, sLeft, sRight,
+                            bTrimQuotes);
+    while (Tokens.Next()) {
+        CString sToken = Tokens.GetToken();
+
+        if (bTrimWhiteSpace) {
+            sToken.Trim();
         }
+
+        ssRet.insert(std::move(sToken));
     }
 
-    while (*p) {
-        if (uLeftLen && uRightLen && !bInside &&
-            strncasecmp(p, sLeft.c_str(), uLeftLen) == 0) {
-            if (!bTrimQuotes) {
-                sTmp += sLeft;
-            }
+    return ssRet.size();
+}
+
+CStringTokenizer::CStringTokenizer(const CString& sStr, const CString& sSep,
+                                   bool bAllowEmpty, const CString& sLeft,
+                                   const CString& sRight, bool bTrimQuotes)
+    : m_sStr(sStr),
+      m_sSep(sSep),
+      m_sLeft(sLeft),
+      m_sRight(sRight),
+      m_bAllowEmpty(bAllowEmpty),
+      m_bTrimQuotes(bTrimQuotes),
+      m_uPos(0),
+      m_uStart(0),
+      m_uEnd(0),
+      m_bQuoted(false),
+      m_cSepLower((char)tolower((unsigned char)m_sSep.c_str()[0])),
+      m_cSepUpper((char)toupper((unsigned char)m_sSep.c_str()[0])) {
+    if (!m_bAllowEmpty) {
+        SkipSeparators();
+    }
+}
+
+bool CStringTokenizer::MatchAt(size_t uPos, const CString& s) const {
+    // Like Split() always did, these are matched case-insensitively
+    return strncasecmp(m_sStr.c_str() + uPos, s.c_str(), s.length()) == 0;
+}
+
+bool CStringTokenizer::IsSeparatorAt(size_t uPos) const {
+    // Most characters don't even start a separator, check that first
+    char c = m_sStr[uPos];
+    if (m_sSep.empty() || (c != m_cSepLower && c != m_cSepUpper)) {
+        return false;
+    }
+    return MatchAt(uPos, m_sSep);
+}
+
+void CStringTokenizer::SkipSeparators() {
+    while (m_uPos < m_sStr.length() && IsSeparatorAt(m_uPos)) {
+        m_uPos += m_sSep.length();
+    }
+}
 
-            p += uLeftLen;
+bool CStringTokenizer::Next() {
+    bool bMarkers = !m_sLeft.empty() && !m_sRight.empty();
+    bool bInside = false;
+    // A token at the end of the string only counts if it isn't empty
+    bool bContent = false;
+
+    m_uStart = m_uPos;
+    m_bQuoted = false;
+
+    while (m_uPos < m_sStr.length()) {
+        if (bMarkers && !bInside && MatchAt(m_uPos, m_sLeft)) {
+            m_uPos += m_sLeft.length();
             bInside = true;
+            m_bQuoted = m_bTrimQuotes;
+            bContent = bContent || !m_bTrimQuotes;
             continue;
         }
 
-        if (uLeftLen && uRightLen && bInside &&
-            strncasecmp(p, sRight.c_str(), uRightLen) == 0) {
-            if (!bTrimQuotes) {
-                sTmp += sRight;
-            }
-
-            p += uRightLen;
+        if (bMarkers && bInside && MatchAt(m_uPos, m_sRight)) {
+            m_uPos += m_sRight.length();
             bInside = false;
+            bContent = bContent || !m_bTrimQuotes;
             continue;
         }
 
-        if (uDelimLen && !bInside &&
-            strncasecmp(p, sDelim.c_str(), uDelimLen) == 0) {
-            if (bTrimWhiteSpace) {
-                sTmp.Trim();
-            }
-
-            vsRet.push_back(sTmp);
-            sTmp.clear();
-            p += uDelimLen;
+        if (!bInside && IsSeparatorAt(m_uPos)) {
+            m_uEnd = m_uPos;
+            m_uPos += m_sSep.length();
 
-            if (!bAllowEmpty) {
-                while (strncasecmp(p, sDelim.c_str(), uDelimLen) == 0) {
-                    p += uDelimLen;
-                }
+            if (!m_bAllowEmpty) {
+                SkipSeparators();
             }
 
-            bInside = false;
-            continue;
-        } else {
-            sTmp += *p;
+            return true;
         }
 
-        p++;
+        bContent = true;
+        m_uPos++;
     }
 
-    if (!sTmp.empty()) {
-        if (bTrimWhiteSpace) {
-            sTmp.Trim();
-        }
+    m_uEnd = m_uPos;
+    return bContent;
+}
 
-        vsRet.push_back(sTmp);
+size_t CStringTokenizer::Skip(size_t uCount) {
+    size_t uSkipped = 0;
+    while (uSkipped < uCount && Next()) {
+        uSkipped++;
     }
-
-    return vsRet.size();
+    return uSkipped;
 }
 
-CString::size_type CString::Split(const CString& sDelim, SCString& ssRet,
-                                  bool bAllowEmpty, const CString& sLeft,
-                                  const CString& sRight, bool bTrimQuotes,
-                                  bool bTrimWhiteSpace) const {
-    VCString vsTokens;
-
-    Split(sDelim, vsTokens, bAllowEmpty, sLeft, sRight, bTrimQuotes,
-          bTrimWhiteSpace);
-
-    ssRet.clear();
+CString CStringTokenizer::GetToken() const {
+    if (!m_bQuoted) {
+        return m_sStr.substr(m_uStart, m_uEnd - m_uStart);
+    }
 
-    for (const CString& sToken : vsTokens) {
-        ssRet.insert(sToken);
+    CString sRet;
+    bool bInside = false;
+    size_t uPos = m_uStart;
+    while (uPos < m_uEnd) {
+        if (!bInside && MatchAt(uPos, m_sLeft)) {
+            uPos += m_sLeft.length();
+            bInside = true;
+        } else if (bInside && MatchAt(uPos, m_sRight)) {
+            uPos += m_sRight.length();
+            bInside = false;
+        } else {
+            sRet += m_sStr[uPos++];
+        }
     }
+    return sRet;
+}
 
-    return ssRet.size();
+bool CStringTokenizer::Equals(const CString& s, CaseSensitivity cs) const {
+    if (m_bQuoted) {
+        return GetToken().Equals(s, cs);
+    }
+    if (s.length() != GetLength()) {
+        return false;
+    }
+    if (cs == CString::CaseSensitive) {
+        return strncmp(GetData(), s.c_str(), GetLength()) == 0;
+    }
+    return strncasecmp(GetData(), s.c_str(), GetLength()) == 0;
 }
 
 CString CString::NamedFormat(const CString& sFormat, const MCString& msValues) {
@@ -1063,10 +1193,8 @@ bool CString::Base64Encode(CString& sRet, unsigned int uWrap) const {
 }
 
 unsigned long CString::Base64Decode(CString& sRet) const {
-    CString sTmp(*this);
     // remove new lines
-    sTmp.Replace("\r", "");
-    sTmp.Replace("\n", "");
+    CString sTmp = StripCRLF_n();
 
     const char* in = sTmp.c_str();
     char c, c1, *p;
@@ -1393,46 +1521,42 @@ bool CString::RightChomp(size_type uLen) {
 CString CString::StripControls_n() const {
     CString sRet;
     const unsigned char* pStart = (const unsigned char*)data();
-    unsigned char ch = *pStart;
     size_type iLength = length();
     sRet.reserve(iLength);
-    bool colorCode = false;
-    unsigned int digits = 0;
-    bool comma = false;
 
-    for (unsigned int a = 0; a < iLength; a++, ch = pStart[a]) {
+    size_type a = 0;
+    while (a < iLength) {
+        // Copy everything up to the next control character at once
+        size_type uNext = a + FindControl(pStart + a, iLength - a);
+        sRet.append((const char*)pStart + a, uNext - a);
+        if (uNext == iLength) break;
+
+        unsigned char ch = pStart[uNext];
+        a = uNext + 1;
+        // Other C0 control codes are just dropped
+        if (ch != 0x03) continue;
+
         // Color code. Format: \x03([0-9]{1,2}(,[0-9]{1,2})?)?
-        if (ch == 0x03) {
-            colorCode = true;
-            digits = 0;
-            comma = false;
-            continue;
-        }
-        if (colorCode) {
-            if (isdigit(ch) && digits < 2) {
+        unsigned int digits = 0;
+        bool comma = false;
+        while (a < iLength) {
+            ch = pStart[a];
+            if (ch >= '0' && ch <= '9' && digits < 2) {
                 digits++;
-                continue;
-            }
-            if (ch == ',' && !comma) {
+            } else if (ch == ',' && !comma) {
                 comma = true;
                 digits = 0;
-                continue;
+            } else {
+                break;
             }
+            a++;
+        }
 
-            colorCode = false;
-
-            if (digits == 0 && comma) {
-                // There was a ',' which wasn't followed by digits, we should
-                // print it.
-                sRet += ',';
-            }
+        // There was a ',' which wasn't followed by digits, we should print
+        // it. Unless another color code starts right away.
+        if (digits == 0 && comma && (a == iLength || pStart[a] != 0x03)) {
+            sRet += ',';
         }
-        // CO controls codes
-        if (ch < 0x20 || ch == 0x7F) continue;
-        sRet += ch;
-    }
-    if (colorCode && digits == 0 && comma) {
-        sRet += ',';
     }
 
     sRet.reserve(0);
@@ -1441,6 +1565,29 @@ CString CString::StripControls_n() const {
 
 CString& CString::StripControls() { return (*this = StripControls_n()); }
 
+CString& CString::StripCRLF() {
+    size_type uLen = length();
+    size_type uOut = FindCRLF(data(), uLen);
+    if (uOut == uLen) return *this;
+
+    // Move the rest of the string over the line breaks
+    char* p = &(*this)[0];
+    size_type uIn = uOut + 1;
+    while (uIn < uLen) {
+        size_type uNext = uIn + FindCRLF(p + uIn, uLen - uIn);
+        memmove(p + uOut, p + uIn, uNext - uIn);
+        uOut += uNext - uIn;
+        uIn = uNext + 1;
+    }
+    resize(uOut);
+    return *this;
+}
+
+CString CString::StripCRLF_n() const {
+    CString sRet = *this;
+    return sRet.StripCRLF();
+}
+
 //////////////// MCString ////////////////
 const MCString MCString::EmptyMap;
 
@@ -55,6 +55,8 @@ CZNC::CZNC()
       m_vsBindHosts(),
       m_vsTrustedProxies(),
       m_vsMotd(),
+      m_vsRehashReport(),
+      m_mPrefetchedRegistries(),
       m_pLockFile(nullptr),
       m_uiConnectDelay(5),
       m_uiAnonIPLimit(10),
@@ -66,6 +68,14 @@ CZNC::CZNC()
       m_lpConnectQueue(),
       m_pConnectQueueTimer(nullptr),
       m_uiConnectPaused(0),
+      m_uiConnectConcurrency(5),
+      m_uiPendingConnections(0),
+      m_KeepAliveQueue(),
+      m_mKeepAlives(),
+      m_uKeepAliveGeneration(0),
+      m_pKeepAliveTimer(nullptr),
+      m_lpPlayback(),
+      m_pPlaybackTimer(nullptr),
       m_uiForceEncoding(0),
       m_sConnectThrottle(),
       m_bProtectWebSessions(true),
@@ -73,7 +83,14 @@ CZNC::CZNC()
       m_bAuthOnlyViaModule(false),
       m_Translation("znc"),
       m_uiConfigWriteDelay(0),
-      m_pConfigTimer(nullptr) {
+      m_pConfigTimer(nullptr),
+      m_pConfigWriteJob(nullptr),
+      m_bConfigWritePending(false),
+      m_bConfigWritePendingVerbose(false),
+      m_uConfigWriteCount(0),
+      m_uConfigWriteCoalesced(0),
+      m_uLastConfigWriteSize(0),
+      m_uLastConfigWriteTime(0) {
     if (!InitCsocket()) {
         CUtils::PrintError("Could not initialize Csocket!");
         exit(-1);
@@ -82,6 +99,7 @@ CZNC::CZNC()
 }
 
 CZNC::~CZNC() {
+    CancelConfigWrite();
     m_pModules->UnloadAll();
 
     for (const auto& it : m_msUsers) {
@@ -102,7 +120,10 @@ CZNC::~CZNC() {
     }
 
     m_pConnectQueueTimer = nullptr;
-    // This deletes m_pConnectQueueTimer
+    m_pKeepAliveTimer = nullptr;
+    m_pPlaybackTimer = nullptr;
+    // This deletes m_pConnectQueueTimer, m_pKeepAliveTimer and
+    // m_pPlaybackTimer
     m_Manager.Cleanup();
     DeleteUsers();
 
@@ -151,10 +172,15 @@ CString CZNC::GetUptime() const {
 }
 
 bool CZNC::OnBoot() {
+    unsigned long long uStart = CUtils::GetMillTime();
+
     bool bFail = false;
     ALLMODULECALL(OnBoot(), &bFail);
     if (bFail) return false;
 
+    CUtils::PrintMessage("Booted all modules in " +
+                         CString(CUtils::GetMillTime() - uStart) + " ms");
+
     return true;
 }
 
@@ -205,6 +231,7 @@ void CZNC::Loop() {
 
                 if (RehashConfig(sError)) {
                     Broadcast("Rehashing succeeded", true);
+                    Broadcast(m_vsRehashReport.front(), true);
                 } else {
                     Broadcast("Rehashing failed: " + sError, true);
                     Broadcast("ZNC is in some possibly inconsistent state!",
@@ -218,6 +245,8 @@ void CZNC::Loop() {
                     if (m_pConfigTimer == nullptr) {
                         m_pConfigTimer = new CConfigWriteTimer(GetConfigWriteDelay());
                         GetManager().AddCron(m_pConfigTimer);
+                    } else {
+                        m_uConfigWriteCoalesced++;
                     }
                     break;
                 }
@@ -229,22 +258,22 @@ void CZNC::Loop() {
                 // stop pending configuration timer
                 DisableConfigTimer();
 
-                if (!WriteConfig()) {
-                    Broadcast("Writing the config file failed", true);
-                } else if (eState == ECONFIG_NEED_VERBOSE_WRITE) {
-                    Broadcast("Writing the config succeeded", true);
-                }
+                WriteConfigInBackground(eState == ECONFIG_NEED_VERBOSE_WRITE);
                 break;
             case ECONFIG_NOTHING:
                 break;
             case ECONFIG_NEED_QUIT:
+                // Don't lose a write which didn't make it to the disk yet
+                if (m_pConfigWriteJob != nullptr || m_bConfigWritePending) {
+                    WriteConfig();
+                }
                 return;
         }
 
         // Check for users that need to be deleted
         if (HandleUserDeletion()) {
             // Also remove those user(s) from the config file
-            WriteConfig();
+            WriteConfigInBackground();
         }
 
         // Csocket wants micro seconds
@@ -450,17 +479,173 @@ CString CZNC::ExpandConfigPath(const CString& sConfigFile, bool bAllowMkDir) {
     return sRetPath;
 }
 
+#ifdef HAVE_PTHREAD
+class CConfigWriteJob : public CJob {
+  public:
+    CConfigWriteJob(CConfig Config, const CString& sHeader,
+                    const CString& sConfigFile, bool bVerbose)
+        : CJob(),
+          m_Config(std::move(Config)),
+          m_sHeader(sHeader),
+          m_sConfigFile(sConfigFile),
+          m_bVerbose(bVerbose),
+          m_bSuccess(false),
+          m_pFile(nullptr),
+          m_uSize(0),
+          m_uTime(0) {}
+
+    ~CConfigWriteJob() override {
+        // Only non-null if the job was cancelled
+        delete m_pFile;
+    }
+
+    CConfigWriteJob(const CConfigWriteJob&) = delete;
+    CConfigWriteJob& operator=(const CConfigWriteJob&) = delete;
+
+    void runThread() override {
+        unsigned long long uStart = CUtils::GetMillTime();
+
+        CString sContents = m_sHeader + "\n" + m_Config.ToString();
+        m_uSize = sContents.size();
+
+        if (wasCancelled()) return;
+
+        m_bSuccess = CZNC::WriteConfigFile(m_sConfigFile, sContents, m_pFile);
+        m_uTime = CUtils::GetMillTime() - uStart;
+    }
+
+    void runMain() override {
+        CFile* pFile = m_pFile;
+        m_pFile = nullptr;
+        CZNC::Get().ConfigWriteFinished(m_bSuccess, pFile, m_uSize, m_uTime,
+                                        m_bVerbose);
+    }
+
+  private:
+    CConfig m_Config;
+    CString m_sHeader;
+    CString m_sConfigFile;
+    bool m_bVerbose;
+    bool m_bSuccess;
+    CFile* m_pFile;
+    unsigned long long m_uSize;
+    unsigned long long m_uTime;
+};
+#endif
+
 bool CZNC::WriteConfig() {
     if (GetConfigFile().empty()) {
         DEBUG("Config file name is empty?!");
         return false;
     }
 
+    // A write in the background would race with us for the temporary file.
+    // Whatever it was going to write is outdated by now anyway.
+    CancelConfigWrite();
+
+    unsigned long long uStart = CUtils::GetMillTime();
+    CString sContents = MakeConfigHeader() + "\n" + MakeConfig().ToString();
+
+    CFile* pFile = nullptr;
+    if (!WriteConfigFile(GetConfigFile(), sContents, pFile)) {
+        return false;
+    }
+
+    m_uConfigWriteCount++;
+    m_uLastConfigWriteSize = sContents.size();
+    m_uLastConfigWriteTime = CUtils::GetMillTime() - uStart;
+
+    // Make sure the lock is kept alive as long as we need it.
+    delete m_pLockFile;
+    m_pLockFile = pFile;
+
+    return true;
+}
+
+void CZNC::WriteConfigInBackground(bool bVerbose) {
+#ifdef HAVE_PTHREAD
+    if (GetConfigFile().empty()) {
+        DEBUG("Config file name is empty?!");
+        Broadcast("Writing the config file failed", true);
+        return;
+    }
+
+    if (m_pConfigWriteJob != nullptr) {
+        // The snapshot for the follow-up write is taken once the current
+        // write finishes, so it will contain this change as well.
+        if (m_bConfigWritePending) {
+            m_uConfigWriteCoalesced++;
+        }
+        m_bConfigWritePending = true;
+        m_bConfigWritePendingVerbose |= bVerbose;
+        return;
+    }
+
+    m_pConfigWriteJob = new CConfigWriteJob(MakeConfig(), MakeConfigHeader(),
+                                            GetConfigFile(), bVerbose);
+    CThreadPool::Get().addJob(m_pConfigWriteJob);
+#else
+    if (!WriteConfig()) {
+        Broadcast("Writing the config file failed", true);
+    } else if (bVerbose) {
+        Broadcast("Writing the config succeeded", true);
+    }
+#endif
+}
+
+void CZNC::ConfigWriteFinished(bool bSuccess, CFile* pFile,
+                               unsigned long long uSize,
+                               unsigned long long uTime, bool bVerbose) {
+    m_pConfigWriteJob = nullptr;
+
+    if (bSuccess) {
+        m_uConfigWriteCount++;
+        m_uLastConfigWriteSize = uSize;
+        m_uLastConfigWriteTime = uTime;
+        DEBUG("Wrote config in the background: " << uSize << " bytes in "
+                                                 << uTime << " ms");
+
+        // Make sure the lock is kept alive as long as we need it.
+        delete m_pLockFile;
+        m_pLockFile = pFile;
+
+        if (bVerbose) {
+            Broadcast("Writing the config succeeded", true);
+        }
+    } else {
+        delete pFile;
+        Broadcast("Writing the config file failed", true);
+    }
+
+    if (m_bConfigWritePending) {
+        bool bPendingVerbose = m_bConfigWritePendingVerbose;
+        m_bConfigWritePending = false;
+        m_bConfigWritePendingVerbose = false;
+        WriteConfigInBackground(bPendingVerbose);
+    }
+}
+
+void CZNC::CancelConfigWrite() {
+    m_bConfigWritePending = false;
+    m_bConfigWritePendingVerbose = false;
+#ifdef HAVE_PTHREAD
+    if (m_pConfigWriteJob != nullptr) {
+        CJob* pJob = m_pConfigWriteJob;
+        m_pConfigWriteJob = nullptr;
+        CThreadPool::Get().cancelJob(pJob);
+    }
+#endif
+}
+
+bool CZNC::WriteConfigFile(const CString& sConfigFile,
+                           const CString& sContents, CFile*& pFileRet) {
+    pFileRet = nullptr;
+
     // We first write to a temporary file and then move it to the right place
-    CFile* pFile = new CFile(GetConfigFile() + "~");
+    CFile* pFile = new CFile(sConfigFile + "~");
 
     if (!pFile->Open(O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
-        DEBUG("Could not write config to " + GetConfigFile() + "~: " +
+        DEBUG("Could not write config to " + sConfigFile + "~: " +
               CString(strerror(errno)));
         delete pFile;
         return false;
@@ -477,8 +662,38 @@ bool CZNC::WriteConfig() {
         return false;
     }
 
-    pFile->Write(MakeConfigHeader() + "\n");
+    pFile->Write(sContents);
+
+    // If Sync() fails... well, let's hope nothing important breaks..
+    pFile->Sync();
+
+    if (pFile->HadError()) {
+        DEBUG("Error while writing the config, errno says: " +
+              CString(strerror(errno)));
+        pFile->Delete();
+        delete pFile;
+        return false;
+    }
+
+    // We wrote to a temporary name, move it to the right place
+    if (!pFile->Move(sConfigFile, true)) {
+        DEBUG(
+            "Error while replacing the config file with a new version, errno "
+            "says "
+            << strerror(errno));
+        pFile->Delete();
+        delete pFile;
+        return false;
+    }
+
+    // Everything went fine, just need to update the saved path.
+    pFile->SetFileName(sConfigFile);
+
+    pFileRet = pFile;
+    return true;
+}
 
+CConfig CZNC::MakeConfig() {
     CConfig config;
     config.AddKeyValuePair("AnonIPLimit", CString(m_uiAnonIPLimit));
     config.AddKeyValuePair("MaxBufferSize", CString(m_uiMaxBufferSize));
@@ -520,6 +735,8 @@ bool CZNC::WriteConfig() {
     }
 
     config.AddKeyValuePair("ConnectDelay", CString(m_uiConnectDelay));
+    config.AddKeyValuePair("ConnectConcurrency",
+                           CString(m_uiConnectConcurrency));
     config.AddKeyValuePair("ServerThrottle",
                            CString(m_sConnectThrottle.GetTTL() / 1000));
 
@@ -577,38 +794,7 @@ bool CZNC::WriteConfig() {
                             it.second->ToConfig());
     }
 
-    config.Write(*pFile);
-
-    // If Sync() fails... well, let's hope nothing important breaks..
-    pFile->Sync();
-
-    if (pFile->HadError()) {
-        DEBUG("Error while writing the config, errno says: " +
-              CString(strerror(errno)));
-        pFile->Delete();
-        delete pFile;
-        return false;
-    }
-
-    // We wrote to a temporary name, move it to the right place
-    if (!pFile->Move(GetConfigFile(), true)) {
-        DEBUG(
-            "Error while replacing the config file with a new version, errno "
-            "says "
-            << strerror(errno));
-        pFile->Delete();
-        delete pFile;
-        return false;
-    }
-
-    // Everything went fine, just need to update the saved path.
-    pFile->SetFileName(GetConfigFile());
-
-    // Make sure the lock is kept alive as long as we need it.
-    delete m_pLockFile;
-    m_pLockFile = pFile;
-
-    return true;
+    return config;
 }
 
 CString CZNC::MakeConfigHeader() {
@@ -997,12 +1183,23 @@ void CZNC::BackupConfigOnce(const CString& sSuffix) {
 bool CZNC::ParseConfig(const CString& sConfig, CString& sError) {
     m_sConfigFile = ExpandConfigPath(sConfig, false);
 
+    unsigned long long uStart = CUtils::GetMillTime();
+
     CConfig config;
     if (!ReadConfig(config, sError)) return false;
+    unsigned long long uRead = CUtils::GetMillTime();
 
     if (!LoadGlobal(config, sError)) return false;
+    unsigned long long uGlobal = CUtils::GetMillTime();
 
     if (!LoadUsers(config, sError)) return false;
+    unsigned long long uUsers = CUtils::GetMillTime();
+
+    CUtils::PrintMessage(
+        "Loaded the config in " + CString(uUsers - uStart) + " ms (reading " +
+        CString(uRead - uStart) + " ms, global settings " +
+        CString(uGlobal - uRead) + " ms, users " + CString(uUsers - uGlobal) +
+        " ms)");
 
     return true;
 }
@@ -1085,20 +1282,410 @@ bool CZNC::ReadConfig(CConfig& config, CString& sError) {
     return true;
 }
 
+struct CZNC::CRehashUser {
+    CString sUserName;
+    bool bAdd = false;
+    bool bDelete = false;
+    // Something outside of the <Network> blocks and LoadModule lines changed
+    bool bSettings = false;
+    // Whether the LoadModule lines of the user changed, and the lines of the
+    // networks whose lines changed. All of them for new users and networks.
+    bool bModules = false;
+    VCString vsModules;
+    map<CString, VCString> mvsNetworkModules;
+    VCString vsAddNetworks;
+    VCString vsDelNetworks;
+    // Networks whose settings changed
+    VCString vsNetworks;
+    // Parsed from the new config without its LoadModule lines, so that no
+    // module runs in it
+    std::unique_ptr<CUser> pNewUser;
+};
+
+// Takes the LoadModule lines out of a user or network block, so that parsing
+// it doesn't load any module
+static VCString TakeModules(CConfig& config) {
+    VCString vsModules;
+    // Parse() lowercases the keys, ToConfig() doesn't
+    if (!config.FindStringVector("loadmodule", vsModules)) {
+        config.FindStringVector("LoadModule", vsModules);
+    }
+    // CUser::ParseConfig() would load bouncedcc for this legacy setting
+    CString sValue;
+    if (config.FindStringEntry("bouncedccs", sValue) && sValue.ToBool()) {
+        vsModules.push_back("bouncedcc");
+    }
+    return vsModules;
+}
+
+// Checks that the modules which aren't loaded yet exist and can be loaded
+// there, without loading them
+static bool CheckModules(const VCString& vsModules, CModules* pLoaded,
+                         CModInfo::EModuleType eType, const CString& sWhere,
+                         CString& sError) {
+    for (const CString& sLine : vsModules) {
+        CString sModName = sLine.Token(0);
+        if (pLoaded && pLoaded->FindModule(sModName)) continue;
+
+        CModInfo ModInfo;
+        CString sModRet;
+        if (!CModules::GetModInfo(ModInfo, sModName, sModRet)) {
+            sError = "Could not load module [" + sModName + "] for [" +
+                     sWhere + "] " + sModRet;
+        } else if (!ModInfo.SupportsType(eType)) {
+            sError = "Module [" + sModName + "] can't be loaded for [" +
+                     sWhere + "]";
+        } else {
+            continue;
+        }
+        CUtils::PrintError(sError);
+        return false;
+    }
+    return true;
+}
+
+static bool SameModules(const VCString& vsOld, const VCString& vsNew) {
+    MCString msOld, msNew;
+    for (const CString& sLine : vsOld) {
+        msOld[sLine.Token(0)] = sLine.Token(1, true);
+    }
+    for (const CString& sLine : vsNew) {
+        msNew[sLine.Token(0)] = sLine.Token(1, true);
+    }
+    return msOld == msNew;
+}
+
 bool CZNC::RehashConfig(CString& sError) {
     ALLMODULECALL(OnPreRehash(), NOTHING);
 
+    // A config write which is still in flight must not replace the file
+    // while we are reading it
+    CancelConfigWrite();
+    m_vsRehashReport.clear();
+
+    unsigned long long uStart = CUtils::GetMillTime();
+
     CConfig config;
     if (!ReadConfig(config, sError)) return false;
+    unsigned long long uRead = CUtils::GetMillTime();
 
     if (!LoadGlobal(config, sError)) return false;
+    unsigned long long uGlobal = CUtils::GetMillTime();
 
-    // do not reload users - it's dangerous!
+    // Only the users and networks which differ from the running state are
+    // touched, everyone else keeps going undisturbed.
+    vector<CRehashUser> vUsers;
+    if (!DiffUsers(config, vUsers, sError)) return false;
+    unsigned long long uDiff = CUtils::GetMillTime();
+
+    bool bApplied = ApplyUsers(vUsers, sError);
+    unsigned long long uApply = CUtils::GetMillTime();
+
+    size_t uNetworks = 0;
+    for (const CRehashUser& User : vUsers) {
+        uNetworks += User.vsAddNetworks.size() + User.vsDelNetworks.size() +
+                     User.vsNetworks.size();
+    }
+
+    m_vsRehashReport.insert(
+        m_vsRehashReport.begin(),
+        t_f("{1} users and {2} networks changed. Reading the config took {3} "
+            "ms, global settings {4} ms, diff {5} ms, applying {6} ms")(
+            vUsers.size(), uNetworks, uRead - uStart, uGlobal - uRead,
+            uDiff - uGlobal, uApply - uDiff));
+
+    for (const CString& sLine : m_vsRehashReport) {
+        DEBUG("Rehash: " << sLine);
+    }
+
+    if (!bApplied) return false;
 
     ALLMODULECALL(OnPostRehash(), NOTHING);
     return true;
 }
 
+bool CZNC::DiffUsers(CConfig& config, vector<CRehashUser>& vUsers,
+                     CString& sError) {
+    CConfig::SubConfig subConf;
+    config.FindSubConfig("user", subConf);
+
+    if (subConf.empty()) {
+        sError = "You must define at least one user in your config.";
+        CUtils::PrintError(sError);
+        return false;
+    }
+
+    for (const auto& it : m_msUsers) {
+        if (subConf.find(it.first) == subConf.end()) {
+            CRehashUser User;
+            User.sUserName = it.first;
+            User.bDelete = true;
+            vUsers.push_back(std::move(User));
+        }
+    }
+
+    for (const auto& subIt : subConf) {
+        const CString& sUserName = subIt.first;
+        CConfig* pSubConf = subIt.second.m_pSubConfig;
+        CUser* pOldUser = FindUser(sUserName);
+
+        CRehashUser User;
+        User.sUserName = sUserName;
+        User.vsModules = TakeModules(*pSubConf);
+
+        CConfig::SubConfig networks;
+        pSubConf->FindSubConfig("network", networks);
+        for (auto& netIt : networks) {
+            CConfig* pNetConf = netIt.second.m_pSubConfig;
+            User.mvsNetworkModules[netIt.first] = TakeModules(*pNetConf);
+            pSubConf->AddSubConfig("network", netIt.first,
+                                   std::move(*pNetConf));
+        }
+
+        // Everything is parsed and validated before anything is applied, so
+        // that a broken user block doesn't leave us with half a rehash. The
+        // modules are only loaded into the running users and networks.
+        User.pNewUser.reset(ParseUser(sUserName, pSubConf, sError));
+        if (!User.pNewUser) return false;
+
+        CString sErr;
+        if (!User.pNewUser->IsValid(sErr, pOldUser != nullptr)) {
+            sError = "Invalid user [" + sUserName + "] " + sErr;
+            CUtils::PrintError(sError);
+            return false;
+        }
+
+        if (!pOldUser) {
+            User.bAdd = true;
+            User.bModules = true;
+        } else {
+            // Both sides are compared as written by ToConfig(), so that
+            // settings left at their defaults don't count as changes
+            CConfig oldConfig = pOldUser->ToConfig();
+            CConfig newConfig = User.pNewUser->ToConfig();
+            User.bModules =
+                !SameModules(TakeModules(oldConfig), User.vsModules);
+
+            CConfig::SubConfig oldNetworks, newNetworks;
+            oldConfig.FindSubConfig("Network", oldNetworks);
+            newConfig.FindSubConfig("Network", newNetworks);
+            User.bSettings = !oldConfig.Equals(newConfig);
+
+            // Network names are case-insensitive
+            map<CString, CConfig*> mpOldNetworks;
+            for (const auto& netIt : oldNetworks) {
+                mpOldNetworks[netIt.first.AsLower()] =
+                    netIt.second.m_pSubConfig;
+            }
+
+            for (const auto& netIt : newNetworks) {
+                const CString& sNetwork = netIt.first;
+                auto oldIt = mpOldNetworks.find(sNetwork.AsLower());
+
+                if (oldIt == mpOldNetworks.end()) {
+                    User.vsAddNetworks.push_back(sNetwork);
+                    continue;
+                }
+
+                CConfig* pOldNetConf = oldIt->second;
+                mpOldNetworks.erase(oldIt);
+                bool bModules = !SameModules(TakeModules(*pOldNetConf),
+                                             User.mvsNetworkModules[sNetwork]);
+                bool bSettings =
+                    !pOldNetConf->Equals(*netIt.second.m_pSubConfig);
+                if (bSettings) User.vsNetworks.push_back(sNetwork);
+                if (!bModules) User.mvsNetworkModules.erase(sNetwork);
+            }
+
+            for (const auto& netIt : oldNetworks) {
+                if (mpOldNetworks.count(netIt.first.AsLower())) {
+                    User.vsDelNetworks.push_back(netIt.first);
+                }
+            }
+
+            if (!User.bSettings && !User.bModules &&
+                User.mvsNetworkModules.empty() &&
+                User.vsAddNetworks.empty() && User.vsDelNetworks.empty() &&
+                User.vsNetworks.empty()) {
+                continue;
+            }
+        }
+
+        // Loading a module can still fail, but at least it must exist
+        if (User.bModules &&
+            !CheckModules(User.vsModules,
+                          pOldUser ? &pOldUser->GetModules() : nullptr,
+                          CModInfo::UserModule, sUserName, sError)) {
+            return false;
+        }
+        for (const auto& it : User.mvsNetworkModules) {
+            CIRCNetwork* pNetwork =
+                pOldUser ? pOldUser->FindNetwork(it.first) : nullptr;
+            if (!CheckModules(it.second,
+                              pNetwork ? &pNetwork->GetModules() : nullptr,
+                              CModInfo::NetworkModule,
+                              sUserName + "/" + it.first, sError)) {
+                return false;
+            }
+        }
+
+        vUsers.push_back(std::move(User));
+    }
+
+    return true;
+}
+
+bool CZNC::SyncModules(const VCString& vsModules, CUser* pUser,
+                       CIRCNetwork* pNetwork, CString& sError) {
+    CModules& Modules = pNetwork ? pNetwork->GetModules() : pUser->GetModules();
+    CModInfo::EModuleType eType =
+        pNetwork ? CModInfo::NetworkModule : CModInfo::UserModule;
+    CString sWhere = pUser->GetUserName();
+    if (pNetwork) sWhere += "/" + pNetwork->GetName();
+    bool bSuccess = true;
+
+    set<CString> ssModules;
+    for (const CString& sLine : vsModules) {
+        CString sModName = sLine.Token(0);
+        CString sArgs = sLine.Token(1, true);
+        CString sModRet;
+        ssModules.insert(sModName);
+
+        CModule* pMod = Modules.FindModule(sModName);
+        if (!pMod) {
+            if (Modules.LoadModule(sModName, sArgs, eType, pUser, pNetwork,
+                                   sModRet)) {
+                m_vsRehashReport.push_back(
+                    t_f("Loaded module {1} for {2}")(sModName, sWhere));
+                continue;
+            }
+        } else if (pMod->GetArgs() != sArgs) {
+            if (Modules.ReloadModule(sModName, sArgs, pUser, pNetwork,
+                                     sModRet)) {
+                m_vsRehashReport.push_back(
+                    t_f("Reloaded module {1} for {2}")(sModName, sWhere));
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        sError = "Could not load module [" + sModName + "] for [" + sWhere +
+                 "] " + sModRet;
+        m_vsRehashReport.push_back(
+            t_f("Could not load module {1} for {2}: {3}")(sModName, sWhere,
+                                                         sModRet));
+        bSuccess = false;
+    }
+
+    VCString vsUnload;
+    for (CModule* pMod : Modules) {
+        if (!ssModules.count(pMod->GetModName())) {
+            vsUnload.push_back(pMod->GetModName());
+        }
+    }
+    for (const CString& sModName : vsUnload) {
+        if (Modules.UnloadModule(sModName)) {
+            m_vsRehashReport.push_back(
+                t_f("Unloaded module {1} for {2}")(sModName, sWhere));
+        }
+    }
+
+    return bSuccess;
+}
+
+bool CZNC::ApplyUsers(vector<CRehashUser>& vUsers, CString& sError) {
+    // Modules may refuse new users. Nothing is applied unless all of them
+    // can be added.
+    for (CRehashUser& User : vUsers) {
+        if (!User.bAdd) continue;
+        bool bFailed = false;
+        CString sErr;
+        GLOBALMODULECALL(OnAddUser(*User.pNewUser, sErr), &bFailed);
+        if (bFailed) {
+            sError = "Could not add user [" + User.sUserName + "] " + sErr;
+            m_vsRehashReport.push_back(
+                t_f("Could not add user {1}: {2}")(User.sUserName, sErr));
+            return false;
+        }
+    }
+
+    for (CRehashUser& User : vUsers) {
+        const CString& sUserName = User.sUserName;
+        CString sErr;
+
+        if (User.bDelete) {
+            DeleteUser(sUserName);
+            m_vsRehashReport.push_back(t_f("Removed user {1}")(sUserName));
+            continue;
+        }
+
+        if (User.bAdd) {
+            // The modules were asked already
+            CUser* pNewUser = User.pNewUser.release();
+            AddUser(pNewUser, sErr, true);
+            m_vsRehashReport.push_back(t_f("Added user {1}")(sUserName));
+
+            SyncModules(User.vsModules, pNewUser, nullptr, sError);
+            for (const auto& it : User.mvsNetworkModules) {
+                CIRCNetwork* pNetwork = pNewUser->FindNetwork(it.first);
+                if (pNetwork) {
+                    SyncModules(it.second, pNewUser, pNetwork, sError);
+                }
+            }
+            continue;
+        }
+
+        CUser* pUser = FindUser(sUserName);
+        const CUser& NewUser = *User.pNewUser;
+
+        if (User.bSettings) {
+            // Validated already, so this doesn't fail
+            pUser->Clone(NewUser, sErr, false, false);
+            m_vsRehashReport.push_back(t_f("Updated user {1}")(sUserName));
+        }
+
+        if (User.bModules) {
+            SyncModules(User.vsModules, pUser, nullptr, sError);
+        }
+
+        for (const CString& sNetwork : User.vsDelNetworks) {
+            // Keep the clients, one of them may have requested the rehash
+            const vector<CClient*>& vClients =
+                pUser->FindNetwork(sNetwork)->GetClients();
+            while (!vClients.empty()) {
+                vClients.front()->SetNetwork(nullptr);
+            }
+
+            if (pUser->DeleteNetwork(sNetwork)) {
+                m_vsRehashReport.push_back(
+                    t_f("Removed network {1}/{2}")(sUserName, sNetwork));
+            }
+        }
+
+        for (const CString& sNetwork : User.vsAddNetworks) {
+            new CIRCNetwork(pUser, *NewUser.FindNetwork(sNetwork));
+            m_vsRehashReport.push_back(
+                t_f("Added network {1}/{2}")(sUserName, sNetwork));
+        }
+
+        for (const CString& sNetwork : User.vsNetworks) {
+            pUser->FindNetwork(sNetwork)->Clone(*NewUser.FindNetwork(sNetwork),
+                                                true, false);
+            m_vsRehashReport.push_back(
+                t_f("Updated network {1}/{2}")(sUserName, sNetwork));
+        }
+
+        for (const auto& it : User.mvsNetworkModules) {
+            CIRCNetwork* pNetwork = pUser->FindNetwork(it.first);
+            if (pNetwork) SyncModules(it.second, pUser, pNetwork, sError);
+        }
+    }
+
+    // Only modules which refused their arguments can have failed
+    return sError.empty();
+}
+
 bool CZNC::LoadGlobal(CConfig& config, CString& sError) {
     sError.clear();
 
@@ -1202,6 +1789,8 @@ bool CZNC::LoadGlobal(CConfig& config, CString& sError) {
     if (config.FindStringEntry("skin", sVal)) SetSkinName(sVal);
     if (config.FindStringEntry("connectdelay", sVal))
         SetConnectDelay(sVal.ToUInt());
+    if (config.FindStringEntry("connectconcurrency", sVal))
+        SetConnectConcurrency(sVal.ToUInt());
     if (config.FindStringEntry("serverthrottle", sVal))
         m_sConnectThrottle.SetTTL(sVal.ToUInt() * 1000);
     if (config.FindStringEntry("anoniplimit", sVal))
@@ -1237,6 +1826,113 @@ bool CZNC::LoadGlobal(CConfig& config, CString& sError) {
     return true;
 }
 
+// Reads the module registries of a single user and all of its networks
+static void ReadUserRegistries(const CString& sUserPath,
+                               map<CString, MCString>& mRegistries) {
+    VCString vsModData = {sUserPath + "/moddata"};
+
+    CDir Networks(sUserPath + "/networks");
+    for (CFile* pNetwork : Networks) {
+        vsModData.push_back(pNetwork->GetLongName() + "/moddata");
+    }
+
+    for (const CString& sModData : vsModData) {
+        CDir Modules(sModData);
+        for (CFile* pModule : Modules) {
+            CString sPath = pModule->GetLongName() + "/.registry";
+            MCString msRegistry;
+            if (msRegistry.ReadFromDisk(sPath) == MCString::MCS_SUCCESS) {
+                mRegistries[sPath].swap(msRegistry);
+            }
+        }
+    }
+}
+
+#ifdef HAVE_PTHREAD
+class CUserPrefetchJob : public CJob {
+  public:
+    CUserPrefetchJob(const CString& sUserPath, CMutex& Mutex,
+                     CConditionVariable& Cond, size_t& uPending)
+        : CJob(),
+          m_sUserPath(sUserPath),
+          m_Mutex(Mutex),
+          m_Cond(Cond),
+          m_uPending(uPending),
+          m_mRegistries() {}
+
+    CUserPrefetchJob(const CUserPrefetchJob&) = delete;
+    CUserPrefetchJob& operator=(const CUserPrefetchJob&) = delete;
+
+    void runThread() override {
+        ReadUserRegistries(m_sUserPath, m_mRegistries);
+
+        // PrefetchUserData() waits for this, nothing here may be touched
+        // after the counter dropped to zero.
+        CMutexLocker guard(m_Mutex);
+        if (--m_uPending == 0) m_Cond.notify_all();
+    }
+
+    void runMain() override {}
+
+    map<CString, MCString>& GetRegistries() { return m_mRegistries; }
+
+  private:
+    CString m_sUserPath;
+    CMutex& m_Mutex;
+    CConditionVariable& m_Cond;
+    size_t& m_uPending;
+    map<CString, MCString> m_mRegistries;
+};
+#endif
+
+void CZNC::PrefetchUserData(const VCString& vsUsers) {
+    const CString sUserPath = GetUserPath();
+
+#ifdef HAVE_PTHREAD
+    CMutex Mutex;
+    CConditionVariable Cond;
+    size_t uPending = vsUsers.size();
+    vector<CUserPrefetchJob*> vpJobs;
+
+    for (const CString& sUser : vsUsers) {
+        CUserPrefetchJob* pJob = new CUserPrefetchJob(
+            sUserPath + "/" + sUser, Mutex, Cond, uPending);
+        vpJobs.push_back(pJob);
+        CThreadPool::Get().addJob(pJob);
+    }
+
+    {
+        CMutexLocker guard(Mutex);
+        Cond.wait(guard, [&]() { return uPending == 0; });
+    }
+
+    // Merge in config order, so that the result doesn't depend on which
+    // thread finished first
+    for (CUserPrefetchJob* pJob : vpJobs) {
+        for (auto& it : pJob->GetRegistries()) {
+            m_mPrefetchedRegistries[it.first].swap(it.second);
+        }
+    }
+
+    // The jobs are done, this only reaps them without waiting for the main
+    // loop to call runMain()
+    CThreadPool::Get().cancelJobs(set<CJob*>(vpJobs.begin(), vpJobs.end()));
+#else
+    for (const CString& sUser : vsUsers) {
+        ReadUserRegistries(sUserPath + "/" + sUser, m_mPrefetchedRegistries);
+    }
+#endif
+}
+
+bool CZNC::TakePrefetchedRegistry(const CString& sPath, MCString& msRet) {
+    auto it = m_mPrefetchedRegistries.find(sPath);
+    if (it == m_mPrefetchedRegistries.end()) return false;
+
+    msRet.swap(it->second);
+    m_mPrefetchedRegistries.erase(it);
+    return true;
+}
+
 bool CZNC::LoadUsers(CConfig& config, CString& sError) {
     sError.clear();
 
@@ -1245,34 +1941,30 @@ bool CZNC::LoadUsers(CConfig& config, CString& sError) {
     CConfig::SubConfig subConf;
     config.FindSubConfig("user", subConf);
 
+    // Reading the module data of thousands of users is mostly waiting for
+    // the disk, so do it in parallel up front. Everything that touches
+    // global state happens below on the main thread, in config order.
+    unsigned long long uStart = CUtils::GetMillTime();
+
+    VCString vsUsers;
+    for (const auto& subIt : subConf) {
+        vsUsers.push_back(subIt.first);
+    }
+    PrefetchUserData(vsUsers);
+
+    unsigned long long uPrefetched = CUtils::GetMillTime();
+    CUtils::PrintMessage("Prefetched module data of " +
+                         CString(vsUsers.size()) + " users in " +
+                         CString(uPrefetched - uStart) + " ms");
+
     for (const auto& subIt : subConf) {
         const CString& sUserName = subIt.first;
         CConfig* pSubConf = subIt.second.m_pSubConfig;
 
         CUtils::PrintMessage("Loading user [" + sUserName + "]");
 
-        std::unique_ptr<CUser> pUser(new CUser(sUserName));
-
-        if (!m_sStatusPrefix.empty()) {
-            if (!pUser->SetStatusPrefix(m_sStatusPrefix)) {
-                sError = "Invalid StatusPrefix [" + m_sStatusPrefix +
-                         "] Must be 1-5 chars, no spaces.";
-                CUtils::PrintError(sError);
-                return false;
-            }
-        }
-
-        if (!pUser->ParseConfig(pSubConf, sError)) {
-            CUtils::PrintError(sError);
-            return false;
-        }
-
-        if (!pSubConf->empty()) {
-            sError = "Unhandled lines in config for User [" + sUserName + "]!";
-            CUtils::PrintError(sError);
-            DumpConfig(pSubConf);
-            return false;
-        }
+        std::unique_ptr<CUser> pUser(ParseUser(sUserName, pSubConf, sError));
+        if (!pUser) return false;
 
         CString sErr;
         if (!AddUser(pUser.release(), sErr, true)) {
@@ -1286,6 +1978,13 @@ bool CZNC::LoadUsers(CConfig& config, CString& sError) {
         }
     }
 
+    // Registries of modules which aren't loaded anymore
+    m_mPrefetchedRegistries.clear();
+
+    CUtils::PrintMessage("Loaded " + CString(m_msUsers.size()) +
+                         " users in " +
+                         CString(CUtils::GetMillTime() - uPrefetched) + " ms");
+
     if (m_msUsers.empty()) {
         sError = "You must define at least one user in your config.";
         CUtils::PrintError(sError);
@@ -1295,6 +1994,34 @@ bool CZNC::LoadUsers(CConfig& config, CString& sError) {
     return true;
 }
 
+CUser* CZNC::ParseUser(const CString& sUserName, CConfig* pConfig,
+                       CString& sError) {
+    std::unique_ptr<CUser> pUser(new CUser(sUserName));
+
+    if (!m_sStatusPrefix.empty()) {
+        if (!pUser->SetStatusPrefix(m_sStatusPrefix)) {
+            sError = "Invalid StatusPrefix [" + m_sStatusPrefix +
+                     "] Must be 1-5 chars, no spaces.";
+            CUtils::PrintError(sError);
+            return nullptr;
+        }
+    }
+
+    if (!pUser->ParseConfig(pConfig, sError)) {
+        CUtils::PrintError(sError);
+        return nullptr;
+    }
+
+    if (!pConfig->empty()) {
+        sError = "Unhandled lines in config for User [" + sUserName + "]!";
+        CUtils::PrintError(sError);
+        DumpConfig(pConfig);
+        return nullptr;
+    }
+
+    return pUser.release();
+}
+
 bool CZNC::LoadListeners(CConfig& config, CString& sError) {
     sError.clear();
 
@@ -1964,6 +2691,8 @@ class CConnectQueueTimer : public CCron {
         list<CIRCNetwork*> ConnectionQueue;
         list<CIRCNetwork*>& RealConnectionQueue =
             CZNC::Get().GetConnectionQueue();
+        vector<CIRCNetwork*> vNetworks =
+            CZNC::Get().GetScheduledConnectionQueue();
 
         // Problem: If a network can't connect right now because e.g. it
         // is throttled, it will re-insert itself into the connection
@@ -1974,15 +2703,29 @@ class CConnectQueueTimer : public CCron {
         // the beginning and work from that.
         ConnectionQueue.swap(RealConnectionQueue);
 
-        while (!ConnectionQueue.empty()) {
-            CIRCNetwork* pNetwork = ConnectionQueue.front();
-            ConnectionQueue.pop_front();
+        // A connection attempt to a dead server can take minutes to time
+        // out, so instead of one connect per run, keep up to
+        // ConnectConcurrency connections in progress. The per host
+        // ServerThrottle still applies.
+        time_t tNow = time(nullptr);
+        set<CIRCNetwork*> ssTried;
 
-            if (pNetwork->Connect()) {
+        for (CIRCNetwork* pNetwork : vNetworks) {
+            if (CZNC::Get().GetPendingConnections() >=
+                CZNC::Get().GetConnectConcurrency()) {
                 break;
             }
+            // Still backing off after failed attempts
+            if (pNetwork->GetNextConnectTime() > tNow) continue;
+
+            ssTried.insert(pNetwork);
+            pNetwork->Connect();
         }
 
+        ConnectionQueue.remove_if([&](CIRCNetwork* pNetwork) {
+            return ssTried.count(pNetwork) > 0;
+        });
+
         /* Now re-insert anything that is left in our local list into
          * the real connection queue.
          */
@@ -2003,6 +2746,7 @@ void CZNC::SetConnectDelay(unsigned int i) {
     }
     if (m_uiConnectDelay != i && m_pConnectQueueTimer != nullptr) {
         m_pConnectQueueTimer->Start(i);
+        GetManager().RescheduleCron(m_pConnectQueueTimer);
     }
     m_uiConnectDelay = i;
 }
@@ -2085,6 +2829,7 @@ void CZNC::ResumeConnectQueue() {
     EnableConnectQueue();
     if (m_pConnectQueueTimer) {
         m_pConnectQueueTimer->UnPause();
+        GetManager().RescheduleCron(m_pConnectQueueTimer);
     }
 }
 
@@ -2118,10 +2863,198 @@ void CZNC::AddNetworkToQueue(CIRCNetwork* pNetwork) {
     EnableConnectQueue();
 }
 
+vector<CIRCNetwork*> CZNC::GetScheduledConnectionQueue() const {
+    vector<CIRCNetwork*> vNetworks(m_lpConnectQueue.begin(),
+                                   m_lpConnectQueue.end());
+    std::stable_sort(vNetworks.begin(), vNetworks.end(),
+                     [](const CIRCNetwork* pA, const CIRCNetwork* pB) {
+                         return pA->GetConnectPriority() <
+                                pB->GetConnectPriority();
+                     });
+    return vNetworks;
+}
+
 void CZNC::LeakConnectQueueTimer(CConnectQueueTimer* pTimer) {
     if (m_pConnectQueueTimer == pTimer) m_pConnectQueueTimer = nullptr;
 }
 
+class CKeepAliveTimer : public CCron {
+  public:
+    CKeepAliveTimer() : CCron() { SetName("Keep connections alive"); }
+    ~CKeepAliveTimer() override {
+        // See ~CConnectQueueTimer()
+        CZNC::Get().LeakKeepAliveTimer(this);
+    }
+
+  protected:
+    void RunJob() override { CZNC::Get().RunKeepAlive(); }
+};
+
+void CZNC::AddKeepAlive(CClient* pClient) {
+    AddKeepAlive(pClient, {pClient, nullptr, 0});
+}
+
+void CZNC::AddKeepAlive(CIRCSock* pIRCSock) {
+    AddKeepAlive(pIRCSock, {nullptr, pIRCSock, 0});
+}
+
+void CZNC::AddKeepAlive(Csock* pSock, const CKeepAlive& KeepAlive) {
+    CKeepAlive& Entry = m_mKeepAlives[pSock];
+    Entry = KeepAlive;
+    Entry.uGeneration = ++m_uKeepAliveGeneration;
+    time_t tFrequency = GetKeepAliveUser(Entry)->GetPingFrequency();
+    m_KeepAliveQueue.emplace(time(nullptr) + std::max<time_t>(tFrequency, 1),
+                             Entry.uGeneration, pSock);
+    ScheduleKeepAlive();
+}
+
+void CZNC::DelKeepAlive(Csock* pSock) {
+    // Its entry in the queue is skipped when it comes up
+    m_mKeepAlives.erase(pSock);
+}
+
+CUser* CZNC::GetKeepAliveUser(const CKeepAlive& KeepAlive) const {
+    if (KeepAlive.pClient) {
+        return KeepAlive.pClient->GetUser();
+    }
+    return KeepAlive.pIRCSock->GetNetwork()->GetUser();
+}
+
+void CZNC::RunKeepAlive() {
+    time_t tNow = time(nullptr);
+    while (!m_KeepAliveQueue.empty() &&
+           std::get<0>(m_KeepAliveQueue.top()) <= tNow) {
+        unsigned long long uGeneration = std::get<1>(m_KeepAliveQueue.top());
+        Csock* pSock = std::get<2>(m_KeepAliveQueue.top());
+        m_KeepAliveQueue.pop();
+
+        auto it = m_mKeepAlives.find(pSock);
+        if (it == m_mKeepAlives.end() ||
+            it->second.uGeneration != uGeneration) {
+            continue;
+        }
+        // Copy it, sending may add or remove keepalives
+        CKeepAlive KeepAlive = it->second;
+        CUser* pUser = GetKeepAliveUser(KeepAlive);
+        if (!pUser) continue;
+        time_t tFrequency = std::max<time_t>(pUser->GetPingFrequency(), 1);
+
+        // Traffic since the entry was queued pushes the deadline back
+        time_t tIdle = pSock->GetTimeSinceLastDataTransaction(tNow);
+        if (tIdle >= tFrequency) {
+            if (KeepAlive.pClient) {
+                KeepAlive.pClient->PutClient("PING :ZNC");
+            } else {
+                KeepAlive.pIRCSock->PutIRC("PING :ZNC");
+            }
+            tIdle = 0;
+        }
+        m_KeepAliveQueue.emplace(tNow - tIdle + tFrequency, uGeneration, pSock);
+    }
+    ScheduleKeepAlive();
+}
+
+void CZNC::ScheduleKeepAlive() {
+    // Don't wake up for sockets which are gone
+    while (!m_KeepAliveQueue.empty()) {
+        auto it = m_mKeepAlives.find(std::get<2>(m_KeepAliveQueue.top()));
+        if (it != m_mKeepAlives.end() &&
+            it->second.uGeneration == std::get<1>(m_KeepAliveQueue.top())) {
+            break;
+        }
+        m_KeepAliveQueue.pop();
+    }
+
+    if (m_KeepAliveQueue.empty()) {
+        if (m_pKeepAliveTimer) m_pKeepAliveTimer->Pause();
+        return;
+    }
+
+    // Sockets used to be checked every PingSlack seconds. Keep waking up at
+    // multiples of it, so that sockets due at about the same time are pinged
+    // together, but skip the wakeups when nothing is due.
+    const KeepAliveDeadline& Next = m_KeepAliveQueue.top();
+    CUser* pUser = GetKeepAliveUser(m_mKeepAlives[std::get<2>(Next)]);
+    time_t tSlack = pUser ? std::max<time_t>(pUser->GetPingSlack(), 1) : 1;
+    time_t tWake = (std::get<0>(Next) + tSlack - 1) / tSlack * tSlack;
+    time_t tDelay = std::max<time_t>(tWake - time(nullptr), 1);
+
+    if (!m_pKeepAliveTimer) {
+        m_pKeepAliveTimer = new CKeepAliveTimer();
+        m_pKeepAliveTimer->Start(tDelay);
+        GetManager().AddCron(m_pKeepAliveTimer);
+    } else {
+        m_pKeepAliveTimer->UnPause();
+        m_pKeepAliveTimer->Start(tDelay);
+        GetManager().RescheduleCron(m_pKeepAliveTimer);
+    }
+}
+
+void CZNC::LeakKeepAliveTimer(CKeepAliveTimer* pTimer) {
+    if (m_pKeepAliveTimer == pTimer) m_pKeepAliveTimer = nullptr;
+}
+
+class CPlaybackTimer : public CCron {
+  public:
+    CPlaybackTimer() : CCron() {
+        SetName("Buffer playback");
+        // Every loop iteration, more or less
+        Start(0.01);
+    }
+    ~CPlaybackTimer() override {
+        // See ~CConnectQueueTimer()
+        CZNC::Get().LeakPlaybackTimer(this);
+    }
+
+  protected:
+    void RunJob() override { CZNC::Get().RunPlayback(); }
+};
+
+// Lines per run of the playback timer, in slices of
+// CClient::m_uPlaybackSlice per client
+static const size_t PLAYBACK_LINES_PER_RUN = 1000;
+
+void CZNC::AddPlayback(CClient* pClient) {
+    if (std::find(m_lpPlayback.begin(), m_lpPlayback.end(), pClient) !=
+        m_lpPlayback.end()) {
+        return;
+    }
+    bool bWasIdle = m_lpPlayback.empty();
+    m_lpPlayback.push_back(pClient);
+
+    if (!m_pPlaybackTimer) {
+        m_pPlaybackTimer = new CPlaybackTimer();
+        GetManager().AddCron(m_pPlaybackTimer);
+    } else if (bWasIdle) {
+        m_pPlaybackTimer->UnPause();
+        GetManager().RescheduleCron(m_pPlaybackTimer);
+    }
+}
+
+void CZNC::DelPlayback(CClient* pClient) { m_lpPlayback.remove(pClient); }
+
+void CZNC::RunPlayback() {
+    // Round robin, a client whose send buffer is full gets its turn again
+    // on the next run
+    size_t uBudget = PLAYBACK_LINES_PER_RUN;
+    size_t uTurns = m_lpPlayback.size();
+    while (uTurns-- > 0 && uBudget > 0 && !m_lpPlayback.empty()) {
+        CClient* pClient = m_lpPlayback.front();
+        m_lpPlayback.pop_front();
+        uBudget -= pClient->ContinuePlayback(
+            std::min(uBudget, CClient::m_uPlaybackSlice));
+        if (pClient->HasPendingPlayback()) AddPlayback(pClient);
+    }
+
+    if (m_lpPlayback.empty() && m_pPlaybackTimer) {
+        m_pPlaybackTimer->Pause();
+    }
+}
+
+void CZNC::LeakPlaybackTimer(CPlaybackTimer* pTimer) {
+    if (m_pPlaybackTimer == pTimer) m_pPlaybackTimer = nullptr;
+}
+
 bool CZNC::WaitForChildLock() { return m_pLockFile && m_pLockFile->ExLock(); }
 
 void CZNC::DisableConfigTimer() {
@@ -17,7 +17,11 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include <znc/Buffer.h>
+#include <znc/Client.h>
+#include <znc/User.h>
 #include <znc/znc.h>
+#include <chrono>
+#include <iostream>
 
 using ::testing::SizeIs;
 using ::testing::ContainerEq;
@@ -28,6 +32,28 @@ class BufferTest : public ::testing::Test {
     void TearDown() override { CZNC::DestroyInstance(); }
 };
 
+class BufferPlaybackTest : public BufferTest {
+  protected:
+    void SetUp() override {
+        BufferTest::SetUp();
+        m_pUser = new CUser("user");
+        m_pUser->SetTimestampPrepend(false);
+        m_pUser->SetTimestampAppend(true);
+        m_pUser->SetTimestampFormat("[stamp]");
+        m_pClient = new CClient;
+        m_pClient->AcceptLogin(*m_pUser);
+    }
+    void TearDown() override {
+        m_pUser->UserDisconnected(m_pClient);
+        delete m_pClient;
+        delete m_pUser;
+        BufferTest::TearDown();
+    }
+
+    CUser* m_pUser;
+    CClient* m_pClient;
+};
+
 TEST_F(BufferTest, BufLine) {
     CBuffer buffer(1);
     buffer.AddLine(CMessage("@key=value :nick PRIVMSG {target} {text}"),
@@ -89,6 +115,35 @@ TEST_F(BufferTest, AddLine) {
     EXPECT_EQ(buffer.Size(), 0u);
 }
 
+TEST_F(BufferTest, ChangeCounters) {
+    CBuffer buffer(3);
+    EXPECT_EQ(buffer.GetLinesAdded(), 0u);
+
+    buffer.AddLine(":irc.server.com 001 nick :a");
+    buffer.AddLine(":irc.server.com 002 nick :b");
+    buffer.AddLine(":irc.server.com 003 nick :c");
+    buffer.AddLine(":irc.server.com 004 nick :d");
+    // Dropping the oldest line isn't a rewrite
+    EXPECT_EQ(buffer.GetLinesAdded(), 4u);
+    EXPECT_EQ(buffer.GetRewrites(), 0u);
+
+    buffer.UpdateExactLine(CMessage(":irc.server.com 004 nick :d"));
+    EXPECT_EQ(buffer.GetLinesAdded(), 4u);
+    EXPECT_EQ(buffer.GetRewrites(), 0u);
+
+    buffer.UpdateLine("003", ":irc.server.com 003 nick :e");
+    EXPECT_EQ(buffer.GetLinesAdded(), 4u);
+    EXPECT_EQ(buffer.GetRewrites(), 1u);
+
+    buffer.UpdateLine("005", ":irc.server.com 005 nick :f");
+    EXPECT_EQ(buffer.GetLinesAdded(), 5u);
+    EXPECT_EQ(buffer.GetRewrites(), 1u);
+
+    buffer.Clear();
+    EXPECT_EQ(buffer.GetLinesAdded(), 5u);
+    EXPECT_EQ(buffer.GetRewrites(), 2u);
+}
+
 TEST_F(BufferTest, UpdateLine) {
     // clang-format off
     CBuffer buffer(50);
@@ -133,3 +188,62 @@ TEST_F(BufferTest, UpdateLine) {
     EXPECT_EQ(buffer.GetBufLine(16).GetFormat(), ":irc.server.com 005 nick FOO=bar :are supported by this server");
     // clang-format on
 }
+
+TEST_F(BufferPlaybackTest, ToMessage) {
+    // clang-format off
+    VCString vsFormats = {
+        ":nick!user@host PRIVMSG #chan :plain",
+        ":nick!user@host PRIVMSG #chan {text}",
+        ":nick!user@host PRIVMSG {target} :<{text}> {unknown}{}",
+        ":{sender}!user@host NOTICE #chan :\\{text\\} and \\\\{text}",
+        ":nick!user@host PRIVMSG #chan :{te\\}xt} {unterminated",
+    };
+    // clang-format on
+    MCString mssParams = {{"target", "#znc"}, {"sender", "*status"},
+                          {"text", "ignored"}};
+
+    for (const CString& sFormat : vsFormats) {
+        CBufLine Line(CMessage(sFormat), "hello");
+        CMessage Message = Line.ToMessage(*m_pClient, mssParams);
+
+        // What ToMessage() used to do for every line
+        CMessage Expected(sFormat);
+        Expected.SetNick(CNick(CString::NamedFormat(
+            Expected.GetNick().GetNickMask(), mssParams)));
+        MCString mssThisParams = mssParams;
+        mssThisParams["text"] = "hello [stamp]";
+        for (unsigned int i = 0; i < Expected.GetParams().size(); ++i) {
+            Expected.SetParam(i, CString::NamedFormat(Expected.GetParam(i),
+                                                      mssThisParams));
+        }
+        EXPECT_EQ(Message.ToString(), Expected.ToString()) << sFormat;
+    }
+
+    CBufLine Line(CMessage(":nick PRIVMSG #chan {text}"), "hello");
+    Line.SetFormat(":nick PRIVMSG #chan :no text");
+    EXPECT_EQ(Line.ToMessage(*m_pClient, mssParams).ToString(),
+              ":nick PRIVMSG #chan :no text");
+}
+
+TEST_F(BufferPlaybackTest, DISABLED_PlaybackBenchmark) {
+    const unsigned int uRounds = 2000;
+    CBuffer Buffer(500);
+    for (unsigned int i = 0; i < Buffer.GetLineCount(); ++i) {
+        Buffer.AddLine(CMessage(":nick!user@host PRIVMSG #chan {text}"),
+                       "a line of some usual length " + CString(i));
+    }
+
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < uRounds; ++i) {
+        for (size_t uIdx = 0; uIdx < Buffer.Size(); ++uIdx) {
+            Buffer.GetBufLine(uIdx).ToMessage(*m_pClient, MCString::EmptyMap);
+        }
+    }
+    auto Elapsed = std::chrono::steady_clock::now() - Start;
+
+    using std::chrono::milliseconds;
+    auto uMs = std::max<long long>(
+        1, std::chrono::duration_cast<milliseconds>(Elapsed).count());
+    std::cout << uRounds * Buffer.Size() * 1000 / uMs << " lines/s"
+              << std::endl;
+}
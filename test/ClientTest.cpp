@@ -20,6 +20,7 @@
 
 using ::testing::IsEmpty;
 using ::testing::ElementsAre;
+using ::testing::HasSubstr;
 
 class ClientTest : public IRCTest {
   protected:
@@ -380,3 +381,51 @@ TEST_F(ClientTest, OnSendToClientMessage) {
     EXPECT_THAT(m_pTestSock->vsLines, ElementsAre(msg.ToString()));
     m_pTestModule->bSendHooks = false;
 }
+
+TEST_F(ClientTest, KeepAlive) {
+    // The IRC connection and the logged in client
+    EXPECT_EQ(CZNC::Get().GetKeepAliveCount(), 2u);
+    {
+        TestClient client;
+        EXPECT_EQ(CZNC::Get().GetKeepAliveCount(), 2u);
+        client.AcceptLogin(*m_pTestUser);
+        EXPECT_EQ(CZNC::Get().GetKeepAliveCount(), 3u);
+        m_pTestNetwork->ClientDisconnected(&client);
+    }
+    EXPECT_EQ(CZNC::Get().GetKeepAliveCount(), 2u);
+}
+
+TEST_F(ClientTest, BufferPlayback) {
+    m_pTestChan->SetBufferCount(250, true);
+    for (int i = 0; i < 250; ++i) {
+        m_pTestChan->AddBuffer(
+            CMessage(":nick!user@host PRIVMSG #chan :line " + CString(i)));
+    }
+    m_pTestClient->Reset();
+    m_pTestChan->SendBuffer(m_pTestClient);
+
+    // The start and the first slice
+    ASSERT_EQ(m_pTestClient->vsLines.size(), 101u);
+    EXPECT_THAT(m_pTestClient->vsLines[0], HasSubstr("Buffer Playback..."));
+    EXPECT_THAT(m_pTestClient->vsLines[100], HasSubstr(":line 99"));
+    EXPECT_TRUE(m_pTestClient->HasPendingPlayback("#chan"));
+    EXPECT_EQ(CZNC::Get().GetPlaybackCount(), 1u);
+
+    // Live messages of the channel wait for the playback
+    CMessage Live(":nick!user@host PRIVMSG #chan :live");
+    Live.SetChan(m_pTestChan);
+    m_pTestClient->PutClient(Live);
+    m_pTestClient->PutClient(":nick!user@host PRIVMSG #other :other");
+    EXPECT_EQ(m_pTestClient->vsLines.size(), 102u);
+    EXPECT_THAT(m_pTestClient->vsLines.back(), HasSubstr("#other"));
+
+    CZNC::Get().RunPlayback();
+    EXPECT_EQ(m_pTestClient->vsLines.size(), 202u);
+    CZNC::Get().RunPlayback();
+    EXPECT_FALSE(m_pTestClient->HasPendingPlayback());
+    EXPECT_EQ(CZNC::Get().GetPlaybackCount(), 0u);
+    ASSERT_EQ(m_pTestClient->vsLines.size(), 254u);
+    EXPECT_THAT(m_pTestClient->vsLines[251], HasSubstr(":line 249"));
+    EXPECT_THAT(m_pTestClient->vsLines[252], HasSubstr("Playback Complete."));
+    EXPECT_EQ(m_pTestClient->vsLines[253], Live.ToString());
+}
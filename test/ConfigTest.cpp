@@ -17,6 +17,8 @@
 #include <gtest/gtest.h>
 #include <znc/FileUtils.h>
 #include <znc/Config.h>
+#include <znc/Utils.h>
+#include <iostream>
 
 class CConfigTest : public ::testing::Test {
   public:
@@ -163,3 +165,132 @@ TEST_F(CConfigErrorTest, Comment3) {
 }
 TEST_F(CConfigSuccessTest, Comment4) { TEST_SUCCESS("/* Foo\n/* Bar */", ""); }
 TEST_F(CConfigSuccessTest, Comment5) { TEST_SUCCESS("/* Foo\n// */", ""); }
+
+/* line endings and separators */
+TEST_F(CConfigSuccessTest, CRLF) {
+    TEST_SUCCESS("Foo = bar\r\n<a b>\r\n\tx = y\r\n</a>\r\n",
+                 "foo=bar\n->a/b\nx=y\n<-\n");
+}
+TEST_F(CConfigSuccessTest, NoTrailingNewline) {
+    TEST_SUCCESS("Foo = bar", "foo=bar\n");
+}
+TEST_F(CConfigSuccessTest, Separators) {
+    TEST_SUCCESS("Foo == bar = baz\n=Bar=  baz\n",
+                 "bar= baz\nfoo=bar = baz\n");
+}
+TEST_F(CConfigErrorTest, MalformedLine) {
+    TEST_ERROR("Foo = bar\nFoo\n", "Error on line 2: Malformed line");
+}
+
+TEST(ConfigTest, ToString) {
+    CConfig sub;
+    sub.AddKeyValuePair("Nick", "nick");
+    sub.AddKeyValuePair("Motd", "multi\nline");
+
+    CConfig conf;
+    conf.AddKeyValuePair("Version", "1.7.1");
+    conf.AddKeyValuePair("Empty", "");
+    conf.AddSubConfig("User", "foo", sub);
+
+    EXPECT_EQ(conf.ToString(),
+              "Version = 1.7.1\n"
+              "\n"
+              "<User foo>\n"
+              "\tMotd = multiline\n"
+              "\tNick = nick\n"
+              "</User>\n");
+}
+
+TEST_F(CConfigTest, Equals) {
+    CConfig net;
+    net.AddKeyValuePair("Server", "irc.example.net +6697");
+    CConfig user;
+    user.AddKeyValuePair("Nick", "nick");
+    user.AddSubConfig("Network", "Example", net);
+
+    CConfig parsed;
+    CString sError;
+    ASSERT_TRUE(parsed.Parse(WriteFile("nick = nick\n<network Example>\n"
+                                       "\tserver = irc.example.net +6697\n"
+                                       "</network>\n"),
+                             sError))
+        << sError;
+    EXPECT_TRUE(user.Equals(parsed));
+    EXPECT_TRUE(parsed.Equals(user));
+
+    CConfig other = user;
+    other.AddKeyValuePair("Nick", "nick2");
+    EXPECT_FALSE(user.Equals(other));
+
+    CConfig renamed;
+    renamed.AddKeyValuePair("Nick", "nick");
+    renamed.AddSubConfig("Network", "example", net);
+    EXPECT_FALSE(user.Equals(renamed));
+
+    CConfig value;
+    value.AddKeyValuePair("Nick", "Nick");
+    value.AddSubConfig("Network", "Example", net);
+    EXPECT_FALSE(user.Equals(value));
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST_F(CConfigTest, DISABLED_ParseBenchmark) {
+    const unsigned int uUsers = 5000;
+    CString sConfig =
+        "Version = 1.7.1\n<Listener l>\n\tPort = 6697\n</Listener>\n";
+    for (unsigned int u = 0; u < uUsers; ++u) {
+        CString sUser = "user" + CString(u);
+        sConfig += "<User " + sUser + ">\n";
+        sConfig += "\tNick = " + sUser + "\n\tAltNick = " + sUser + "_\n";
+        sConfig += "\tRealName = Some User\n\tAdmin = false\n";
+        sConfig += "\tBuffer = 500\n\tAutoClearChanBuffer = true\n";
+        sConfig += "\tChanModes = +stn\n\tTimezone = Europe/Berlin\n";
+        sConfig += "\tLoadModule = chansaver\n\tLoadModule = controlpanel\n";
+        sConfig += "\t<Pass password>\n\t\tHash = abcdef\n";
+        sConfig += "\t\tMethod = SHA256\n\t\tSalt = 123456\n\t</Pass>\n";
+        for (unsigned int n = 0; n < 2; ++n) {
+            sConfig += "\t<Network net" + CString(n) + ">\n";
+            sConfig += "\t\tServer = irc.example.com +6697\n";
+            sConfig += "\t\tLoadModule = simple_away\n";
+            for (unsigned int c = 0; c < 5; ++c) {
+                sConfig += "\t\t<Chan #chan" + CString(c) + ">\n";
+                sConfig += "\t\t\tBuffer = 50\n\t\t\tDetached = false\n";
+                sConfig += "\t\t</Chan>\n";
+            }
+            sConfig += "\t</Network>\n";
+        }
+        sConfig += "</User>\n";
+    }
+
+    CFile& File = WriteFile(sConfig);
+
+    unsigned long long uStart = CUtils::GetMillTime();
+    CConfig conf;
+    CString sError;
+    ASSERT_TRUE(conf.Parse(File, sError)) << sError;
+    unsigned long long uParsed = CUtils::GetMillTime();
+
+    // This is what CZNC::LoadUsers() and CUser::ParseConfig() do
+    CConfig::SubConfig Users;
+    ASSERT_TRUE(conf.FindSubConfig("user", Users));
+    unsigned int uChans = 0;
+    for (auto& User : Users) {
+        CString sNick;
+        User.second.m_pSubConfig->FindStringEntry("nick", sNick);
+        CConfig::SubConfig Networks;
+        User.second.m_pSubConfig->FindSubConfig("network", Networks);
+        for (auto& Network : Networks) {
+            CConfig::SubConfig Chans;
+            Network.second.m_pSubConfig->FindSubConfig("chan", Chans);
+            uChans += Chans.size();
+        }
+    }
+    unsigned long long uDone = CUtils::GetMillTime();
+
+    EXPECT_EQ(Users.size(), uUsers);
+    EXPECT_EQ(uChans, uUsers * 10);
+    std::cout << "Config of " << CString::ToByteStr(sConfig.size()) << " with "
+              << uUsers << " users: parsed in " << (uParsed - uStart)
+              << " ms, users walked in " << (uDone - uParsed) << " ms"
+              << std::endl;
+}
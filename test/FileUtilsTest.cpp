@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2004-2018 ZNC, see the NOTICE file for details.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <znc/FileUtils.h>
+
+TEST(FileUtilsTest, PreallocateAndTruncate) {
+    char sName[] = "./temp-XXXXXX";
+    int fd = mkstemp(sName);
+    ASSERT_NE(fd, -1);
+    close(fd);
+
+    CFile File(sName);
+    ASSERT_TRUE(File.Open(O_WRONLY | O_APPEND));
+    EXPECT_EQ(File.Write("hello\n"), 6);
+
+    // Whether the file system supports it or not, the size doesn't change
+    // and appended data goes right after the old end
+    File.Preallocate(6, 1024 * 1024);
+    EXPECT_EQ(File.GetSize(), 6);
+    EXPECT_EQ(File.Write("world\n"), 6);
+    EXPECT_EQ(File.GetSize(), 12);
+
+    EXPECT_TRUE(File.Truncate(12));
+    EXPECT_EQ(File.GetSize(), 12);
+    EXPECT_TRUE(File.Truncate(5));
+    EXPECT_EQ(File.GetSize(), 5);
+    File.Close();
+
+    CString sContent;
+    ASSERT_TRUE(File.Open());
+    EXPECT_TRUE(File.ReadFile(sContent));
+    EXPECT_EQ(sContent, "hello");
+    File.Close();
+    File.Delete();
+}
@@ -18,6 +18,9 @@
 #include <gmock/gmock.h>
 #include "IRCTest.h"
 #include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
 
 using testing::ElementsAre;
 using testing::ContainerEq;
@@ -514,6 +517,34 @@ TEST_F(IRCSockTest, ISupport) {
     EXPECT_EQ(m_pTestSock->GetISupport("SAFELIST", "default"), "");
 }
 
+TEST_F(IRCSockTest, CaseMapping) {
+    m_pTestSock->ReadLine(
+        ":irc.znc.in 001 me :Welcome to the Internet Relay Network me");
+    EXPECT_EQ(m_pTestNetwork->GetCaseMapping().GetName(), "rfc1459");
+    EXPECT_EQ(m_pTestNetwork->FindChan("#CHAN"), m_pTestChan);
+
+    m_pTestChan->AddNick("Nick[1]");
+    EXPECT_NE(m_pTestChan->FindNick("nick{1}"), nullptr);
+    m_pTestSock->ReadLine(":NICK{1}!user@host NICK :other");
+    EXPECT_EQ(m_pTestChan->FindNick("nick[1]"), nullptr);
+    ASSERT_NE(m_pTestChan->FindNick("OTHER"), nullptr);
+    EXPECT_EQ(m_pTestChan->FindNick("OTHER")->GetNick(), "other");
+
+    // The server knows the right case
+    size_t uNicks = m_pTestChan->GetNickCount();
+    m_pTestChan->AddNick("Other");
+    EXPECT_EQ(m_pTestChan->GetNickCount(), uNicks);
+    EXPECT_EQ(m_pTestChan->FindNick("other")->GetNick(), "Other");
+
+    m_pTestChan->AddNick("a[b]");
+    m_pTestSock->ReadLine(
+        ":irc.znc.in 005 me CASEMAPPING=ascii :are supported by this server");
+    EXPECT_EQ(m_pTestNetwork->GetCaseMapping().GetName(), "ascii");
+    EXPECT_EQ(m_pTestChan->FindNick("a{b}"), nullptr);
+    EXPECT_NE(m_pTestChan->FindNick("A[B]"), nullptr);
+    EXPECT_EQ(m_pTestNetwork->FindChans("#C*").size(), 1u);
+}
+
 TEST_F(IRCSockTest, StatusMsg) {
     m_pTestSock->ReadLine(
         ":irc.znc.in 001 me :Welcome to the Internet Relay Network me");
@@ -530,3 +561,135 @@ TEST_F(IRCSockTest, StatusMsg) {
     EXPECT_EQ(m_pTestChan->GetBuffer().GetLine(0, *m_pTestClient),
               ":someone PRIVMSG @#chan :hello ops");
 }
+
+TEST_F(IRCSockTest, PendingConnections) {
+    unsigned int uPending = CZNC::Get().GetPendingConnections();
+    EXPECT_EQ(uPending, 1u);
+    m_pTestSock->ReadLine(
+        ":irc.znc.in 001 me :Welcome to the Internet Relay Network me");
+    EXPECT_EQ(CZNC::Get().GetPendingConnections(), 0u);
+
+    CUser user("other");
+    CIRCNetwork network(&user, "network");
+    {
+        TestIRCSock sock(&network);
+        EXPECT_EQ(CZNC::Get().GetPendingConnections(), 1u);
+    }
+    // Closed before registration, but not because of an error
+    EXPECT_EQ(CZNC::Get().GetPendingConnections(), 0u);
+    EXPECT_EQ(network.GetConnectFailures(), 0u);
+
+    {
+        TestIRCSock sock(&network);
+        sock.Timeout();
+    }
+    EXPECT_EQ(CZNC::Get().GetPendingConnections(), 0u);
+    EXPECT_EQ(network.GetConnectFailures(), 1u);
+}
+
+TEST_F(IRCSockTest, SendQueueLanes) {
+    m_pTestSock->SetFloodBudget(0);
+    EXPECT_FALSE(m_pTestSock->IsFloodTimerArmed());
+
+    m_pTestSock->PutIRC("WHO #chan");
+    m_pTestSock->PutIRC("MODE #chan +b");
+    m_pTestSock->PutIRC("PRIVMSG #chan :hello");
+    m_pTestSock->PutIRC("MODE #chan +o nick");
+    m_pTestSock->PutIRCQuick("PONG :irc.znc.in");
+    EXPECT_THAT(m_pTestSock->vsLines, IsEmpty());
+    EXPECT_EQ(m_pTestSock->GetSendQueueSize(), 5u);
+    EXPECT_EQ(m_pTestSock->GetSendQueueSize(CIRCSock::SEND_LANE_BULK), 2u);
+    EXPECT_TRUE(m_pTestSock->IsFloodTimerArmed());
+
+    // Sending a line sends whatever the budget allows, in lane order
+    m_pTestSock->SetFloodBudget(2);
+    m_pTestSock->PutIRC("PRIVMSG #chan :again");
+    EXPECT_THAT(m_pTestSock->vsLines,
+                ElementsAre("PONG :irc.znc.in", "PRIVMSG #chan :hello"));
+    EXPECT_TRUE(m_pTestSock->IsFloodTimerArmed());
+
+    m_pTestSock->SetFloodBudget(5);
+    m_pTestSock->PutIRC("PING :irc.znc.in");
+    EXPECT_THAT(m_pTestSock->vsLines,
+                ElementsAre("PONG :irc.znc.in", "PRIVMSG #chan :hello",
+                            "MODE #chan +o nick", "PRIVMSG #chan :again",
+                            "PING :irc.znc.in", "WHO #chan",
+                            "MODE #chan +b"));
+    EXPECT_EQ(m_pTestSock->GetSendQueueSize(), 0u);
+    EXPECT_EQ(m_pTestSock->GetSentLines(), 7u);
+    // Nothing is waiting, so there is nothing to wake up for
+    EXPECT_FALSE(m_pTestSock->IsFloodTimerArmed());
+}
+
+namespace {
+// Overrides the hook, but leaves the work to the default implementation
+class SendHookModule : public CModule {
+  public:
+    MODCONSTRUCTOR(SendHookModule) {}
+
+    EModRet OnSendToIRCMessage(CMessage& Message) override {
+        uCalls++;
+        return CModule::OnSendToIRCMessage(Message);
+    }
+
+    unsigned int uCalls = 0;
+};
+}  // namespace
+
+TEST_F(IRCSockTest, SendWithoutHooks) {
+    CZNC::Get().GetModules().clear();
+    std::unique_ptr<CModule> pPlain(TModLoad<CModule>(
+        nullptr, nullptr, nullptr, "plain", "", CModInfo::GlobalModule));
+    std::unique_ptr<CModule> pHook(TModLoad<SendHookModule>(
+        nullptr, nullptr, nullptr, "hook", "", CModInfo::GlobalModule));
+    EXPECT_FALSE(pPlain->WantsSendToIRCMessage());
+    EXPECT_FALSE(pPlain->WantsSendToIRC());
+    EXPECT_TRUE(pHook->WantsSendToIRCMessage());
+    EXPECT_FALSE(pHook->WantsSendToIRC());
+
+    // Nobody overrides the hooks, lines go straight to the socket
+    CZNC::Get().GetModules().push_back(pPlain.get());
+    m_pTestSock->PutIRC("@test-tag=1 PRIVMSG #chan :hello");
+    EXPECT_THAT(m_pTestSock->vsLines, ElementsAre("PRIVMSG #chan :hello"));
+
+    // Calling the default implementation doesn't opt out
+    CZNC::Get().GetModules().push_back(pHook.get());
+    m_pTestSock->PutIRC("PRIVMSG #chan :again");
+    m_pTestSock->PutIRC("PRIVMSG #chan :and again");
+    auto pHookModule = static_cast<SendHookModule*>(pHook.get());
+    EXPECT_EQ(pHookModule->uCalls, 2u);
+    EXPECT_TRUE(pHook->WantsSendToIRCMessage());
+    EXPECT_THAT(m_pTestSock->vsLines,
+                ElementsAre("PRIVMSG #chan :hello", "PRIVMSG #chan :again",
+                            "PRIVMSG #chan :and again"));
+    CZNC::Get().GetModules().clear();
+}
+
+TEST_F(IRCSockTest, DISABLED_PutIRCBenchmark) {
+    const unsigned int uLines = 1000000;
+    m_pTestSock->SetFloodProtection(false);
+
+    // TestModule overrides OnSendToIRCMessage(), which makes every line get
+    // parsed again before it's sent
+    for (bool bModules : {false, true}) {
+        CZNC::Get().GetModules().clear();
+        if (bModules) {
+            CZNC::Get().GetModules().push_back(m_pTestModule);
+        }
+
+        auto Start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < uLines; ++i) {
+            m_pTestSock->PutIRC("PRIVMSG #chan :a line of some usual length");
+            if (m_pTestSock->vsLines.size() >= 1000) {
+                m_pTestSock->Reset();
+            }
+        }
+        auto Elapsed = std::chrono::steady_clock::now() - Start;
+
+        using std::chrono::milliseconds;
+        auto uMs = std::max<long long>(
+            1, std::chrono::duration_cast<milliseconds>(Elapsed).count());
+        std::cout << (bModules ? "With" : "Without") << " modules: "
+                  << uLines * 1000 / uMs << " lines/s" << std::endl;
+    }
+}
@@ -53,6 +53,12 @@ class TestIRCSock : public CIRCSock {
         return true;
     }
     void Reset() { vsLines.clear(); }
+    void SetFloodBudget(unsigned int uLines) {
+        m_uFloodBudget = uLines * m_uFloodInterval;
+        m_uFloodRefill = CUtils::GetMillTime();
+    }
+    bool IsFloodTimerArmed() const { return m_pFloodTimer != nullptr; }
+    void SetFloodProtection(bool bEnabled) { m_bFloodProtection = bEnabled; }
     VCString vsLines;
 };
 
@@ -94,3 +94,42 @@ TEST_F(NetworkTest, FindQueries) {
     EXPECT_EQ(network.FindQueries("?A*").size(), 2u);
     EXPECT_EQ(network.FindQueries("*z").size(), 1u);
 }
+
+TEST_F(NetworkTest, ConnectBackoff) {
+    CUser user("user");
+    CIRCNetwork network(&user, "network");
+    CZNC::Get().SetConnectDelay(5);
+
+    EXPECT_EQ(network.GetConnectFailures(), 0u);
+    EXPECT_EQ(network.GetNextConnectTime(), 0);
+
+    time_t tNow = time(nullptr);
+    network.IRCConnectFailed();
+    EXPECT_EQ(network.GetConnectFailures(), 1u);
+    EXPECT_GE(network.GetNextConnectTime(), tNow + 5);
+    EXPECT_LE(network.GetNextConnectTime(), time(nullptr) + 5);
+
+    tNow = time(nullptr);
+    network.IRCConnectFailed();
+    EXPECT_GE(network.GetNextConnectTime(), tNow + 10);
+    EXPECT_LE(network.GetNextConnectTime(), time(nullptr) + 10);
+
+    for (int i = 0; i < 40; ++i) {
+        network.IRCConnectFailed();
+    }
+    EXPECT_EQ(network.GetConnectFailures(), 42u);
+    EXPECT_LE(network.GetNextConnectTime(), time(nullptr) + 300);
+}
+
+TEST_F(NetworkTest, ConnectQueuePriority) {
+    CUser user("user");
+    CUser admin("admin");
+    admin.SetAdmin(true);
+
+    CIRCNetwork first(&user, "first");
+    CIRCNetwork second(&user, "second");
+    CIRCNetwork third(&admin, "third");
+
+    std::vector<CIRCNetwork*> vExpected = {&third, &first, &second};
+    EXPECT_EQ(CZNC::Get().GetScheduledConnectionQueue(), vExpected);
+}
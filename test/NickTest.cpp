@@ -34,3 +34,25 @@ TEST(NickTest, Parse) {
     EXPECT_EQ(Nick2.GetHostMask(), "nick!~ident@host");
     EXPECT_TRUE(Nick2.NickEquals("nick"));
 }
+
+TEST(NickTest, CaseMapping) {
+    CCaseMapping Mapping;
+    EXPECT_EQ(Mapping.GetName(), "rfc1459");
+    EXPECT_TRUE(Mapping.Equals("Nick[a]\\~", "nick{A}|^"));
+    EXPECT_FALSE(Mapping.Equals("nick", "nick_"));
+    EXPECT_EQ(Mapping.Hash("Nick[a]\\~"), Mapping.Hash("nick{A}|^"));
+    EXPECT_EQ(Mapping.Fold("#Chan[]"), "#chan{}");
+
+    EXPECT_TRUE(Mapping.SetName("strict-rfc1459"));
+    EXPECT_TRUE(Mapping.Equals("Nick[a]\\", "nick{A}|"));
+    EXPECT_FALSE(Mapping.Equals("nick~", "nick^"));
+
+    EXPECT_TRUE(Mapping.SetName("ascii"));
+    EXPECT_TRUE(Mapping.Equals("NICK", "nick"));
+    EXPECT_FALSE(Mapping.Equals("nick[", "nick{"));
+    // Only ASCII letters fold
+    EXPECT_FALSE(Mapping.Equals("\xC3\x84", "\xC3\xA4"));
+
+    EXPECT_FALSE(Mapping.SetName("unknown"));
+    EXPECT_EQ(Mapping.GetName(), "rfc1459");
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2004-2018 ZNC, see the NOTICE file for details.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <znc/Socket.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+class CTestCron : public CCron {
+  public:
+    CTestCron(double dInterval, uint32_t uCycles, int& iRuns,
+              bool* pbDeleted = nullptr)
+        : CCron(), m_iRuns(iRuns), m_pbDeleted(pbDeleted) {
+        StartMaxCycles(dInterval, uCycles);
+    }
+
+    ~CTestCron() override {
+        if (m_pbDeleted) *m_pbDeleted = true;
+    }
+
+    CTestCron(const CTestCron&) = delete;
+    CTestCron& operator=(const CTestCron&) = delete;
+
+    std::function<void()> m_fOnRun;
+
+  protected:
+    void RunJob() override {
+        m_iRuns++;
+        if (m_fOnRun) m_fOnRun();
+    }
+
+  private:
+    int& m_iRuns;
+    bool* m_pbDeleted;
+};
+
+static timeval Now() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv;
+}
+
+static timeval After(const timeval& tStart, double dSecs) {
+    timeval tDelta, tResult;
+    tDelta.tv_sec = (time_t)dSecs;
+    tDelta.tv_usec = (suseconds_t)((dSecs - tDelta.tv_sec) * 1000000);
+    timeradd(&tStart, &tDelta, &tResult);
+    return tResult;
+}
+
+// Wakes the wheel up whenever it asks for it, like CSockManager does.
+// Returns the number of wakeups.
+static int WakeUntil(CTimerWheel& Wheel, const timeval& tEnd) {
+    int iWakeups = 0;
+    timeval tNext;
+    while (Wheel.GetNextExpiry(tNext) && !timercmp(&tNext, &tEnd, >)) {
+        Wheel.Expire(tNext);
+        iWakeups++;
+    }
+    return iWakeups;
+}
+
+TEST(TimerWheelTest, RunsDueCrons) {
+    CTimerWheel Wheel;
+    int iRuns = 0;
+    timeval tStart = Now();
+    Wheel.Add(new CTestCron(1, 0, iRuns));
+    EXPECT_EQ(Wheel.GetCronCount(), 1u);
+
+    Wheel.Expire(After(tStart, 0.9));
+    EXPECT_EQ(iRuns, 0);
+    Wheel.Expire(After(tStart, 1.1));
+    EXPECT_EQ(iRuns, 1);
+    Wheel.Expire(After(tStart, 1.5));
+    EXPECT_EQ(iRuns, 1);
+    Wheel.Expire(After(tStart, 2.2));
+    EXPECT_EQ(iRuns, 2);
+    EXPECT_EQ(Wheel.GetCronCount(), 1u);
+}
+
+TEST(TimerWheelTest, FarAwayCrons) {
+    CTimerWheel Wheel;
+    // Level 2, level 3 and beyond the end of the wheel
+    const double adIntervals[] = {100, 10 * 3600, 30 * 24 * 3600};
+    int aiRuns[3] = {0, 0, 0};
+    bool abDeleted[3] = {false, false, false};
+    timeval tStart = Now();
+    for (int i = 0; i < 3; ++i) {
+        Wheel.Add(new CTestCron(adIntervals[i], 1, aiRuns[i], &abDeleted[i]));
+    }
+
+    // Step through the cascades of the coarse levels
+    for (double dTime = 7; dTime < 100; dTime += 7) {
+        Wheel.Expire(After(tStart, dTime));
+    }
+    for (int i = 0; i < 3; ++i) {
+        Wheel.Expire(After(tStart, adIntervals[i] - 0.5));
+        EXPECT_EQ(aiRuns[i], 0) << i;
+        Wheel.Expire(After(tStart, adIntervals[i] + 0.5));
+        EXPECT_EQ(aiRuns[i], 1) << i;
+        // The only cycle is over
+        EXPECT_TRUE(abDeleted[i]) << i;
+    }
+    EXPECT_EQ(Wheel.GetCronCount(), 0u);
+}
+
+TEST(TimerWheelTest, Remove) {
+    CTimerWheel Wheel;
+    int iRuns = 0;
+    bool bDeleted = false;
+    timeval tStart = Now();
+    CTestCron* pCron = new CTestCron(1, 0, iRuns, &bDeleted);
+    Wheel.Add(pCron);
+    Wheel.Add(new CTestCron(1, 0, iRuns));
+
+    EXPECT_TRUE(Wheel.Remove(pCron));
+    EXPECT_FALSE(Wheel.Remove(pCron));
+    EXPECT_FALSE(Wheel.Contains(pCron));
+    Wheel.Expire(After(tStart, 1.5));
+    EXPECT_EQ(iRuns, 1);
+    EXPECT_FALSE(bDeleted);
+    delete pCron;
+}
+
+TEST(TimerWheelTest, RemoveFromRunJob) {
+    CTimerWheel Wheel;
+    int iFirstRuns = 0, iSecondRuns = 0;
+    timeval tStart = Now();
+    CTestCron* pFirst = new CTestCron(1, 0, iFirstRuns);
+    CTestCron* pSecond = new CTestCron(1, 0, iSecondRuns);
+    Wheel.Add(pFirst);
+    Wheel.Add(pSecond);
+    pFirst->m_fOnRun = [&]() {
+        if (Wheel.Remove(pSecond)) delete pSecond;
+    };
+
+    Wheel.Expire(After(tStart, 1.5));
+    EXPECT_EQ(iFirstRuns, 1);
+    EXPECT_EQ(iSecondRuns, 0);
+    EXPECT_EQ(Wheel.GetCronCount(), 1u);
+}
+
+TEST(TimerWheelTest, Reschedule) {
+    CTimerWheel Wheel;
+    int iRuns = 0;
+    timeval tStart = Now();
+    CTestCron* pCron = new CTestCron(60, 0, iRuns);
+    Wheel.Add(pCron);
+
+    pCron->Start(1);
+    Wheel.Reschedule(pCron);
+    Wheel.Expire(After(tStart, 1.5));
+    EXPECT_EQ(iRuns, 1);
+}
+
+TEST(TimerWheelTest, Paused) {
+    CTimerWheel Wheel;
+    int iRuns = 0;
+    timeval tStart = Now();
+    CTestCron* pCron = new CTestCron(1, 0, iRuns);
+    Wheel.Add(pCron);
+
+    pCron->Pause();
+    Wheel.Expire(After(tStart, 1.5));
+    EXPECT_EQ(iRuns, 0);
+    // Paused crons aren't polled on every tick
+    EXPECT_LT(WakeUntil(Wheel, After(tStart, 2.4)), 5);
+    EXPECT_EQ(iRuns, 0);
+
+    pCron->UnPause();
+    Wheel.Reschedule(pCron);
+    Wheel.Expire(After(tStart, 2.5));
+    EXPECT_EQ(iRuns, 1);
+}
+
+TEST(TimerWheelTest, GetNextExpiry) {
+    CTimerWheel Wheel;
+    timeval tNext;
+    EXPECT_FALSE(Wheel.GetNextExpiry(tNext));
+
+    // The wheel may ask to be woken up earlier to cascade a level, but
+    // never later than the next cron is due
+    int iRuns = 0;
+    Wheel.Add(new CTestCron(200, 0, iRuns));
+    CTestCron* pCron = new CTestCron(1, 0, iRuns);
+    Wheel.Add(pCron);
+    timeval tDue = CTimerWheel::RoundUp(pCron->GetNextRun());
+    while (iRuns == 0) {
+        ASSERT_TRUE(Wheel.GetNextExpiry(tNext));
+        ASSERT_FALSE(timercmp(&tNext, &tDue, >));
+        Wheel.Expire(tNext);
+    }
+    EXPECT_EQ(tNext.tv_sec, tDue.tv_sec);
+    EXPECT_EQ(tNext.tv_usec, tDue.tv_usec);
+}
+
+TEST(TimerWheelTest, DISABLED_TimerWheelBenchmark) {
+    // One loop iteration every 100ms for a minute, with crons like the ping
+    // and join timers of networks: long intervals, few due at a time.
+    const unsigned int uIterations = 600;
+
+    for (unsigned int uCrons : {1000, 10000, 100000}) {
+        int iRuns = 0;
+        std::vector<CCron*> vCrons;
+        CTimerWheel Wheel;
+        for (unsigned int i = 0; i < uCrons; ++i) {
+            vCrons.push_back(new CTestCron(30 + i % 270, 0, iRuns));
+            Wheel.Add(new CTestCron(30 + i % 270, 0, iRuns));
+        }
+        timeval tStart = Now();
+
+        auto Start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < uIterations; ++i) {
+            // What CSockCommon::Cron() does
+            timeval tNow = After(tStart, i * 0.1);
+            for (CCron* pCron : vCrons) {
+                if (pCron->isValid()) pCron->run(tNow);
+            }
+        }
+        auto Scan = std::chrono::steady_clock::now() - Start;
+
+        Start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < uIterations; ++i) {
+            Wheel.Expire(After(tStart, i * 0.1));
+        }
+        auto Wheeled = std::chrono::steady_clock::now() - Start;
+
+        using std::chrono::microseconds;
+        std::cout << uCrons << " crons: scan "
+                  << std::chrono::duration_cast<microseconds>(Scan).count() /
+                         uIterations
+                  << " us/iteration, wheel "
+                  << std::chrono::duration_cast<microseconds>(Wheeled)
+                             .count() /
+                         uIterations
+                  << " us/iteration" << std::endl;
+
+        for (CCron* pCron : vCrons) delete pCron;
+    }
+}
@@ -16,6 +16,9 @@
 
 #include <gtest/gtest.h>
 #include <znc/ZNCString.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
 
 class EscapeTest : public ::testing::Test {
   protected:
@@ -172,6 +175,89 @@ TEST(StringTest, Split) {
     EXPECT_EQ(mexpected, mresult) << "URLSplit";
 }
 
+TEST(StringTest, Tokenizer) {
+    CString sLine = "  PRIVMSG  #chan \"a b\"c :text";
+    CStringTokenizer Tokens(sLine, " ", false, "\"", "\"");
+    ASSERT_TRUE(Tokens.Next());
+    EXPECT_TRUE(Tokens.Equals("privmsg"));
+    EXPECT_FALSE(Tokens.Equals("privmsg", CString::CaseSensitive));
+    EXPECT_EQ(CString(Tokens.GetData(), Tokens.GetLength()), "PRIVMSG");
+    EXPECT_EQ(Tokens.Skip(1), 1u);
+    ASSERT_TRUE(Tokens.Next());
+    EXPECT_EQ(CString(Tokens.GetData(), Tokens.GetLength()), "\"a b\"c");
+    EXPECT_EQ(Tokens.GetToken(), "a bc");
+    EXPECT_TRUE(Tokens.Equals("A BC"));
+    ASSERT_TRUE(Tokens.Next());
+    EXPECT_EQ(Tokens.GetRest(), ":text");
+    EXPECT_FALSE(Tokens.Next());
+    EXPECT_FALSE(Tokens.Next());
+
+    // Tokens are what Split() returns
+    for (const CString& s : std::initializer_list<CString>{
+             "", " ", "a", "a,,b,", ",\"\",b", "a,\"b,c"}) {
+        for (bool bAllowEmpty : {false, true}) {
+            VCString vsSplit, vsTokens;
+            s.Split(",", vsSplit, bAllowEmpty, "\"", "\"");
+            CStringTokenizer Tokens(s, ",", bAllowEmpty, "\"", "\"");
+            while (Tokens.Next()) vsTokens.push_back(Tokens.GetToken());
+            EXPECT_EQ(vsTokens, vsSplit) << s << " " << bAllowEmpty;
+        }
+    }
+    VCString vsExpected = {"", "b"};
+    VCString vsResult;
+    CS(",\"\",b").Split(",", vsResult, false, "\"", "\"");
+    EXPECT_EQ(vsResult, vsExpected);
+}
+
+TEST(StringTest, DISABLED_TokenizerBenchmark) {
+    const unsigned int uRounds = 200000;
+    CString sNames = "@nick1 +nick2 nick3!user@host.example.com nick4 nick5";
+    for (int i = 0; i < 5; ++i) sNames += " " + sNames;
+    CString sISupport = "CHANMODES=eIbq,k,flj,CFLMPQScgimnprstz";
+
+    auto Measure = [&](const char* szName, std::function<size_t()> fRun) {
+        size_t uTokens = 0;
+        auto Start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < uRounds; ++i) uTokens += fRun();
+        auto Elapsed = std::chrono::steady_clock::now() - Start;
+        using std::chrono::nanoseconds;
+        std::cout << szName << ": "
+                  << std::chrono::duration_cast<nanoseconds>(Elapsed).count() /
+                         uTokens
+                  << " ns/token" << std::endl;
+    };
+
+    Measure("NAMES, Split()", [&]() {
+        VCString vsNicks;
+        sNames.Split(" ", vsNicks, false);
+        return vsNicks.size();
+    });
+    Measure("NAMES, CStringTokenizer", [&]() {
+        size_t uTokens = 0;
+        CStringTokenizer Nicks(sNames);
+        while (Nicks.Next()) uTokens++;
+        return uTokens;
+    });
+    Measure("ISUPPORT, Token()", [&]() {
+        CString sValue = sISupport.Token(1, true, "=");
+        for (unsigned int a = 0; a < 4; a++) sValue.Token(a, false, ",");
+        return 5;
+    });
+    Measure("ISUPPORT, CStringTokenizer", [&]() {
+        CStringTokenizer Tokens(sISupport, "=");
+        Tokens.Skip(1);
+        Tokens.Next();
+        CString sValue = Tokens.GetRest();
+        CStringTokenizer Modes(sValue, ",");
+        Modes.Skip(4);
+        return 5;
+    });
+    Measure("Quoted Token()", [&]() {
+        sNames.Token(30, false, " ", false, "\"", "\"");
+        return 31;
+    });
+}
+
 TEST(StringTest, NamedFormat) {
     MCString m = {{"a", "b"}};
     EXPECT_EQ(CString::NamedFormat(CS("\\{x{a}y{a}"), m), "{xbyb");
@@ -284,3 +370,63 @@ TEST(StringTest, StripControls) {
     // Strips underline
     EXPECT_EQ(CString("\x1Ftest").StripControls(), "test");
 }
+
+TEST(StringTest, StripLong) {
+    // Long enough for the vectorized scans, with controls at block borders
+    CString sLine = CString(15, 'a') + "\x02" + CString(16, 'b') + "\x03" +
+                    "12,34" + CString(20, 'c') + "\x03,\x03" + "4,d\r\n";
+    EXPECT_EQ(sLine.StripControls_n(), CString(15, 'a') + CString(16, 'b') +
+                                           CString(20, 'c') + ",d");
+    EXPECT_EQ(sLine.StripCRLF_n(), sLine.TrimSuffix_n("\r\n"));
+    EXPECT_EQ(CS("a\rb\n\nc\r\n").StripCRLF_n(), "abc");
+    EXPECT_EQ(CS("\r\n").StripCRLF_n(), "");
+
+    CString sAbc = "ABCDEFGHIJKLMNOPQRSTUVWXYZ[@`{ abcdefghijklmnopqrstuvwxyz";
+    EXPECT_EQ(sAbc.AsLower(),
+              "abcdefghijklmnopqrstuvwxyz[@`{ abcdefghijklmnopqrstuvwxyz");
+    EXPECT_EQ(sAbc.AsUpper(),
+              "ABCDEFGHIJKLMNOPQRSTUVWXYZ[@`{ ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+}
+
+TEST(StringTest, DISABLED_StripBenchmark) {
+    // clang-format off
+    VCString vsCorpus = {
+        ":nick!~user@host.example.com PRIVMSG #channel :hey, did anyone try the new release yet?\r\n",
+        ":nick!~user@host.example.com PRIVMSG #channel :\x02important:\x02 the meeting moved to \x03" "04,01 15:00 UTC\x03\r\n",
+        ":irc.example.net 353 me = #channel :@op +voice nick1 nick2 nick3 nick4 nick5 nick6 nick7 nick8\r\n",
+        ":nick!~user@host.example.com NOTICE me :\x1Fhttps://example.com/a/rather/long/link/that/people/paste\x1F\r\n",
+        ":nick!~user@host.example.com JOIN #channel\r\n",
+        "@time=2018-01-01T00:00:00.000Z :nick!~user@host.example.com PRIVMSG #channel :\x01" "ACTION waves\x01\r\n",
+    };
+    // clang-format on
+    const unsigned int uRounds = 200000;
+    size_t uBytes = 0;
+    for (const CString& sLine : vsCorpus) uBytes += sLine.size();
+    uBytes *= uRounds;
+
+    auto Measure = [&](const char* szName, std::function<void(CString&)> f) {
+        auto Start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < uRounds; ++i) {
+            for (const CString& sLine : vsCorpus) {
+                CString sCopy = sLine;
+                f(sCopy);
+            }
+        }
+        auto Elapsed = std::chrono::steady_clock::now() - Start;
+        using std::chrono::microseconds;
+        std::cout << szName << ": "
+                  << uBytes / std::max<long long>(
+                                  1, std::chrono::duration_cast<microseconds>(
+                                         Elapsed).count())
+                  << " MB/s" << std::endl;
+    };
+
+    Measure("Copy only", [](CString& s) {});
+    Measure("StripControls()", [](CString& s) { s.StripControls(); });
+    Measure("Replace() CR and LF", [](CString& s) {
+        s.Replace("\n", "");
+        s.Replace("\r", "");
+    });
+    Measure("StripCRLF()", [](CString& s) { s.StripCRLF(); });
+    Measure("MakeLower()", [](CString& s) { s.MakeLower(); });
+}
@@ -15,8 +15,11 @@
  */
 
 #include <gtest/gtest.h>
+#include <znc/FileUtils.h>
 #include <znc/User.h>
+#include <znc/Utils.h>
 #include <znc/znc.h>
+#include <iostream>
 
 class UserTest : public ::testing::Test {
   protected:
@@ -149,3 +152,108 @@ TEST_F(UserTest, TestAuthOnlyViaModule) {
 
     CZNC::Get().SetAuthOnlyViaModule(bAuthOnlyViaModuleDefault);
 }
+
+class UserDataTest : public UserTest {
+  protected:
+    UserDataTest() {
+        char sName[] = "./znc-XXXXXX";
+        m_sDataDir = mkdtemp(sName);
+        CZNC::Get().InitDirs("", m_sDataDir);
+    }
+    ~UserDataTest() {
+        for (auto it = m_vsPaths.rbegin(); it != m_vsPaths.rend(); ++it) {
+            if (CFile::IsDir(*it)) {
+                rmdir(it->c_str());
+            } else {
+                CFile::Delete(*it);
+            }
+        }
+        rmdir(m_sDataDir.c_str());
+    }
+
+    // Returns the path of the written registry
+    CString WriteRegistry(const CString& sDir, const MCString& msRegistry) {
+        CString sPath = m_sDataDir;
+        VCString vsParts;
+        sDir.Split("/", vsParts, false);
+        for (const CString& sPart : vsParts) {
+            sPath += "/" + sPart;
+            if (!CFile::Exists(sPath)) {
+                CDir::MakeDir(sPath);
+                m_vsPaths.push_back(sPath);
+            }
+        }
+        sPath += "/.registry";
+        msRegistry.WriteToDisk(sPath);
+        m_vsPaths.push_back(sPath);
+        return sPath;
+    }
+
+    CString m_sDataDir;
+    VCString m_vsPaths;
+};
+
+TEST_F(UserDataTest, PrefetchUserData) {
+    MCString msUser = {{"key", "value"}};
+    MCString msNetwork = {{"nick", "foo bar"}};
+    CString sUserPath = WriteRegistry("users/user/moddata/mod", msUser);
+    CString sNetworkPath =
+        WriteRegistry("users/user/networks/net/moddata/mod", msNetwork);
+    CString sOtherPath = WriteRegistry("users/other/moddata/mod", msUser);
+
+    CZNC::Get().PrefetchUserData({"user", "missing"});
+
+    MCString msRegistry;
+    EXPECT_TRUE(CZNC::Get().TakePrefetchedRegistry(sUserPath, msRegistry));
+    EXPECT_EQ(msRegistry, msUser);
+    EXPECT_TRUE(CZNC::Get().TakePrefetchedRegistry(sNetworkPath, msRegistry));
+    EXPECT_EQ(msRegistry, msNetwork);
+    // Every registry can only be taken once
+    EXPECT_FALSE(CZNC::Get().TakePrefetchedRegistry(sUserPath, msRegistry));
+    EXPECT_FALSE(CZNC::Get().TakePrefetchedRegistry(sOtherPath, msRegistry));
+}
+
+// Run with --gtest_also_run_disabled_tests. The numbers are only meaningful
+// with a cold page cache, e.g. after echo 3 > /proc/sys/vm/drop_caches
+TEST_F(UserDataTest, DISABLED_StartupBenchmark) {
+    const unsigned int uUsers = 500;
+    const VCString vsModules = {"log", "savebuff", "perform", "nickserv"};
+
+    MCString msRegistry;
+    for (unsigned int i = 0; i < 20; ++i) {
+        msRegistry["key" + CString(i)] = CString(40, 'x');
+    }
+
+    VCString vsUsers, vsPaths;
+    for (unsigned int u = 0; u < uUsers; ++u) {
+        CString sUser = "user" + CString(u);
+        vsUsers.push_back(sUser);
+        for (const CString& sModule : vsModules) {
+            vsPaths.push_back(WriteRegistry(
+                "users/" + sUser + "/moddata/" + sModule, msRegistry));
+            vsPaths.push_back(WriteRegistry("users/" + sUser +
+                                                "/networks/net/moddata/" +
+                                                sModule,
+                                            msRegistry));
+        }
+    }
+
+    unsigned long long uStart = CUtils::GetMillTime();
+    for (const CString& sPath : vsPaths) {
+        MCString msRead;
+        ASSERT_EQ(msRead.ReadFromDisk(sPath), MCString::MCS_SUCCESS);
+    }
+    unsigned long long uSerial = CUtils::GetMillTime() - uStart;
+
+    uStart = CUtils::GetMillTime();
+    CZNC::Get().PrefetchUserData(vsUsers);
+    for (const CString& sPath : vsPaths) {
+        MCString msRead;
+        ASSERT_TRUE(CZNC::Get().TakePrefetchedRegistry(sPath, msRead));
+    }
+    unsigned long long uPrefetched = CUtils::GetMillTime() - uStart;
+
+    std::cout << vsPaths.size() << " registries of " << uUsers
+              << " users: serial " << uSerial << " ms, prefetched "
+              << uPrefetched << " ms" << std::endl;
+}
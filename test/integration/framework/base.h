@@ -70,6 +70,7 @@ class Process : public IO<QProcess> {
         m_exit = code;
     }
     void CanDie() { m_allowDie = true; }
+    qint64 GetPid() const { return m_proc.processId(); }
 
     // I can't do much about SWIG...
     void CanLeak() { m_allowLeak = true; }
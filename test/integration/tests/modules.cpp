@@ -17,11 +17,194 @@
 #include "znctest.h"
 #include <gmock/gmock.h>
 
+#include <QElapsedTimer>
+#include <QtEndian>
+#include <unistd.h>
+
 using testing::HasSubstr;
+using testing::Not;
 
 namespace znc_inttest {
 namespace {
 
+// Offers a DCC SEND from foo, and connects to the port which bouncedcc
+// offers to the client instead
+void BounceDCCSend(Socket& ircd, Socket& client, QTcpServer& sender,
+                   QTcpSocket& receiver, qint64 size) {
+    ASSERT_TRUE(sender.listen(QHostAddress::LocalHost));
+    ircd.Write(":foo!x@y PRIVMSG nick :\001DCC SEND file 2130706433 " +
+               QByteArray::number(sender.serverPort()) + " " +
+               QByteArray::number(size) + "\001");
+    QByteArray offer;
+    // DCC SEND file <ip> <port> <size>
+    client.ReadUntilAndGet("DCC SEND file ", offer);
+    receiver.connectToHost("127.0.0.1", offer.split(' ')[4].toUShort());
+    ASSERT_TRUE(receiver.waitForConnected());
+    ASSERT_TRUE(sender.waitForNewConnection(30000));
+}
+
+// Sends size bytes, which have to arrive at the other end unchanged
+void RelayDCC(QTcpSocket* from, QTcpSocket* to, qint64 size, bool check) {
+    // Whole periods of the pattern, so that every chunk starts the same
+    QByteArray chunk(251 * 256, 0);
+    for (int i = 0; i < chunk.size(); ++i) chunk[i] = char(i % 251);
+    qint64 sent = 0, received = 0;
+    auto deadline = QDateTime::currentDateTime().addSecs(600);
+    while (received < size) {
+        ASSERT_LT(QDateTime::currentDateTime(), deadline);
+        if (sent < size && from->bytesToWrite() < 4 * chunk.size()) {
+            qint64 len = std::min<qint64>(chunk.size(), size - sent);
+            from->write(chunk.constData(), len);
+            sent += len;
+        }
+        from->flush();
+        if (!to->bytesAvailable() && !to->waitForReadyRead(10)) continue;
+        QByteArray data = to->readAll();
+        if (check) {
+            for (int i = 0; i < data.size(); ++i) {
+                ASSERT_EQ(data[i], char((received + i) % 251))
+                    << "at " << received + i;
+            }
+        }
+        received += data.size();
+    }
+    EXPECT_EQ(received, size);
+}
+
+// Fills a file with the same pattern which RelayDCC() checks
+void WriteDCCFile(const QString& path, qint64 size) {
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    QByteArray chunk(251 * 256, 0);
+    for (int i = 0; i < chunk.size(); ++i) chunk[i] = char(i % 251);
+    for (qint64 written = 0; written < size; written += chunk.size()) {
+        qint64 len = std::min<qint64>(chunk.size(), size - written);
+        ASSERT_EQ(file.write(chunk.constData(), len), len);
+    }
+}
+
+// Receives a file like DCC clients do, acknowledging whatever arrived
+void ReceiveDCC(QTcpSocket& from, qint64 size, bool check) {
+    qint64 received = 0;
+    auto deadline = QDateTime::currentDateTime().addSecs(600);
+    while (received < size) {
+        ASSERT_LT(QDateTime::currentDateTime(), deadline);
+        if (!from.bytesAvailable() && !from.waitForReadyRead(10)) continue;
+        QByteArray data = from.readAll();
+        if (check) {
+            for (int i = 0; i < data.size(); ++i) {
+                ASSERT_EQ(data[i], char((received + i) % 251))
+                    << "at " << received + i;
+            }
+        }
+        received += data.size();
+        quint32 ack = qToBigEndian<quint32>(quint32(received));
+        from.write(reinterpret_cast<const char*>(&ack), sizeof(ack));
+        from.flush();
+    }
+    EXPECT_EQ(received, size);
+}
+
+// Sends size bytes of the pattern, ignoring the acknowledgements
+void SendDCC(QTcpSocket* to, qint64 size) {
+    QByteArray chunk(251 * 256, 0);
+    for (int i = 0; i < chunk.size(); ++i) chunk[i] = char(i % 251);
+    qint64 sent = 0;
+    auto deadline = QDateTime::currentDateTime().addSecs(600);
+    while (sent < size || to->bytesToWrite()) {
+        ASSERT_LT(QDateTime::currentDateTime(), deadline);
+        if (sent < size && to->bytesToWrite() < 4 * chunk.size()) {
+            qint64 len = std::min<qint64>(chunk.size(), size - sent);
+            to->write(chunk.constData(), len);
+            sent += len;
+        }
+        to->waitForBytesWritten(10);
+        to->readAll();
+    }
+}
+
+// Checks that a file is size bytes of the pattern
+void CheckDCCFile(const QString& path, qint64 size) {
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    ASSERT_EQ(file.size(), size);
+    for (qint64 offset = 0; offset < size;) {
+        QByteArray data = file.read(1024 * 1024);
+        ASSERT_FALSE(data.isEmpty());
+        for (int i = 0; i < data.size(); ++i) {
+            ASSERT_EQ(data[i], char((offset + i) % 251)) << "at " << offset + i;
+        }
+        offset += data.size();
+    }
+}
+
+// CPU time the process has used so far, in seconds
+double ProcessCPU(qint64 pid) {
+    QFile stat("/proc/" + QString::number(pid) + "/stat");
+    if (!stat.open(QIODevice::ReadOnly)) return 0;
+    // The fields after the command name, which is in parentheses. utime and
+    // stime are the 14th and 15th of all fields.
+    QList<QByteArray> fields =
+        stat.readAll().split(')').last().trimmed().split(' ');
+    return (fields[11].toLongLong() + fields[12].toLongLong()) /
+           double(sysconf(_SC_CLK_TCK));
+}
+
+// Counts the system calls of a running process with strace -c, for as long
+// as it lives. strace has to be allowed to attach to the process, see
+// /proc/sys/kernel/yama/ptrace_scope.
+class SyscallCounter {
+  public:
+    SyscallCounter(qint64 pid, const QString& dir)
+        : m_output(dir + "/strace." + QString::number(pid)) {
+        m_strace.setReadChannel(QProcess::StandardError);
+        m_strace.start("strace", QStringList() << "-c" << "-f" << "-o"
+                                               << m_output << "-p"
+                                               << QString::number(pid));
+        if (!m_strace.waitForStarted()) return;
+        // It tells about every thread it attached to
+        QByteArray err;
+        while (!err.contains("attached") && m_strace.waitForReadyRead(10000)) {
+            err += m_strace.readAllStandardError();
+        }
+    }
+    ~SyscallCounter() {
+        m_strace.terminate();
+        m_strace.waitForFinished();
+    }
+
+    // Detaches and prints the system calls per MB of a transfer
+    void Report(const char* name, qint64 size) {
+        if (m_strace.state() != QProcess::Running) {
+            std::cout << name << ": strace isn't installed or can't attach"
+                      << std::endl;
+            return;
+        }
+        m_strace.terminate();
+        m_strace.waitForFinished();
+        QFile file(m_output);
+        if (!file.open(QIODevice::ReadOnly)) return;
+        // The numbers are right-aligned with their headers:
+        // % time     seconds  usecs/call     calls    errors syscall
+        // ...
+        // 100.00    0.417291           1    272418        13 total
+        int end = -1;
+        qint64 calls = 0;
+        for (QByteArray line : file.readAll().split('\n')) {
+            if (line.contains("usecs/call")) end = line.indexOf(" calls") + 6;
+            if (end > 0 && line.endsWith(" total")) {
+                calls = line.left(end).split(' ').last().toLongLong();
+            }
+        }
+        std::cout << name << ": " << calls * 1e6 / size
+                  << " system calls per MB" << std::endl;
+    }
+
+  private:
+    QString m_output;
+    QProcess m_strace;
+};
+
 TEST_F(ZNCTest, NotifyConnectModule) {
     auto znc = Run();
     auto ircd = ConnectIRCd();
@@ -199,5 +382,309 @@ TEST_F(ZNCTest, ModuleCSRFOverride) {
     EXPECT_THAT(reply, HasSubstr("ipsum"));
 }
 
+TEST_F(ZNCTest, BounceDCC) {
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod bouncedcc");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+
+    for (QByteArray splice : {"true", "false"}) {
+        client.Write("PRIVMSG *bouncedcc :splice " + splice);
+        client.ReadUntil("*bouncedcc");
+        QTcpServer sender;
+        QTcpSocket receiver;
+        BounceDCCSend(ircd, client, sender, receiver, 4 * 1024 * 1024);
+        QTcpSocket* from = sender.nextPendingConnection();
+        RelayDCC(from, &receiver, 4 * 1024 * 1024, true);
+        // DCC receivers acknowledge what they got
+        RelayDCC(&receiver, from, 4, true);
+    }
+}
+
+TEST_F(ZNCTest, DISABLED_BounceDCCBenchmark) {
+    // A big transfer between two local sockets, with the relay in the
+    // kernel and through ZNC's buffers
+    const qint64 size = 1024 * 1024 * 1024;
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod bouncedcc");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+
+    for (QByteArray splice : {"true", "false"}) {
+        client.Write("PRIVMSG *bouncedcc :splice " + splice);
+        client.ReadUntil("*bouncedcc");
+        QTcpServer sender;
+        QTcpSocket receiver;
+        BounceDCCSend(ircd, client, sender, receiver, size);
+        QTcpSocket* from = sender.nextPendingConnection();
+
+        QElapsedTimer Timer;
+        Timer.start();
+        double cpu = ProcessCPU(znc->GetPid());
+        RelayDCC(from, &receiver, size, false);
+        cpu = ProcessCPU(znc->GetPid()) - cpu;
+        std::cout << "Splice " << splice.constData() << ": "
+                  << size / 1000 / Timer.elapsed() << " MB/s, ZNC used "
+                  << cpu * 1e9 / size << " s of CPU per GB" << std::endl;
+    }
+}
+
+TEST_F(ZNCTest, DCCModule) {
+    const qint64 size = 8 * 1024 * 1024;
+    QString dir = m_dir.path() + "/users/user/moddata/dcc";
+    ASSERT_TRUE(QDir().mkpath(dir));
+    WriteDCCFile(dir + "/file", size);
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod dcc");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+
+    // From ZNC to the client
+    client.Write("PRIVMSG *dcc :get file");
+    QByteArray offer;
+    // DCC SEND file <ip> <port> <size>
+    client.ReadUntilAndGet("DCC SEND file ", offer);
+    QTcpSocket receiver;
+    receiver.connectToHost("127.0.0.1", offer.split(' ')[4].toUShort());
+    ASSERT_TRUE(receiver.waitForConnected());
+    ReceiveDCC(receiver, size, true);
+    receiver.disconnectFromHost();
+    client.ReadUntil("Sending [file] to [user] completed at");
+
+    // From the client to ZNC
+    QTcpServer sender;
+    ASSERT_TRUE(sender.listen(QHostAddress::LocalHost));
+    client.Write("PRIVMSG *dcc :\001DCC SEND upload 2130706433 " +
+                 QByteArray::number(sender.serverPort()) + " " +
+                 QByteArray::number(size) + "\001");
+    ASSERT_TRUE(sender.waitForNewConnection(30000));
+    SendDCC(sender.nextPendingConnection(), size);
+    client.ReadUntil("Receiving [upload] from [nick] completed at");
+    CheckDCCFile(dir + "/upload", size);
+}
+
+TEST_F(ZNCTest, DISABLED_DCCBenchmark) {
+    // A big file from ZNC to a local client and back. The system calls are
+    // counted in a second round, as strace slows each of them down a lot.
+    const qint64 size = 1024 * 1024 * 1024;
+    QString dir = m_dir.path() + "/users/user/moddata/dcc";
+    ASSERT_TRUE(QDir().mkpath(dir));
+    WriteDCCFile(dir + "/file", size);
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod dcc");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+
+    for (bool trace : {false, true}) {
+        std::unique_ptr<SyscallCounter> syscalls;
+        QByteArray name = trace ? "traced" : "upload";
+
+        client.Write("PRIVMSG *dcc :get file");
+        QByteArray offer;
+        client.ReadUntilAndGet("DCC SEND file ", offer);
+        QTcpSocket receiver;
+        receiver.connectToHost("127.0.0.1", offer.split(' ')[4].toUShort());
+        ASSERT_TRUE(receiver.waitForConnected());
+        if (trace) {
+            syscalls.reset(new SyscallCounter(znc->GetPid(), m_dir.path()));
+        }
+        QElapsedTimer Timer;
+        Timer.start();
+        double cpu = ProcessCPU(znc->GetPid());
+        ReceiveDCC(receiver, size, false);
+        cpu = ProcessCPU(znc->GetPid()) - cpu;
+        if (syscalls) {
+            syscalls->Report("Send", size);
+        } else {
+            std::cout << "Send: " << size / 1000 / Timer.elapsed()
+                      << " MB/s, ZNC used " << cpu * 1e9 / size
+                      << " s of CPU per GB" << std::endl;
+        }
+        receiver.disconnectFromHost();
+        client.ReadUntil("completed at");
+
+        QTcpServer sender;
+        ASSERT_TRUE(sender.listen(QHostAddress::LocalHost));
+        client.Write("PRIVMSG *dcc :\001DCC SEND " + name + " 2130706433 " +
+                     QByteArray::number(sender.serverPort()) + " " +
+                     QByteArray::number(size) + "\001");
+        ASSERT_TRUE(sender.waitForNewConnection(30000));
+        if (trace) {
+            syscalls.reset(new SyscallCounter(znc->GetPid(), m_dir.path()));
+        }
+        Timer.start();
+        cpu = ProcessCPU(znc->GetPid());
+        SendDCC(sender.nextPendingConnection(), size);
+        client.ReadUntil("Receiving [" + name + "] from [nick] completed at");
+        cpu = ProcessCPU(znc->GetPid()) - cpu;
+        if (syscalls) {
+            syscalls->Report("Get", size);
+        } else {
+            std::cout << "Get: " << size / 1000 / Timer.elapsed()
+                      << " MB/s, ZNC used " << cpu * 1e9 / size
+                      << " s of CPU per GB" << std::endl;
+        }
+    }
+}
+
+TEST_F(ZNCTest, LogSearch) {
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod log -index");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+    ircd.Write(":nick JOIN :#znc");
+    ircd.Write(":foo!x@y PRIVMSG #znc :the build is broken");
+    ircd.Write(":bar!x@y PRIVMSG #znc :the Build is fine now");
+    ircd.Write(":bar!x@y PRIVMSG #znc :unrelated");
+    client.ReadUntil("unrelated");
+
+    client.Write("PRIVMSG *log :search #znc broken build");
+    client.ReadUntil(" <foo> the build is broken");
+    client.ReadUntil("1 match found");
+    client.Write("PRIVMSG *log :search #znc build nick:BAR");
+    client.ReadUntil(" <bar> the Build is fine now");
+    client.ReadUntil("1 match found");
+    client.Write("PRIVMSG *log :search #ZNC build");
+    client.ReadUntil("2 matches found");
+    client.Write("PRIVMSG *log :search #znc build 2000-01-01 2000-12-31");
+    client.ReadUntil("0 matches found");
+    client.Write("PRIVMSG *log :search #nowhere build");
+    client.ReadUntil("Nothing is logged for #nowhere");
+}
+
+TEST_F(ZNCTest, LogNetworks) {
+    QFile conf(m_dir.path() + "/configs/znc.conf");
+    ASSERT_TRUE(conf.open(QIODevice::Append | QIODevice::Text));
+    QTextStream(&conf) << "ServerThrottle = 1\n";
+    auto znc = Run();
+    auto ircd1 = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod log -flush 0");
+    client.ReadUntil("Loaded module");
+    client.Write("znc loadmod controlpanel");
+    client.Write("PRIVMSG *controlpanel :AddNetwork user test2");
+    client.ReadUntil("Network test2 added to user user.");
+    client.Write("PRIVMSG *controlpanel :AddServer user test2 127.0.0.1 6667");
+    client.ReadUntil("Added IRC Server");
+    auto ircd2 = ConnectIRCd();
+
+    // The same channel on both networks goes to two files
+    ircd1.Write(":server 001 nick :Hello");
+    ircd1.Write(":nick JOIN :#znc");
+    ircd1.Write(":foo!x@y PRIVMSG #znc :on the first network");
+    client.ReadUntil("on the first network");
+    ircd2.Write(":server 001 nick :Hello");
+    ircd2.Write(":nick JOIN :#znc");
+    ircd2.Write(":bar!x@y PRIVMSG #znc :on the second network");
+
+    auto ReadLog = [&](const QString& network) {
+        QDir dir(m_dir.path() + "/users/user/moddata/log/" + network + "/#znc");
+        QByteArray data;
+        for (const QString& name : dir.entryList(QDir::Files)) {
+            QFile file(dir.filePath(name));
+            if (file.open(QIODevice::ReadOnly)) data += file.readAll();
+        }
+        return data.toStdString();
+    };
+    for (int i = 0; i < 300; ++i) {
+        if (ReadLog("test2").find("second") != std::string::npos) break;
+        usleep(100000);
+    }
+    EXPECT_THAT(ReadLog("test"), HasSubstr("<foo> on the first network"));
+    EXPECT_THAT(ReadLog("test"), Not(HasSubstr("second")));
+    EXPECT_THAT(ReadLog("test2"), HasSubstr("<bar> on the second network"));
+    EXPECT_THAT(ReadLog("test2"), Not(HasSubstr("first")));
+}
+
+TEST_F(ZNCTest, LogCompress) {
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod log -index -compress");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+    ircd.Write(":nick JOIN :#znc");
+    ircd.Write(":foo!x@y PRIVMSG #znc :needle in the haystack");
+    // Fill the first segment of the index, so that it gets compressed
+    for (int i = 0; i < 16400; ++i) {
+        ircd.Write(":bar!x@y PRIVMSG #znc :hay " + QByteArray::number(i));
+    }
+    ircd.Write(":bar!x@y PRIVMSG #znc :lastline");
+    client.ReadUntil("lastline");
+
+    QFile packed(m_dir.path() +
+                 "/users/user/moddata/log/index/test/#znc/00000000.dat.gz");
+    for (int i = 0; i < 600 && !packed.exists(); ++i) usleep(100000);
+    ASSERT_TRUE(packed.exists());
+    client.Write("PRIVMSG *log :search #znc needle");
+    client.ReadUntil(" <foo> needle in the haystack");
+    client.ReadUntil("1 match found");
+    client.Write("PRIVMSG *log :stats");
+    client.ReadUntil("Files compressed");
+
+    client.Write("PRIVMSG *log :play #znc");
+    client.ReadUntil("<bar> hay 16399");
+    client.ReadUntil("<bar> lastline");
+    client.ReadUntil("End of #znc");
+    client.Write("PRIVMSG *log :play #znc 2000-01-01");
+    client.ReadUntil("Nothing is logged for #znc on 2000-01-01");
+}
+
+TEST_F(ZNCTest, DISABLED_LogIndexBenchmark) {
+    // A month of a busy channel goes through the log module, then the index
+    // is searched. The lines all get the current time, so the time index
+    // doesn't skip anything.
+    const int iLines = 30 * 10000;
+    const char* aWords[] = {"the",   "build",  "is",      "broken", "again",
+                            "who",   "pushed", "release", "lunch",  "deploy",
+                            "server", "down",  "latency", "patch",  "review",
+                            "thanks"};
+    auto znc = Run();
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod log -index");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":server 001 nick :Hello");
+    ircd.Write(":nick JOIN :#znc");
+
+    QElapsedTimer Timer;
+    Timer.start();
+    unsigned int uSeed = 1;
+    for (int i = 0; i < iLines; ++i) {
+        QByteArray sLine =
+            ":nick" + QByteArray::number(i % 200) + "!x@y PRIVMSG #znc :";
+        for (int iWord = 0; iWord < 8; ++iWord) {
+            uSeed = uSeed * 1103515245 + 12345;
+            sLine += aWords[(uSeed >> 16) % 16];
+            sLine += " ";
+        }
+        ircd.Write(sLine + QByteArray::number(i));
+    }
+    ircd.Write(":nick0!x@y PRIVMSG #znc :lastline");
+    client.ReadUntil("lastline");
+    std::cout << "Logging and indexing: "
+              << Timer.nsecsElapsed() / 1000 / iLines << " us/line"
+              << std::endl;
+
+    for (QByteArray sQuery :
+         {"broken build", "deploy latency nick:nick42", "123456", "lastline"}) {
+        client.Write("PRIVMSG *log :search #znc " + sQuery);
+        QByteArray sFound;
+        client.ReadUntilAndGet("found in ", sFound);
+        std::cout << sQuery.constData() << ": " << sFound.constData()
+                  << std::endl;
+    }
+}
+
 }  // namespace
 }  // namespace znc_inttest
@@ -16,6 +16,8 @@
 
 #include "znctest.h"
 
+#include <QElapsedTimer>
+
 namespace znc_inttest {
 namespace {
 
@@ -236,5 +238,215 @@ TEST_F(ZNCTest, ModperlNV) {
     client.ReadUntil(":a b");
 }
 
+
+TEST_F(ZNCTest, ModpythonLegacyHook) {
+    if (QProcessEnvironment::systemEnvironment().value(
+            "DISABLED_ZNC_PERL_PYTHON_TEST") == "1") {
+        return;
+    }
+    auto znc = Run();
+    znc->CanLeak();
+
+    // Only the legacy hook is overridden, but the message hook which calls it
+    // by default must still be dispatched to python.
+    InstallModule("test.py", R"(
+        import znc
+
+        class test(znc.Module):
+            def OnPrivMsg(self, nick, msg):
+                self.PutModule('legacy ' + msg.s)
+                return znc.CONTINUE
+    )");
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modpython");
+    client.Write("znc loadmod test");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":someone!x@y PRIVMSG nick :hello");
+    client.ReadUntil(":legacy hello");
+}
+
+TEST_F(ZNCTest, ModperlLegacyHook) {
+    if (QProcessEnvironment::systemEnvironment().value(
+            "DISABLED_ZNC_PERL_PYTHON_TEST") == "1") {
+        return;
+    }
+    auto znc = Run();
+    znc->CanLeak();
+
+    InstallModule("test.pm", R"(
+        package test;
+        use base 'ZNC::Module';
+        sub OnPrivMsg {
+            my ($self, $nick, $msg) = @_;
+            $self->PutModule("legacy $msg");
+            return $ZNC::CONTINUE;
+        }
+
+        1;
+    )");
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modperl");
+    client.Write("znc loadmod test");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":someone!x@y PRIVMSG nick :hello");
+    client.ReadUntil(":legacy hello");
+}
+
+TEST_F(ZNCTest, ModpythonEventBatch) {
+    if (QProcessEnvironment::systemEnvironment().value(
+            "DISABLED_ZNC_PERL_PYTHON_TEST") == "1") {
+        return;
+    }
+    auto znc = Run();
+    znc->CanLeak();
+
+    InstallModule("test.py", R"(
+        import znc
+
+        class test(znc.Module):
+            def OnLoad(self, args, message):
+                self.SetEventBatching(0)
+                return True
+
+            def OnEventBatch(self, events):
+                for e in events:
+                    self.PutModule('{} {} {} {}: {}'.format(*e[:5]))
+    )");
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modpython");
+    client.Write("znc loadmod test");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":someone!x@y PRIVMSG #znc :hello");
+    ircd.Write(":someone!x@y PART #znc :bye");
+    client.ReadUntil(":text test #znc someone: hello");
+    client.ReadUntil(":part test #znc someone: bye");
+    // Lines from the client are by our own nick
+    client.Write("PRIVMSG #znc :hi");
+    client.ReadUntil(":text test #znc ");
+    client.ReadUntil(": hi");
+}
+
+TEST_F(ZNCTest, ModperlEventBatch) {
+    if (QProcessEnvironment::systemEnvironment().value(
+            "DISABLED_ZNC_PERL_PYTHON_TEST") == "1") {
+        return;
+    }
+    auto znc = Run();
+    znc->CanLeak();
+
+    InstallModule("test.pm", R"(
+        package test;
+        use base 'ZNC::Module';
+        sub OnLoad {
+            my $self = shift;
+            $self->SetEventBatching(0);
+            return 1;
+        }
+        sub OnEventBatch {
+            my ($self, $events) = @_;
+            for my $e (@$events) {
+                $self->PutModule("$e->[0] $e->[1] $e->[2] $e->[3]: $e->[4]");
+            }
+        }
+
+        1;
+    )");
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modperl");
+    client.Write("znc loadmod test");
+    client.ReadUntil("Loaded module");
+    ircd.Write(":someone!x@y PRIVMSG #znc :hello");
+    ircd.Write(":someone!x@y PART #znc :bye");
+    client.ReadUntil(":text test #znc someone: hello");
+    client.ReadUntil(":part test #znc someone: bye");
+}
+
+TEST_F(ZNCTest, ModpythonRunInThread) {
+    if (QProcessEnvironment::systemEnvironment().value(
+            "DISABLED_ZNC_PERL_PYTHON_TEST") == "1") {
+        return;
+    }
+    auto znc = Run();
+    znc->CanLeak();
+
+    InstallModule("test.py", R"(
+        import time
+        import znc
+
+        class test(znc.Module):
+            def OnModCommand(self, cmd):
+                if cmd == 'slow':
+                    self.RunInThread(lambda: time.sleep(2) or 'slept',
+                                     self.PutModule)
+                elif cmd == 'fail':
+                    self.RunInThread(lambda: 1 / 0, self.PutModule,
+                                     lambda e: self.PutModule(repr(e)))
+                else:
+                    self.PutModule(cmd)
+    )");
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modpython");
+    client.Write("znc loadmod test");
+    client.ReadUntil("Loaded module");
+    // The loop keeps going while the job sleeps
+    client.Write("PRIVMSG *test :slow");
+    client.Write("PRIVMSG *test :fast");
+    client.ReadUntil(":fast");
+    client.ReadUntil(":slept");
+    client.Write("PRIVMSG *test :fail");
+    client.ReadUntil(":ZeroDivisionError");
+    // Unloading waits for the running job
+    client.Write("PRIVMSG *test :slow");
+    client.Write("znc unloadmod test");
+    client.ReadUntil("Module [test] unloaded");
+}
+
+TEST_F(ZNCTest, DISABLED_ModpythonIdleBenchmark) {
+    // Time how long lines from the server take to reach the client with a
+    // number of python modules loaded which don't override any hook.
+    const int iLines = 5000;
+    auto znc = Run();
+    znc->CanLeak();
+
+    auto ircd = ConnectIRCd();
+    auto client = LoginClient();
+    client.Write("znc loadmod modpython");
+    client.ReadUntil("Loaded module");
+
+    int iLoaded = 0;
+    for (int iModules : {0, 10, 50}) {
+        for (; iLoaded < iModules; ++iLoaded) {
+            QString sName = "idle" + QString::number(iLoaded);
+            InstallModule(sName + ".py",
+                          "import znc\nclass " + sName + "(znc.Module): pass");
+            client.Write("znc loadmod " + sName.toUtf8());
+            client.ReadUntil("Loaded module [" + sName.toUtf8() + "]");
+        }
+
+        QElapsedTimer Timer;
+        Timer.start();
+        for (int i = 0; i < iLines; ++i) {
+            ircd.Write(":someone!x@y PRIVMSG nick :line " +
+                       QByteArray::number(iModules) + " " +
+                       QByteArray::number(i));
+        }
+        client.ReadUntil("line " + QByteArray::number(iModules) + " " +
+                         QByteArray::number(iLines - 1));
+        std::cout << iModules << " idle modules: "
+                  << Timer.nsecsElapsed() / 1000 / iLines << " us/line"
+                  << std::endl;
+    }
+}
+
 }  // namespace
 }  // namespace znc_inttest